@@ -0,0 +1,751 @@
+#include "../src/neural_net.h"
+#include "../src/matrix.h"
+#include "../src/activation.h"
+#include "../src/initialization.h"
+#include "../src/cost.h"
+#include "../src/dataset.h"
+#include "../src/random.h"
+#include "../src/optimizer.h"
+#include "../src/cpu.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+// Each measurement repeats a benchmark until it has run for at least this
+// long, unless a different time is given on the command line.
+#define BENCH_DEFAULT_SECONDS 0.25
+
+// The best of this many measurements is reported, which filters out
+// interference from the rest of the machine.
+#define BENCH_REPETITIONS 3
+
+typedef void (*BenchFunc)(void *);
+
+typedef struct
+{
+    const char *group;
+    char name[64];
+    size_t iterations;
+    double seconds;
+    double flops, bytes, items;
+    size_t threads;
+}
+BenchResult;
+
+typedef struct
+{
+    Matrix result, a, b;
+}
+BenchMatMul;
+
+typedef struct
+{
+    Matrix result, a;
+    SparseMatrix b;
+    int transB;
+}
+BenchMatMulSparse;
+
+typedef struct
+{
+    Matrix result, mat;
+    // Exactly one is set: derivatives in terms of the output have their own
+    // type.
+    NetActivationFunc function;
+    NetActivationDerivFunc deriv;
+}
+BenchActivation;
+
+typedef struct
+{
+    Optimizer optimizer;
+    OptimizerStep step;
+    Matrix params, grads;
+}
+BenchOptimizer;
+
+typedef struct
+{
+    NeuralNet *net;
+    Matrix features, labels;
+    NetWorkspace workspace;
+}
+BenchBackprop;
+
+typedef struct
+{
+    NeuralNet *net;
+    Matrix features;
+    NetWorkspace workspace;
+    size_t batchSize;
+}
+BenchPredict;
+
+typedef struct
+{
+    NeuralNet *net;
+    Dataset *training;
+    NetTrainOptions options;
+    size_t miniBatchSize;
+}
+BenchTrain;
+
+/**
+ * @brief Reads a monotonic clock.
+ *
+ * @return A time in seconds.
+ */
+static double benchSeconds(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return now.tv_sec + now.tv_nsec * 1e-9;
+}
+
+/**
+ * @brief Fills a matrix with uniform values in [-1, 1).
+ *
+ * @param mat An initialized matrix.
+ * @param rng A seeded random number generator.
+ */
+static void benchFill(Matrix *mat, Rng *rng)
+{
+    for (size_t i = 0; i < mat->rows * mat->columns; ++i)
+    {
+        mat->elements[i] = 2.0f * rngUniform(rng) - 1.0f;
+    }
+}
+
+/**
+ * @brief Times a benchmark. The number of iterations doubles until one batch
+ *        of them takes the minimum time, then the fastest of several batches
+ *        is kept.
+ *
+ * @param result The result to fill in. Its work per iteration must be set.
+ * @param func The function to time.
+ * @param arg The argument of the function.
+ * @param minSeconds The minimum time of one measurement.
+ */
+static void benchRun(BenchResult *result, BenchFunc func, void *arg, double minSeconds)
+{
+    // Warm the caches and any lazily allocated buffers.
+    func(arg);
+
+    size_t iterations = 1;
+    double seconds = 0.0;
+    for (;;)
+    {
+        double start = benchSeconds();
+        for (size_t i = 0; i < iterations; ++i)
+        {
+            func(arg);
+        }
+        seconds = benchSeconds() - start;
+
+        if (seconds >= minSeconds)
+        {
+            break;
+        }
+        iterations *= 2;
+    }
+
+    for (size_t repetition = 1; repetition < BENCH_REPETITIONS; ++repetition)
+    {
+        double start = benchSeconds();
+        for (size_t i = 0; i < iterations; ++i)
+        {
+            func(arg);
+        }
+        double elapsed = benchSeconds() - start;
+        if (elapsed < seconds)
+        {
+            seconds = elapsed;
+        }
+    }
+
+    result->iterations = iterations;
+    result->seconds = seconds / iterations;
+}
+
+/**
+ * @brief Writes a result as a JSON object. Rates are per second of one
+ *        iteration.
+ *
+ * @param result A timed result.
+ * @param last Nonzero if no result follows.
+ */
+static void benchPrint(BenchResult *result, int last)
+{
+    printf("    {\"group\": \"%s\", \"name\": \"%s\", \"threads\": %lu, "
+           "\"iterations\": %lu, \"seconds\": %.9g, "
+           "\"gflops\": %.6g, \"bytes_per_second\": %.6g, \"items_per_second\": %.6g}%s\n",
+           result->group,
+           result->name,
+           result->threads,
+           result->iterations,
+           result->seconds,
+           result->flops / result->seconds * 1e-9,
+           result->bytes / result->seconds,
+           result->items / result->seconds,
+           last ? "" : ",");
+}
+
+static void benchMatMul(void *arg)
+{
+    BenchMatMul *bench = (BenchMatMul *)arg;
+    matMulInto(&bench->result, &bench->a, &bench->b);
+}
+
+static void benchMatMulSparse(void *arg)
+{
+    BenchMatMulSparse *bench = (BenchMatMulSparse *)arg;
+    if (bench->transB)
+    {
+        matMulSparseTransBInto(&bench->result, &bench->a, &bench->b);
+        return;
+    }
+
+    matMulSparseInto(&bench->result, &bench->a, &bench->b);
+}
+
+static void benchActivation(void *arg)
+{
+    BenchActivation *bench = (BenchActivation *)arg;
+    if (bench->deriv != NULL)
+    {
+        bench->deriv(&bench->result, &bench->mat);
+    }
+    else
+    {
+        bench->function(&bench->result, &bench->mat);
+    }
+}
+
+static void benchOptimizer(void *arg)
+{
+    BenchOptimizer *bench = (BenchOptimizer *)arg;
+    optimizerUpdate(&bench->optimizer,
+                    &bench->step,
+                    0,
+                    bench->params.elements,
+                    bench->grads.elements,
+                    0,
+                    bench->params.rows * bench->params.columns);
+}
+
+static void benchBackprop(void *arg)
+{
+    BenchBackprop *bench = (BenchBackprop *)arg;
+    netBackprop(bench->net,
+                &bench->features,
+                &bench->labels,
+                actSigmoidFastInto,
+                actSigmoidDerivOutputInto,
+                costSquaredErrDerivInto,
+                &bench->workspace);
+}
+
+static void benchPredict(void *arg)
+{
+    BenchPredict *bench = (BenchPredict *)arg;
+    if (bench->batchSize > 1)
+    {
+        netPredictBatch(bench->net, &bench->features, actSigmoidFastInto, &bench->workspace);
+        return;
+    }
+
+    Matrix output = netPredict(bench->net, &bench->features, actSigmoidFastInto);
+    matFree(&output);
+}
+
+static void benchTrain(void *arg)
+{
+    BenchTrain *bench = (BenchTrain *)arg;
+    netTrain(bench->net,
+             bench->training,
+             actSigmoidFastInto,
+             actSigmoidDerivOutputInto,
+             costSquaredErrDerivInto,
+             1,
+             bench->miniBatchSize,
+             0.1f,
+             &bench->options);
+}
+
+/**
+ * @brief Counts the weights of a network, which is its multiply-adds per
+ *        sample in one forward pass.
+ */
+static double benchWeights(NeuralNet *net)
+{
+    double weights = 0.0;
+    for (size_t i = 0; i < net->layers - 1; ++i)
+    {
+        weights += (double)net->layerSizes[i] * net->layerSizes[i + 1];
+    }
+
+    return weights;
+}
+
+/**
+ * @brief Counts the floating point operations of backpropagating one sample:
+ *        the forward pass, the weight gradients, and the deltas of every layer
+ *        but the first.
+ */
+static double benchBackpropFlops(NeuralNet *net)
+{
+    double firstWeights = (double)net->layerSizes[0] * net->layerSizes[1];
+
+    return 2.0 * (3.0 * benchWeights(net) - firstWeights);
+}
+
+/**
+ * @brief Writes the benchmark name of a network and batch size, such as
+ *        784-16-16-10/b64.
+ */
+static void benchNetName(char *name, size_t size, NeuralNet *net, size_t batchSize)
+{
+    int length = 0;
+    for (size_t i = 0; i < net->layers && (size_t)length < size; ++i)
+    {
+        length += snprintf(&name[length], size - length, "%s%lu", i == 0 ? "" : "-", net->layerSizes[i]);
+    }
+    if ((size_t)length < size)
+    {
+        snprintf(&name[length], size - length, "/b%lu", batchSize);
+    }
+}
+
+/**
+ * @brief Measures matrix multiplication at square shapes and at the shapes
+ *        of the layers of the example network.
+ */
+static size_t benchMatMuls(BenchResult *results, double minSeconds, Rng *rng)
+{
+    // The rows of a, the columns of b, and the shared dimension.
+    static const size_t shapes[][3] = {
+        {64, 64, 64},
+        {128, 128, 128},
+        {256, 256, 256},
+        {512, 512, 512},
+        {16, 1, 784},
+        {16, 10, 784},
+        {16, 256, 784},
+        {784, 256, 16},
+        {512, 256, 512},
+    };
+
+    size_t count = sizeof(shapes) / sizeof(shapes[0]);
+    for (size_t i = 0; i < count; ++i)
+    {
+        size_t m = shapes[i][0];
+        size_t n = shapes[i][1];
+        size_t k = shapes[i][2];
+
+        BenchMatMul bench;
+        matInit(&bench.a, m, k);
+        matInit(&bench.b, k, n);
+        matInit(&bench.result, m, n);
+        benchFill(&bench.a, rng);
+        benchFill(&bench.b, rng);
+
+        BenchResult *result = &results[i];
+        result->group = "matMul";
+        snprintf(result->name, sizeof(result->name), "%lux%lux%lu", m, n, k);
+        result->threads = 1;
+        result->flops = 2.0 * m * n * k;
+        result->bytes = (double)(m * k + k * n + m * n) * sizeof(float);
+        result->items = 1.0;
+        benchRun(result, benchMatMul, &bench, minSeconds);
+
+        matFree(&bench.a);
+        matFree(&bench.b);
+        matFree(&bench.result);
+    }
+
+    return count;
+}
+
+/**
+ * @brief Measures the sparse first layer kernels at the layer shapes of the
+ *        example networks, with a batch of inputs as sparse as MNIST. Both the
+ *        forward product and the weight gradient are timed. Flops and bytes
+ *        count the nonzeros only.
+ */
+static size_t benchMatMulSparses(BenchResult *results, double minSeconds, Rng *rng)
+{
+    // The rows of a, the columns of b, and the shared dimension.
+    static const size_t shapes[][3] = {
+        {16, 10, 784},
+        {16, 256, 784},
+        {256, 256, 784},
+    };
+    const float density = 0.19f;
+
+    size_t shapeCount = sizeof(shapes) / sizeof(shapes[0]);
+    size_t count = 0;
+    for (size_t i = 0; i < shapeCount; ++i)
+    {
+        size_t m = shapes[i][0];
+        size_t n = shapes[i][1];
+        size_t k = shapes[i][2];
+
+        BenchMatMulSparse bench;
+        bench.b = (SparseMatrix){k, n, k * n, NULL, NULL, NULL};
+        bench.b.columnStarts = (size_t *)malloc((n + 1) * sizeof(size_t));
+        bench.b.rowIndices = (uint32_t *)malloc(k * n * sizeof(uint32_t));
+        bench.b.values = (float *)malloc(k * n * sizeof(float));
+        size_t nonzeros = 0;
+        for (size_t j = 0; j < n; ++j)
+        {
+            bench.b.columnStarts[j] = nonzeros;
+            for (size_t row = 0; row < k; ++row)
+            {
+                if (rngUniform(rng) < density)
+                {
+                    bench.b.rowIndices[nonzeros] = (uint32_t)row;
+                    bench.b.values[nonzeros] = rngUniform(rng);
+                    ++nonzeros;
+                }
+            }
+        }
+        bench.b.columnStarts[n] = nonzeros;
+
+        for (int transB = 0; transB <= 1; ++transB)
+        {
+            // The gradient multiplies deltas of m x n by the transposed 
+            // features, giving m x k.
+            bench.transB = transB;
+            matInit(&bench.a, m, transB ? n : k);
+            matInit(&bench.result, m, transB ? k : n);
+            benchFill(&bench.a, rng);
+
+            BenchResult *result = &results[count++];
+            result->group = transB ? "matMulSparseTransB" : "matMulSparse";
+            snprintf(result->name, sizeof(result->name), "%lux%lux%lu/d%.2f", m, n, k, density);
+            result->threads = 1;
+            result->flops = 2.0 * m * nonzeros;
+            result->bytes = (double)(m * k + m * n) * sizeof(float) +
+                            (double)nonzeros * (sizeof(float) + sizeof(uint32_t));
+            result->items = 1.0;
+            benchRun(result, benchMatMulSparse, &bench, minSeconds);
+
+            matFree(&bench.a);
+            matFree(&bench.result);
+        }
+
+        free(bench.b.columnStarts);
+        free(bench.b.rowIndices);
+        free(bench.b.values);
+    }
+
+    return count;
+}
+
+/**
+ * @brief Measures the activation functions over one batch of the widest
+ *        hidden layer. An exponential counts as one operation.
+ */
+static size_t benchActivations(BenchResult *results, double minSeconds, Rng *rng)
+{
+    static const struct
+    {
+        const char *name;
+        NetActivationFunc function;
+        NetActivationDerivFunc deriv;
+        double flops;
+    }
+    functions[] = {
+        {"actSigmoid", actSigmoidInto, NULL, 3.0},
+        {"actSigmoidDeriv", actSigmoidDerivInto, NULL, 5.0},
+        {"actSigmoidFast", actSigmoidFastInto, NULL, 3.0},
+        {"actSigmoidDerivOutput", NULL, actSigmoidDerivOutputInto, 2.0},
+        {"actSoftmax", actSoftmaxInto, NULL, 5.0},
+    };
+
+    size_t count = sizeof(functions) / sizeof(functions[0]);
+    for (size_t i = 0; i < count; ++i)
+    {
+        BenchActivation bench;
+        matInit(&bench.mat, 1024, 256);
+        matInit(&bench.result, 1024, 256);
+        benchFill(&bench.mat, rng);
+        bench.function = functions[i].function;
+        bench.deriv = functions[i].deriv;
+
+        double elements = (double)bench.mat.rows * bench.mat.columns;
+        BenchResult *result = &results[i];
+        result->group = functions[i].name;
+        snprintf(result->name, sizeof(result->name), "%lux%lu", bench.mat.rows, bench.mat.columns);
+        result->threads = 1;
+        result->flops = functions[i].flops * elements;
+        result->bytes = 2.0 * elements * sizeof(float);
+        result->items = elements;
+        benchRun(result, benchActivation, &bench, minSeconds);
+
+        matFree(&bench.mat);
+        matFree(&bench.result);
+    }
+
+    return count;
+}
+
+/**
+ * @brief Measures one update of each optimizer over the first layer of the
+ *        widest network. Bytes count the parameters and state read and
+ *        written and the gradients read.
+ */
+static size_t benchOptimizers(BenchResult *results, double minSeconds, Rng *rng)
+{
+    static const struct
+    {
+        const char *name;
+        OptimizerType type;
+        double flops, states;
+    }
+    optimizers[] = {
+        {"sgd", OPTIMIZER_SGD, 2.0, 0.0},
+        {"momentum", OPTIMIZER_MOMENTUM, 5.0, 1.0},
+        {"nesterov", OPTIMIZER_NESTEROV, 7.0, 1.0},
+        {"rmsprop", OPTIMIZER_RMSPROP, 9.0, 1.0},
+        {"adam", OPTIMIZER_ADAM, 14.0, 2.0},
+    };
+
+    size_t count = sizeof(optimizers) / sizeof(optimizers[0]);
+    for (size_t i = 0; i < count; ++i)
+    {
+        BenchOptimizer bench;
+        matInit(&bench.params, 1024, 28*28);
+        matInit(&bench.grads, 1024, 28*28);
+        benchFill(&bench.params, rng);
+        benchFill(&bench.grads, rng);
+
+        size_t elements = bench.params.rows * bench.params.columns;
+        OptimizerOptions options;
+        optimizerOptionsInit(&options, optimizers[i].type);
+        optimizerInit(&bench.optimizer, &options, 0.001f, 1, &elements);
+        optimizerBeginStep(&bench.optimizer, 10, &bench.step);
+
+        BenchResult *result = &results[i];
+        result->group = "optimizerUpdate";
+        snprintf(result->name, sizeof(result->name), "%s/%lu", optimizers[i].name, elements);
+        result->threads = 1;
+        result->flops = optimizers[i].flops * elements;
+        result->bytes = (3.0 + 2.0 * optimizers[i].states) * elements * sizeof(float);
+        result->items = elements;
+        benchRun(result, benchOptimizer, &bench, minSeconds);
+
+        optimizerFree(&bench.optimizer);
+        matFree(&bench.params);
+        matFree(&bench.grads);
+    }
+
+    return count;
+}
+
+/**
+ * @brief Measures backpropagation of single samples and of batches. Bytes
+ *        count the weights read by both passes and the gradients written.
+ */
+static size_t benchBackprops(BenchResult *results, NeuralNet *net, double minSeconds, Rng *rng)
+{
+    static const size_t batchSizes[] = {1, 10, 64, 256};
+
+    size_t count = sizeof(batchSizes) / sizeof(batchSizes[0]);
+    for (size_t i = 0; i < count; ++i)
+    {
+        size_t batchSize = batchSizes[i];
+        BenchBackprop bench;
+        bench.net = net;
+        matInit(&bench.features, net->layerSizes[0], batchSize);
+        matInit(&bench.labels, net->layerSizes[net->layers - 1], batchSize);
+        benchFill(&bench.features, rng);
+        netWorkspaceInit(&bench.workspace, net, batchSize);
+
+        BenchResult *result = &results[i];
+        result->group = "netBackprop";
+        benchNetName(result->name, sizeof(result->name), net, batchSize);
+        result->threads = 1;
+        result->flops = benchBackpropFlops(net) * batchSize;
+        result->bytes = 3.0 * benchWeights(net) * sizeof(float) +
+                        (double)net->layerSizes[0] * batchSize * sizeof(float);
+        result->items = batchSize;
+        benchRun(result, benchBackprop, &bench, minSeconds);
+
+        netWorkspaceFree(&bench.workspace);
+        matFree(&bench.features);
+        matFree(&bench.labels);
+    }
+
+    return count;
+}
+
+/**
+ * @brief Measures prediction one sample at a time and in a batch. Bytes
+ *        count the weights and the features read.
+ */
+static size_t benchPredicts(BenchResult *results, NeuralNet *net, double minSeconds, Rng *rng)
+{
+    static const size_t batchSizes[] = {1, 256};
+
+    size_t count = sizeof(batchSizes) / sizeof(batchSizes[0]);
+    for (size_t i = 0; i < count; ++i)
+    {
+        size_t batchSize = batchSizes[i];
+        BenchPredict bench;
+        bench.net = net;
+        bench.batchSize = batchSize;
+        matInit(&bench.features, net->layerSizes[0], batchSize);
+        benchFill(&bench.features, rng);
+        netWorkspaceInit(&bench.workspace, net, batchSize);
+
+        BenchResult *result = &results[i];
+        result->group = "netPredict";
+        benchNetName(result->name, sizeof(result->name), net, batchSize);
+        result->threads = 1;
+        result->flops = 2.0 * benchWeights(net) * batchSize;
+        result->bytes = benchWeights(net) * sizeof(float) +
+                        (double)net->layerSizes[0] * batchSize * sizeof(float);
+        result->items = batchSize;
+        benchRun(result, benchPredict, &bench, minSeconds);
+
+        netWorkspaceFree(&bench.workspace);
+        matFree(&bench.features);
+    }
+
+    return count;
+}
+
+/**
+ * @brief Measures one epoch of training over a synthetic dataset with the
+ *        shape of MNIST, on one thread and on every online processor.
+ *
+ * @param training The synthetic dataset, trimmed so an epoch is short.
+ */
+static size_t benchTrains(BenchResult *results,
+                          NeuralNet *net,
+                          Dataset *training,
+                          double minSeconds)
+{
+    const size_t miniBatchSize = 10;
+    long processors = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t threadCounts[] = {1, processors > 1 ? (size_t)processors : 1};
+
+    size_t count = threadCounts[1] > 1 ? 2 : 1;
+    for (size_t i = 0; i < count; ++i)
+    {
+        BenchTrain bench;
+        bench.net = net;
+        bench.training = training;
+        bench.miniBatchSize = miniBatchSize;
+        netTrainOptionsInit(&bench.options);
+        bench.options.threads = threadCounts[i];
+
+        BenchResult *result = &results[i];
+        result->group = "netTrain";
+        benchNetName(result->name, sizeof(result->name), net, miniBatchSize);
+        result->threads = threadCounts[i];
+        result->flops = benchBackpropFlops(net) * training->samples;
+        result->bytes = 3.0 * benchWeights(net) * sizeof(float) * training->samples / miniBatchSize +
+                        (double)training->featureSize * training->samples;
+        result->items = training->samples;
+        benchRun(result, benchTrain, &bench, minSeconds);
+    }
+
+    return count;
+}
+
+/**
+ * @brief Runs the benchmark suite and writes the results to standard output
+ *        as JSON. An optional argument sets the minimum seconds of each
+ *        measurement.
+ */
+int main(int argc, char **argv)
+{
+    double minSeconds = BENCH_DEFAULT_SECONDS;
+    if (argc > 1)
+    {
+        minSeconds = atof(argv[1]);
+        if (minSeconds <= 0.0)
+        {
+            fprintf(stderr, "Error: Invalid minimum time %s\n", argv[1]);
+            return 1;
+        }
+    }
+
+    Rng rng;
+    rngSeed(&rng, 1);
+
+    // A synthetic dataset with the shape of MNIST. The larger networks train
+    // on a prefix of it so an epoch stays short.
+    const size_t samples = 6000;
+    const size_t featureSize = 28*28;
+    const size_t classes = 10;
+    unsigned char *features = (unsigned char *)malloc(samples * featureSize);
+    unsigned char *labels = (unsigned char *)malloc(samples);
+    for (size_t i = 0; i < samples * featureSize; ++i)
+    {
+        features[i] = (unsigned char)rngBounded(&rng, 256);
+    }
+    for (size_t i = 0; i < samples; ++i)
+    {
+        labels[i] = (unsigned char)rngBounded(&rng, classes);
+    }
+
+    // The network of main.c, and larger ones where the hidden layers
+    // dominate.
+    size_t smallSizes[] = {28*28, 16, 16, 10};
+    size_t mediumSizes[] = {28*28, 256, 256, 10};
+    size_t largeSizes[] = {28*28, 1024, 1024, 10};
+    size_t *networkSizes[] = {smallSizes, mediumSizes, largeSizes};
+    size_t trainingSamples[] = {samples, 1000, 250};
+    const size_t networks = sizeof(networkSizes) / sizeof(networkSizes[0]);
+
+    BenchResult results[64];
+    size_t count = 0;
+    count += benchMatMuls(&results[count], minSeconds, &rng);
+    count += benchMatMulSparses(&results[count], minSeconds, &rng);
+    count += benchActivations(&results[count], minSeconds, &rng);
+    count += benchOptimizers(&results[count], minSeconds, &rng);
+    for (size_t i = 0; i < networks; ++i)
+    {
+        NeuralNet net;
+        netInit(&net, 4, networkSizes[i], initNormalDist, NULL, NULL);
+        Dataset training;
+        datasetInit(&training,
+                    features,
+                    DATASET_UINT8,
+                    labels,
+                    trainingSamples[i],
+                    featureSize,
+                    classes,
+                    1.0f / 255.0f);
+
+        count += benchBackprops(&results[count], &net, minSeconds, &rng);
+        count += benchPredicts(&results[count], &net, minSeconds, &rng);
+        count += benchTrains(&results[count], &net, &training, minSeconds);
+
+        datasetFree(&training);
+        netFree(&net);
+    }
+
+    printf("{\n");
+    printf("  \"isa\": \"%s\",\n", cpuIsaName(cpuIsa()));
+    printf("  \"min_seconds\": %g,\n", minSeconds);
+    printf("  \"repetitions\": %d,\n", BENCH_REPETITIONS);
+    printf("  \"benchmarks\": [\n");
+    for (size_t i = 0; i < count; ++i)
+    {
+        benchPrint(&results[i], i == count - 1);
+    }
+    printf("  ]\n");
+    printf("}\n");
+
+    free(features);
+    free(labels);
+
+    return 0;
+}
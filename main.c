@@ -3,102 +3,127 @@
 #include "src/initialization.h"
 #include "src/activation.h"
 #include "src/cost.h"
+#include "src/dataset.h"
+#include "src/net_io.h"
+#include "src/quantize.h"
+#include "src/profile.h"
+#include "src/optimizer.h"
+#include "src/tune.h"
 #include <stdlib.h>
 #include <stdio.h>
 
-Matrix *loadFeatures(const char *fileName, size_t samples)
+/**
+ * @brief Prints the loss of a training epoch, and where its time went when 
+ *        profiling.
+ *
+ * @param report The report of the epoch.
+ * @param arg Unused.
+ */
+static void printEpoch(const NetEpochReport *report, void *arg)
 {
-    FILE *file = fopen(fileName, "rb");
-
-    // Skip the file header.
-    fseek(file, 16, SEEK_SET);
-
-    Matrix *data = (Matrix *)malloc(samples * sizeof(Matrix));
-    for (size_t i = 0; i < samples; ++i)
+    printf("Epoch %lu of %lu: loss %.4f, %.2fs\n",
+           report->epoch, report->epochs, report->loss, report->seconds);
+    if (profileEnabled())
     {
-        matInit(&data[i], 28*28, 1);
-        for (size_t j = 0; j < 28*28; ++j)
-        {
-            data[i].elements[j] = (unsigned char)fgetc(file) / 255.0f;
-        }
+        profilePrint(stdout, &report->profile);
     }
-
-    return data;
 }
 
-Matrix *loadLabels(const char *fileName, size_t samples)
+int main()
 {
-    FILE *file = fopen(fileName, "rb");
-
-    // Skip the file header.
-    fseek(file, 8, SEEK_SET);
-
-    Matrix *data = (Matrix *)malloc(samples * sizeof(Matrix));
-    for (size_t i = 0; i < samples; ++i)
+    // Load the MNIST dataset.
+    Dataset training, testing;
+    if (datasetLoadIdx(&training,
+                       "./data/train-images-idx3-ubyte",
+                       "./data/train-labels-idx1-ubyte",
+                       10) != 0)
     {
-        matInit(&data[i], 10, 1);
-        data[i].elements[fgetc(file)] = 1.0;
+        return 1;
+    }
+    if (datasetLoadIdx(&testing,
+                       "./data/t10k-images-idx3-ubyte",
+                       "./data/t10k-labels-idx1-ubyte",
+                       10) != 0)
+    {
+        datasetFree(&training);
+        return 1;
     }
 
-    return data;
-}
+    // MNIST is about a fifth nonzero, so both sets train and test through 
+    // sparse batches.
+    datasetIndexSparse(&training);
+    datasetIndexSparse(&testing);
 
-int main()
-{
     // Set up the neural network.
     const size_t layers = 4;
     size_t layerSizes[] = {28*28, 16, 16, 10};
     NeuralNet net;
-    netInit(&net, layers, layerSizes, initNormalDist, NULL);
+    netInit(&net, layers, layerSizes, initNormalDist, NULL, NULL);
+    net.output = NET_OUTPUT_SOFTMAX;
+
+    // Pick thread counts and GEMM blocks for this machine, measuring only
+    // what the tuning cache does not have yet.
+    const size_t miniBatchSize = 10;
+    tuneNet(&net,
+            &training,
+            actSigmoidFastInto,
+            actSigmoidDerivOutputInto,
+            costSquaredErrDerivInto,
+            miniBatchSize,
+            NULL);
+    printf("Tuned: %lu training threads, %lu testing threads\n",
+           net.trainThreads, net.testThreads);
 
     // Train the neural network on the MNIST dataset.
     printf("Training...\n");
-    const size_t trainingSize = 60000;
-    Matrix *trainingFeats = loadFeatures("./data/train-images-idx3-ubyte", trainingSize);
-    Matrix *trainingLabels = loadLabels("./data/train-labels-idx1-ubyte", trainingSize);
+    NetTrainOptions options;
+    netTrainOptionsInit(&options);
+    optimizerOptionsInit(&options.optimizer, OPTIMIZER_ADAM);
+    options.epochCallback = printEpoch;
+
+    // Profile each epoch when NET_PROFILE is set.
+    if (getenv("NET_PROFILE") != NULL)
+    {
+        profileEnable(1);
+    }
     netTrain(&net,
-             trainingFeats,
-             trainingLabels,
-             trainingSize,
-             actSigmoid,
-             actSigmoidDeriv,
-             costSquaredErrDeriv,
-             30,
-             10,
-             2.0f);
+             &training,
+             actSigmoidFastInto,
+             actSigmoidDerivOutputInto,
+             costSquaredErrDerivInto,
+             5,
+             miniBatchSize,
+             0.003f,
+             &options);
+
+    // Save the trained weights so they can be reloaded without training.
+    if (netSave(&net, "./net.model") != 0)
+    {
+        fprintf(stderr, "Error: The trained network was not saved\n");
+    }
 
     // Test the neural network.
     printf("Testing...\n");
-    const size_t testingSize = 10000;
-    Matrix *testingFeats = loadFeatures("./data/t10k-images-idx3-ubyte", testingSize);
-    Matrix *testingLabels = loadLabels("./data/t10k-labels-idx1-ubyte", testingSize);
-    size_t correct = netTest(&net,
-                             testingFeats,
-                             testingLabels,
-                             testingSize,
-                             actSigmoid);
+    size_t correct = netTest(&net, &testing, actSigmoidFastInto, options.threads);
 
     // Output the test results.
-    float accuracy = (float)correct / testingSize;
-    printf("%lu correct of %lu\n", correct, testingSize);
+    float accuracy = (float)correct / testing.samples;
+    printf("%lu correct of %lu\n", correct, testing.samples);
     printf("Accuracy: %.2f\n", accuracy);
-    
+
+    // Compare an int8 quantized copy of the network against the original.
+    QuantNet qnet;
+    quantInit(&qnet, &net);
+    QuantComparison comparison;
+    quantCompare(&qnet, &net, &testing, actSigmoidFastInto, net.testThreads, &comparison);
+    printf("Quantized: %lu correct of %lu, %lu predictions agree\n",
+           comparison.quantCorrect, comparison.samples, comparison.agreements);
+    quantFree(&qnet);
+
     // Free all allocated memory.
-    for (size_t i = 0; i < trainingSize; ++i)
-    {
-        matFree(&trainingFeats[i]);
-        matFree(&trainingLabels[i]);
-    }
-    for (size_t i = 0; i < testingSize; ++i)
-    {
-        matFree(&testingFeats[i]);
-        matFree(&testingLabels[i]);
-    }
-    free(trainingFeats);
-    free(trainingLabels);
-    free(testingFeats);
-    free(testingLabels);
+    datasetFree(&training);
+    datasetFree(&testing);
     netFree(&net);
-    
+
     return 0;
 }
@@ -1,6 +1,370 @@
 #include "activation.h"
+#include "cpu.h"
 #include "matrix.h"
+#include "profile.h"
 #include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#ifdef CPU_X86
+#include <immintrin.h>
+#endif
+
+// Range reduction and polynomial constants for the fast exponential. The 
+// polynomial approximates exp(r) on [-ln(2)/2, ln(2)/2]. Exponents are clamped 
+// to +-80 so results never overflow or become denormal, which would stall.
+#define ACT_EXP_MAX 80.0f
+#define ACT_EXP_MIN -80.0f
+#define ACT_LOG2E 1.44269504088896341f
+#define ACT_LN2_HI 0.693359375f
+#define ACT_LN2_LO -2.12194440e-4f
+#define ACT_EXP_P0 1.9875691500e-4f
+#define ACT_EXP_P1 1.3981999507e-3f
+#define ACT_EXP_P2 8.3334519073e-3f
+#define ACT_EXP_P3 4.1665795894e-2f
+#define ACT_EXP_P4 1.6666665459e-1f
+#define ACT_EXP_P5 5.0000001201e-1f
+
+// Softmax works on blocks of this many columns at a time, keeping the maximum 
+// and sum of each column on the stack while walking the rows contiguously.
+#define ACT_SOFTMAX_BLOCK 64
+
+/**
+ * @brief Checks two matrices have the same size, printing an error if not.
+ *
+ * @param result An initialized matrix.
+ * @param mat An initialized matrix.
+ * @param name A name for the function in the error message.
+ * @return Nonzero if the sizes match.
+ */
+static int actSameSize(const Matrix *result, const Matrix *mat, const char *name)
+{
+    if (result->rows != mat->rows || result->columns != mat->columns)
+    {
+        fprintf(stderr,
+                "Error: Cannot apply %s to matrix (%lu, %lu) into (%lu, %lu)\n",
+                name,
+                mat->rows, mat->columns,
+                result->rows, result->columns);
+
+        return 0;
+    }
+
+    return 1;
+}
+
+/**
+ * @brief Finds how to walk two matrices of the same size row by row. When 
+ *        both are contiguous they are walked as a single long row, so vector 
+ *        loops only have one tail.
+ *
+ * @param result An initialized matrix.
+ * @param mat An initialized matrix with the same size.
+ * @param rows Set to the number of rows to walk.
+ * @param count Set to the number of elements in each row.
+ */
+static void actRows(const Matrix *result, const Matrix *mat, size_t *rows, size_t *count)
+{
+    *rows = mat->rows;
+    *count = mat->columns;
+    if (matIsContiguous(result) && matIsContiguous(mat))
+    {
+        *rows = 1;
+        *count = mat->rows * mat->columns;
+    }
+}
+
+/**
+ * @brief Approximates the exponential with range reduction and a polynomial. 
+ *        The relative error is a few units in the last place, and it compiles 
+ *        to straight-line code.
+ *
+ * @param x An exponent.
+ * @return An approximation of exp(x).
+ */
+static inline float actFastExp(float x)
+{
+    x = x > ACT_EXP_MAX ? ACT_EXP_MAX : x;
+    x = x < ACT_EXP_MIN ? ACT_EXP_MIN : x;
+
+    // Split x into n * ln(2) + r. Halves round up, as in the vector
+    // versions, so every tier gives the same n.
+    float n = floorf(x * ACT_LOG2E + 0.5f);
+    int32_t k = (int32_t)n;
+    float r = x - n * ACT_LN2_HI - n * ACT_LN2_LO;
+
+    float p = ACT_EXP_P0;
+    p = p * r + ACT_EXP_P1;
+    p = p * r + ACT_EXP_P2;
+    p = p * r + ACT_EXP_P3;
+    p = p * r + ACT_EXP_P4;
+    p = p * r + ACT_EXP_P5;
+    p = p * r * r + r + 1.0f;
+
+    // Scale by 2^n through the exponent bits.
+    int32_t bits = (k + 127) << 23;
+    float scale;
+    memcpy(&scale, &bits, sizeof(scale));
+
+    return p * scale;
+}
+
+// The vector loops of each tier, selected from the tables below by cpuIsa.
+// Every variant finishes its row with actFastExp.
+typedef void (*ActSigmoidRowFunc)(const float *in, float *out, size_t count);
+typedef void (*ActSoftmaxRowFunc)(const float *x,
+                                  const float *maximums,
+                                  float *y,
+                                  float *sums,
+                                  size_t width);
+
+/**
+ * @brief Takes the fast sigmoid of one row.
+ *
+ * @param in The inputs.
+ * @param out The outputs, which may be the inputs.
+ * @param count The number of elements.
+ */
+static void actSigmoidFastRowScalar(const float *in, float *out, size_t count)
+{
+    for (size_t i = 0; i < count; ++i)
+    {
+        out[i] = 1.0f / (1.0f + actFastExp(-in[i]));
+    }
+}
+
+/**
+ * @brief Exponentiates one row of a softmax block less the maximums of its
+ *        columns, adding the results to the sums of the columns.
+ *
+ * @param x The inputs of the row.
+ * @param maximums The maximum of each column.
+ * @param y The outputs of the row, which may be the inputs.
+ * @param sums The running sum of each column.
+ * @param width The number of columns in the block.
+ */
+static void actSoftmaxRowScalar(const float *x,
+                                const float *maximums,
+                                float *y,
+                                float *sums,
+                                size_t width)
+{
+    for (size_t j = 0; j < width; ++j)
+    {
+        float e = actFastExp(x[j] - maximums[j]);
+        y[j] = e;
+        sums[j] += e;
+    }
+}
+
+#ifdef CPU_X86
+/**
+ * @brief Approximates the exponential of four values. Matches actFastExp.
+ *
+ * @param x Four exponents.
+ * @return Approximations of exp(x).
+ */
+static inline CPU_TARGET_SSE42 __m128 actFastExp4(__m128 x)
+{
+    x = _mm_min_ps(x, _mm_set1_ps(ACT_EXP_MAX));
+    x = _mm_max_ps(x, _mm_set1_ps(ACT_EXP_MIN));
+
+    __m128 n = _mm_floor_ps(_mm_add_ps(_mm_mul_ps(x, _mm_set1_ps(ACT_LOG2E)), _mm_set1_ps(0.5f)));
+    __m128 r = _mm_sub_ps(x, _mm_mul_ps(n, _mm_set1_ps(ACT_LN2_HI)));
+    r = _mm_sub_ps(r, _mm_mul_ps(n, _mm_set1_ps(ACT_LN2_LO)));
+
+    __m128 p = _mm_set1_ps(ACT_EXP_P0);
+    p = _mm_add_ps(_mm_mul_ps(p, r), _mm_set1_ps(ACT_EXP_P1));
+    p = _mm_add_ps(_mm_mul_ps(p, r), _mm_set1_ps(ACT_EXP_P2));
+    p = _mm_add_ps(_mm_mul_ps(p, r), _mm_set1_ps(ACT_EXP_P3));
+    p = _mm_add_ps(_mm_mul_ps(p, r), _mm_set1_ps(ACT_EXP_P4));
+    p = _mm_add_ps(_mm_mul_ps(p, r), _mm_set1_ps(ACT_EXP_P5));
+    p = _mm_add_ps(_mm_mul_ps(p, _mm_mul_ps(r, r)), _mm_add_ps(r, _mm_set1_ps(1.0f)));
+
+    __m128i bits = _mm_slli_epi32(_mm_add_epi32(_mm_cvtps_epi32(n), _mm_set1_epi32(127)), 23);
+
+    return _mm_mul_ps(p, _mm_castsi128_ps(bits));
+}
+
+/**
+ * @brief Approximates the exponential of eight values. Matches actFastExp.
+ *
+ * @param x Eight exponents.
+ * @return Approximations of exp(x).
+ */
+static inline CPU_TARGET_AVX2 __m256 actFastExp8(__m256 x)
+{
+    x = _mm256_min_ps(x, _mm256_set1_ps(ACT_EXP_MAX));
+    x = _mm256_max_ps(x, _mm256_set1_ps(ACT_EXP_MIN));
+
+    __m256 n = _mm256_floor_ps(_mm256_fmadd_ps(x, _mm256_set1_ps(ACT_LOG2E), _mm256_set1_ps(0.5f)));
+    __m256 r = _mm256_fnmadd_ps(n, _mm256_set1_ps(ACT_LN2_HI), x);
+    r = _mm256_fnmadd_ps(n, _mm256_set1_ps(ACT_LN2_LO), r);
+
+    __m256 p = _mm256_set1_ps(ACT_EXP_P0);
+    p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(ACT_EXP_P1));
+    p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(ACT_EXP_P2));
+    p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(ACT_EXP_P3));
+    p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(ACT_EXP_P4));
+    p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(ACT_EXP_P5));
+    p = _mm256_fmadd_ps(p, _mm256_mul_ps(r, r), _mm256_add_ps(r, _mm256_set1_ps(1.0f)));
+
+    __m256i bits = _mm256_slli_epi32(_mm256_add_epi32(_mm256_cvtps_epi32(n), _mm256_set1_epi32(127)), 23);
+
+    return _mm256_mul_ps(p, _mm256_castsi256_ps(bits));
+}
+
+/**
+ * @brief Approximates the exponential of sixteen values. Matches actFastExp.
+ *
+ * @param x Sixteen exponents.
+ * @return Approximations of exp(x).
+ */
+static inline CPU_TARGET_AVX512 __m512 actFastExp16(__m512 x)
+{
+    x = _mm512_min_ps(x, _mm512_set1_ps(ACT_EXP_MAX));
+    x = _mm512_max_ps(x, _mm512_set1_ps(ACT_EXP_MIN));
+
+    __m512 t = _mm512_fmadd_ps(x, _mm512_set1_ps(ACT_LOG2E), _mm512_set1_ps(0.5f));
+    __m512 n = _mm512_roundscale_ps(t, _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC);
+    __m512 r = _mm512_fnmadd_ps(n, _mm512_set1_ps(ACT_LN2_HI), x);
+    r = _mm512_fnmadd_ps(n, _mm512_set1_ps(ACT_LN2_LO), r);
+
+    __m512 p = _mm512_set1_ps(ACT_EXP_P0);
+    p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(ACT_EXP_P1));
+    p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(ACT_EXP_P2));
+    p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(ACT_EXP_P3));
+    p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(ACT_EXP_P4));
+    p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(ACT_EXP_P5));
+    p = _mm512_fmadd_ps(p, _mm512_mul_ps(r, r), _mm512_add_ps(r, _mm512_set1_ps(1.0f)));
+
+    __m512i bits = _mm512_slli_epi32(_mm512_add_epi32(_mm512_cvtps_epi32(n), _mm512_set1_epi32(127)), 23);
+
+    return _mm512_mul_ps(p, _mm512_castsi512_ps(bits));
+}
+
+/**
+ * @brief Takes the fast sigmoid of one row four values at a time.
+ */
+static CPU_TARGET_SSE42 void actSigmoidFastRowSse(const float *in, float *out, size_t count)
+{
+    __m128 ones = _mm_set1_ps(1.0f);
+    __m128 signs = _mm_set1_ps(-0.0f);
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4)
+    {
+        __m128 x = _mm_xor_ps(_mm_loadu_ps(&in[i]), signs);
+        _mm_storeu_ps(&out[i], _mm_div_ps(ones, _mm_add_ps(ones, actFastExp4(x))));
+    }
+    actSigmoidFastRowScalar(&in[i], &out[i], count - i);
+}
+
+/**
+ * @brief Takes the fast sigmoid of one row eight values at a time.
+ */
+static CPU_TARGET_AVX2 void actSigmoidFastRowAvx2(const float *in, float *out, size_t count)
+{
+    __m256 ones = _mm256_set1_ps(1.0f);
+    __m256 signs = _mm256_set1_ps(-0.0f);
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8)
+    {
+        __m256 x = _mm256_xor_ps(_mm256_loadu_ps(&in[i]), signs);
+        _mm256_storeu_ps(&out[i], _mm256_div_ps(ones, _mm256_add_ps(ones, actFastExp8(x))));
+    }
+    actSigmoidFastRowScalar(&in[i], &out[i], count - i);
+}
+
+/**
+ * @brief Takes the fast sigmoid of one row sixteen values at a time.
+ */
+static CPU_TARGET_AVX512 void actSigmoidFastRowAvx512(const float *in, float *out, size_t count)
+{
+    __m512 ones = _mm512_set1_ps(1.0f);
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16)
+    {
+        __m512 x = _mm512_sub_ps(_mm512_setzero_ps(), _mm512_loadu_ps(&in[i]));
+        _mm512_storeu_ps(&out[i], _mm512_div_ps(ones, _mm512_add_ps(ones, actFastExp16(x))));
+    }
+    actSigmoidFastRowScalar(&in[i], &out[i], count - i);
+}
+
+/**
+ * @brief Exponentiates one row of a softmax block four columns at a time.
+ */
+static CPU_TARGET_SSE42 void actSoftmaxRowSse(const float *x,
+                                              const float *maximums,
+                                              float *y,
+                                              float *sums,
+                                              size_t width)
+{
+    size_t j = 0;
+    for (; j + 4 <= width; j += 4)
+    {
+        __m128 e = actFastExp4(_mm_sub_ps(_mm_loadu_ps(&x[j]), _mm_loadu_ps(&maximums[j])));
+        _mm_storeu_ps(&y[j], e);
+        _mm_storeu_ps(&sums[j], _mm_add_ps(_mm_loadu_ps(&sums[j]), e));
+    }
+    actSoftmaxRowScalar(&x[j], &maximums[j], &y[j], &sums[j], width - j);
+}
+
+/**
+ * @brief Exponentiates one row of a softmax block eight columns at a time.
+ */
+static CPU_TARGET_AVX2 void actSoftmaxRowAvx2(const float *x,
+                                              const float *maximums,
+                                              float *y,
+                                              float *sums,
+                                              size_t width)
+{
+    size_t j = 0;
+    for (; j + 8 <= width; j += 8)
+    {
+        __m256 e = actFastExp8(_mm256_sub_ps(_mm256_loadu_ps(&x[j]), _mm256_loadu_ps(&maximums[j])));
+        _mm256_storeu_ps(&y[j], e);
+        _mm256_storeu_ps(&sums[j], _mm256_add_ps(_mm256_loadu_ps(&sums[j]), e));
+    }
+    actSoftmaxRowScalar(&x[j], &maximums[j], &y[j], &sums[j], width - j);
+}
+
+/**
+ * @brief Exponentiates one row of a softmax block sixteen columns at a time.
+ */
+static CPU_TARGET_AVX512 void actSoftmaxRowAvx512(const float *x,
+                                                  const float *maximums,
+                                                  float *y,
+                                                  float *sums,
+                                                  size_t width)
+{
+    size_t j = 0;
+    for (; j + 16 <= width; j += 16)
+    {
+        __m512 e = actFastExp16(_mm512_sub_ps(_mm512_loadu_ps(&x[j]), _mm512_loadu_ps(&maximums[j])));
+        _mm512_storeu_ps(&y[j], e);
+        _mm512_storeu_ps(&sums[j], _mm512_add_ps(_mm512_loadu_ps(&sums[j]), e));
+    }
+    actSoftmaxRowScalar(&x[j], &maximums[j], &y[j], &sums[j], width - j);
+}
+
+static const ActSigmoidRowFunc actSigmoidFastRows[CPU_ISAS] = {
+    actSigmoidFastRowScalar,
+    actSigmoidFastRowSse,
+    actSigmoidFastRowAvx2,
+    actSigmoidFastRowAvx512,
+};
+
+static const ActSoftmaxRowFunc actSoftmaxRows[CPU_ISAS] = {
+    actSoftmaxRowScalar,
+    actSoftmaxRowSse,
+    actSoftmaxRowAvx2,
+    actSoftmaxRowAvx512,
+};
+#else
+static const ActSigmoidRowFunc actSigmoidFastRows[CPU_ISAS] = {actSigmoidFastRowScalar};
+static const ActSoftmaxRowFunc actSoftmaxRows[CPU_ISAS] = {actSoftmaxRowScalar};
+#endif
 
 /**
  * @brief Performs the sigmoid function.
@@ -12,12 +376,64 @@ Matrix actSigmoid(Matrix *mat)
 {
     Matrix result;
     matInit(&result, mat->rows, mat->columns);
-    for (size_t i = 0; i < mat->rows * mat->columns; ++i)
+    actSigmoidInto(&result, mat);
+
+    return result;
+}
+
+/**
+ * @brief Performs the sigmoid function into an existing matrix. The result may
+ *        be the input.
+ *
+ * @param result An initialized matrix with the same size.
+ * @param mat An initialized matrix.
+ */
+void actSigmoidInto(Matrix *result, Matrix *mat)
+{
+    if (!actSameSize(result, mat, "sigmoid"))
     {
-        result.elements[i] = 1.0f / (1.0f + expf(-mat->elements[i]));
+        return;
     }
 
-    return result;
+    uint64_t start = profileBegin();
+    size_t rows, count;
+    actRows(result, mat, &rows, &count);
+    for (size_t r = 0; r < rows; ++r)
+    {
+        const float *x = &mat->elements[r * mat->stride];
+        float *y = &result->elements[r * result->stride];
+        for (size_t i = 0; i < count; ++i)
+        {
+            y[i] = 1.0f / (1.0f + expf(-x[i]));
+        }
+    }
+    profileEndKernel(PROFILE_ACTIVATION, start, 3 * (uint64_t)mat->rows * mat->columns);
+}
+
+/**
+ * @brief Performs the sigmoid function with a fast approximation of the 
+ *        exponential, vectorized for the instruction set cpuIsa selects. 
+ *        The result may be the input.
+ *
+ * @param result An initialized matrix with the same size.
+ * @param mat An initialized matrix.
+ */
+void actSigmoidFastInto(Matrix *result, Matrix *mat)
+{
+    if (!actSameSize(result, mat, "sigmoid"))
+    {
+        return;
+    }
+
+    uint64_t start = profileBegin();
+    ActSigmoidRowFunc sigmoidRow = actSigmoidFastRows[cpuIsa()];
+    size_t rows, count;
+    actRows(result, mat, &rows, &count);
+    for (size_t r = 0; r < rows; ++r)
+    {
+        sigmoidRow(&mat->elements[r * mat->stride], &result->elements[r * result->stride], count);
+    }
+    profileEndKernel(PROFILE_ACTIVATION, start, 3 * (uint64_t)mat->rows * mat->columns);
 }
 
 /**
@@ -30,11 +446,133 @@ Matrix actSigmoidDeriv(Matrix *mat)
 {
     Matrix result;
     matInit(&result, mat->rows, mat->columns);
-    for (size_t i = 0; i < mat->rows * mat->columns; ++i)
+    actSigmoidDerivInto(&result, mat);
+
+    return result;
+}
+
+/**
+ * @brief Performs the sigmoid function derivative into an existing matrix. The
+ *        result may be the input. This takes the sigmoid input, so its type
+ *        is not a NetActivationDerivFunc; netTrain and netBackprop give the
+ *        derivative the activation output and take actSigmoidDerivOutputInto.
+ *
+ * @param result An initialized matrix with the same size.
+ * @param mat An initialized matrix.
+ */
+void actSigmoidDerivInto(Matrix *result, Matrix *mat)
+{
+    if (!actSameSize(result, mat, "sigmoid derivative"))
     {
-        float sigmoid = 1.0f / (1.0f + expf(-mat->elements[i]));
-        result.elements[i] = sigmoid * (1.0f - sigmoid);
+        return;
     }
 
-    return result;
+    uint64_t start = profileBegin();
+    size_t rows, count;
+    actRows(result, mat, &rows, &count);
+    for (size_t r = 0; r < rows; ++r)
+    {
+        const float *x = &mat->elements[r * mat->stride];
+        float *y = &result->elements[r * result->stride];
+        for (size_t i = 0; i < count; ++i)
+        {
+            float sigmoid = 1.0f / (1.0f + expf(-x[i]));
+            y[i] = sigmoid * (1.0f - sigmoid);
+        }
+    }
+    profileEndKernel(PROFILE_ACTIVATION, start, 5 * (uint64_t)mat->rows * mat->columns);
+}
+
+/**
+ * @brief Performs the sigmoid function derivative in terms of the sigmoid 
+ *        output, so the exponential is never evaluated again. The result may 
+ *        be the input. The output is const, which gives this the signature of
+ *        a NetActivationDerivFunc.
+ *
+ * @param result An initialized matrix with the same size.
+ * @param output An initialized matrix of sigmoid outputs.
+ */
+void actSigmoidDerivOutputInto(Matrix *result, const Matrix *output)
+{
+    if (!actSameSize(result, output, "sigmoid derivative"))
+    {
+        return;
+    }
+
+    uint64_t start = profileBegin();
+    size_t rows, count;
+    actRows(result, output, &rows, &count);
+    for (size_t r = 0; r < rows; ++r)
+    {
+        const float *x = &output->elements[r * output->stride];
+        float *y = &result->elements[r * result->stride];
+        for (size_t i = 0; i < count; ++i)
+        {
+            y[i] = x[i] * (1.0f - x[i]);
+        }
+    }
+    profileEndKernel(PROFILE_ACTIVATION, start, 2 * (uint64_t)output->rows * output->columns);
+}
+
+/**
+ * @brief Performs the softmax function on each column, with a fast 
+ *        approximation of the exponential. The maximum of each column is 
+ *        subtracted first, so large inputs never overflow. Columns are 
+ *        processed in blocks so the rows are read contiguously and the 
+ *        exponentials are vectorized across columns. The result may be the 
+ *        input.
+ *
+ * @param result An initialized matrix with the same size.
+ * @param mat An initialized matrix with one column per sample.
+ */
+void actSoftmaxInto(Matrix *result, Matrix *mat)
+{
+    if (!actSameSize(result, mat, "softmax"))
+    {
+        return;
+    }
+
+    uint64_t start = profileBegin();
+    ActSoftmaxRowFunc softmaxRow = actSoftmaxRows[cpuIsa()];
+    size_t rows = mat->rows;
+    size_t columns = mat->columns;
+    float maximums[ACT_SOFTMAX_BLOCK], sums[ACT_SOFTMAX_BLOCK];
+    for (size_t block = 0; block < columns; block += ACT_SOFTMAX_BLOCK)
+    {
+        size_t width = columns - block < ACT_SOFTMAX_BLOCK ? columns - block : ACT_SOFTMAX_BLOCK;
+        const float *in = &mat->elements[block];
+        float *out = &result->elements[block];
+
+        for (size_t j = 0; j < width; ++j)
+        {
+            maximums[j] = in[j];
+            sums[j] = 0.0f;
+        }
+        for (size_t r = 1; r < rows; ++r)
+        {
+            for (size_t j = 0; j < width; ++j)
+            {
+                float x = in[r * mat->stride + j];
+                maximums[j] = x > maximums[j] ? x : maximums[j];
+            }
+        }
+
+        for (size_t r = 0; r < rows; ++r)
+        {
+            softmaxRow(&in[r * mat->stride], maximums, &out[r * result->stride], sums, width);
+        }
+
+        for (size_t j = 0; j < width; ++j)
+        {
+            sums[j] = 1.0f / sums[j];
+        }
+        for (size_t r = 0; r < rows; ++r)
+        {
+            for (size_t j = 0; j < width; ++j)
+            {
+                out[r * result->stride + j] *= sums[j];
+            }
+        }
+    }
+    profileEndKernel(PROFILE_ACTIVATION, start, 5 * (uint64_t)rows * columns);
 }
@@ -6,4 +6,12 @@
 Matrix actSigmoid(Matrix *mat);
 Matrix actSigmoidDeriv(Matrix *mat);
 
+void actSigmoidInto(Matrix *result, Matrix *mat);
+void actSigmoidDerivInto(Matrix *result, Matrix *mat);
+
+void actSigmoidFastInto(Matrix *result, Matrix *mat);
+void actSigmoidDerivOutputInto(Matrix *result, const Matrix *output);
+
+void actSoftmaxInto(Matrix *result, Matrix *mat);
+
 #endif
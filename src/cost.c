@@ -1,12 +1,233 @@
 #include "cost.h"
 #include "matrix.h"
+#include "profile.h"
+#include <float.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
 
+/**
+ * @brief Checks a prediction and its labels have the same size, printing an 
+ *        error if not.
+ *
+ * @param prediction An initialized matrix.
+ * @param label An initialized matrix.
+ * @param name A name for the cost in the error message.
+ * @return Nonzero if the sizes match.
+ */
+static int costSameSize(Matrix *prediction, Matrix *label, const char *name)
+{
+    if (prediction->rows != label->rows || prediction->columns != label->columns)
+    {
+        fprintf(stderr,
+                "Error: Cannot compute %s of prediction (%lu, %lu) and label (%lu, %lu)\n",
+                name,
+                prediction->rows, prediction->columns,
+                label->rows, label->columns);
+
+        return 0;
+    }
+
+    return 1;
+}
+
+/**
+ * @brief Computes half the squared error of one sample.
+ *
+ * @param prediction An initialized matrix.
+ * @param label The labels for the prediction.
+ * @param column The column of the sample.
+ * @return The loss of the sample.
+ */
+static float costSquaredErrColumn(Matrix *prediction, Matrix *label, size_t column)
+{
+    float loss = 0.0f;
+    for (size_t r = 0; r < prediction->rows; ++r)
+    {
+        float difference = prediction->elements[r * prediction->stride + column] -
+                           label->elements[r * label->stride + column];
+        loss += difference * difference;
+    }
+
+    return 0.5f * loss;
+}
+
+/**
+ * @brief Computes the cross entropy of one sample. Probabilities are clamped 
+ *        to the smallest normal float, so a confident wrong prediction gives 
+ *        a large but finite loss.
+ *
+ * @param prediction An initialized matrix of probabilities.
+ * @param label The labels for the prediction.
+ * @param column The column of the sample.
+ * @return The loss of the sample.
+ */
+static float costCrossEntropyColumn(Matrix *prediction, Matrix *label, size_t column)
+{
+    float loss = 0.0f;
+    for (size_t r = 0; r < prediction->rows; ++r)
+    {
+        float target = label->elements[r * label->stride + column];
+        if (target != 0.0f)
+        {
+            float probability = prediction->elements[r * prediction->stride + column];
+            loss -= target * logf(probability > FLT_MIN ? probability : FLT_MIN);
+        }
+    }
+
+    return loss;
+}
+
+/**
+ * @brief Computes half the squared error of each sample.
+ *
+ * @param prediction A matrix with one column per sample.
+ * @param label The labels for the prediction.
+ * @return A new row matrix with the loss of each sample.
+ */
 Matrix costSquaredErr(Matrix *prediction, Matrix *label)
 {
-    return (Matrix){0, 0, NULL};
+    if (!costSameSize(prediction, label, "squared error"))
+    {
+        return matView(NULL, 0, 0, 0);
+    }
+
+    Matrix result;
+    matInit(&result, 1, prediction->columns);
+    for (size_t i = 0; i < prediction->columns; ++i)
+    {
+        result.elements[i] = costSquaredErrColumn(prediction, label, i);
+    }
+
+    return result;
 }
 
 Matrix costSquaredErrDeriv(Matrix *prediction, Matrix *label)
 {
     return matSub(prediction, label);
 }
+
+void costSquaredErrDerivInto(Matrix *result, Matrix *prediction, Matrix *label)
+{
+    matSubInto(result, prediction, label);
+}
+
+/**
+ * @brief Computes half the squared error summed over a batch.
+ *
+ * @param prediction A matrix with one column per sample.
+ * @param label The labels for the prediction.
+ * @return The summed loss.
+ */
+float costSquaredErrSum(Matrix *prediction, Matrix *label)
+{
+    if (!costSameSize(prediction, label, "squared error"))
+    {
+        return 0.0f;
+    }
+
+    float loss = 0.0f;
+    for (size_t r = 0; r < prediction->rows; ++r)
+    {
+        const float *x = &prediction->elements[r * prediction->stride];
+        const float *y = &label->elements[r * label->stride];
+        for (size_t i = 0; i < prediction->columns; ++i)
+        {
+            float difference = x[i] - y[i];
+            loss += difference * difference;
+        }
+    }
+
+    return 0.5f * loss;
+}
+
+/**
+ * @brief Computes the cross entropy of each sample.
+ *
+ * @param prediction A matrix of probabilities with one column per sample, 
+ *                   such as a softmax output.
+ * @param label The labels for the prediction.
+ * @return A new row matrix with the loss of each sample.
+ */
+Matrix costCrossEntropy(Matrix *prediction, Matrix *label)
+{
+    if (!costSameSize(prediction, label, "cross entropy"))
+    {
+        return matView(NULL, 0, 0, 0);
+    }
+
+    Matrix result;
+    matInit(&result, 1, prediction->columns);
+    for (size_t i = 0; i < prediction->columns; ++i)
+    {
+        result.elements[i] = costCrossEntropyColumn(prediction, label, i);
+    }
+
+    return result;
+}
+
+/**
+ * @brief Computes the cross entropy summed over a batch.
+ *
+ * @param prediction A matrix of probabilities with one column per sample.
+ * @param label The labels for the prediction.
+ * @return The summed loss.
+ */
+float costCrossEntropySum(Matrix *prediction, Matrix *label)
+{
+    if (!costSameSize(prediction, label, "cross entropy"))
+    {
+        return 0.0f;
+    }
+
+    float loss = 0.0f;
+    for (size_t i = 0; i < prediction->columns; ++i)
+    {
+        loss += costCrossEntropyColumn(prediction, label, i);
+    }
+
+    return loss;
+}
+
+/**
+ * @brief Computes the output delta of a softmax layer trained with cross 
+ *        entropy, and the loss, in a single pass. The gradient of the loss 
+ *        with respect to the softmax inputs is simply the prediction minus 
+ *        the label, so no activation derivative is needed.
+ *
+ * @param delta An initialized matrix with the same size. It may be the 
+ *              prediction.
+ * @param prediction The softmax outputs, one column per sample.
+ * @param label The labels for the prediction.
+ * @return The cross entropy summed over the batch.
+ */
+float costSoftmaxCrossEntropyDeltaInto(Matrix *delta, Matrix *prediction, Matrix *label)
+{
+    if (!costSameSize(prediction, label, "cross entropy") ||
+        !costSameSize(delta, label, "cross entropy delta"))
+    {
+        return 0.0f;
+    }
+
+    uint64_t start = profileBegin();
+    float loss = 0.0f;
+    for (size_t r = 0; r < prediction->rows; ++r)
+    {
+        const float *x = &prediction->elements[r * prediction->stride];
+        const float *y = &label->elements[r * label->stride];
+        float *out = &delta->elements[r * delta->stride];
+        for (size_t i = 0; i < prediction->columns; ++i)
+        {
+            float probability = x[i];
+            float target = y[i];
+            if (target != 0.0f)
+            {
+                loss -= target * logf(probability > FLT_MIN ? probability : FLT_MIN);
+            }
+            out[i] = probability - target;
+        }
+    }
+    profileEndKernel(PROFILE_MAT_ELEMENTWISE, start, (uint64_t)prediction->rows * prediction->columns);
+
+    return loss;
+}
@@ -6,4 +6,12 @@
 Matrix costSquaredErr(Matrix *prediction, Matrix *label);
 Matrix costSquaredErrDeriv(Matrix *prediction, Matrix *label);
 
+void costSquaredErrDerivInto(Matrix *result, Matrix *prediction, Matrix *label);
+float costSquaredErrSum(Matrix *prediction, Matrix *label);
+
+Matrix costCrossEntropy(Matrix *prediction, Matrix *label);
+
+float costCrossEntropySum(Matrix *prediction, Matrix *label);
+float costSoftmaxCrossEntropyDeltaInto(Matrix *delta, Matrix *prediction, Matrix *label);
+
 #endif
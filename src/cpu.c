@@ -0,0 +1,204 @@
+#include "cpu.h"
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef CPU_X86
+#include <cpuid.h>
+#endif
+
+static const char *const cpuIsaNames[CPU_ISAS] = {
+    "scalar",
+    "sse4.2",
+    "avx2",
+    "avx512",
+};
+
+static pthread_once_t cpuOnce = PTHREAD_ONCE_INIT;
+static CpuIsa cpuSelected = CPU_SCALAR;
+static int cpuFeatures[CPU_FEATURES];
+
+/**
+ * @brief Finds the fastest tier the processor and operating system support.
+ *        The checks read CPUID, and the AVX tiers also require the operating
+ *        system to save the wider registers.
+ *
+ * @return The fastest supported tier.
+ */
+CpuIsa cpuDetect(void)
+{
+#ifdef CPU_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f") &&
+        __builtin_cpu_supports("avx2") &&
+        __builtin_cpu_supports("fma"))
+    {
+        return CPU_AVX512;
+    }
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+    {
+        return CPU_AVX2;
+    }
+    if (__builtin_cpu_supports("sse4.2"))
+    {
+        return CPU_SSE42;
+    }
+#endif
+
+    return CPU_SCALAR;
+}
+
+/**
+ * @brief Selects the tier: the fastest supported one, or the one named by
+ *        the override if the processor supports it.
+ */
+static void cpuSelectTier(void)
+{
+    CpuIsa detected = cpuDetect();
+    cpuSelected = detected;
+
+    const char *name = getenv(CPU_ISA_ENV);
+    if (name == NULL || name[0] == '\0')
+    {
+        return;
+    }
+
+    for (size_t i = 0; i < CPU_ISAS; ++i)
+    {
+        if (strcmp(name, cpuIsaNames[i]) != 0)
+        {
+            continue;
+        }
+        if (i > detected)
+        {
+            fprintf(stderr,
+                    "Error: %s=%s is not supported by this processor, using %s\n",
+                    CPU_ISA_ENV, name, cpuIsaNames[detected]);
+
+            return;
+        }
+
+        cpuSelected = (CpuIsa)i;
+        return;
+    }
+
+    fprintf(stderr,
+            "Error: Unknown %s=%s, using %s\n",
+            CPU_ISA_ENV, name, cpuIsaNames[detected]);
+}
+
+/**
+ * @brief Selects the tier for this process, and the instructions outside the
+ *        tiers that the processor supports and the tier allows.
+ */
+static void cpuSelect(void)
+{
+    cpuSelectTier();
+#ifdef CPU_X86
+    cpuFeatures[CPU_F16C] = cpuSelected >= CPU_AVX2 && __builtin_cpu_supports("f16c");
+    cpuFeatures[CPU_AVX512BF16] = cpuSelected >= CPU_AVX512 &&
+                                  __builtin_cpu_supports("avx512bf16") &&
+                                  __builtin_cpu_supports("avx512vl");
+    cpuFeatures[CPU_AVXVNNI] = cpuSelected >= CPU_AVX2 && __builtin_cpu_supports("avxvnni");
+    cpuFeatures[CPU_AVX512VNNI] = cpuSelected >= CPU_AVX512 &&
+                                  __builtin_cpu_supports("avx512vnni") &&
+                                  __builtin_cpu_supports("avx512vl");
+#endif
+}
+
+/**
+ * @brief Gets the tier every dispatched kernel runs. It is selected on the
+ *        first call and never changes afterwards, so any thread may call
+ *        this.
+ *
+ * @return The selected tier.
+ */
+CpuIsa cpuIsa(void)
+{
+    pthread_once(&cpuOnce, cpuSelect);
+
+    return cpuSelected;
+}
+
+/**
+ * @brief Checks whether dispatched code may use an instruction outside the
+ *        tiers.
+ *        Like the tier, this is decided on the first call.
+ *
+ * @param feature An instruction.
+ * @return Nonzero if it may be used.
+ */
+int cpuHasFeature(CpuFeature feature)
+{
+    pthread_once(&cpuOnce, cpuSelect);
+
+    return cpuFeatures[feature];
+}
+
+/**
+ * @brief Names a tier as the override accepts it.
+ *
+ * @param isa A tier.
+ * @return The name of the tier.
+ */
+const char *cpuIsaName(CpuIsa isa)
+{
+    return isa < CPU_ISAS ? cpuIsaNames[isa] : "unknown";
+}
+
+/**
+ * @brief Names the processor model by its CPUID brand string, with runs of
+ *        spaces replaced by single underscores so the name is one word.
+ *
+ * @param buffer Set to the name, truncated to fit.
+ * @param size The size of the buffer.
+ */
+void cpuModel(char *buffer, size_t size)
+{
+    if (size == 0)
+    {
+        return;
+    }
+
+    char brand[49] = "";
+#ifdef CPU_X86
+    if (__get_cpuid_max(0x80000000, NULL) >= 0x80000004)
+    {
+        uint32_t *words = (uint32_t *)brand;
+        for (uint32_t leaf = 0; leaf < 3; ++leaf)
+        {
+            __get_cpuid(0x80000002 + leaf,
+                        &words[4 * leaf],
+                        &words[4 * leaf + 1],
+                        &words[4 * leaf + 2],
+                        &words[4 * leaf + 3]);
+        }
+        brand[48] = '\0';
+    }
+#endif
+
+    size_t length = 0;
+    int space = 0;
+    for (const char *c = brand; *c != '\0' && length + 1 < size; ++c)
+    {
+        if (*c == ' ' || *c == '\t')
+        {
+            space = length > 0;
+            continue;
+        }
+        if (space && length + 2 < size)
+        {
+            buffer[length++] = '_';
+        }
+        space = 0;
+        buffer[length++] = *c;
+    }
+    buffer[length] = '\0';
+
+    if (length == 0)
+    {
+        snprintf(buffer, size, "unknown");
+    }
+}
@@ -0,0 +1,54 @@
+#ifndef CPU_H
+#define CPU_H
+
+#include <stddef.h>
+
+// Instruction set tiers with their own kernel variants, from slowest to
+// fastest. Each tier includes everything below it.
+typedef enum
+{
+    CPU_SCALAR,
+    CPU_SSE42,
+    CPU_AVX2,
+    CPU_AVX512,
+    CPU_ISAS
+}
+CpuIsa;
+
+// Conversion and int8 dot product instructions outside the tiers. Each is
+// only used when the processor has it and the selected tier includes the
+// registers it needs: F16C and AVX-VNNI from AVX2, and AVX-512 BF16 and
+// AVX-512 VNNI from AVX-512.
+typedef enum
+{
+    CPU_F16C,
+    CPU_AVX512BF16,
+    CPU_AVXVNNI,
+    CPU_AVX512VNNI,
+    CPU_FEATURES
+}
+CpuFeature;
+
+// Setting this environment variable to a tier name forces that tier.
+#define CPU_ISA_ENV "NET_ISA"
+
+// Kernel variants are compiled for their tier with function attributes, so
+// the rest of the build keeps its generic flags.
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define CPU_X86 1
+#define CPU_TARGET_SSE42 __attribute__((target("sse4.2")))
+#define CPU_TARGET_AVX2 __attribute__((target("avx2,fma")))
+#define CPU_TARGET_AVX512 __attribute__((target("avx512f,avx2,fma")))
+#define CPU_TARGET_F16C __attribute__((target("f16c,avx")))
+#define CPU_TARGET_AVX512BF16 __attribute__((target("avx512bf16,avx512vl,avx512f")))
+#define CPU_TARGET_AVXVNNI __attribute__((target("avxvnni,avx2")))
+#define CPU_TARGET_AVX512VNNI __attribute__((target("avx512vnni,avx512vl,avx512f,avx2")))
+#endif
+
+CpuIsa cpuDetect(void);
+CpuIsa cpuIsa(void);
+int cpuHasFeature(CpuFeature feature);
+const char *cpuIsaName(CpuIsa isa);
+void cpuModel(char *buffer, size_t size);
+
+#endif
@@ -0,0 +1,527 @@
+#include "dataset.h"
+#include "matrix.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// The IDX type code for unsigned bytes.
+#define IDX_UBYTE 0x08
+
+/**
+ * @brief Memory maps an IDX file of unsigned bytes and validates its header.
+ *        The elements are used in place and are never copied.
+ *
+ * @param file An unopened IDX file.
+ * @param fileName The path of the file.
+ * @return Zero on success, or nonzero if the file could not be opened or is
+ *         not a valid IDX file.
+ */
+int idxOpen(IdxFile *file, const char *fileName)
+{
+    memset(file, 0, sizeof(IdxFile));
+
+    int descriptor = open(fileName, O_RDONLY);
+    if (descriptor < 0)
+    {
+        fprintf(stderr, "Error: Cannot open %s\n", fileName);
+        return -1;
+    }
+
+    struct stat status;
+    if (fstat(descriptor, &status) != 0 || status.st_size < 4)
+    {
+        fprintf(stderr, "Error: %s is too small for an IDX header\n", fileName);
+        close(descriptor);
+        return -1;
+    }
+
+    file->mappingSize = (size_t)status.st_size;
+    file->mapping = mmap(NULL, file->mappingSize, PROT_READ, MAP_PRIVATE, descriptor, 0);
+    close(descriptor);
+    if (file->mapping == MAP_FAILED)
+    {
+        fprintf(stderr, "Error: Cannot map %s\n", fileName);
+        file->mapping = NULL;
+        return -1;
+    }
+
+    // The magic number is two zero bytes, a type code and a dimension count.
+    const unsigned char *header = (const unsigned char *)file->mapping;
+    file->dims = header[3];
+    if (header[0] != 0 || header[1] != 0 || header[2] != IDX_UBYTE ||
+        file->dims == 0 || file->dims > IDX_MAX_DIMS)
+    {
+        fprintf(stderr,
+                "Error: %s has an unsupported IDX magic number %02x%02x%02x%02x\n",
+                fileName, header[0], header[1], header[2], header[3]);
+        idxClose(file);
+        return -1;
+    }
+
+    size_t headerSize = 4 + 4 * file->dims;
+    if (file->mappingSize < headerSize)
+    {
+        fprintf(stderr, "Error: %s has a truncated IDX header\n", fileName);
+        idxClose(file);
+        return -1;
+    }
+
+    // The dimension sizes are big endian. A crafted header could make their
+    // product wrap, which would pass the size check below.
+    file->itemSize = 1;
+    int overflow = 0;
+    for (size_t i = 0; i < file->dims; ++i)
+    {
+        const unsigned char *size = &header[4 + 4 * i];
+        file->sizes[i] = ((size_t)size[0] << 24) | ((size_t)size[1] << 16) |
+                         ((size_t)size[2] << 8) | (size_t)size[3];
+        if (i > 0)
+        {
+            overflow |= __builtin_mul_overflow(file->itemSize, file->sizes[i], &file->itemSize);
+        }
+    }
+    file->count = file->sizes[0];
+
+    size_t dataSize;
+    overflow |= __builtin_mul_overflow(file->count, file->itemSize, &dataSize);
+    if (overflow)
+    {
+        fprintf(stderr, "Error: %s has IDX dimensions too large to address\n", fileName);
+        idxClose(file);
+        return -1;
+    }
+
+    if (file->mappingSize - headerSize < dataSize)
+    {
+        fprintf(stderr,
+                "Error: %s holds %lu bytes of data but its header needs %lu\n",
+                fileName,
+                file->mappingSize - headerSize,
+                dataSize);
+        idxClose(file);
+        return -1;
+    }
+
+    file->data = header + headerSize;
+    madvise(file->mapping, file->mappingSize, MADV_WILLNEED);
+
+    return 0;
+}
+
+/**
+ * @brief Unmaps an IDX file.
+ *
+ * @param file An opened IDX file.
+ */
+void idxClose(IdxFile *file)
+{
+    if (file->mapping != NULL)
+    {
+        munmap(file->mapping, file->mappingSize);
+    }
+    memset(file, 0, sizeof(IdxFile));
+}
+
+/**
+ * @brief Reads one feature of a sample, scaled.
+ *
+ * @param dataset An initialized dataset.
+ * @param index The index of the feature among all features of the dataset.
+ * @return The scaled feature.
+ */
+static float datasetFeature(Dataset *dataset, size_t index)
+{
+    if (dataset->format == DATASET_UINT8)
+    {
+        return ((const unsigned char *)dataset->features)[index] * dataset->featureScale;
+    }
+
+    return ((const float *)dataset->features)[index] * dataset->featureScale;
+}
+
+/**
+ * @brief Counts the nonzero features of one sample.
+ *
+ * @return The number of nonzero features of the sample.
+ */
+static size_t datasetCountNonzeros(Dataset *dataset, size_t sample)
+{
+    size_t nonzeros = 0;
+    for (size_t j = 0; j < dataset->featureSize; ++j)
+    {
+        nonzeros += datasetFeature(dataset, sample * dataset->featureSize + j) != 0.0f;
+    }
+
+    return nonzeros;
+}
+
+/**
+ * @brief Builds a sparse index of the nonzero features of each sample, if 
+ *        the dataset is sparse enough. The density is first estimated from 
+ *        up to DATASET_DENSITY_SAMPLES evenly spaced samples, so a dense 
+ *        dataset is rejected without reading all of it. Only the feature 
+ *        indices are stored: the values stay in the feature buffer, or the 
+ *        mapped file, and are scaled when a batch is gathered. Building the 
+ *        index reads every feature once, which pages in a mapped file.
+ *
+ * @param dataset An initialized or loaded dataset.
+ * @return Nonzero if the dataset has a sparse index afterwards.
+ */
+int datasetIndexSparse(Dataset *dataset)
+{
+    if (datasetIsSparse(dataset) || dataset->samples == 0 || dataset->featureSize == 0)
+    {
+        return datasetIsSparse(dataset);
+    }
+
+    size_t probes = dataset->samples < DATASET_DENSITY_SAMPLES ? dataset->samples : DATASET_DENSITY_SAMPLES;
+    size_t sampled = 0;
+    for (size_t i = 0; i < probes; ++i)
+    {
+        sampled += datasetCountNonzeros(dataset, i * dataset->samples / probes);
+    }
+    if (sampled > DATASET_SPARSE_DENSITY * probes * dataset->featureSize)
+    {
+        return 0;
+    }
+
+    size_t *sampleStarts = (size_t *)malloc((dataset->samples + 1) * sizeof(size_t));
+    size_t nonzeros = 0;
+    for (size_t i = 0; i < dataset->samples; ++i)
+    {
+        sampleStarts[i] = nonzeros;
+        nonzeros += datasetCountNonzeros(dataset, i);
+    }
+    sampleStarts[dataset->samples] = nonzeros;
+
+    // The sample can miss dense regions, so the whole count decides.
+    if (nonzeros > DATASET_SPARSE_DENSITY * dataset->samples * dataset->featureSize)
+    {
+        free(sampleStarts);
+        return 0;
+    }
+
+    uint32_t *featureIndices = (uint32_t *)malloc(nonzeros * sizeof(uint32_t));
+    size_t next = 0;
+    for (size_t i = 0; i < dataset->samples; ++i)
+    {
+        for (size_t j = 0; j < dataset->featureSize; ++j)
+        {
+            if (datasetFeature(dataset, i * dataset->featureSize + j) != 0.0f)
+            {
+                featureIndices[next++] = (uint32_t)j;
+            }
+        }
+    }
+
+    dataset->nonzeros = nonzeros;
+    dataset->sampleStarts = sampleStarts;
+    dataset->featureIndices = featureIndices;
+
+    return 1;
+}
+
+/**
+ * @brief Wraps contiguous sample-major buffers in a dataset. The buffers are 
+ *        not copied and must outlive the dataset.
+ *
+ * @param dataset An uninitialized dataset.
+ * @param features The features of each sample in turn, as unsigned bytes or 
+ *                 floats.
+ * @param format The type of the features.
+ * @param labels The class of each sample.
+ * @param samples The number of samples.
+ * @param featureSize The number of features in each sample.
+ * @param classes The number of classes.
+ * @param featureScale A scale applied to each feature when a batch is 
+ *                     gathered.
+ * @return Zero on success, or nonzero if a label is not a valid class.
+ */
+int datasetInit(Dataset *dataset,
+                const void *features,
+                DatasetFormat format,
+                const unsigned char *labels,
+                size_t samples,
+                size_t featureSize,
+                size_t classes,
+                float featureScale)
+{
+    memset(dataset, 0, sizeof(Dataset));
+    for (size_t i = 0; i < samples; ++i)
+    {
+        if (labels[i] >= classes)
+        {
+            fprintf(stderr,
+                    "Error: Label %u at %lu, but only %lu classes\n",
+                    labels[i], i, classes);
+            return -1;
+        }
+    }
+
+    dataset->samples = samples;
+    dataset->featureSize = featureSize;
+    dataset->classes = classes;
+    dataset->format = format;
+    dataset->features = features;
+    dataset->labels = labels;
+    dataset->featureScale = featureScale;
+
+    return 0;
+}
+
+/**
+ * @brief Loads a dataset from an IDX file of features and an IDX file of class
+ *        labels. The features stay as unsigned bytes in the mapped file and are
+ *        scaled to [0, 1] when a batch is gathered.
+ *
+ * @param dataset An unloaded dataset.
+ * @param featureFileName The path of the feature file, with one item per
+ *                        sample.
+ * @param labelFileName The path of the label file, with one byte per sample.
+ * @param classes The number of classes.
+ * @return Zero on success, or nonzero if the files are invalid or do not match.
+ */
+int datasetLoadIdx(Dataset *dataset,
+                   const char *featureFileName,
+                   const char *labelFileName,
+                   size_t classes)
+{
+    memset(dataset, 0, sizeof(Dataset));
+    if (idxOpen(&dataset->featureFile, featureFileName) != 0)
+    {
+        return -1;
+    }
+    if (idxOpen(&dataset->labelFile, labelFileName) != 0)
+    {
+        idxClose(&dataset->featureFile);
+        return -1;
+    }
+
+    IdxFile *featureFile = &dataset->featureFile;
+    IdxFile *labelFile = &dataset->labelFile;
+    if (labelFile->dims != 1 || labelFile->count != featureFile->count)
+    {
+        fprintf(stderr,
+                "Error: %s has %lu labels for %lu samples\n",
+                labelFileName, labelFile->count, featureFile->count);
+        datasetFree(dataset);
+        return -1;
+    }
+    for (size_t i = 0; i < labelFile->count; ++i)
+    {
+        if (labelFile->data[i] >= classes)
+        {
+            fprintf(stderr,
+                    "Error: %s has label %u at %lu, but only %lu classes\n",
+                    labelFileName, labelFile->data[i], i, classes);
+            datasetFree(dataset);
+            return -1;
+        }
+    }
+
+    dataset->samples = featureFile->count;
+    dataset->featureSize = featureFile->itemSize;
+    dataset->classes = classes;
+    dataset->format = DATASET_UINT8;
+    dataset->features = featureFile->data;
+    dataset->labels = labelFile->data;
+    dataset->featureScale = 1.0f / 255.0f;
+
+    return 0;
+}
+
+/**
+ * @brief Unmaps the files of a dataset and frees its sparse index. Buffers 
+ *        passed to datasetInit are left to their owner.
+ *
+ * @param dataset An initialized or loaded dataset.
+ */
+void datasetFree(Dataset *dataset)
+{
+    free(dataset->sampleStarts);
+    free(dataset->featureIndices);
+    idxClose(&dataset->featureFile);
+    idxClose(&dataset->labelFile);
+    memset(dataset, 0, sizeof(Dataset));
+}
+
+/**
+ * @brief One hot encodes the labels of samples into the columns of a batch.
+ *
+ * @param dataset A loaded dataset.
+ * @param indices The indices of the samples.
+ * @param count The number of samples.
+ * @param labels An initialized matrix with one row per class and one column
+ *               per sample, or NULL to skip the labels.
+ */
+static void datasetGatherLabels(Dataset *dataset,
+                                const uint32_t *indices,
+                                size_t count,
+                                Matrix *labels)
+{
+    if (labels == NULL)
+    {
+        return;
+    }
+    if (labels->rows != dataset->classes || labels->columns != count)
+    {
+        fprintf(stderr,
+                "Error: Cannot gather %lu labels of %lu classes into (%lu, %lu)\n",
+                count, dataset->classes,
+                labels->rows, labels->columns);
+
+        return;
+    }
+
+    matSet(labels, 0.0f);
+    for (size_t j = 0; j < count; ++j)
+    {
+        labels->elements[dataset->labels[indices[j]] * labels->stride + j] = 1.0f;
+    }
+}
+
+/**
+ * @brief Gathers samples into the columns of a batch, scaling the features and
+ *        one hot encoding the labels.
+ *
+ * @param dataset A loaded dataset.
+ * @param indices The indices of the samples.
+ * @param count The number of samples.
+ * @param features An initialized matrix with one row per feature and one
+ *                 column per sample.
+ * @param labels An initialized matrix with one row per class and one column
+ *               per sample, or NULL to skip the labels.
+ */
+void datasetGather(Dataset *dataset,
+                   const uint32_t *indices,
+                   size_t count,
+                   Matrix *features,
+                   Matrix *labels)
+{
+    if (features->rows != dataset->featureSize || features->columns != count)
+    {
+        fprintf(stderr,
+                "Error: Cannot gather %lu samples of %lu features into (%lu, %lu)\n",
+                count, dataset->featureSize,
+                features->rows, features->columns);
+
+        return;
+    }
+
+    // Each row of the batch reads one feature from every sample, so the
+    // writes are contiguous and the reads advance through each sample.
+    size_t featureSize = dataset->featureSize;
+    float scale = dataset->featureScale;
+    for (size_t i = 0; i < featureSize; ++i)
+    {
+        float *row = &features->elements[i * features->stride];
+        if (dataset->format == DATASET_UINT8)
+        {
+            const unsigned char *data = (const unsigned char *)dataset->features + i;
+            for (size_t j = 0; j < count; ++j)
+            {
+                row[j] = data[(size_t)indices[j] * featureSize] * scale;
+            }
+        }
+        else
+        {
+            const float *data = (const float *)dataset->features + i;
+            for (size_t j = 0; j < count; ++j)
+            {
+                row[j] = data[(size_t)indices[j] * featureSize] * scale;
+            }
+        }
+    }
+
+    datasetGatherLabels(dataset, indices, count, labels);
+}
+
+/**
+ * @brief Checks whether a dataset has a sparse index.
+ *
+ * @param dataset An initialized or loaded dataset.
+ * @return Nonzero if batches can be gathered with datasetGatherSparse.
+ */
+int datasetIsSparse(Dataset *dataset)
+{
+    return dataset->sampleStarts != NULL;
+}
+
+/**
+ * @brief Gathers samples into the columns of a sparse batch, reading and 
+ *        scaling only the nonzero features the sparse index lists, and one 
+ *        hot encodes the labels.
+ *
+ * @param dataset A dataset with a sparse index.
+ * @param indices The indices of the samples.
+ * @param count The number of samples.
+ * @param features A sparse matrix with one row per feature and room for the 
+ *                 nonzeros of every sample. Its columns are set to the count.
+ * @param labels An initialized matrix with one row per class and one column 
+ *               per sample, or NULL to skip the labels.
+ */
+void datasetGatherSparse(Dataset *dataset,
+                         const uint32_t *indices,
+                         size_t count,
+                         SparseMatrix *features,
+                         Matrix *labels)
+{
+    if (!datasetIsSparse(dataset) || features->rows != dataset->featureSize)
+    {
+        fprintf(stderr,
+                "Error: Cannot gather %lu samples of %lu features into sparse (%lu, %lu)\n",
+                count, dataset->featureSize,
+                features->rows, features->columns);
+
+        return;
+    }
+
+    float scale = dataset->featureScale;
+    size_t next = 0;
+    for (size_t j = 0; j < count; ++j)
+    {
+        size_t start = dataset->sampleStarts[indices[j]];
+        size_t size = dataset->sampleStarts[indices[j] + 1] - start;
+        if (next + size > features->capacity)
+        {
+            fprintf(stderr,
+                    "Error: Cannot gather more than %lu nonzero features\n",
+                    features->capacity);
+            features->columns = 0;
+            features->columnStarts[0] = 0;
+
+            return;
+        }
+
+        features->columnStarts[j] = next;
+        const uint32_t *rows = &dataset->featureIndices[start];
+        memcpy(&features->rowIndices[next], rows, size * sizeof(uint32_t));
+        size_t offset = (size_t)indices[j] * dataset->featureSize;
+        float *values = &features->values[next];
+        if (dataset->format == DATASET_UINT8)
+        {
+            const unsigned char *data = (const unsigned char *)dataset->features + offset;
+            for (size_t p = 0; p < size; ++p)
+            {
+                values[p] = data[rows[p]] * scale;
+            }
+        }
+        else
+        {
+            const float *data = (const float *)dataset->features + offset;
+            for (size_t p = 0; p < size; ++p)
+            {
+                values[p] = data[rows[p]] * scale;
+            }
+        }
+        next += size;
+    }
+    features->columns = count;
+    features->columnStarts[count] = next;
+
+    datasetGatherLabels(dataset, indices, count, labels);
+}
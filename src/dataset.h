@@ -0,0 +1,80 @@
+#ifndef DATASET_H
+#define DATASET_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "matrix.h"
+
+#define IDX_MAX_DIMS 4
+
+// Datasets with at most this fraction of nonzero features can get a sparse 
+// index with datasetIndexSparse, so batches can skip the zeros. Denser 
+// datasets are always gathered into dense matrices.
+#define DATASET_SPARSE_DENSITY 0.25
+
+// The number of samples read to estimate the density of a dataset before its 
+// sparse index is built.
+#define DATASET_DENSITY_SAMPLES 256
+
+typedef struct
+{
+    void *mapping;
+    size_t mappingSize;
+    const unsigned char *data;
+    size_t dims;
+    size_t sizes[IDX_MAX_DIMS];
+    size_t count, itemSize;
+}
+IdxFile;
+
+typedef enum
+{
+    DATASET_UINT8,
+    DATASET_FLOAT32
+}
+DatasetFormat;
+
+typedef struct
+{
+    size_t samples, featureSize, classes;
+    DatasetFormat format;
+    const void *features;
+    const unsigned char *labels;
+    float featureScale;
+    IdxFile featureFile, labelFile;
+    size_t nonzeros;
+    size_t *sampleStarts;
+    uint32_t *featureIndices;
+}
+Dataset;
+
+int idxOpen(IdxFile *file, const char *fileName);
+void idxClose(IdxFile *file);
+
+int datasetInit(Dataset *dataset,
+                const void *features,
+                DatasetFormat format,
+                const unsigned char *labels,
+                size_t samples,
+                size_t featureSize,
+                size_t classes,
+                float featureScale);
+int datasetLoadIdx(Dataset *dataset,
+                   const char *featureFileName,
+                   const char *labelFileName,
+                   size_t classes);
+void datasetFree(Dataset *dataset);
+void datasetGather(Dataset *dataset,
+                   const uint32_t *indices,
+                   size_t count,
+                   Matrix *features,
+                   Matrix *labels);
+int datasetIndexSparse(Dataset *dataset);
+int datasetIsSparse(Dataset *dataset);
+void datasetGatherSparse(Dataset *dataset,
+                         const uint32_t *indices,
+                         size_t count,
+                         SparseMatrix *features,
+                         Matrix *labels);
+
+#endif
@@ -0,0 +1,1067 @@
+#include "gemm.h"
+#include "cpu.h"
+#include "half.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#ifdef CPU_X86
+#include <immintrin.h>
+#endif
+
+// Packing buffers. Each thread gets its own pair so concurrent calls do not
+// share state.
+static _Thread_local float packedA[GEMM_MC * GEMM_KC] __attribute__((aligned(64)));
+static _Thread_local float packedB[GEMM_KC * GEMM_NC] __attribute__((aligned(64)));
+
+// A block of a half precision A, widened to floats before it is packed.
+static _Thread_local float convertedA[GEMM_MC * GEMM_KC] __attribute__((aligned(64)));
+
+// The A operand, stored either as floats or in half precision.
+typedef struct
+{
+    const float *elements;
+    const uint16_t *halfElements;
+    HalfFormat format;
+}
+GemmOperand;
+
+// A product shape with its own cache blocks. The blocks are packed into one
+// word, so retuning a shape replaces them in a single store.
+typedef struct
+{
+    GemmTranspose transA, transB;
+    size_t m, n, k;
+    _Atomic uint64_t blocking;
+}
+GemmTuning;
+
+// Each packed block size takes this many bits, which holds any size that fits
+// the packing buffers.
+#define GEMM_BLOCK_BITS 21
+#define GEMM_BLOCK_MASK ((UINT64_C(1) << GEMM_BLOCK_BITS) - 1)
+
+_Static_assert(GEMM_KC * GEMM_NC <= GEMM_BLOCK_MASK &&
+               GEMM_MC * GEMM_KC <= GEMM_BLOCK_MASK,
+               "Packed cache blocks are too narrow");
+
+// A shape is appended once, under the mutex, and later tunings of it only
+// store new blocks. Lookups scan the published entries without taking the
+// lock, so they never see a half written entry.
+static GemmTuning gemmTunings[GEMM_TUNINGS];
+static _Atomic size_t gemmTuningCount;
+static pthread_mutex_t gemmTuningMutex = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * @brief Packs a block of A into row panels of GEMM_MR rows. Each panel is
+ *        stored column by column and padded with zeros.
+ *
+ * @param mc The number of rows in the block.
+ * @param kc The number of columns in the block.
+ * @param a The first element of the block.
+ * @param rowStride The distance between rows of A.
+ * @param colStride The distance between columns of A.
+ * @param packed A destination buffer.
+ */
+static void gemmPackA(size_t mc,
+                      size_t kc,
+                      const float *a,
+                      size_t rowStride,
+                      size_t colStride,
+                      float *packed)
+{
+    for (size_t i = 0; i < mc; i += GEMM_MR)
+    {
+        size_t mr = mc - i < GEMM_MR ? mc - i : GEMM_MR;
+        for (size_t p = 0; p < kc; ++p)
+        {
+            for (size_t r = 0; r < mr; ++r)
+            {
+                packed[r] = a[(i + r) * rowStride + p * colStride];
+            }
+            for (size_t r = mr; r < GEMM_MR; ++r)
+            {
+                packed[r] = 0.0f;
+            }
+            packed += GEMM_MR;
+        }
+    }
+}
+
+/**
+ * @brief Packs a block of B into column panels of GEMM_NR columns. Each panel
+ *        is stored row by row and padded with zeros.
+ *
+ * @param kc The number of rows in the block.
+ * @param nc The number of columns in the block.
+ * @param b The first element of the block.
+ * @param rowStride The distance between rows of B.
+ * @param colStride The distance between columns of B.
+ * @param packed A destination buffer.
+ */
+static void gemmPackB(size_t kc,
+                      size_t nc,
+                      const float *b,
+                      size_t rowStride,
+                      size_t colStride,
+                      float *packed)
+{
+    for (size_t j = 0; j < nc; j += GEMM_NR)
+    {
+        size_t nr = nc - j < GEMM_NR ? nc - j : GEMM_NR;
+        for (size_t p = 0; p < kc; ++p)
+        {
+            const float *row = &b[p * rowStride + j * colStride];
+            if (colStride == 1)
+            {
+                memcpy(packed, row, nr * sizeof(float));
+            }
+            else
+            {
+                for (size_t r = 0; r < nr; ++r)
+                {
+                    packed[r] = row[r * colStride];
+                }
+            }
+            for (size_t r = nr; r < GEMM_NR; ++r)
+            {
+                packed[r] = 0.0f;
+            }
+            packed += GEMM_NR;
+        }
+    }
+}
+
+// One micro-kernel and dot product per tier, selected from these tables by
+// cpuIsa. The SSE tier has no dot product of its own and reuses the scalar
+// one, whose eight partial sums the compiler already keeps in registers.
+typedef void (*GemmKernelFunc)(size_t kc,
+                               float alpha,
+                               const float *a,
+                               const float *b,
+                               float beta,
+                               float *c,
+                               size_t ldc);
+typedef float (*GemmDotFunc)(size_t k, const float *a, const float *b);
+
+/**
+ * @brief Multiplies a packed GEMM_MR x kc panel by a packed kc x GEMM_NR
+ *        panel into a full GEMM_MR x GEMM_NR register block.
+ *
+ * @param kc The shared dimension.
+ * @param alpha A scalar for the product.
+ * @param a A packed panel of A.
+ * @param b A packed panel of B.
+ * @param beta A scalar for the existing values of C.
+ * @param c The first element of the block of C.
+ * @param ldc The distance between rows of C.
+ */
+static void gemmKernelScalar(size_t kc,
+                             float alpha,
+                             const float *a,
+                             const float *b,
+                             float beta,
+                             float *c,
+                             size_t ldc)
+{
+    float acc[GEMM_MR][GEMM_NR] = {{0.0f}};
+    for (size_t p = 0; p < kc; ++p)
+    {
+        for (size_t r = 0; r < GEMM_MR; ++r)
+        {
+            for (size_t j = 0; j < GEMM_NR; ++j)
+            {
+                acc[r][j] += a[r] * b[j];
+            }
+        }
+        a += GEMM_MR;
+        b += GEMM_NR;
+    }
+
+    for (size_t r = 0; r < GEMM_MR; ++r)
+    {
+        for (size_t j = 0; j < GEMM_NR; ++j)
+        {
+            float result = alpha * acc[r][j];
+            if (beta != 0.0f)
+            {
+                result += beta * c[r * ldc + j];
+            }
+            c[r * ldc + j] = result;
+        }
+    }
+}
+
+/**
+ * @brief Computes a dot product of two contiguous vectors.
+ */
+static float gemmDotScalar(size_t k, const float *a, const float *b)
+{
+    size_t p = 0;
+    float partial[8] = {0.0f};
+    for (; p + 8 <= k; p += 8)
+    {
+        for (size_t j = 0; j < 8; ++j)
+        {
+            partial[j] += a[p + j] * b[p + j];
+        }
+    }
+    float sum = ((partial[0] + partial[1]) + (partial[2] + partial[3])) +
+                ((partial[4] + partial[5]) + (partial[6] + partial[7]));
+    for (; p < k; ++p)
+    {
+        sum += a[p] * b[p];
+    }
+
+    return sum;
+}
+
+#ifdef CPU_X86
+/**
+ * @brief The micro-kernel on SSE registers. Sixteen registers cannot hold
+ *        the whole tile, so each half of the columns is accumulated in its
+ *        own pass over the panels.
+ */
+static CPU_TARGET_SSE42 void gemmKernelSse(size_t kc,
+                                           float alpha,
+                                           const float *a,
+                                           const float *b,
+                                           float beta,
+                                           float *c,
+                                           size_t ldc)
+{
+    __m128 alphas = _mm_set1_ps(alpha);
+    __m128 betas = _mm_set1_ps(beta);
+    for (size_t h = 0; h < GEMM_NR; h += 8)
+    {
+        __m128 c00 = _mm_setzero_ps(), c01 = _mm_setzero_ps();
+        __m128 c10 = _mm_setzero_ps(), c11 = _mm_setzero_ps();
+        __m128 c20 = _mm_setzero_ps(), c21 = _mm_setzero_ps();
+        __m128 c30 = _mm_setzero_ps(), c31 = _mm_setzero_ps();
+        __m128 c40 = _mm_setzero_ps(), c41 = _mm_setzero_ps();
+        __m128 c50 = _mm_setzero_ps(), c51 = _mm_setzero_ps();
+        const float *ap = a;
+        const float *bp = b + h;
+        for (size_t p = 0; p < kc; ++p)
+        {
+            __m128 b0 = _mm_load_ps(bp);
+            __m128 b1 = _mm_load_ps(bp + 4);
+            __m128 ai = _mm_load1_ps(ap);
+            c00 = _mm_add_ps(c00, _mm_mul_ps(ai, b0));
+            c01 = _mm_add_ps(c01, _mm_mul_ps(ai, b1));
+            ai = _mm_load1_ps(ap + 1);
+            c10 = _mm_add_ps(c10, _mm_mul_ps(ai, b0));
+            c11 = _mm_add_ps(c11, _mm_mul_ps(ai, b1));
+            ai = _mm_load1_ps(ap + 2);
+            c20 = _mm_add_ps(c20, _mm_mul_ps(ai, b0));
+            c21 = _mm_add_ps(c21, _mm_mul_ps(ai, b1));
+            ai = _mm_load1_ps(ap + 3);
+            c30 = _mm_add_ps(c30, _mm_mul_ps(ai, b0));
+            c31 = _mm_add_ps(c31, _mm_mul_ps(ai, b1));
+            ai = _mm_load1_ps(ap + 4);
+            c40 = _mm_add_ps(c40, _mm_mul_ps(ai, b0));
+            c41 = _mm_add_ps(c41, _mm_mul_ps(ai, b1));
+            ai = _mm_load1_ps(ap + 5);
+            c50 = _mm_add_ps(c50, _mm_mul_ps(ai, b0));
+            c51 = _mm_add_ps(c51, _mm_mul_ps(ai, b1));
+            ap += GEMM_MR;
+            bp += GEMM_NR;
+        }
+
+        __m128 acc[GEMM_MR][2] = {{c00, c01}, {c10, c11}, {c20, c21},
+                                  {c30, c31}, {c40, c41}, {c50, c51}};
+        for (size_t r = 0; r < GEMM_MR; ++r)
+        {
+            for (size_t q = 0; q < 2; ++q)
+            {
+                float *cp = &c[r * ldc + h + q * 4];
+                __m128 result = _mm_mul_ps(alphas, acc[r][q]);
+                if (beta != 0.0f)
+                {
+                    result = _mm_add_ps(result, _mm_mul_ps(betas, _mm_loadu_ps(cp)));
+                }
+                _mm_storeu_ps(cp, result);
+            }
+        }
+    }
+}
+
+/**
+ * @brief The micro-kernel on AVX2 registers with fused multiply-adds. Each
+ *        row of the tile takes two registers.
+ */
+static CPU_TARGET_AVX2 void gemmKernelAvx2(size_t kc,
+                                           float alpha,
+                                           const float *a,
+                                           const float *b,
+                                           float beta,
+                                           float *c,
+                                           size_t ldc)
+{
+    __m256 c00 = _mm256_setzero_ps(), c01 = _mm256_setzero_ps();
+    __m256 c10 = _mm256_setzero_ps(), c11 = _mm256_setzero_ps();
+    __m256 c20 = _mm256_setzero_ps(), c21 = _mm256_setzero_ps();
+    __m256 c30 = _mm256_setzero_ps(), c31 = _mm256_setzero_ps();
+    __m256 c40 = _mm256_setzero_ps(), c41 = _mm256_setzero_ps();
+    __m256 c50 = _mm256_setzero_ps(), c51 = _mm256_setzero_ps();
+    for (size_t p = 0; p < kc; ++p)
+    {
+        __m256 b0 = _mm256_load_ps(b);
+        __m256 b1 = _mm256_load_ps(b + 8);
+        __m256 ai = _mm256_broadcast_ss(a);
+        c00 = _mm256_fmadd_ps(ai, b0, c00);
+        c01 = _mm256_fmadd_ps(ai, b1, c01);
+        ai = _mm256_broadcast_ss(a + 1);
+        c10 = _mm256_fmadd_ps(ai, b0, c10);
+        c11 = _mm256_fmadd_ps(ai, b1, c11);
+        ai = _mm256_broadcast_ss(a + 2);
+        c20 = _mm256_fmadd_ps(ai, b0, c20);
+        c21 = _mm256_fmadd_ps(ai, b1, c21);
+        ai = _mm256_broadcast_ss(a + 3);
+        c30 = _mm256_fmadd_ps(ai, b0, c30);
+        c31 = _mm256_fmadd_ps(ai, b1, c31);
+        ai = _mm256_broadcast_ss(a + 4);
+        c40 = _mm256_fmadd_ps(ai, b0, c40);
+        c41 = _mm256_fmadd_ps(ai, b1, c41);
+        ai = _mm256_broadcast_ss(a + 5);
+        c50 = _mm256_fmadd_ps(ai, b0, c50);
+        c51 = _mm256_fmadd_ps(ai, b1, c51);
+        a += GEMM_MR;
+        b += GEMM_NR;
+    }
+
+    __m256 acc[GEMM_MR][2] = {{c00, c01}, {c10, c11}, {c20, c21},
+                              {c30, c31}, {c40, c41}, {c50, c51}};
+    __m256 alphas = _mm256_set1_ps(alpha);
+    __m256 betas = _mm256_set1_ps(beta);
+    for (size_t r = 0; r < GEMM_MR; ++r)
+    {
+        for (size_t h = 0; h < 2; ++h)
+        {
+            __m256 result = _mm256_mul_ps(alphas, acc[r][h]);
+            if (beta != 0.0f)
+            {
+                result = _mm256_fmadd_ps(betas, _mm256_loadu_ps(&c[r * ldc + h * 8]), result);
+            }
+            _mm256_storeu_ps(&c[r * ldc + h * 8], result);
+        }
+    }
+}
+
+/**
+ * @brief The micro-kernel on AVX-512 registers. A row of the tile fits in one
+ *        register, so even and odd steps of the shared dimension accumulate
+ *        separately to keep enough fused multiply-adds in flight.
+ */
+static CPU_TARGET_AVX512 void gemmKernelAvx512(size_t kc,
+                                               float alpha,
+                                               const float *a,
+                                               const float *b,
+                                               float beta,
+                                               float *c,
+                                               size_t ldc)
+{
+    __m512 c0 = _mm512_setzero_ps(), d0 = _mm512_setzero_ps();
+    __m512 c1 = _mm512_setzero_ps(), d1 = _mm512_setzero_ps();
+    __m512 c2 = _mm512_setzero_ps(), d2 = _mm512_setzero_ps();
+    __m512 c3 = _mm512_setzero_ps(), d3 = _mm512_setzero_ps();
+    __m512 c4 = _mm512_setzero_ps(), d4 = _mm512_setzero_ps();
+    __m512 c5 = _mm512_setzero_ps(), d5 = _mm512_setzero_ps();
+    size_t p = 0;
+    for (; p + 2 <= kc; p += 2)
+    {
+        __m512 b0 = _mm512_load_ps(b);
+        __m512 b1 = _mm512_load_ps(b + GEMM_NR);
+        c0 = _mm512_fmadd_ps(_mm512_set1_ps(a[0]), b0, c0);
+        d0 = _mm512_fmadd_ps(_mm512_set1_ps(a[GEMM_MR]), b1, d0);
+        c1 = _mm512_fmadd_ps(_mm512_set1_ps(a[1]), b0, c1);
+        d1 = _mm512_fmadd_ps(_mm512_set1_ps(a[GEMM_MR + 1]), b1, d1);
+        c2 = _mm512_fmadd_ps(_mm512_set1_ps(a[2]), b0, c2);
+        d2 = _mm512_fmadd_ps(_mm512_set1_ps(a[GEMM_MR + 2]), b1, d2);
+        c3 = _mm512_fmadd_ps(_mm512_set1_ps(a[3]), b0, c3);
+        d3 = _mm512_fmadd_ps(_mm512_set1_ps(a[GEMM_MR + 3]), b1, d3);
+        c4 = _mm512_fmadd_ps(_mm512_set1_ps(a[4]), b0, c4);
+        d4 = _mm512_fmadd_ps(_mm512_set1_ps(a[GEMM_MR + 4]), b1, d4);
+        c5 = _mm512_fmadd_ps(_mm512_set1_ps(a[5]), b0, c5);
+        d5 = _mm512_fmadd_ps(_mm512_set1_ps(a[GEMM_MR + 5]), b1, d5);
+        a += 2 * GEMM_MR;
+        b += 2 * GEMM_NR;
+    }
+    if (p < kc)
+    {
+        __m512 b0 = _mm512_load_ps(b);
+        c0 = _mm512_fmadd_ps(_mm512_set1_ps(a[0]), b0, c0);
+        c1 = _mm512_fmadd_ps(_mm512_set1_ps(a[1]), b0, c1);
+        c2 = _mm512_fmadd_ps(_mm512_set1_ps(a[2]), b0, c2);
+        c3 = _mm512_fmadd_ps(_mm512_set1_ps(a[3]), b0, c3);
+        c4 = _mm512_fmadd_ps(_mm512_set1_ps(a[4]), b0, c4);
+        c5 = _mm512_fmadd_ps(_mm512_set1_ps(a[5]), b0, c5);
+    }
+
+    __m512 acc[GEMM_MR] = {_mm512_add_ps(c0, d0), _mm512_add_ps(c1, d1), _mm512_add_ps(c2, d2),
+                           _mm512_add_ps(c3, d3), _mm512_add_ps(c4, d4), _mm512_add_ps(c5, d5)};
+    __m512 alphas = _mm512_set1_ps(alpha);
+    __m512 betas = _mm512_set1_ps(beta);
+    for (size_t r = 0; r < GEMM_MR; ++r)
+    {
+        __m512 result = _mm512_mul_ps(alphas, acc[r]);
+        if (beta != 0.0f)
+        {
+            result = _mm512_fmadd_ps(betas, _mm512_loadu_ps(&c[r * ldc]), result);
+        }
+        _mm512_storeu_ps(&c[r * ldc], result);
+    }
+}
+
+/**
+ * @brief The dot product on AVX2 registers, with four accumulators to hide
+ *        the latency of the fused multiply-adds.
+ */
+static CPU_TARGET_AVX2 float gemmDotAvx2(size_t k, const float *a, const float *b)
+{
+    size_t p = 0;
+    __m256 acc0 = _mm256_setzero_ps(), acc1 = _mm256_setzero_ps();
+    __m256 acc2 = _mm256_setzero_ps(), acc3 = _mm256_setzero_ps();
+    for (; p + 32 <= k; p += 32)
+    {
+        acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + p), _mm256_loadu_ps(b + p), acc0);
+        acc1 = _mm256_fmadd_ps(_mm256_loadu_ps(a + p + 8), _mm256_loadu_ps(b + p + 8), acc1);
+        acc2 = _mm256_fmadd_ps(_mm256_loadu_ps(a + p + 16), _mm256_loadu_ps(b + p + 16), acc2);
+        acc3 = _mm256_fmadd_ps(_mm256_loadu_ps(a + p + 24), _mm256_loadu_ps(b + p + 24), acc3);
+    }
+    for (; p + 8 <= k; p += 8)
+    {
+        acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + p), _mm256_loadu_ps(b + p), acc0);
+    }
+    __m256 acc = _mm256_add_ps(_mm256_add_ps(acc0, acc1), _mm256_add_ps(acc2, acc3));
+    __m128 half = _mm_add_ps(_mm256_castps256_ps128(acc), _mm256_extractf128_ps(acc, 1));
+    half = _mm_add_ps(half, _mm_movehl_ps(half, half));
+    half = _mm_add_ss(half, _mm_movehdup_ps(half));
+    float sum = _mm_cvtss_f32(half);
+    for (; p < k; ++p)
+    {
+        sum += a[p] * b[p];
+    }
+
+    return sum;
+}
+
+/**
+ * @brief The dot product on AVX-512 registers.
+ */
+static CPU_TARGET_AVX512 float gemmDotAvx512(size_t k, const float *a, const float *b)
+{
+    size_t p = 0;
+    __m512 acc0 = _mm512_setzero_ps(), acc1 = _mm512_setzero_ps();
+    __m512 acc2 = _mm512_setzero_ps(), acc3 = _mm512_setzero_ps();
+    for (; p + 64 <= k; p += 64)
+    {
+        acc0 = _mm512_fmadd_ps(_mm512_loadu_ps(a + p), _mm512_loadu_ps(b + p), acc0);
+        acc1 = _mm512_fmadd_ps(_mm512_loadu_ps(a + p + 16), _mm512_loadu_ps(b + p + 16), acc1);
+        acc2 = _mm512_fmadd_ps(_mm512_loadu_ps(a + p + 32), _mm512_loadu_ps(b + p + 32), acc2);
+        acc3 = _mm512_fmadd_ps(_mm512_loadu_ps(a + p + 48), _mm512_loadu_ps(b + p + 48), acc3);
+    }
+    for (; p + 16 <= k; p += 16)
+    {
+        acc0 = _mm512_fmadd_ps(_mm512_loadu_ps(a + p), _mm512_loadu_ps(b + p), acc0);
+    }
+    float sum = _mm512_reduce_add_ps(_mm512_add_ps(_mm512_add_ps(acc0, acc1), _mm512_add_ps(acc2, acc3)));
+    for (; p < k; ++p)
+    {
+        sum += a[p] * b[p];
+    }
+
+    return sum;
+}
+
+static const GemmKernelFunc gemmKernels[CPU_ISAS] = {
+    gemmKernelScalar,
+    gemmKernelSse,
+    gemmKernelAvx2,
+    gemmKernelAvx512,
+};
+
+static const GemmDotFunc gemmDots[CPU_ISAS] = {
+    gemmDotScalar,
+    gemmDotScalar,
+    gemmDotAvx2,
+    gemmDotAvx512,
+};
+#else
+static const GemmKernelFunc gemmKernels[CPU_ISAS] = {gemmKernelScalar};
+static const GemmDotFunc gemmDots[CPU_ISAS] = {gemmDotScalar};
+#endif
+
+/**
+ * @brief Runs the micro-kernel on a block that may be smaller than a full
+ *        register block. Partial blocks go through a temporary so the kernel
+ *        never touches memory outside C.
+ */
+static void gemmKernelEdge(GemmKernelFunc kernel,
+                           size_t mr,
+                           size_t nr,
+                           size_t kc,
+                           float alpha,
+                           const float *a,
+                           const float *b,
+                           float beta,
+                           float *c,
+                           size_t ldc)
+{
+    if (mr == GEMM_MR && nr == GEMM_NR)
+    {
+        kernel(kc, alpha, a, b, beta, c, ldc);
+        return;
+    }
+
+    float temp[GEMM_MR * GEMM_NR] __attribute__((aligned(64)));
+    kernel(kc, alpha, a, b, 0.0f, temp, GEMM_NR);
+    for (size_t r = 0; r < mr; ++r)
+    {
+        for (size_t j = 0; j < nr; ++j)
+        {
+            float result = temp[r * GEMM_NR + j];
+            if (beta != 0.0f)
+            {
+                result += beta * c[r * ldc + j];
+            }
+            c[r * ldc + j] = result;
+        }
+    }
+}
+
+/**
+ * @brief Reads a contiguous run of A as floats. Float operands are returned 
+ *        in place, and half precision runs are widened into a buffer.
+ *
+ * @param a The A operand.
+ * @param offset The index of the first element of the run.
+ * @param count The length of the run.
+ * @param buffer Room for count floats.
+ * @return The run as floats.
+ */
+static const float *gemmReadA(const GemmOperand *a, size_t offset, size_t count, float *buffer)
+{
+    if (a->halfElements == NULL)
+    {
+        return &a->elements[offset];
+    }
+    halfToFloats(a->format, &a->halfElements[offset], buffer, count);
+
+    return buffer;
+}
+
+/**
+ * @brief Computes a matrix-vector product. Packing a single column into
+ *        GEMM_NR wide panels would waste most of the micro-kernel, so each
+ *        row of A is reduced directly against the column of B. Half precision
+ *        rows are widened a slice at a time while the slice is in L1.
+ */
+static void gemv(size_t m,
+                 size_t k,
+                 float alpha,
+                 const GemmOperand *a,
+                 size_t lda,
+                 const float *x,
+                 size_t incx,
+                 float beta,
+                 float *c,
+                 size_t ldc)
+{
+    // Gather a strided column into contiguous memory.
+    if (incx != 1)
+    {
+        for (size_t p = 0; p < k; ++p)
+        {
+            packedB[p] = x[p * incx];
+        }
+        x = packedB;
+    }
+
+    GemmDotFunc dot = gemmDots[cpuIsa()];
+    size_t slice = a->halfElements == NULL ? k : GEMM_KC;
+    for (size_t i = 0; i < m; ++i)
+    {
+        float sum = 0.0f;
+        for (size_t p = 0; p < k; p += slice)
+        {
+            size_t length = k - p < slice ? k - p : slice;
+            const float *row = gemmReadA(a, i * lda + p, length, convertedA);
+            sum += dot(length, row, &x[p]);
+        }
+
+        float result = alpha * sum;
+        if (beta != 0.0f)
+        {
+            result += beta * c[i * ldc];
+        }
+        c[i * ldc] = result;
+    }
+}
+
+/**
+ * @brief Computes a transposed matrix-vector product. The rows of the stored
+ *        matrix are scaled by the vector and summed, so A is still read in
+ *        its stored order.
+ */
+static void gemvTrans(size_t m,
+                      size_t k,
+                      float alpha,
+                      const GemmOperand *a,
+                      size_t lda,
+                      const float *x,
+                      size_t incx,
+                      float beta,
+                      float *c,
+                      size_t ldc)
+{
+    float *sum = packedA;
+    memset(sum, 0, m * sizeof(float));
+    for (size_t p = 0; p < k; ++p)
+    {
+        float scale = x[p * incx];
+        const float *row = gemmReadA(a, p * lda, m, packedB);
+        for (size_t i = 0; i < m; ++i)
+        {
+            sum[i] += scale * row[i];
+        }
+    }
+
+    for (size_t i = 0; i < m; ++i)
+    {
+        float result = alpha * sum[i];
+        if (beta != 0.0f)
+        {
+            result += beta * c[i * ldc];
+        }
+        c[i * ldc] = result;
+    }
+}
+
+/**
+ * @brief Packs a block of op(A), widening it first if A is stored in half 
+ *        precision. The widened block keeps the stored layout of A, so it is 
+ *        packed with the same transpose.
+ */
+static void gemmPackOperandA(const GemmOperand *a,
+                             GemmTranspose transA,
+                             size_t lda,
+                             size_t ic,
+                             size_t pc,
+                             size_t mc,
+                             size_t kc)
+{
+    if (a->halfElements == NULL)
+    {
+        size_t rowStride = transA == GEMM_TRANS ? 1 : lda;
+        size_t colStride = transA == GEMM_TRANS ? lda : 1;
+        gemmPackA(mc, kc, &a->elements[ic * rowStride + pc * colStride], rowStride, colStride, packedA);
+        return;
+    }
+
+    if (transA == GEMM_TRANS)
+    {
+        for (size_t p = 0; p < kc; ++p)
+        {
+            halfToFloats(a->format, &a->halfElements[(pc + p) * lda + ic], &convertedA[p * mc], mc);
+        }
+        gemmPackA(mc, kc, convertedA, 1, mc, packedA);
+    }
+    else
+    {
+        for (size_t i = 0; i < mc; ++i)
+        {
+            halfToFloats(a->format, &a->halfElements[(ic + i) * lda + pc], &convertedA[i * kc], kc);
+        }
+        gemmPackA(mc, kc, convertedA, kc, 1, packedA);
+    }
+}
+
+/**
+ * @brief Gets the cache blocks every product uses unless it is tuned.
+ *
+ * @param blocking Set to the default blocks.
+ */
+void gemmDefaultBlocking(GemmBlocking *blocking)
+{
+    blocking->mc = GEMM_MC;
+    blocking->kc = GEMM_KC;
+    blocking->nc = GEMM_NC;
+}
+
+/**
+ * @brief Checks whether cache blocks fit the packing buffers. The packed 
+ *        panels are padded to whole register blocks, so the rows of A are 
+ *        rounded up to GEMM_MR and the columns of B to GEMM_NR.
+ *
+ * @param blocking The blocks.
+ * @return Nonzero if the blocks fit, or zero if they do not.
+ */
+int gemmBlockingFits(const GemmBlocking *blocking)
+{
+    if (blocking->mc == 0 || blocking->kc == 0 || blocking->nc == 0)
+    {
+        return 0;
+    }
+
+    size_t mcPanels = blocking->mc / GEMM_MR + (blocking->mc % GEMM_MR != 0);
+    size_t ncPanels = blocking->nc / GEMM_NR + (blocking->nc % GEMM_NR != 0);
+    size_t packedASize, packedBSize;
+    if (__builtin_mul_overflow(mcPanels, GEMM_MR, &packedASize) ||
+        __builtin_mul_overflow(packedASize, blocking->kc, &packedASize) ||
+        __builtin_mul_overflow(ncPanels, GEMM_NR, &packedBSize) ||
+        __builtin_mul_overflow(packedBSize, blocking->kc, &packedBSize))
+    {
+        return 0;
+    }
+
+    return packedASize <= GEMM_MC * GEMM_KC && packedBSize <= GEMM_KC * GEMM_NC;
+}
+
+/**
+ * @brief Sets the cache blocks of one product shape, replacing any earlier 
+ *        blocks of the shape. Every later product of exactly this shape uses 
+ *        them, on any thread.
+ *
+ * @param transA Whether A is transposed.
+ * @param transB Whether B is transposed.
+ * @param m The number of rows of op(A) and C.
+ * @param n The number of columns of op(B) and C.
+ * @param k The number of columns of op(A) and rows of op(B).
+ * @param blocking The blocks, which must fit the packing buffers.
+ * @return Zero on success, or nonzero if the blocks do not fit or the table 
+ *         has no room for a new shape.
+ */
+int gemmSetBlocking(GemmTranspose transA,
+                    GemmTranspose transB,
+                    size_t m,
+                    size_t n,
+                    size_t k,
+                    const GemmBlocking *blocking)
+{
+    if (!gemmBlockingFits(blocking))
+    {
+        fprintf(stderr,
+                "Error: Cache blocks (%lu, %lu, %lu) do not fit the packing buffers\n",
+                blocking->mc, blocking->kc, blocking->nc);
+
+        return -1;
+    }
+    uint64_t packed = (uint64_t)blocking->mc |
+                      (uint64_t)blocking->kc << GEMM_BLOCK_BITS |
+                      (uint64_t)blocking->nc << 2 * GEMM_BLOCK_BITS;
+
+    pthread_mutex_lock(&gemmTuningMutex);
+    size_t count = atomic_load_explicit(&gemmTuningCount, memory_order_relaxed);
+    for (size_t i = 0; i < count; ++i)
+    {
+        GemmTuning *tuning = &gemmTunings[i];
+        if (tuning->m == m && tuning->n == n && tuning->k == k &&
+            tuning->transA == transA && tuning->transB == transB)
+        {
+            atomic_store_explicit(&tuning->blocking, packed, memory_order_relaxed);
+            pthread_mutex_unlock(&gemmTuningMutex);
+
+            return 0;
+        }
+    }
+    if (count == GEMM_TUNINGS)
+    {
+        pthread_mutex_unlock(&gemmTuningMutex);
+        fprintf(stderr, "Error: Cannot tune more than %d product shapes\n", GEMM_TUNINGS);
+
+        return -1;
+    }
+    GemmTuning *tuning = &gemmTunings[count];
+    tuning->transA = transA;
+    tuning->transB = transB;
+    tuning->m = m;
+    tuning->n = n;
+    tuning->k = k;
+    atomic_store_explicit(&tuning->blocking, packed, memory_order_relaxed);
+    atomic_store_explicit(&gemmTuningCount, count + 1, memory_order_release);
+    pthread_mutex_unlock(&gemmTuningMutex);
+
+    return 0;
+}
+
+/**
+ * @brief Gets the cache blocks a product shape uses: its tuned blocks, or the 
+ *        defaults.
+ *
+ * @param transA Whether A is transposed.
+ * @param transB Whether B is transposed.
+ * @param m The number of rows of op(A) and C.
+ * @param n The number of columns of op(B) and C.
+ * @param k The number of columns of op(A) and rows of op(B).
+ * @param blocking Set to the blocks.
+ */
+void gemmGetBlocking(GemmTranspose transA,
+                     GemmTranspose transB,
+                     size_t m,
+                     size_t n,
+                     size_t k,
+                     GemmBlocking *blocking)
+{
+    size_t count = atomic_load_explicit(&gemmTuningCount, memory_order_acquire);
+    for (size_t i = 0; i < count; ++i)
+    {
+        GemmTuning *tuning = &gemmTunings[i];
+        if (tuning->m == m && tuning->n == n && tuning->k == k &&
+            tuning->transA == transA && tuning->transB == transB)
+        {
+            uint64_t packed = atomic_load_explicit(&tuning->blocking, memory_order_relaxed);
+            blocking->mc = packed & GEMM_BLOCK_MASK;
+            blocking->kc = packed >> GEMM_BLOCK_BITS & GEMM_BLOCK_MASK;
+            blocking->nc = packed >> 2 * GEMM_BLOCK_BITS & GEMM_BLOCK_MASK;
+            return;
+        }
+    }
+
+    gemmDefaultBlocking(blocking);
+}
+
+/**
+ * @brief Forgets every tuned shape, so all products use the default blocks 
+ *        again. No other thread may be multiplying at the same time.
+ */
+void gemmClearBlockings(void)
+{
+    pthread_mutex_lock(&gemmTuningMutex);
+    atomic_store_explicit(&gemmTuningCount, 0, memory_order_release);
+    pthread_mutex_unlock(&gemmTuningMutex);
+}
+
+/**
+ * @brief Runs the blocked product for an A operand in either storage.
+ *
+ * @param blocking The cache blocks, which must fit, or NULL for the blocks
+ *        set for the shape.
+ */
+static void gemmDriver(const GemmBlocking *blocking,
+                       GemmTranspose transA,
+                       GemmTranspose transB,
+                       size_t m,
+                       size_t n,
+                       size_t k,
+                       float alpha,
+                       const GemmOperand *a,
+                       size_t lda,
+                       const float *b,
+                       size_t ldb,
+                       float beta,
+                       float *c,
+                       size_t ldc)
+{
+    if (m == 0 || n == 0)
+    {
+        return;
+    }
+
+    // An empty product only scales C.
+    if (k == 0 || alpha == 0.0f)
+    {
+        for (size_t i = 0; i < m; ++i)
+        {
+            for (size_t j = 0; j < n; ++j)
+            {
+                c[i * ldc + j] = beta == 0.0f ? 0.0f : beta * c[i * ldc + j];
+            }
+        }
+        return;
+    }
+
+    // The distances between consecutive rows and columns of op(B).
+    size_t bRowStride = transB == GEMM_TRANS ? 1 : ldb;
+    size_t bColStride = transB == GEMM_TRANS ? ldb : 1;
+
+    if (n == 1 && transA == GEMM_NO_TRANS && k <= GEMM_KC * GEMM_NC)
+    {
+        gemv(m, k, alpha, a, lda, b, bRowStride, beta, c, ldc);
+        return;
+    }
+    if (n == 1 && transA == GEMM_TRANS && m <= GEMM_MC * GEMM_KC)
+    {
+        gemvTrans(m, k, alpha, a, lda, b, bRowStride, beta, c, ldc);
+        return;
+    }
+
+    GemmKernelFunc kernel = gemmKernels[cpuIsa()];
+    GemmBlocking shapeBlocking;
+    if (blocking == NULL)
+    {
+        gemmGetBlocking(transA, transB, m, n, k, &shapeBlocking);
+        blocking = &shapeBlocking;
+    }
+    for (size_t jc = 0; jc < n; jc += blocking->nc)
+    {
+        size_t nc = n - jc < blocking->nc ? n - jc : blocking->nc;
+        for (size_t pc = 0; pc < k; pc += blocking->kc)
+        {
+            size_t kc = k - pc < blocking->kc ? k - pc : blocking->kc;
+            gemmPackB(kc,
+                      nc,
+                      &b[pc * bRowStride + jc * bColStride],
+                      bRowStride,
+                      bColStride,
+                      packedB);
+
+            // Later slices of the shared dimension accumulate into C.
+            float blockBeta = pc == 0 ? beta : 1.0f;
+            for (size_t ic = 0; ic < m; ic += blocking->mc)
+            {
+                size_t mc = m - ic < blocking->mc ? m - ic : blocking->mc;
+                gemmPackOperandA(a, transA, lda, ic, pc, mc, kc);
+
+                for (size_t jr = 0; jr < nc; jr += GEMM_NR)
+                {
+                    size_t nr = nc - jr < GEMM_NR ? nc - jr : GEMM_NR;
+                    for (size_t ir = 0; ir < mc; ir += GEMM_MR)
+                    {
+                        size_t mr = mc - ir < GEMM_MR ? mc - ir : GEMM_MR;
+                        gemmKernelEdge(kernel,
+                                       mr,
+                                       nr,
+                                       kc,
+                                       alpha,
+                                       &packedA[ir * kc],
+                                       &packedB[jr * kc],
+                                       blockBeta,
+                                       &c[(ic + ir) * ldc + jc + jr],
+                                       ldc);
+                    }
+                }
+            }
+        }
+    }
+}
+
+/**
+ * @brief Computes C = alpha * op(A) * op(B) + beta * C for row-major 
+ *        matrices, where op optionally transposes its operand. Transposed 
+ *        operands are read in their stored layout, so they never need to be 
+ *        materialized. When beta is zero, C is only written, so it may be 
+ *        uninitialized.
+ *
+ * @param transA Whether to transpose A.
+ * @param transB Whether to transpose B.
+ * @param m The number of rows of op(A) and C.
+ * @param n The number of columns of op(B) and C.
+ * @param k The number of columns of op(A) and rows of op(B).
+ * @param alpha A scalar for the product.
+ * @param a The elements of A.
+ * @param lda The distance between rows of A as stored.
+ * @param b The elements of B.
+ * @param ldb The distance between rows of B as stored.
+ * @param beta A scalar for the existing values of C.
+ * @param c The elements of C.
+ * @param ldc The distance between rows of C.
+ */
+void gemm(GemmTranspose transA,
+          GemmTranspose transB,
+          size_t m,
+          size_t n,
+          size_t k,
+          float alpha,
+          const float *a,
+          size_t lda,
+          const float *b,
+          size_t ldb,
+          float beta,
+          float *c,
+          size_t ldc)
+{
+    GemmOperand operand = {a, NULL, HALF_FLOAT16};
+    gemmDriver(NULL, transA, transB, m, n, k, alpha, &operand, lda, b, ldb, beta, c, ldc);
+}
+
+/**
+ * @brief Computes C = alpha * op(A) * op(B) + beta * C like gemm, with the 
+ *        given cache blocks instead of those set for the shape. This lets a 
+ *        tuner measure candidate blocks without registering them.
+ *
+ * @param blocking The cache blocks.
+ * @param transA Whether to transpose A.
+ * @param transB Whether to transpose B.
+ * @param m The number of rows of op(A) and C.
+ * @param n The number of columns of op(B) and C.
+ * @param k The number of columns of op(A) and rows of op(B).
+ * @param alpha A scalar for the product.
+ * @param a The elements of A.
+ * @param lda The distance between rows of A as stored.
+ * @param b The elements of B.
+ * @param ldb The distance between rows of B as stored.
+ * @param beta A scalar for the existing values of C.
+ * @param c The elements of C.
+ * @param ldc The distance between rows of C.
+ * @return Zero on success, or -1 if the blocks do not fit the packing 
+ *         buffers, in which case C is left alone.
+ */
+int gemmWithBlocking(const GemmBlocking *blocking,
+                     GemmTranspose transA,
+                     GemmTranspose transB,
+                     size_t m,
+                     size_t n,
+                     size_t k,
+                     float alpha,
+                     const float *a,
+                     size_t lda,
+                     const float *b,
+                     size_t ldb,
+                     float beta,
+                     float *c,
+                     size_t ldc)
+{
+    if (!gemmBlockingFits(blocking))
+    {
+        return -1;
+    }
+
+    GemmOperand operand = {a, NULL, HALF_FLOAT16};
+    gemmDriver(blocking, transA, transB, m, n, k, alpha, &operand, lda, b, ldb, beta, c, ldc);
+
+    return 0;
+}
+
+/**
+ * @brief Computes C = alpha * op(A) * op(B) + beta * C like gemm, with A
+ *        stored in half precision. A is widened to floats a cache block at a
+ *        time as it is packed, so it is read from memory at half the width
+ *        and the arithmetic stays in single precision.
+ *
+ * @param format The storage format of A.
+ * @param transA Whether to transpose A.
+ * @param transB Whether to transpose B.
+ * @param m The number of rows of op(A) and C.
+ * @param n The number of columns of op(B) and C.
+ * @param k The number of columns of op(A) and rows of op(B).
+ * @param alpha A scalar for the product.
+ * @param a The half precision elements of A.
+ * @param lda The distance between rows of A as stored.
+ * @param b The elements of B.
+ * @param ldb The distance between rows of B as stored.
+ * @param beta A scalar for the existing values of C.
+ * @param c The elements of C.
+ * @param ldc The distance between rows of C.
+ */
+void gemmHalfA(HalfFormat format,
+               GemmTranspose transA,
+               GemmTranspose transB,
+               size_t m,
+               size_t n,
+               size_t k,
+               float alpha,
+               const uint16_t *a,
+               size_t lda,
+               const float *b,
+               size_t ldb,
+               float beta,
+               float *c,
+               size_t ldc)
+{
+    GemmOperand operand = {NULL, a, format};
+    gemmDriver(NULL, transA, transB, m, n, k, alpha, &operand, lda, b, ldb, beta, c, ldc);
+}
@@ -0,0 +1,96 @@
+#ifndef GEMM_H
+#define GEMM_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "half.h"
+
+// Register block of the micro-kernel (rows of A by columns of B).
+#define GEMM_MR 6
+#define GEMM_NR 16
+
+// Default cache blocks: an MC x KC panel of A stays in L2 and a KC x NR
+// sliver of B stays in L1 while the micro-kernel streams over it. Tuned
+// blocks may have other shapes, but never more than MC x KC elements of A or
+// KC x NC elements of B, which size the packing buffers. Panels are padded
+// to whole register blocks, so the rows of A count in multiples of MR and the
+// columns of B in multiples of NR.
+#define GEMM_MC 96
+#define GEMM_KC 256
+#define GEMM_NC 1024
+
+// The number of product shapes that can have their own blocks.
+#define GEMM_TUNINGS 64
+
+typedef enum
+{
+    GEMM_NO_TRANS,
+    GEMM_TRANS
+}
+GemmTranspose;
+
+typedef struct
+{
+    size_t mc, kc, nc;
+}
+GemmBlocking;
+
+void gemmDefaultBlocking(GemmBlocking *blocking);
+int gemmBlockingFits(const GemmBlocking *blocking);
+int gemmSetBlocking(GemmTranspose transA,
+                    GemmTranspose transB,
+                    size_t m,
+                    size_t n,
+                    size_t k,
+                    const GemmBlocking *blocking);
+void gemmGetBlocking(GemmTranspose transA,
+                     GemmTranspose transB,
+                     size_t m,
+                     size_t n,
+                     size_t k,
+                     GemmBlocking *blocking);
+void gemmClearBlockings(void);
+
+void gemm(GemmTranspose transA,
+          GemmTranspose transB,
+          size_t m,
+          size_t n,
+          size_t k,
+          float alpha,
+          const float *a,
+          size_t lda,
+          const float *b,
+          size_t ldb,
+          float beta,
+          float *c,
+          size_t ldc);
+int gemmWithBlocking(const GemmBlocking *blocking,
+                     GemmTranspose transA,
+                     GemmTranspose transB,
+                     size_t m,
+                     size_t n,
+                     size_t k,
+                     float alpha,
+                     const float *a,
+                     size_t lda,
+                     const float *b,
+                     size_t ldb,
+                     float beta,
+                     float *c,
+                     size_t ldc);
+void gemmHalfA(HalfFormat format,
+               GemmTranspose transA,
+               GemmTranspose transB,
+               size_t m,
+               size_t n,
+               size_t k,
+               float alpha,
+               const uint16_t *a,
+               size_t lda,
+               const float *b,
+               size_t ldb,
+               float beta,
+               float *c,
+               size_t ldc);
+
+#endif
@@ -0,0 +1,329 @@
+#include "half.h"
+#include "cpu.h"
+#include "profile.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef CPU_X86
+#include <immintrin.h>
+#endif
+
+/**
+ * @brief Converts a float to IEEE half precision, rounding to nearest even.
+ *        Values too large for half precision become infinity.
+ *
+ * @param value A float.
+ * @return The half precision bits.
+ */
+static uint16_t halfFromFloat16(float value)
+{
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    uint32_t sign = (bits >> 16) & 0x8000;
+    uint32_t magnitude = bits & 0x7fffffff;
+
+    // Infinity stays infinity and NaN stays a quiet NaN.
+    if (magnitude >= 0x7f800000)
+    {
+        return sign | 0x7c00 | (magnitude > 0x7f800000 ? 0x200 : 0);
+    }
+
+    // 65520 and above round to infinity.
+    if (magnitude >= 0x477ff000)
+    {
+        return sign | 0x7c00;
+    }
+
+    // Below the smallest normal half, adding 0.5 lines the half precision
+    // subnormal up with the bottom of the float mantissa, and the float
+    // addition does the rounding.
+    if (magnitude < 0x38800000)
+    {
+        float scaled;
+        memcpy(&scaled, &magnitude, sizeof(scaled));
+        scaled += 0.5f;
+        memcpy(&magnitude, &scaled, sizeof(magnitude));
+
+        return sign | (uint16_t)(magnitude - 0x3f000000);
+    }
+
+    // Rebias the exponent from 127 to 15 and round the dropped 13 bits to
+    // nearest even.
+    uint32_t odd = (magnitude >> 13) & 1;
+    magnitude += 0xc8000fff + odd;
+
+    return sign | (uint16_t)(magnitude >> 13);
+}
+
+/**
+ * @brief Converts IEEE half precision to a float. Every half is exact.
+ *
+ * @param value The half precision bits.
+ * @return A float.
+ */
+static float halfToFloat16(uint16_t value)
+{
+    uint32_t sign = (uint32_t)(value & 0x8000) << 16;
+    uint32_t exponent = (value >> 10) & 0x1f;
+    uint32_t mantissa = value & 0x3ff;
+    uint32_t bits;
+    if (exponent == 0)
+    {
+        // Zero or subnormal: the mantissa counts units of 2^-24.
+        float magnitude = (float)mantissa * 5.9604644775390625e-8f;
+        memcpy(&bits, &magnitude, sizeof(bits));
+        bits |= sign;
+    }
+    else if (exponent == 0x1f)
+    {
+        bits = sign | 0x7f800000 | (mantissa << 13);
+    }
+    else
+    {
+        bits = sign | ((exponent + 112) << 23) | (mantissa << 13);
+    }
+
+    float result;
+    memcpy(&result, &bits, sizeof(result));
+
+    return result;
+}
+
+/**
+ * @brief Converts a float to bfloat16, rounding to nearest even.
+ *
+ * @param value A float.
+ * @return The bfloat16 bits.
+ */
+static uint16_t halfFromBfloat16(float value)
+{
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    if ((bits & 0x7fffffff) > 0x7f800000)
+    {
+        return (uint16_t)((bits >> 16) | 0x40);
+    }
+    bits += 0x7fff + ((bits >> 16) & 1);
+
+    return (uint16_t)(bits >> 16);
+}
+
+/**
+ * @brief Converts a float to half precision storage.
+ *
+ * @param format The storage format.
+ * @param value A float.
+ * @return The stored bits.
+ */
+uint16_t halfFromFloat(HalfFormat format, float value)
+{
+    return format == HALF_FLOAT16 ? halfFromFloat16(value) : halfFromBfloat16(value);
+}
+
+/**
+ * @brief Converts half precision storage to a float.
+ *
+ * @param format The storage format.
+ * @param value The stored bits.
+ * @return A float.
+ */
+float halfToFloat(HalfFormat format, uint16_t value)
+{
+    if (format == HALF_FLOAT16)
+    {
+        return halfToFloat16(value);
+    }
+
+    // A bfloat16 is the top half of a float.
+    uint32_t bits = (uint32_t)value << 16;
+    float result;
+    memcpy(&result, &bits, sizeof(result));
+
+    return result;
+}
+
+#ifdef CPU_X86
+/**
+ * @brief Converts whole groups of eight floats to float16 with F16C.
+ *
+ * @return The number of values converted.
+ */
+static CPU_TARGET_F16C size_t halfFromFloats16F16c(const float *values, uint16_t *result, size_t count)
+{
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8)
+    {
+        __m128i half = _mm256_cvtps_ph(_mm256_loadu_ps(&values[i]), _MM_FROUND_TO_NEAREST_INT);
+        _mm_storeu_si128((__m128i *)&result[i], half);
+    }
+
+    return i;
+}
+
+/**
+ * @brief Converts whole groups of eight floats to bfloat16 with AVX-512 BF16.
+ *        The instruction flushes subnormal floats to zero, so groups holding 
+ *        any are converted one at a time to keep the rounding of 
+ *        halfFromBfloat16.
+ *
+ * @return The number of values converted.
+ */
+static CPU_TARGET_AVX512BF16 size_t halfFromFloatsBf16Avx512(const float *values,
+                                                             uint16_t *result,
+                                                             size_t count)
+{
+    __m256i magnitudeMask = _mm256_set1_epi32(0x7fffffff);
+    __m256i smallestNormal = _mm256_set1_epi32(0x00800000);
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8)
+    {
+        __m256 x = _mm256_loadu_ps(&values[i]);
+        __m256i magnitude = _mm256_and_si256(_mm256_castps_si256(x), magnitudeMask);
+        __m256i subnormal = _mm256_and_si256(_mm256_cmpgt_epi32(smallestNormal, magnitude),
+                                             _mm256_cmpgt_epi32(magnitude, _mm256_setzero_si256()));
+        if (!_mm256_testz_si256(subnormal, subnormal))
+        {
+            for (size_t j = i; j < i + 8; ++j)
+            {
+                result[j] = halfFromBfloat16(values[j]);
+            }
+            continue;
+        }
+        __m128bh half = _mm256_cvtneps_pbh(x);
+        _mm_storeu_si128((__m128i *)&result[i], (__m128i)half);
+    }
+
+    return i;
+}
+
+/**
+ * @brief Converts whole groups of eight float16 values to floats with F16C.
+ *
+ * @return The number of values converted.
+ */
+static CPU_TARGET_F16C size_t halfToFloats16F16c(const uint16_t *values, float *result, size_t count)
+{
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8)
+    {
+        __m128i half = _mm_loadu_si128((const __m128i *)&values[i]);
+        _mm256_storeu_ps(&result[i], _mm256_cvtph_ps(half));
+    }
+
+    return i;
+}
+
+/**
+ * @brief Converts whole groups of eight bfloat16 values to floats with SSE.
+ *        Interleaving zeros below each bfloat16 widens it to a float.
+ *
+ * @return The number of values converted.
+ */
+static CPU_TARGET_SSE42 size_t halfToFloatsBf16Sse(const uint16_t *values, float *result, size_t count)
+{
+    size_t i = 0;
+    __m128i zero = _mm_setzero_si128();
+    for (; i + 8 <= count; i += 8)
+    {
+        __m128i half = _mm_loadu_si128((const __m128i *)&values[i]);
+        _mm_storeu_si128((__m128i *)&result[i], _mm_unpacklo_epi16(zero, half));
+        _mm_storeu_si128((__m128i *)&result[i + 4], _mm_unpackhi_epi16(zero, half));
+    }
+
+    return i;
+}
+#endif
+
+/**
+ * @brief Converts an array of floats to half precision storage. Uses F16C for
+ *        float16 and AVX-512 BF16 for bfloat16 when cpuHasFeature allows 
+ *        them. The AVX-512 BF16 conversion flushes subnormal inputs to zero.
+ *
+ * @param format The storage format.
+ * @param values The floats.
+ * @param result The stored bits.
+ * @param count The number of values.
+ */
+void halfFromFloats(HalfFormat format, const float *values, uint16_t *result, size_t count)
+{
+    size_t i = 0;
+#ifdef CPU_X86
+    if (format == HALF_FLOAT16 && cpuHasFeature(CPU_F16C))
+    {
+        i = halfFromFloats16F16c(values, result, count);
+    }
+    else if (format == HALF_BFLOAT16 && cpuHasFeature(CPU_AVX512BF16))
+    {
+        i = halfFromFloatsBf16Avx512(values, result, count);
+    }
+#endif
+    for (; i < count; ++i)
+    {
+        result[i] = halfFromFloat(format, values[i]);
+    }
+}
+
+/**
+ * @brief Converts an array of half precision storage to floats. Uses F16C for
+ *        float16 when cpuHasFeature allows it, and SSE for bfloat16 from the
+ *        SSE4.2 tier up.
+ *
+ * @param format The storage format.
+ * @param values The stored bits.
+ * @param result The floats.
+ * @param count The number of values.
+ */
+void halfToFloats(HalfFormat format, const uint16_t *values, float *result, size_t count)
+{
+    size_t i = 0;
+#ifdef CPU_X86
+    if (format == HALF_FLOAT16 && cpuHasFeature(CPU_F16C))
+    {
+        i = halfToFloats16F16c(values, result, count);
+    }
+    else if (format == HALF_BFLOAT16 && cpuIsa() >= CPU_SSE42)
+    {
+        i = halfToFloatsBf16Sse(values, result, count);
+    }
+#endif
+    for (; i < count; ++i)
+    {
+        result[i] = halfToFloat(format, values[i]);
+    }
+}
+
+/**
+ * @brief Creates a zero matrix in half precision storage.
+ *
+ * @param mat An uninitialized matrix.
+ * @param format The storage format.
+ * @param rows A number of rows.
+ * @param columns A number of columns.
+ */
+void halfMatInit(HalfMatrix *mat, HalfFormat format, size_t rows, size_t columns)
+{
+    mat->rows = rows;
+    mat->columns = columns;
+    mat->format = format;
+    mat->elements = (uint16_t *)calloc(rows * columns, sizeof(uint16_t));
+    profileAlloc(rows * columns * sizeof(uint16_t));
+}
+
+/**
+ * @brief Frees the memory of a half precision matrix.
+ *
+ * @param mat An initialized matrix.
+ */
+void halfMatFree(HalfMatrix *mat)
+{
+    if (mat->elements != NULL)
+    {
+        profileFree(mat->rows * mat->columns * sizeof(uint16_t));
+        free(mat->elements);
+    }
+
+    mat->rows = 0;
+    mat->columns = 0;
+    mat->elements = NULL;
+}
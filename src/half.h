@@ -0,0 +1,30 @@
+#ifndef HALF_H
+#define HALF_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef enum
+{
+    HALF_FLOAT16,
+    HALF_BFLOAT16
+}
+HalfFormat;
+
+typedef struct
+{
+    size_t rows, columns;
+    HalfFormat format;
+    uint16_t *elements;
+}
+HalfMatrix;
+
+uint16_t halfFromFloat(HalfFormat format, float value);
+float halfToFloat(HalfFormat format, uint16_t value);
+void halfFromFloats(HalfFormat format, const float *values, uint16_t *result, size_t count);
+void halfToFloats(HalfFormat format, const uint16_t *values, float *result, size_t count);
+
+void halfMatInit(HalfMatrix *mat, HalfFormat format, size_t rows, size_t columns);
+void halfMatFree(HalfMatrix *mat);
+
+#endif
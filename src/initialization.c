@@ -1,23 +1,369 @@
+#include "initialization.h"
 #include "matrix.h"
-#include <stdlib.h>
-#include <time.h>
+#include "random.h"
+#include "thread_pool.h"
 #include <math.h>
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define INIT_SSE2 1
+#endif
+
+// Constants for the logarithm and the sine and cosine polynomials, from the
+// Cephes single precision library. The polynomials are accurate on
+// [-pi/4, pi/4].
+#define INIT_SQRT_HALF 0.707106781186547524f
+#define INIT_LN2_HI 0.693359375f
+#define INIT_LN2_LO -2.12194440e-4f
+#define INIT_LOG_P0 7.0376836292e-2f
+#define INIT_LOG_P1 -1.1514610310e-1f
+#define INIT_LOG_P2 1.1676998740e-1f
+#define INIT_LOG_P3 -1.2420140846e-1f
+#define INIT_LOG_P4 1.4249322787e-1f
+#define INIT_LOG_P5 -1.6668057665e-1f
+#define INIT_LOG_P6 2.0000714765e-1f
+#define INIT_LOG_P7 -2.4999993993e-1f
+#define INIT_LOG_P8 3.3333331174e-1f
+#define INIT_SIN_P0 -1.9515295891e-4f
+#define INIT_SIN_P1 8.3321608736e-3f
+#define INIT_SIN_P2 -1.6666654611e-1f
+#define INIT_COS_P0 2.443315711809948e-5f
+#define INIT_COS_P1 -1.388731625493765e-3f
+#define INIT_COS_P2 4.166664568298827e-2f
+#define INIT_TWO_PI 6.28318530717958648f
+
+/**
+ * @brief The state shared by the threads filling one matrix.
+ */
+typedef struct
+{
+    Matrix *mat;
+    const InitParams *params;
+    float mean, stddev;
+    size_t chunks;
+}
+InitFill;
 
 /**
- * @brief Fill a matrix by sampling from a normal distribution.
+ * @brief Sets the default initialization options: seed zero on one thread.
  *
- * @param mat An initialized matrix.
+ * @param options Uninitialized options.
+ */
+void initOptionsInit(InitOptions *options)
+{
+    options->seed = 0;
+    options->threads = 1;
+}
+
+/**
+ * @brief Computes a natural logarithm of a positive normal float.
+ */
+static inline float initLog(float x)
+{
+    uint32_t bits;
+    memcpy(&bits, &x, sizeof(bits));
+    float exponent = (float)((int32_t)(bits >> 23) - 126);
+    bits = (bits & 0x007fffff) | 0x3f000000;
+    memcpy(&x, &bits, sizeof(x));
+
+    // Keep the mantissa in [sqrt(1/2), sqrt(2)) so the polynomial converges.
+    if (x < INIT_SQRT_HALF)
+    {
+        exponent = exponent - 1.0f;
+        x = (x + x) - 1.0f;
+    }
+    else
+    {
+        x = (x + 0.0f) - 1.0f;
+    }
+
+    float z = x * x;
+    float y = INIT_LOG_P0;
+    y = y * x + INIT_LOG_P1;
+    y = y * x + INIT_LOG_P2;
+    y = y * x + INIT_LOG_P3;
+    y = y * x + INIT_LOG_P4;
+    y = y * x + INIT_LOG_P5;
+    y = y * x + INIT_LOG_P6;
+    y = y * x + INIT_LOG_P7;
+    y = y * x + INIT_LOG_P8;
+    y = y * x * z;
+    y = y + exponent * INIT_LN2_LO;
+    y = y - 0.5f * z;
+    x = x + y;
+
+    return x + exponent * INIT_LN2_HI;
+}
+
+/**
+ * @brief Computes the sine and cosine of 2 pi u for u in [0, 1). The angle is
+ *        reduced exactly to an eighth of a turn around a quadrant boundary.
+ */
+static inline void initSinCos(float u, float *sine, float *cosine)
+{
+    // 2 pi u is 2 pi t plus half a turn, which flips both signs.
+    float t = u - 0.5f;
+    int32_t quadrant = (int32_t)(4.0f * t + 2.5f) - 2;
+    float x = (t - (float)quadrant * 0.25f) * INIT_TWO_PI;
+    float z = x * x;
+
+    float s = INIT_SIN_P0;
+    s = s * z + INIT_SIN_P1;
+    s = s * z + INIT_SIN_P2;
+    s = s * z * x + x;
+
+    float c = INIT_COS_P0;
+    c = c * z + INIT_COS_P1;
+    c = c * z + INIT_COS_P2;
+    c = c * z * z;
+    c = c - 0.5f * z;
+    c = c + 1.0f;
+
+    int32_t turn = quadrant & 3;
+    float sinT = (turn & 1) ? c : s;
+    float cosT = (turn & 1) ? s : c;
+    *sine = (turn & 2) ? sinT : -sinT;
+    *cosine = ((turn + 1) & 2) ? cosT : -cosT;
+}
+
+#ifdef INIT_SSE2
+/**
+ * @brief Computes four logarithms with the same operations as initLog.
+ */
+static inline __m128 initLog4(__m128 x)
+{
+    __m128 ones = _mm_set1_ps(1.0f);
+    __m128i bits = _mm_castps_si128(x);
+    __m128i exponent = _mm_sub_epi32(_mm_srli_epi32(bits, 23), _mm_set1_epi32(126));
+    bits = _mm_or_si128(_mm_and_si128(bits, _mm_set1_epi32(0x007fffff)), _mm_set1_epi32(0x3f000000));
+    x = _mm_castsi128_ps(bits);
+
+    // The comparison mask is -1 in each lane below sqrt(1/2).
+    __m128 below = _mm_cmplt_ps(x, _mm_set1_ps(INIT_SQRT_HALF));
+    __m128 e = _mm_cvtepi32_ps(exponent);
+    e = _mm_sub_ps(e, _mm_and_ps(below, ones));
+    x = _mm_sub_ps(_mm_add_ps(x, _mm_and_ps(below, x)), ones);
+
+    __m128 z = _mm_mul_ps(x, x);
+    __m128 y = _mm_set1_ps(INIT_LOG_P0);
+    y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(INIT_LOG_P1));
+    y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(INIT_LOG_P2));
+    y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(INIT_LOG_P3));
+    y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(INIT_LOG_P4));
+    y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(INIT_LOG_P5));
+    y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(INIT_LOG_P6));
+    y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(INIT_LOG_P7));
+    y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(INIT_LOG_P8));
+    y = _mm_mul_ps(_mm_mul_ps(y, x), z);
+    y = _mm_add_ps(y, _mm_mul_ps(e, _mm_set1_ps(INIT_LN2_LO)));
+    y = _mm_sub_ps(y, _mm_mul_ps(_mm_set1_ps(0.5f), z));
+    x = _mm_add_ps(x, y);
+
+    return _mm_add_ps(x, _mm_mul_ps(e, _mm_set1_ps(INIT_LN2_HI)));
+}
+
+/**
+ * @brief Computes four sines and cosines with the same operations as
+ *        initSinCos.
+ */
+static inline void initSinCos4(__m128 u, __m128 *sine, __m128 *cosine)
+{
+    __m128 t = _mm_sub_ps(u, _mm_set1_ps(0.5f));
+    __m128i quadrant = _mm_sub_epi32(_mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(4.0f), t),
+                                                                 _mm_set1_ps(2.5f))),
+                                     _mm_set1_epi32(2));
+    __m128 offset = _mm_mul_ps(_mm_cvtepi32_ps(quadrant), _mm_set1_ps(0.25f));
+    __m128 x = _mm_mul_ps(_mm_sub_ps(t, offset), _mm_set1_ps(INIT_TWO_PI));
+    __m128 z = _mm_mul_ps(x, x);
+
+    __m128 s = _mm_set1_ps(INIT_SIN_P0);
+    s = _mm_add_ps(_mm_mul_ps(s, z), _mm_set1_ps(INIT_SIN_P1));
+    s = _mm_add_ps(_mm_mul_ps(s, z), _mm_set1_ps(INIT_SIN_P2));
+    s = _mm_add_ps(_mm_mul_ps(_mm_mul_ps(s, z), x), x);
+
+    __m128 c = _mm_set1_ps(INIT_COS_P0);
+    c = _mm_add_ps(_mm_mul_ps(c, z), _mm_set1_ps(INIT_COS_P1));
+    c = _mm_add_ps(_mm_mul_ps(c, z), _mm_set1_ps(INIT_COS_P2));
+    c = _mm_mul_ps(_mm_mul_ps(c, z), z);
+    c = _mm_sub_ps(c, _mm_mul_ps(_mm_set1_ps(0.5f), z));
+    c = _mm_add_ps(c, _mm_set1_ps(1.0f));
+
+    // Odd quadrants swap sine and cosine. The sign bits come from the second
+    // bit of the quadrant, flipped for the extra half turn.
+    __m128i turn = _mm_and_si128(quadrant, _mm_set1_epi32(3));
+    __m128 swap = _mm_castsi128_ps(_mm_cmpeq_epi32(_mm_and_si128(turn, _mm_set1_epi32(1)), _mm_set1_epi32(1)));
+    __m128i two = _mm_set1_epi32(2);
+    __m128i sinSign = _mm_slli_epi32(_mm_xor_si128(_mm_and_si128(turn, two), two), 30);
+    __m128i cosSign = _mm_slli_epi32(_mm_xor_si128(_mm_and_si128(_mm_add_epi32(turn, _mm_set1_epi32(1)), two), two), 30);
+    __m128 sinT = _mm_or_ps(_mm_and_ps(swap, c), _mm_andnot_ps(swap, s));
+    __m128 cosT = _mm_or_ps(_mm_and_ps(swap, s), _mm_andnot_ps(swap, c));
+    *sine = _mm_xor_ps(sinT, _mm_castsi128_ps(sinSign));
+    *cosine = _mm_xor_ps(cosT, _mm_castsi128_ps(cosSign));
+}
+#endif
+
+/**
+ * @brief Turns pairs of uniform values into pairs of standard normal values
+ *        with the Box-Muller transform, in place.
+ *
+ * @param first Uniform values in (0, 1]. Replaced by r cos(theta).
+ * @param second Uniform values in [0, 1). Replaced by r sin(theta).
+ * @param count The number of pairs.
+ */
+static void initBoxMuller(float *first, float *second, size_t count)
+{
+    size_t i = 0;
+#ifdef INIT_SSE2
+    for (; i + 4 <= count; i += 4)
+    {
+        __m128 radius = _mm_sqrt_ps(_mm_mul_ps(_mm_set1_ps(-2.0f), initLog4(_mm_loadu_ps(&first[i]))));
+        __m128 sine, cosine;
+        initSinCos4(_mm_loadu_ps(&second[i]), &sine, &cosine);
+        _mm_storeu_ps(&first[i], _mm_mul_ps(radius, cosine));
+        _mm_storeu_ps(&second[i], _mm_mul_ps(radius, sine));
+    }
+#endif
+    for (; i < count; ++i)
+    {
+        float radius = sqrtf(-2.0f * initLog(first[i]));
+        float sine, cosine;
+        initSinCos(second[i], &sine, &cosine);
+        first[i] = radius * cosine;
+        second[i] = radius * sine;
+    }
+}
+
+/**
+ * @brief Fills one chunk of a matrix from the chunk's own random stream.
+ *
+ * @param fill The matrix and distribution.
+ * @param chunk The index of the chunk.
  */
-void initNormalDist(Matrix *mat)
+static void initFillChunk(InitFill *fill, size_t chunk)
 {
-    srand(time(NULL));
-    for (size_t i = 0; i < mat->rows * mat->columns; ++i)
+    size_t size = fill->mat->rows * fill->mat->columns;
+    size_t start = chunk * INIT_CHUNK_SIZE;
+    size_t count = size - start < INIT_CHUNK_SIZE ? size - start : INIT_CHUNK_SIZE;
+    size_t pairs = (count + 1) / 2;
+
+    // Each 64 bit draw gives two 24 bit uniforms. The first is shifted up by
+    // one step so the logarithm never sees zero.
+    Rng rng;
+    rngSeedStream(&rng, fill->params->seed, (fill->params->stream << 32) | chunk);
+    float first[INIT_CHUNK_SIZE / 2], second[INIT_CHUNK_SIZE / 2];
+    for (size_t i = 0; i < pairs; ++i)
     {
-        // Use the Box-Muller transform to sample from a normal distribution.
-        float uniform1 = (float)rand() / RAND_MAX;
-        float uniform2 = (float)rand() / RAND_MAX;
-        float normal = sqrtf(-2.0f * logf(uniform1)) * cosf(2.0f * M_PI * uniform2);
+        uint64_t bits = rngNext(&rng);
+        first[i] = ((bits >> 40) + 1) * (1.0f / 16777216.0f);
+        second[i] = ((bits >> 16) & 0xffffff) * (1.0f / 16777216.0f);
+    }
+    initBoxMuller(first, second, pairs);
 
-        mat->elements[i] = normal;
+    Matrix *mat = fill->mat;
+    if (matIsContiguous(mat))
+    {
+        float *elements = &mat->elements[start];
+        for (size_t i = 0; i < pairs; ++i)
+        {
+            elements[i] = fill->mean + fill->stddev * first[i];
+        }
+        for (size_t i = 0; i < count - pairs; ++i)
+        {
+            elements[pairs + i] = fill->mean + fill->stddev * second[i];
+        }
+        return;
     }
+
+    // A view fills the same logical elements, skipping the padding of each row.
+    for (size_t i = 0; i < count; ++i)
+    {
+        size_t index = start + i;
+        float value = i < pairs ? first[i] : second[i - pairs];
+        mat->elements[(index / mat->columns) * mat->stride + index % mat->columns] =
+            fill->mean + fill->stddev * value;
+    }
+}
+
+/**
+ * @brief Fills every chunk assigned to one thread.
+ *
+ * @param arg The shared fill state.
+ * @param thread The index of the thread.
+ * @param threads The number of threads.
+ */
+static void initFillShard(void *arg, size_t thread, size_t threads)
+{
+    InitFill *fill = (InitFill *)arg;
+    for (size_t chunk = thread; chunk < fill->chunks; chunk += threads)
+    {
+        initFillChunk(fill, chunk);
+    }
+}
+
+/**
+ * @brief Fills a matrix by sampling from a normal distribution. The values
+ *        only depend on the seed and stream of the parameters, never on the
+ *        number of threads.
+ *
+ * @param mat An initialized matrix.
+ * @param params The random stream and the threads to fill with.
+ * @param mean The mean of the distribution.
+ * @param stddev The standard deviation of the distribution.
+ */
+void initNormal(Matrix *mat, const InitParams *params, float mean, float stddev)
+{
+    size_t size = mat->rows * mat->columns;
+    InitFill fill = {mat, params, mean, stddev, (size + INIT_CHUNK_SIZE - 1) / INIT_CHUNK_SIZE};
+
+    size_t threads = params->threads < fill.chunks ? params->threads : fill.chunks;
+    if (threads <= 1)
+    {
+        initFillShard(&fill, 0, 1);
+        return;
+    }
+
+    ThreadPool pool;
+    poolInit(&pool, threads);
+    poolRun(&pool, initFillShard, &fill);
+    poolFree(&pool);
+}
+
+/**
+ * @brief Fill a matrix by sampling from a standard normal distribution.
+ *
+ * @param mat An initialized matrix.
+ * @param params The random stream and the threads to fill with.
+ */
+void initNormalDist(Matrix *mat, const InitParams *params)
+{
+    initNormal(mat, params, 0.0f, 1.0f);
+}
+
+/**
+ * @brief Fills a matrix with Xavier (Glorot) normal initialization, which
+ *        keeps the variance of activations and gradients steady for sigmoid
+ *        and tanh layers.
+ *
+ * @param mat An initialized matrix.
+ * @param params The random stream, the fan in and fan out of the layer, and
+ *               the threads to fill with.
+ */
+void initXavier(Matrix *mat, const InitParams *params)
+{
+    initNormal(mat, params, 0.0f, sqrtf(2.0f / (params->fanIn + params->fanOut)));
+}
+
+/**
+ * @brief Fills a matrix with He normal initialization, which suits ReLU
+ *        layers.
+ *
+ * @param mat An initialized matrix.
+ * @param params The random stream, the fan in of the layer, and the threads
+ *               to fill with.
+ */
+void initHe(Matrix *mat, const InitParams *params)
+{
+    initNormal(mat, params, 0.0f, sqrtf(2.0f / params->fanIn));
 }
@@ -1,8 +1,34 @@
 #ifndef INITIALIZATION_H
 #define INITIALIZATION_H
 
+#include <stddef.h>
+#include <stdint.h>
 #include "matrix.h"
 
-void initNormalDist(Matrix *mat);
+// Matrices are filled in chunks of this many elements, each from its own
+// random stream, so the values never depend on the number of threads.
+#define INIT_CHUNK_SIZE 4096
+
+typedef struct
+{
+    uint64_t seed;
+    size_t threads;
+}
+InitOptions;
+
+typedef struct
+{
+    uint64_t seed, stream;
+    size_t fanIn, fanOut;
+    size_t threads;
+}
+InitParams;
+
+void initOptionsInit(InitOptions *options);
+
+void initNormal(Matrix *mat, const InitParams *params, float mean, float stddev);
+void initNormalDist(Matrix *mat, const InitParams *params);
+void initXavier(Matrix *mat, const InitParams *params);
+void initHe(Matrix *mat, const InitParams *params);
 
 #endif
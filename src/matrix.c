@@ -1,20 +1,340 @@
 #include "matrix.h"
+#include "cpu.h"
+#include "gemm.h"
+#include "profile.h"
 #include <stddef.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+
+// Sixteen floats, read and written unaligned. Each tier lowers it to its
+// widest registers: four SSE, two AVX2 or one AVX-512 register.
+typedef float MatVector __attribute__((vector_size(64), aligned(4), may_alias));
+#define MAT_LANES 16
+
+// The element-wise loops over one row. Each tier has its own table, and the
+// scalar one is the reference the others vectorize.
+typedef struct
+{
+    void (*add)(float *out, const float *x, const float *y, size_t count);
+    void (*sub)(float *out, const float *x, const float *y, size_t count);
+    void (*mul)(float *out, const float *x, const float *y, size_t count);
+    void (*addScaled)(float *out, const float *x, float scalar, size_t count);
+    void (*scale)(float *out, const float *x, float scalar, size_t count);
+    void (*addScalar)(float *out, const float *x, float scalar, size_t count);
+}
+MatRowKernels;
+
+// The loop bodies below are inlined into every tier and compiled for its
+// instruction set. The output may be one of the inputs, since each vector is
+// loaded before the same lanes are stored.
+#define MAT_INLINE static inline __attribute__((always_inline))
+
+MAT_INLINE void matAddRow(float *out, const float *x, const float *y, size_t count, int vector)
+{
+    size_t j = 0;
+    for (; vector && j + MAT_LANES <= count; j += MAT_LANES)
+    {
+        *(MatVector *)&out[j] = *(const MatVector *)&x[j] + *(const MatVector *)&y[j];
+    }
+    for (; j < count; ++j)
+    {
+        out[j] = x[j] + y[j];
+    }
+}
+
+MAT_INLINE void matSubRow(float *out, const float *x, const float *y, size_t count, int vector)
+{
+    size_t j = 0;
+    for (; vector && j + MAT_LANES <= count; j += MAT_LANES)
+    {
+        *(MatVector *)&out[j] = *(const MatVector *)&x[j] - *(const MatVector *)&y[j];
+    }
+    for (; j < count; ++j)
+    {
+        out[j] = x[j] - y[j];
+    }
+}
+
+MAT_INLINE void matMulRow(float *out, const float *x, const float *y, size_t count, int vector)
+{
+    size_t j = 0;
+    for (; vector && j + MAT_LANES <= count; j += MAT_LANES)
+    {
+        *(MatVector *)&out[j] = *(const MatVector *)&x[j] * *(const MatVector *)&y[j];
+    }
+    for (; j < count; ++j)
+    {
+        out[j] = x[j] * y[j];
+    }
+}
+
+MAT_INLINE void matAddScaledRow(float *out, const float *x, float scalar, size_t count, int vector)
+{
+    size_t j = 0;
+    for (; vector && j + MAT_LANES <= count; j += MAT_LANES)
+    {
+        *(MatVector *)&out[j] += scalar * *(const MatVector *)&x[j];
+    }
+    for (; j < count; ++j)
+    {
+        out[j] += scalar * x[j];
+    }
+}
+
+MAT_INLINE void matScaleRow(float *out, const float *x, float scalar, size_t count, int vector)
+{
+    size_t j = 0;
+    for (; vector && j + MAT_LANES <= count; j += MAT_LANES)
+    {
+        *(MatVector *)&out[j] = *(const MatVector *)&x[j] * scalar;
+    }
+    for (; j < count; ++j)
+    {
+        out[j] = x[j] * scalar;
+    }
+}
+
+MAT_INLINE void matAddScalarRow(float *out, const float *x, float scalar, size_t count, int vector)
+{
+    size_t j = 0;
+    for (; vector && j + MAT_LANES <= count; j += MAT_LANES)
+    {
+        *(MatVector *)&out[j] = *(const MatVector *)&x[j] + scalar;
+    }
+    for (; j < count; ++j)
+    {
+        out[j] = x[j] + scalar;
+    }
+}
+
+// Defines the row kernels of one tier and their table.
+#define MAT_ROW_KERNELS(name, target, vector)                                                         \
+    static target void matAddRow##name(float *out, const float *x, const float *y, size_t count)     \
+    {                                                                                                 \
+        matAddRow(out, x, y, count, vector);                                                          \
+    }                                                                                                 \
+    static target void matSubRow##name(float *out, const float *x, const float *y, size_t count)     \
+    {                                                                                                 \
+        matSubRow(out, x, y, count, vector);                                                          \
+    }                                                                                                 \
+    static target void matMulRow##name(float *out, const float *x, const float *y, size_t count)     \
+    {                                                                                                 \
+        matMulRow(out, x, y, count, vector);                                                          \
+    }                                                                                                 \
+    static target void matAddScaledRow##name(float *out, const float *x, float scalar, size_t count) \
+    {                                                                                                 \
+        matAddScaledRow(out, x, scalar, count, vector);                                               \
+    }                                                                                                 \
+    static target void matScaleRow##name(float *out, const float *x, float scalar, size_t count)     \
+    {                                                                                                 \
+        matScaleRow(out, x, scalar, count, vector);                                                   \
+    }                                                                                                 \
+    static target void matAddScalarRow##name(float *out, const float *x, float scalar, size_t count) \
+    {                                                                                                 \
+        matAddScalarRow(out, x, scalar, count, vector);                                               \
+    }                                                                                                 \
+    static const MatRowKernels matRowKernels##name = {                                                \
+        matAddRow##name,                                                                              \
+        matSubRow##name,                                                                              \
+        matMulRow##name,                                                                              \
+        matAddScaledRow##name,                                                                        \
+        matScaleRow##name,                                                                            \
+        matAddScalarRow##name,                                                                        \
+    };
+
+MAT_ROW_KERNELS(Scalar, , 0)
+#ifdef CPU_X86
+MAT_ROW_KERNELS(Sse, CPU_TARGET_SSE42, 1)
+MAT_ROW_KERNELS(Avx2, CPU_TARGET_AVX2, 1)
+MAT_ROW_KERNELS(Avx512, CPU_TARGET_AVX512, 1)
+
+static const MatRowKernels *const matRowKernels[CPU_ISAS] = {
+    &matRowKernelsScalar,
+    &matRowKernelsSse,
+    &matRowKernelsAvx2,
+    &matRowKernelsAvx512,
+};
+#else
+static const MatRowKernels *const matRowKernels[CPU_ISAS] = {&matRowKernelsScalar};
+#endif
 
 /**
- * @brief Creates a zero matrix.
+ * @brief Checks two matrices have the same size, printing an error if not.
+ *
+ * @param a An initialized matrix.
+ * @param b An initialized matrix.
+ * @param operation A name for the operation in the error message.
+ * @return Nonzero if the sizes match.
+ */
+static int matSameSize(Matrix *a, Matrix *b, const char *operation)
+{
+    if (a->rows != b->rows || a->columns != b->columns)
+    {
+        fprintf(stderr,
+                "Error: Cannot %s matrices (%lu, %lu) and (%lu, %lu)\n",
+                operation,
+                a->rows, a->columns,
+                b->rows, b->columns);
+
+        return 0;
+    }
+
+    return 1;
+}
+
+/**
+ * @brief Finds how to walk matrices of the same size row by row. When all of 
+ *        them are contiguous they are walked as a single long row, so the row 
+ *        kernels only have one tail.
+ *
+ * @param result An initialized matrix.
+ * @param a An initialized matrix with the same size.
+ * @param b An initialized matrix with the same size, or NULL.
+ * @param rows Set to the number of rows to walk.
+ * @param count Set to the number of elements in each row.
+ */
+static void matRows(Matrix *result, Matrix *a, Matrix *b, size_t *rows, size_t *count)
+{
+    *rows = result->rows;
+    *count = result->columns;
+    if (matIsContiguous(result) && matIsContiguous(a) && (b == NULL || matIsContiguous(b)))
+    {
+        *rows = 1;
+        *count = result->rows * result->columns;
+    }
+}
+
+/**
+ * @brief Allocates zeroed, aligned elements for a matrix with a given stride.
  *
  * @param mat An uninitialized matrix.
  * @param rows A number of rows.
  * @param columns A number of columns.
+ * @param stride The number of elements from one row to the next.
  */
-void matInit(Matrix *mat, size_t rows, size_t columns)
+static void matAllocate(Matrix *mat, size_t rows, size_t columns, size_t stride)
 {
+    size_t bytes = rows * stride * sizeof(float);
+    size_t allocated = (bytes + MAT_ALIGNMENT - 1) & ~(size_t)(MAT_ALIGNMENT - 1);
     mat->rows = rows;
     mat->columns = columns;
-    mat->elements = (float *)calloc(rows * columns, sizeof(float));
+    mat->stride = stride;
+    mat->elements = (float *)aligned_alloc(MAT_ALIGNMENT, allocated > 0 ? allocated : MAT_ALIGNMENT);
+    mat->owner = 1;
+    memset(mat->elements, 0, allocated);
+    profileAlloc(bytes);
+}
+
+/**
+ * @brief Creates a zero matrix. The elements are contiguous and start on a 
+ *        64 byte boundary.
+ *
+ * @param mat An uninitialized matrix.
+ * @param rows A number of rows.
+ * @param columns A number of columns.
+ */
+void matInit(Matrix *mat, size_t rows, size_t columns)
+{
+    matAllocate(mat, rows, columns, columns);
+}
+
+/**
+ * @brief Creates a zero matrix whose rows are padded to whole 64 byte lines, 
+ *        so every row starts aligned and vector loops can run over the 
+ *        padding instead of a scalar tail. The padding stays zero unless 
+ *        written through it.
+ *
+ * @param mat An uninitialized matrix.
+ * @param rows A number of rows.
+ * @param columns A number of columns.
+ */
+void matInitPadded(Matrix *mat, size_t rows, size_t columns)
+{
+    size_t lineFloats = MAT_ALIGNMENT / sizeof(float);
+    matAllocate(mat, rows, columns, (columns + lineFloats - 1) / lineFloats * lineFloats);
+}
+
+/**
+ * @brief Wraps existing elements in a matrix without copying them. The 
+ *        matrix does not own the elements, so matFree leaves them alone.
+ *
+ * @param elements The first element.
+ * @param rows A number of rows.
+ * @param columns A number of columns.
+ * @param stride The number of elements from one row to the next, at least 
+ *               the number of columns.
+ * @return A view of the elements.
+ */
+Matrix matView(float *elements, size_t rows, size_t columns, size_t stride)
+{
+    return (Matrix){rows, columns, stride, elements, 0};
+}
+
+/**
+ * @brief Views a block of a matrix without copying. Writes through the view 
+ *        change the matrix, and the view must not outlive it.
+ *
+ * @param mat An initialized matrix.
+ * @param row The first row of the block.
+ * @param column The first column of the block.
+ * @param rows The number of rows in the block.
+ * @param columns The number of columns in the block.
+ * @return A view of the block, or an empty matrix if it does not fit.
+ */
+Matrix matSubView(Matrix *mat, size_t row, size_t column, size_t rows, size_t columns)
+{
+    if (row + rows > mat->rows || column + columns > mat->columns)
+    {
+        fprintf(stderr,
+                "Error: Cannot view (%lu, %lu) at (%lu, %lu) of matrix (%lu, %lu)\n",
+                rows, columns,
+                row, column,
+                mat->rows, mat->columns);
+
+        return matView(NULL, 0, 0, 0);
+    }
+
+    return matView(&mat->elements[row * mat->stride + column], rows, columns, mat->stride);
+}
+
+/**
+ * @brief Views a range of the rows of a matrix without copying.
+ *
+ * @param mat An initialized matrix.
+ * @param start The first row.
+ * @param end One past the last row.
+ * @return A view of the rows.
+ */
+Matrix matRowView(Matrix *mat, size_t start, size_t end)
+{
+    return matSubView(mat, start, 0, end - start, mat->columns);
+}
+
+/**
+ * @brief Views a range of the columns of a matrix without copying, such as a 
+ *        part of a batch with one sample per column.
+ *
+ * @param mat An initialized matrix.
+ * @param start The first column.
+ * @param end One past the last column.
+ * @return A view of the columns.
+ */
+Matrix matColumnView(Matrix *mat, size_t start, size_t end)
+{
+    return matSubView(mat, 0, start, mat->rows, end - start);
+}
+
+/**
+ * @brief Checks whether the elements of a matrix are one contiguous run, so 
+ *        they can be visited as a flat array.
+ *
+ * @param mat An initialized matrix.
+ * @return Nonzero if no row is followed by padding or other elements.
+ */
+int matIsContiguous(const Matrix *mat)
+{
+    return mat->stride == mat->columns || mat->rows <= 1;
 }
 
 /**
@@ -27,23 +347,50 @@ Matrix matCopy(Matrix *mat)
 {
     Matrix copy;
     matInit(&copy, mat->rows, mat->columns);
-    for (size_t i = 0; i < mat->rows * mat->columns; ++i)
-    {
-        copy.elements[i] = mat->elements[i];
-    }
+    matCopyInto(&copy, mat);
     
     return copy;
 }
 
 /**
- * @brief Frees the elements of a matrix.
+ * @brief Performs a deep copy into an existing matrix.
+ *
+ * @param result An initialized matrix with the same size.
+ * @param mat An initialized matrix.
+ */
+void matCopyInto(Matrix *result, Matrix *mat)
+{
+    if (!matSameSize(result, mat, "copy"))
+    {
+        return;
+    }
+
+    if (matIsContiguous(result) && matIsContiguous(mat))
+    {
+        memcpy(result->elements, mat->elements, mat->rows * mat->columns * sizeof(float));
+        return;
+    }
+    for (size_t i = 0; i < mat->rows; ++i)
+    {
+        memcpy(&result->elements[i * result->stride], &mat->elements[i * mat->stride], mat->columns * sizeof(float));
+    }
+}
+
+/**
+ * @brief Frees the elements of a matrix that owns them. A view is only 
+ *        cleared.
  *
  * @param mat An initialized matrix.
  */
 void matFree(Matrix *mat)
 {
-    free(mat->elements);
+    if (mat->owner && mat->elements != NULL)
+    {
+        profileFree(mat->rows * mat->stride * sizeof(float));
+        free(mat->elements);
+    }
     mat->elements = NULL;
+    mat->owner = 0;
 }
 
 /**
@@ -54,9 +401,13 @@ void matFree(Matrix *mat)
  */
 void matSet(Matrix *mat, float value)
 {
-    for (size_t i = 0; i < mat->rows * mat->columns; ++i)
+    for (size_t i = 0; i < mat->rows; ++i)
     {
-        mat->elements[i] = value;
+        float *row = &mat->elements[i * mat->stride];
+        for (size_t j = 0; j < mat->columns; ++j)
+        {
+            row[j] = value;
+        }
     }
 }
 
@@ -72,7 +423,7 @@ void matPrint(Matrix *mat)
         printf("[ ");
         for (size_t j = 0; j < mat->columns; ++j)
         {
-            printf("%f ", mat->elements[i * mat->columns + j]);
+            printf("%f ", mat->elements[i * mat->stride + j]);
         }
         printf("]\n");
     }
@@ -82,22 +433,54 @@ void matPrint(Matrix *mat)
  * @brief Finds the maximum element.
  *
  * @param mat An initialized matrix.
- * @return The index of the maximum element.
+ * @return The index of the maximum element, counting row by row.
  */
 size_t matMaxElement(Matrix *mat)
 {
     size_t maxElemIndex = 0;
-    for (size_t i = 0; i < mat->rows * mat->columns; ++i)
+    float maxElem = mat->elements[0];
+    for (size_t i = 0; i < mat->rows; ++i)
     {
-        if (mat->elements[i] >= mat->elements[maxElemIndex])
+        float *row = &mat->elements[i * mat->stride];
+        for (size_t j = 0; j < mat->columns; ++j)
         {
-            maxElemIndex = i;
+            if (row[j] >= maxElem)
+            {
+                maxElem = row[j];
+                maxElemIndex = i * mat->columns + j;
+            }
         }
     }
 
     return maxElemIndex;
 }
 
+/**
+ * @brief Finds the maximum element of each column. Rows are scanned whole, so 
+ *        the comparisons run along contiguous memory.
+ *
+ * @param mat An initialized matrix.
+ * @param indices The row of the maximum element of each column.
+ */
+void matMaxColumnElements(Matrix *mat, size_t *indices)
+{
+    for (size_t j = 0; j < mat->columns; ++j)
+    {
+        indices[j] = 0;
+    }
+    for (size_t i = 1; i < mat->rows; ++i)
+    {
+        float *row = &mat->elements[i * mat->stride];
+        for (size_t j = 0; j < mat->columns; ++j)
+        {
+            if (row[j] >= mat->elements[indices[j] * mat->stride + j])
+            {
+                indices[j] = i;
+            }
+        }
+    }
+}
+
 /**
  * @brief Tranposes a matrix.
  *
@@ -108,16 +491,39 @@ Matrix matTranspose(Matrix *mat)
 {
     Matrix result;
     matInit(&result, mat->columns, mat->rows);
+    matTransposeInto(&result, mat);
 
-    for (size_t i = 0; i < result.rows; ++i)
+    return result;
+}
+
+/**
+ * @brief Tranposes a matrix into an existing matrix. The result must not 
+ *        share memory with the input.
+ *
+ * @param result An initialized matrix with the transposed size.
+ * @param mat An initialized matrix.
+ */
+void matTransposeInto(Matrix *result, Matrix *mat)
+{
+    if (result->rows != mat->columns || result->columns != mat->rows)
     {
-        for (size_t j = 0; j < result.columns; ++j)
+        fprintf(stderr,
+                "Error: Cannot transpose matrix (%lu, %lu) into (%lu, %lu)\n",
+                mat->rows, mat->columns,
+                result->rows, result->columns);
+
+        return;
+    }
+
+    uint64_t start = profileBegin();
+    for (size_t i = 0; i < result->rows; ++i)
+    {
+        for (size_t j = 0; j < result->columns; ++j)
         {
-            result.elements[i * result.columns + j] = mat->elements[j * mat->columns + i];
+            result->elements[i * result->stride + j] = mat->elements[j * mat->stride + i];
         }
     }
-
-    return result;
+    profileEndKernel(PROFILE_MAT_ELEMENTWISE, start, 0);
 }
 
 /**
@@ -130,26 +536,47 @@ Matrix matTranspose(Matrix *mat)
 Matrix matAdd(Matrix *a, Matrix *b)
 {
     // Must have the same number of elements to add.
-    if (a->rows != b->rows || a->columns != b->columns)
+    if (!matSameSize(a, b, "add"))
     {
-        fprintf(stderr,
-                "Error: Cannot add matrices (%lu, %lu) and (%lu, %lu)\n",
-                a->rows, a->columns,
-                b->rows, b->columns);
-
-        return (Matrix){0, 0, NULL};
+        return matView(NULL, 0, 0, 0);
     }
     
     Matrix result;
     matInit(&result, a->rows, a->columns);
-    for (size_t i = 0; i < result.rows * result.columns; ++i)
-    {
-        result.elements[i] = a->elements[i] + b->elements[i];
-    }
+    matAddInto(&result, a, b);
     
     return result;
 }
 
+/**
+ * @brief Performs matrix addition into an existing matrix. The result may be 
+ *        one of the inputs.
+ *
+ * @param result An initialized matrix with the same size.
+ * @param a An initialized matrix.
+ * @param b An initialized matrix.
+ */
+void matAddInto(Matrix *result, Matrix *a, Matrix *b)
+{
+    if (!matSameSize(a, b, "add") || !matSameSize(result, a, "add"))
+    {
+        return;
+    }
+
+    uint64_t start = profileBegin();
+    const MatRowKernels *kernels = matRowKernels[cpuIsa()];
+    size_t rows, count;
+    matRows(result, a, b, &rows, &count);
+    for (size_t i = 0; i < rows; ++i)
+    {
+        kernels->add(&result->elements[i * result->stride],
+                     &a->elements[i * a->stride],
+                     &b->elements[i * b->stride],
+                     count);
+    }
+    profileEndKernel(PROFILE_MAT_ELEMENTWISE, start, result->rows * result->columns);
+}
+
 /**
  * @brief Performs matrix subtraction (a minus b).
  *
@@ -160,26 +587,73 @@ Matrix matAdd(Matrix *a, Matrix *b)
 Matrix matSub(Matrix *a, Matrix *b)
 {
     // Must have the same number of elements to subtract.
-    if (a->rows != b->rows || a->columns != b->columns)
+    if (!matSameSize(a, b, "subtract"))
     {
-        fprintf(stderr,
-                "Error: Cannot subtract matrices (%lu, %lu) and (%lu, %lu)\n",
-                a->rows, a->columns,
-                b->rows, b->columns);
-        
-        return (Matrix){0, 0, NULL};
+        return matView(NULL, 0, 0, 0);
     }
     
     Matrix result;
     matInit(&result, a->rows, a->columns);
-    for (size_t i = 0; i < result.rows * result.columns; ++i)
-    {
-        result.elements[i] = a->elements[i] - b->elements[i];
-    }
+    matSubInto(&result, a, b);
     
     return result;
 }
 
+/**
+ * @brief Performs matrix subtraction (a minus b) into an existing matrix. The 
+ *        result may be one of the inputs.
+ *
+ * @param result An initialized matrix with the same size.
+ * @param a An initialized matrix.
+ * @param b An initialized matrix.
+ */
+void matSubInto(Matrix *result, Matrix *a, Matrix *b)
+{
+    if (!matSameSize(a, b, "subtract") || !matSameSize(result, a, "subtract"))
+    {
+        return;
+    }
+
+    uint64_t start = profileBegin();
+    const MatRowKernels *kernels = matRowKernels[cpuIsa()];
+    size_t rows, count;
+    matRows(result, a, b, &rows, &count);
+    for (size_t i = 0; i < rows; ++i)
+    {
+        kernels->sub(&result->elements[i * result->stride],
+                     &a->elements[i * a->stride],
+                     &b->elements[i * b->stride],
+                     count);
+    }
+    profileEndKernel(PROFILE_MAT_ELEMENTWISE, start, result->rows * result->columns);
+}
+
+/**
+ * @brief Adds a scaled matrix to a matrix in place (mat += scalar * other). 
+ *        A negative scalar subtracts.
+ *
+ * @param mat An initialized matrix.
+ * @param other An initialized matrix with the same size.
+ * @param scalar A scalar for the other matrix.
+ */
+void matAddScaled(Matrix *mat, Matrix *other, float scalar)
+{
+    if (!matSameSize(mat, other, "add"))
+    {
+        return;
+    }
+
+    uint64_t start = profileBegin();
+    const MatRowKernels *kernels = matRowKernels[cpuIsa()];
+    size_t rows, count;
+    matRows(mat, other, NULL, &rows, &count);
+    for (size_t i = 0; i < rows; ++i)
+    {
+        kernels->addScaled(&mat->elements[i * mat->stride], &other->elements[i * other->stride], scalar, count);
+    }
+    profileEndKernel(PROFILE_MAT_ELEMENTWISE, start, 2 * mat->rows * mat->columns);
+}
+
 /**
  * @brief Performs matrix multiplication (a times b).
  *
@@ -197,24 +671,401 @@ Matrix matMul(Matrix *a, Matrix *b)
                 a->rows, a->columns,
                 b->rows, b->columns);
         
-        return (Matrix){0, 0, NULL};
+        return matView(NULL, 0, 0, 0);
     }
     
     Matrix result;
     matInit(&result, a->rows, b->columns);
-    for (size_t i = 0; i < result.rows; ++i)
+    matMulInto(&result, a, b);
+
+    return result;
+}
+
+/**
+ * @brief Checks the sizes for a matrix multiplication, printing an error if 
+ *        they do not match.
+ *
+ * @param result An initialized matrix.
+ * @param a An initialized matrix.
+ * @param b An initialized matrix.
+ * @return Nonzero if the sizes match.
+ */
+static int matMulSizes(Matrix *result, Matrix *a, Matrix *b)
+{
+    if (a->columns != b->rows || result->rows != a->rows || result->columns != b->columns)
+    {
+        fprintf(stderr,
+                "Error: Cannot multiply matrices (%lu, %lu) and (%lu, %lu) into (%lu, %lu)\n",
+                a->rows, a->columns,
+                b->rows, b->columns,
+                result->rows, result->columns);
+
+        return 0;
+    }
+
+    return 1;
+}
+
+/**
+ * @brief Performs matrix multiplication (a times b) into an existing matrix. 
+ *        The result must not share memory with the inputs.
+ *
+ * @param result An initialized matrix with the product size.
+ * @param a An initialized matrix.
+ * @param b An initialized matrix.
+ */
+void matMulInto(Matrix *result, Matrix *a, Matrix *b)
+{
+    if (!matMulSizes(result, a, b))
+    {
+        return;
+    }
+
+    uint64_t start = profileBegin();
+    gemm(GEMM_NO_TRANS,
+         GEMM_NO_TRANS,
+         result->rows,
+         result->columns,
+         a->columns,
+         1.0f,
+         a->elements,
+         a->stride,
+         b->elements,
+         b->stride,
+         0.0f,
+         result->elements,
+         result->stride);
+    profileEndKernel(PROFILE_MAT_MUL, start, 2 * (uint64_t)result->rows * result->columns * a->columns);
+}
+
+/**
+ * @brief Accumulates a matrix multiplication into an existing matrix 
+ *        (result += a times b). The result must not share memory with the 
+ *        inputs.
+ *
+ * @param result An initialized matrix with the product size.
+ * @param a An initialized matrix.
+ * @param b An initialized matrix.
+ */
+void matMulAddInto(Matrix *result, Matrix *a, Matrix *b)
+{
+    if (!matMulSizes(result, a, b))
+    {
+        return;
+    }
+
+    uint64_t start = profileBegin();
+    gemm(GEMM_NO_TRANS,
+         GEMM_NO_TRANS,
+         result->rows,
+         result->columns,
+         a->columns,
+         1.0f,
+         a->elements,
+         a->stride,
+         b->elements,
+         b->stride,
+         1.0f,
+         result->elements,
+         result->stride);
+    profileEndKernel(PROFILE_MAT_MUL, start, 2 * (uint64_t)result->rows * result->columns * a->columns);
+}
+
+/**
+ * @brief Performs matrix multiplication with the first matrix transposed 
+ *        (a^T times b) into an existing matrix. The transpose is never 
+ *        materialized. The result must not share memory with the inputs.
+ *
+ * @param result An initialized matrix with the product size.
+ * @param a An initialized matrix.
+ * @param b An initialized matrix.
+ */
+void matMulTransAInto(Matrix *result, Matrix *a, Matrix *b)
+{
+    if (a->rows != b->rows || result->rows != a->columns || result->columns != b->columns)
     {
-        for (size_t j = 0; j < result.columns; ++j)
+        fprintf(stderr,
+                "Error: Cannot multiply transposed matrix (%lu, %lu) and (%lu, %lu) into (%lu, %lu)\n",
+                a->rows, a->columns,
+                b->rows, b->columns,
+                result->rows, result->columns);
+
+        return;
+    }
+
+    uint64_t start = profileBegin();
+    gemm(GEMM_TRANS,
+         GEMM_NO_TRANS,
+         result->rows,
+         result->columns,
+         a->rows,
+         1.0f,
+         a->elements,
+         a->stride,
+         b->elements,
+         b->stride,
+         0.0f,
+         result->elements,
+         result->stride);
+    profileEndKernel(PROFILE_MAT_MUL_TRANS_A, start, 2 * (uint64_t)result->rows * result->columns * a->rows);
+}
+
+/**
+ * @brief Performs matrix multiplication (a times b) into an existing matrix,
+ *        with the first matrix stored in half precision. The result must not
+ *        share memory with the inputs.
+ *
+ * @param result An initialized matrix with the product size.
+ * @param a An initialized half precision matrix.
+ * @param b An initialized matrix.
+ */
+void matMulHalfInto(Matrix *result, HalfMatrix *a, Matrix *b)
+{
+    if (a->columns != b->rows || result->rows != a->rows || result->columns != b->columns)
+    {
+        fprintf(stderr,
+                "Error: Cannot multiply matrices (%lu, %lu) and (%lu, %lu) into (%lu, %lu)\n",
+                a->rows, a->columns,
+                b->rows, b->columns,
+                result->rows, result->columns);
+
+        return;
+    }
+
+    uint64_t start = profileBegin();
+    gemmHalfA(a->format,
+              GEMM_NO_TRANS,
+              GEMM_NO_TRANS,
+              result->rows,
+              result->columns,
+              a->columns,
+              1.0f,
+              a->elements,
+              a->columns,
+              b->elements,
+              b->stride,
+              0.0f,
+              result->elements,
+              result->stride);
+    profileEndKernel(PROFILE_MAT_MUL_HALF, start, 2 * (uint64_t)result->rows * result->columns * a->columns);
+}
+
+/**
+ * @brief Performs matrix multiplication with the first matrix transposed 
+ *        (a^T times b) into an existing matrix, with the first matrix stored 
+ *        in half precision. The result must not share memory with the inputs.
+ *
+ * @param result An initialized matrix with the product size.
+ * @param a An initialized half precision matrix.
+ * @param b An initialized matrix.
+ */
+void matMulHalfTransAInto(Matrix *result, HalfMatrix *a, Matrix *b)
+{
+    if (a->rows != b->rows || result->rows != a->columns || result->columns != b->columns)
+    {
+        fprintf(stderr,
+                "Error: Cannot multiply transposed matrix (%lu, %lu) and (%lu, %lu) into (%lu, %lu)\n",
+                a->rows, a->columns,
+                b->rows, b->columns,
+                result->rows, result->columns);
+
+        return;
+    }
+
+    uint64_t start = profileBegin();
+    gemmHalfA(a->format,
+              GEMM_TRANS,
+              GEMM_NO_TRANS,
+              result->rows,
+              result->columns,
+              a->rows,
+              1.0f,
+              a->elements,
+              a->columns,
+              b->elements,
+              b->stride,
+              0.0f,
+              result->elements,
+              result->stride);
+    profileEndKernel(PROFILE_MAT_MUL_HALF, start, 2 * (uint64_t)result->rows * result->columns * a->rows);
+}
+
+/**
+ * @brief Performs matrix multiplication by a sparse matrix (a times b) into 
+ *        an existing matrix, touching only the nonzeros of b. Four rows of a 
+ *        are handled together so each nonzero is loaded once per four rows. 
+ *        The result must not share memory with the inputs.
+ *
+ * @param result An initialized matrix with the product size.
+ * @param a An initialized matrix.
+ * @param b An initialized sparse matrix.
+ */
+void matMulSparseInto(Matrix *result, Matrix *a, SparseMatrix *b)
+{
+    if (a->columns != b->rows || result->rows != a->rows || result->columns != b->columns)
+    {
+        fprintf(stderr,
+                "Error: Cannot multiply matrix (%lu, %lu) and sparse (%lu, %lu) into (%lu, %lu)\n",
+                a->rows, a->columns,
+                b->rows, b->columns,
+                result->rows, result->columns);
+
+        return;
+    }
+
+    uint64_t start = profileBegin();
+    size_t m = a->rows;
+    size_t n = b->columns;
+    size_t lda = a->stride;
+    size_t ldc = result->stride;
+    size_t i = 0;
+    for (; i + 4 <= m; i += 4)
+    {
+        const float *row0 = &a->elements[i * lda];
+        const float *row1 = row0 + lda;
+        const float *row2 = row1 + lda;
+        const float *row3 = row2 + lda;
+        for (size_t j = 0; j < n; ++j)
         {
-            for (size_t k = 0; k < a->columns; ++k)
+            float sum0 = 0.0f, sum1 = 0.0f, sum2 = 0.0f, sum3 = 0.0f;
+            for (size_t p = b->columnStarts[j]; p < b->columnStarts[j + 1]; ++p)
             {
-                result.elements[i * result.columns + j] +=
-                    a->elements[i * a->columns + k] * b->elements[k * b->columns + j];
+                uint32_t index = b->rowIndices[p];
+                float value = b->values[p];
+                sum0 += value * row0[index];
+                sum1 += value * row1[index];
+                sum2 += value * row2[index];
+                sum3 += value * row3[index];
             }
+            result->elements[i * ldc + j] = sum0;
+            result->elements[(i + 1) * ldc + j] = sum1;
+            result->elements[(i + 2) * ldc + j] = sum2;
+            result->elements[(i + 3) * ldc + j] = sum3;
         }
     }
+    for (; i < m; ++i)
+    {
+        const float *row = &a->elements[i * lda];
+        for (size_t j = 0; j < n; ++j)
+        {
+            float sum = 0.0f;
+            for (size_t p = b->columnStarts[j]; p < b->columnStarts[j + 1]; ++p)
+            {
+                sum += b->values[p] * row[b->rowIndices[p]];
+            }
+            result->elements[i * ldc + j] = sum;
+        }
+    }
+    profileEndKernel(PROFILE_MAT_MUL_SPARSE, start, 2 * (uint64_t)m * b->columnStarts[n]);
+}
 
-    return result;
+/**
+ * @brief Performs matrix multiplication with a sparse second matrix 
+ *        transposed (a times b^T) into an existing matrix. Each element of a 
+ *        is scattered into the columns of the result named by the nonzeros 
+ *        of the matching column of b, so zeros of b cost nothing. Four rows 
+ *        are handled together, as in matMulSparseInto. The result must not 
+ *        share memory with the inputs.
+ *
+ * @param result An initialized matrix with the product size.
+ * @param a An initialized matrix.
+ * @param b An initialized sparse matrix.
+ */
+void matMulSparseTransBInto(Matrix *result, Matrix *a, SparseMatrix *b)
+{
+    if (a->columns != b->columns || result->rows != a->rows || result->columns != b->rows)
+    {
+        fprintf(stderr,
+                "Error: Cannot multiply matrix (%lu, %lu) and transposed sparse (%lu, %lu) into (%lu, %lu)\n",
+                a->rows, a->columns,
+                b->rows, b->columns,
+                result->rows, result->columns);
+
+        return;
+    }
+
+    uint64_t start = profileBegin();
+    size_t m = a->rows;
+    size_t n = a->columns;
+    size_t lda = a->stride;
+    size_t ldc = result->stride;
+    matSet(result, 0.0f);
+    size_t i = 0;
+    for (; i + 4 <= m; i += 4)
+    {
+        float *row0 = &result->elements[i * ldc];
+        float *row1 = row0 + ldc;
+        float *row2 = row1 + ldc;
+        float *row3 = row2 + ldc;
+        for (size_t j = 0; j < n; ++j)
+        {
+            float scale0 = a->elements[i * lda + j];
+            float scale1 = a->elements[(i + 1) * lda + j];
+            float scale2 = a->elements[(i + 2) * lda + j];
+            float scale3 = a->elements[(i + 3) * lda + j];
+            for (size_t p = b->columnStarts[j]; p < b->columnStarts[j + 1]; ++p)
+            {
+                uint32_t index = b->rowIndices[p];
+                float value = b->values[p];
+                row0[index] += scale0 * value;
+                row1[index] += scale1 * value;
+                row2[index] += scale2 * value;
+                row3[index] += scale3 * value;
+            }
+        }
+    }
+    for (; i < m; ++i)
+    {
+        float *row = &result->elements[i * ldc];
+        for (size_t j = 0; j < n; ++j)
+        {
+            float scale = a->elements[i * lda + j];
+            for (size_t p = b->columnStarts[j]; p < b->columnStarts[j + 1]; ++p)
+            {
+                row[b->rowIndices[p]] += scale * b->values[p];
+            }
+        }
+    }
+    profileEndKernel(PROFILE_MAT_MUL_SPARSE, start, 2 * (uint64_t)m * b->columnStarts[n]);
+}
+
+/**
+ * @brief Performs matrix multiplication with the second matrix transposed 
+ *        (a times b^T) into an existing matrix. The transpose is never 
+ *        materialized. The result must not share memory with the inputs.
+ *
+ * @param result An initialized matrix with the product size.
+ * @param a An initialized matrix.
+ * @param b An initialized matrix.
+ */
+void matMulTransBInto(Matrix *result, Matrix *a, Matrix *b)
+{
+    if (a->columns != b->columns || result->rows != a->rows || result->columns != b->rows)
+    {
+        fprintf(stderr,
+                "Error: Cannot multiply matrix (%lu, %lu) and transposed (%lu, %lu) into (%lu, %lu)\n",
+                a->rows, a->columns,
+                b->rows, b->columns,
+                result->rows, result->columns);
+
+        return;
+    }
+
+    uint64_t start = profileBegin();
+    gemm(GEMM_NO_TRANS,
+         GEMM_TRANS,
+         result->rows,
+         result->columns,
+         a->columns,
+         1.0f,
+         a->elements,
+         a->stride,
+         b->elements,
+         b->stride,
+         0.0f,
+         result->elements,
+         result->stride);
+    profileEndKernel(PROFILE_MAT_MUL_TRANS_B, start, 2 * (uint64_t)result->rows * result->columns * a->columns);
 }
 
 /**
@@ -227,26 +1078,47 @@ Matrix matMul(Matrix *a, Matrix *b)
 Matrix matElementMul(Matrix *a, Matrix *b)
 {
     // Must have the same number of elements to multiply.
-    if (a->rows != b->rows || a->columns != b->columns)
+    if (!matSameSize(a, b, "multiply"))
     {
-        fprintf(stderr,
-                "Error: Cannot multiply matrices (%lu, %lu) and (%lu, %lu)\n",
-                a->rows, a->columns,
-                b->rows, b->columns);
-
-        return (Matrix){0, 0, NULL};
+        return matView(NULL, 0, 0, 0);
     }
     
     Matrix result;
     matInit(&result, a->rows, a->columns);
-    for (size_t i = 0; i < result.rows * result.columns; ++i)
-    {
-        result.elements[i] = a->elements[i] * b->elements[i];
-    }
+    matElementMulInto(&result, a, b);
     
     return result;
 }
 
+/**
+ * @brief Performs element-wise matrix multiplication into an existing matrix. 
+ *        The result may be one of the inputs.
+ *
+ * @param result An initialized matrix with the same size.
+ * @param a An initialized matrix.
+ * @param b An initialized matrix.
+ */
+void matElementMulInto(Matrix *result, Matrix *a, Matrix *b)
+{
+    if (!matSameSize(a, b, "multiply") || !matSameSize(result, a, "multiply"))
+    {
+        return;
+    }
+
+    uint64_t start = profileBegin();
+    const MatRowKernels *kernels = matRowKernels[cpuIsa()];
+    size_t rows, count;
+    matRows(result, a, b, &rows, &count);
+    for (size_t i = 0; i < rows; ++i)
+    {
+        kernels->mul(&result->elements[i * result->stride],
+                     &a->elements[i * a->stride],
+                     &b->elements[i * b->stride],
+                     count);
+    }
+    profileEndKernel(PROFILE_MAT_ELEMENTWISE, start, result->rows * result->columns);
+}
+
 /**
  * @brief Performs scalar multiplication.
  *
@@ -258,10 +1130,142 @@ Matrix matScalarMul(Matrix *mat, float scalar)
 {
     Matrix result;
     matInit(&result, mat->rows, mat->columns);
-    for (size_t i = 0; i < result.rows * result.columns; ++i)
+    matScalarMulInto(&result, mat, scalar);
+    
+    return result;
+}
+
+/**
+ * @brief Performs scalar multiplication into an existing matrix. The result 
+ *        may be the input.
+ *
+ * @param result An initialized matrix with the same size.
+ * @param mat An initialized matrix.
+ * @param scalar A scalar.
+ */
+void matScalarMulInto(Matrix *result, Matrix *mat, float scalar)
+{
+    if (!matSameSize(result, mat, "multiply"))
     {
-        result.elements[i] = mat->elements[i] * scalar;
+        return;
     }
-    
+
+    uint64_t start = profileBegin();
+    const MatRowKernels *kernels = matRowKernels[cpuIsa()];
+    size_t rows, count;
+    matRows(result, mat, NULL, &rows, &count);
+    for (size_t i = 0; i < rows; ++i)
+    {
+        kernels->scale(&result->elements[i * result->stride], &mat->elements[i * mat->stride], scalar, count);
+    }
+    profileEndKernel(PROFILE_MAT_ELEMENTWISE, start, result->rows * result->columns);
+}
+
+/**
+ * @brief Adds a column vector to every column of a matrix.
+ *
+ * @param mat An initialized matrix.
+ * @param column An initialized column vector with the same number of rows.
+ * @return A new result matrix.
+ */
+Matrix matAddColumn(Matrix *mat, Matrix *column)
+{
+    // The column vector must match the rows of the matrix.
+    if (column->columns != 1 || column->rows != mat->rows)
+    {
+        fprintf(stderr,
+                "Error: Cannot add column (%lu, %lu) to matrix (%lu, %lu)\n",
+                column->rows, column->columns,
+                mat->rows, mat->columns);
+
+        return matView(NULL, 0, 0, 0);
+    }
+
+    Matrix result;
+    matInit(&result, mat->rows, mat->columns);
+    matAddColumnInto(&result, mat, column);
+
     return result;
 }
+
+/**
+ * @brief Adds a column vector to every column of a matrix into an existing 
+ *        matrix. The result may be the input matrix.
+ *
+ * @param result An initialized matrix with the same size.
+ * @param mat An initialized matrix.
+ * @param column An initialized column vector with the same number of rows.
+ */
+void matAddColumnInto(Matrix *result, Matrix *mat, Matrix *column)
+{
+    if (column->columns != 1 || column->rows != mat->rows)
+    {
+        fprintf(stderr,
+                "Error: Cannot add column (%lu, %lu) to matrix (%lu, %lu)\n",
+                column->rows, column->columns,
+                mat->rows, mat->columns);
+
+        return;
+    }
+    if (!matSameSize(result, mat, "add"))
+    {
+        return;
+    }
+
+    uint64_t start = profileBegin();
+    const MatRowKernels *kernels = matRowKernels[cpuIsa()];
+    for (size_t i = 0; i < result->rows; ++i)
+    {
+        kernels->addScalar(&result->elements[i * result->stride],
+                           &mat->elements[i * mat->stride],
+                           column->elements[i * column->stride],
+                           result->columns);
+    }
+    profileEndKernel(PROFILE_MAT_ELEMENTWISE, start, result->rows * result->columns);
+}
+
+/**
+ * @brief Sums the elements of each row.
+ *
+ * @param mat An initialized matrix.
+ * @return A new column vector of row sums.
+ */
+Matrix matRowSum(Matrix *mat)
+{
+    Matrix result;
+    matInit(&result, mat->rows, 1);
+    matRowSumInto(&result, mat);
+
+    return result;
+}
+
+/**
+ * @brief Sums the elements of each row into an existing column vector.
+ *
+ * @param result An initialized column vector with the same number of rows.
+ * @param mat An initialized matrix.
+ */
+void matRowSumInto(Matrix *result, Matrix *mat)
+{
+    if (result->columns != 1 || result->rows != mat->rows)
+    {
+        fprintf(stderr,
+                "Error: Cannot sum rows of matrix (%lu, %lu) into (%lu, %lu)\n",
+                mat->rows, mat->columns,
+                result->rows, result->columns);
+
+        return;
+    }
+
+    uint64_t start = profileBegin();
+    for (size_t i = 0; i < mat->rows; ++i)
+    {
+        float sum = 0.0f;
+        for (size_t j = 0; j < mat->columns; ++j)
+        {
+            sum += mat->elements[i * mat->stride + j];
+        }
+        result->elements[i * result->stride] = sum;
+    }
+    profileEndKernel(PROFILE_MAT_ELEMENTWISE, start, mat->rows * mat->columns);
+}
@@ -2,22 +2,51 @@
 #define MATRIX_H
 
 #include "stddef.h"
+#include "stdint.h"
+#include "half.h"
 
+// Allocated matrices start on this boundary, and padded rows are a whole 
+// number of it.
+#define MAT_ALIGNMENT 64
+
+// A row-major matrix. Row i starts stride elements after row i - 1, so a 
+// matrix can view a block of another. Only the owner frees the elements.
 typedef struct
 {
-    size_t rows, columns;
+    size_t rows, columns, stride;
     float *elements;
+    int owner;
 }
 Matrix;
 
+// A sparse matrix stored column by column. The nonzeros of column j are at 
+// [columnStarts[j], columnStarts[j + 1]) of rowIndices and values, and at 
+// most capacity of them fit.
+typedef struct
+{
+    size_t rows, columns, capacity;
+    size_t *columnStarts;
+    uint32_t *rowIndices;
+    float *values;
+}
+SparseMatrix;
+
 void matInit(Matrix *mat, size_t rows, size_t columns);
+void matInitPadded(Matrix *mat, size_t rows, size_t columns);
+Matrix matView(float *elements, size_t rows, size_t columns, size_t stride);
+Matrix matSubView(Matrix *mat, size_t row, size_t column, size_t rows, size_t columns);
+Matrix matRowView(Matrix *mat, size_t start, size_t end);
+Matrix matColumnView(Matrix *mat, size_t start, size_t end);
+int matIsContiguous(const Matrix *mat);
 Matrix matCopy(Matrix *mat);
+void matCopyInto(Matrix *result, Matrix *mat);
 void matSet(Matrix *mat, float value);
 void matFree(Matrix *mat);
 
 void matPrint(Matrix *mat);
 
 size_t matMaxElement(Matrix *mat);
+void matMaxColumnElements(Matrix *mat, size_t *indices);
 
 Matrix matTranspose(Matrix *mat);
 Matrix matAdd(Matrix *a, Matrix *b);
@@ -25,5 +54,24 @@ Matrix matSub(Matrix *a, Matrix *b);
 Matrix matMul(Matrix *a, Matrix *b);
 Matrix matElementMul(Matrix *a, Matrix *b);
 Matrix matScalarMul(Matrix *mat, float scalar);
+Matrix matAddColumn(Matrix *mat, Matrix *column);
+Matrix matRowSum(Matrix *mat);
+
+void matTransposeInto(Matrix *result, Matrix *mat);
+void matAddInto(Matrix *result, Matrix *a, Matrix *b);
+void matSubInto(Matrix *result, Matrix *a, Matrix *b);
+void matAddScaled(Matrix *mat, Matrix *other, float scalar);
+void matMulInto(Matrix *result, Matrix *a, Matrix *b);
+void matMulAddInto(Matrix *result, Matrix *a, Matrix *b);
+void matMulTransAInto(Matrix *result, Matrix *a, Matrix *b);
+void matMulTransBInto(Matrix *result, Matrix *a, Matrix *b);
+void matMulHalfInto(Matrix *result, HalfMatrix *a, Matrix *b);
+void matMulHalfTransAInto(Matrix *result, HalfMatrix *a, Matrix *b);
+void matMulSparseInto(Matrix *result, Matrix *a, SparseMatrix *b);
+void matMulSparseTransBInto(Matrix *result, Matrix *a, SparseMatrix *b);
+void matElementMulInto(Matrix *result, Matrix *a, Matrix *b);
+void matScalarMulInto(Matrix *result, Matrix *mat, float scalar);
+void matAddColumnInto(Matrix *result, Matrix *mat, Matrix *column);
+void matRowSumInto(Matrix *result, Matrix *mat);
 
 #endif
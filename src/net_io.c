@@ -0,0 +1,341 @@
+#include "net_io.h"
+#include "neural_net.h"
+#include "matrix.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// FNV-1a parameters, applied to whole 64 bit words.
+#define NET_FILE_HASH_BASIS 0xcbf29ce484222325ULL
+#define NET_FILE_HASH_PRIME 0x00000100000001b3ULL
+
+/**
+ * @brief Appends a section to a model file, aligned.
+ *
+ * @param offset The end of the file so far, moved past the section.
+ * @param bytes The size of the section.
+ * @return Zero on success, or nonzero if the file size overflows.
+ */
+static int netFileAddSection(size_t *offset, size_t bytes)
+{
+    size_t aligned;
+    if (__builtin_add_overflow(bytes, NET_FILE_ALIGNMENT - 1, &aligned))
+    {
+        return -1;
+    }
+    aligned &= ~(size_t)(NET_FILE_ALIGNMENT - 1);
+
+    return __builtin_add_overflow(*offset, aligned, offset) ? -1 : 0;
+}
+
+/**
+ * @brief Lays out a model file: the header, the table of layer sizes, then
+ *        the weights and biases of each layer in turn, each section aligned.
+ *        The sections after the table have the layout of the parameter slab
+ *        of a network, so the slab is saved and mapped whole. Sizes read from
+ *        a file are untrusted, so every product and sum is checked.
+ *
+ * @param layers The number of layers.
+ * @param layerSizes The number of neurons in each layer.
+ * @param weightOffsets The file offset of the weights of each layer, or NULL.
+ * @param biasOffsets The file offset of the biases of each layer, or NULL.
+ * @param fileSize Set to the size of the file in bytes.
+ * @return Zero on success, or nonzero if the size overflows.
+ */
+static int netFileLayout(size_t layers,
+                         const uint64_t *layerSizes,
+                         size_t *weightOffsets,
+                         size_t *biasOffsets,
+                         size_t *fileSize)
+{
+    size_t offset = sizeof(NetFileHeader);
+    if (netFileAddSection(&offset, layers * sizeof(uint64_t)) != 0)
+    {
+        return -1;
+    }
+    for (size_t i = 0; i < layers - 1; ++i)
+    {
+        if (weightOffsets != NULL)
+        {
+            weightOffsets[i] = offset;
+        }
+        size_t bytes;
+        if (__builtin_mul_overflow(layerSizes[i + 1], layerSizes[i], &bytes) ||
+            __builtin_mul_overflow(bytes, sizeof(float), &bytes) ||
+            netFileAddSection(&offset, bytes) != 0)
+        {
+            return -1;
+        }
+
+        if (biasOffsets != NULL)
+        {
+            biasOffsets[i] = offset;
+        }
+        if (__builtin_mul_overflow(layerSizes[i + 1], sizeof(float), &bytes) ||
+            netFileAddSection(&offset, bytes) != 0)
+        {
+            return -1;
+        }
+    }
+    *fileSize = offset;
+
+    return 0;
+}
+
+/**
+ * @brief Hashes the body of a model file with FNV-1a over 64 bit words.
+ *        Sections are aligned, so the body is always a whole number of words.
+ *
+ * @param data The body of the file, following the header.
+ * @param bytes The size of the body.
+ * @return The checksum.
+ */
+static uint64_t netFileChecksum(const unsigned char *data, size_t bytes)
+{
+    uint64_t hash = NET_FILE_HASH_BASIS;
+    for (size_t i = 0; i + sizeof(uint64_t) <= bytes; i += sizeof(uint64_t))
+    {
+        uint64_t word;
+        memcpy(&word, &data[i], sizeof(uint64_t));
+        hash = (hash ^ word) * NET_FILE_HASH_PRIME;
+    }
+
+    return hash;
+}
+
+/**
+ * @brief Saves a neural network to a versioned binary model file. Values are
+ *        stored in the byte order of the host.
+ *
+ * @param net An initialized neural network.
+ * @param fileName The path of the file.
+ * @return Zero on success, or nonzero if the file could not be written.
+ */
+int netSave(NeuralNet *net, const char *fileName)
+{
+    if (net->layers < 2)
+    {
+        fprintf(stderr, "Error: Cannot save a network of %lu layers\n", net->layers);
+        return -1;
+    }
+
+    uint64_t *layerSizes = (uint64_t *)malloc(net->layers * sizeof(uint64_t));
+    for (size_t i = 0; i < net->layers; ++i)
+    {
+        layerSizes[i] = net->layerSizes[i];
+    }
+
+    size_t *weightOffsets = (size_t *)malloc((net->layers - 1) * sizeof(size_t));
+    size_t *biasOffsets = (size_t *)malloc((net->layers - 1) * sizeof(size_t));
+    size_t fileSize;
+    if (netFileLayout(net->layers, layerSizes, weightOffsets, biasOffsets, &fileSize) != 0)
+    {
+        fprintf(stderr, "Error: Cannot lay out a network this large\n");
+        free(biasOffsets);
+        free(weightOffsets);
+        free(layerSizes);
+        return -1;
+    }
+
+    // Assemble the whole file so the padding is zeroed and the checksum can be
+    // taken before anything is written.
+    unsigned char *file = (unsigned char *)calloc(fileSize, 1);
+    memcpy(&file[sizeof(NetFileHeader)], layerSizes, net->layers * sizeof(uint64_t));
+    memcpy(&file[weightOffsets[0]], net->parameters, net->parameterCount * sizeof(float));
+
+    NetFileHeader header;
+    memset(&header, 0, sizeof(NetFileHeader));
+    memcpy(header.magic, NET_FILE_MAGIC, sizeof(header.magic));
+    header.version = NET_FILE_VERSION;
+    header.layers = (uint32_t)net->layers;
+    header.output = (uint32_t)net->output;
+    header.dataSize = fileSize - sizeof(NetFileHeader);
+    header.checksum = netFileChecksum(&file[sizeof(NetFileHeader)], header.dataSize);
+    memcpy(file, &header, sizeof(NetFileHeader));
+
+    int result = 0;
+    FILE *stream = fopen(fileName, "wb");
+    if (stream == NULL)
+    {
+        fprintf(stderr, "Error: Cannot open %s for writing\n", fileName);
+        result = -1;
+    }
+    else
+    {
+        if (fwrite(file, 1, fileSize, stream) != fileSize)
+        {
+            fprintf(stderr, "Error: Cannot write %s\n", fileName);
+            result = -1;
+        }
+        if (fclose(stream) != 0)
+        {
+            fprintf(stderr, "Error: Cannot close %s\n", fileName);
+            result = -1;
+        }
+    }
+
+    free(file);
+    free(biasOffsets);
+    free(weightOffsets);
+    free(layerSizes);
+
+    return result;
+}
+
+/**
+ * @brief Loads a neural network from a model file into newly allocated
+ *        memory. The checksum is always verified.
+ *
+ * @param net An uninitialized neural network.
+ * @param fileName The path of the file.
+ * @return Zero on success, or nonzero if the file is invalid.
+ */
+int netLoad(NeuralNet *net, const char *fileName)
+{
+    NeuralNet mapped;
+    if (netMap(&mapped, fileName, 1) != 0)
+    {
+        return -1;
+    }
+
+    netInit(net, mapped.layers, mapped.layerSizes, NULL, NULL, NULL);
+    net->output = mapped.output;
+    netCopyParameters(net, &mapped);
+    netFree(&mapped);
+
+    return 0;
+}
+
+/**
+ * @brief Memory maps a model file and points the weights and biases of a
+ *        neural network at it. Nothing is copied, so pages are only read when
+ *        first used. The mapping is read-only: the network can predict and
+ *        test but must not be trained. netFree unmaps the file.
+ *
+ * @param net An uninitialized neural network.
+ * @param fileName The path of the file.
+ * @param verify Nonzero to verify the checksum, which reads the whole file.
+ *               Truncation is detected either way.
+ * @return Zero on success, or nonzero if the file is invalid.
+ */
+int netMap(NeuralNet *net, const char *fileName, int verify)
+{
+    memset(net, 0, sizeof(NeuralNet));
+
+    int descriptor = open(fileName, O_RDONLY);
+    if (descriptor < 0)
+    {
+        fprintf(stderr, "Error: Cannot open %s\n", fileName);
+        return -1;
+    }
+
+    struct stat status;
+    if (fstat(descriptor, &status) != 0 || (size_t)status.st_size < sizeof(NetFileHeader))
+    {
+        fprintf(stderr, "Error: %s is too small for a model header\n", fileName);
+        close(descriptor);
+        return -1;
+    }
+
+    size_t mappingSize = (size_t)status.st_size;
+    void *mapping = mmap(NULL, mappingSize, PROT_READ, MAP_SHARED, descriptor, 0);
+    close(descriptor);
+    if (mapping == MAP_FAILED)
+    {
+        fprintf(stderr, "Error: Cannot map %s\n", fileName);
+        return -1;
+    }
+
+    const unsigned char *file = (const unsigned char *)mapping;
+    NetFileHeader header;
+    memcpy(&header, file, sizeof(NetFileHeader));
+    if (memcmp(header.magic, NET_FILE_MAGIC, sizeof(header.magic)) != 0 ||
+        header.version != NET_FILE_VERSION ||
+        header.layers < 2 ||
+        header.output > NET_OUTPUT_SOFTMAX)
+    {
+        fprintf(stderr, "Error: %s is not a version %d model file\n", fileName, NET_FILE_VERSION);
+        munmap(mapping, mappingSize);
+        return -1;
+    }
+
+    size_t layers = header.layers;
+    const uint64_t *layerSizes = (const uint64_t *)&file[sizeof(NetFileHeader)];
+    if (mappingSize - sizeof(NetFileHeader) < layers * sizeof(uint64_t))
+    {
+        fprintf(stderr, "Error: %s has a truncated layer table\n", fileName);
+        munmap(mapping, mappingSize);
+        return -1;
+    }
+    for (size_t i = 0; i < layers; ++i)
+    {
+        if (layerSizes[i] == 0 || layerSizes[i] > UINT32_MAX)
+        {
+            fprintf(stderr, "Error: %s has an invalid size for layer %lu\n", fileName, i);
+            munmap(mapping, mappingSize);
+            return -1;
+        }
+    }
+
+    size_t *weightOffsets = (size_t *)malloc((layers - 1) * sizeof(size_t));
+    size_t *biasOffsets = (size_t *)malloc((layers - 1) * sizeof(size_t));
+    size_t fileSize;
+    if (netFileLayout(layers, layerSizes, weightOffsets, biasOffsets, &fileSize) != 0)
+    {
+        fprintf(stderr, "Error: %s has layers too large to address\n", fileName);
+        free(weightOffsets);
+        free(biasOffsets);
+        munmap(mapping, mappingSize);
+        return -1;
+    }
+    if (header.dataSize != fileSize - sizeof(NetFileHeader) || mappingSize < fileSize)
+    {
+        fprintf(stderr,
+                "Error: %s holds %lu bytes but its layers need %lu\n",
+                fileName, mappingSize, fileSize);
+        free(weightOffsets);
+        free(biasOffsets);
+        munmap(mapping, mappingSize);
+        return -1;
+    }
+    if (verify && netFileChecksum(&file[sizeof(NetFileHeader)], header.dataSize) != header.checksum)
+    {
+        fprintf(stderr, "Error: %s does not match its checksum\n", fileName);
+        free(weightOffsets);
+        free(biasOffsets);
+        munmap(mapping, mappingSize);
+        return -1;
+    }
+
+    // The matrices are views of the mapping. Their elements are never freed.
+    net->layers = layers;
+    net->output = (NetOutput)header.output;
+    net->layerSizes = (size_t *)malloc(layers * sizeof(size_t));
+    for (size_t i = 0; i < layers; ++i)
+    {
+        net->layerSizes[i] = layerSizes[i];
+    }
+    net->weights = (Matrix *)malloc((layers - 1) * sizeof(Matrix));
+    net->biases = (Matrix *)malloc((layers - 1) * sizeof(Matrix));
+    for (size_t i = 0; i < layers - 1; ++i)
+    {
+        net->weights[i] = matView((float *)&file[weightOffsets[i]],
+                                  net->layerSizes[i + 1],
+                                  net->layerSizes[i],
+                                  net->layerSizes[i]);
+        net->biases[i] = matView((float *)&file[biasOffsets[i]], net->layerSizes[i + 1], 1, 1);
+    }
+    net->parameters = (float *)&file[weightOffsets[0]];
+    net->parameterCount = (fileSize - weightOffsets[0]) / sizeof(float);
+    net->mapping = mapping;
+    net->mappingSize = mappingSize;
+
+    free(weightOffsets);
+    free(biasOffsets);
+
+    return 0;
+}
@@ -0,0 +1,30 @@
+#ifndef NET_IO_H
+#define NET_IO_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "neural_net.h"
+
+#define NET_FILE_MAGIC "NNETMODL"
+#define NET_FILE_VERSION 1
+
+// Every section of a model file starts on this boundary.
+#define NET_FILE_ALIGNMENT 64
+
+typedef struct
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t layers;
+    uint64_t dataSize;
+    uint64_t checksum;
+    uint32_t output;
+    unsigned char reserved[28];
+}
+NetFileHeader;
+
+int netSave(NeuralNet *net, const char *fileName);
+int netLoad(NeuralNet *net, const char *fileName);
+int netMap(NeuralNet *net, const char *fileName, int verify);
+
+#endif
@@ -1,26 +1,111 @@
 #include "neural_net.h"
 #include "matrix.h"
+#include "thread_pool.h"
+#include "dataset.h"
+#include "prefetch.h"
+#include "activation.h"
+#include "cost.h"
 #include <math.h>
+#include <stdatomic.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
 #include <time.h>
 
+// Backpropagation and prediction take either dense or sparse features. They 
+// are defined with their public dense wrappers below.
+static void netBackpropInput(NeuralNet *net,
+                             Matrix *features,
+                             SparseMatrix *sparseFeatures,
+                             Matrix *labels,
+                             NetActivationFunc activation,
+                             NetActivationDerivFunc activationDeriv,
+                             NetCostFunc costDeriv,
+                             NetWorkspace *workspace);
+static Matrix *netPredictInput(NeuralNet *net,
+                               Matrix *features,
+                               SparseMatrix *sparseFeatures,
+                               NetActivationFunc activation,
+                               NetWorkspace *workspace);
+
+/**
+ * @brief Lays out the weights and biases of every layer in one slab: the 
+ *        weights then the biases of each layer in turn, each starting on a 
+ *        64 byte boundary. This is also the layout of the body of a model 
+ *        file, and of the gradients in a workspace.
+ *
+ * @param layers The number of layers.
+ * @param layerSizes The number of neurons in each layer.
+ * @param slab The slab, or NULL to only measure the layout.
+ * @param weights Set to views of the weights of each layer, or NULL.
+ * @param biases Set to views of the biases of each layer, or NULL.
+ * @return The number of floats in the slab, padding included.
+ */
+static size_t netParameterLayout(size_t layers,
+                                 const size_t *layerSizes,
+                                 float *slab,
+                                 Matrix *weights,
+                                 Matrix *biases)
+{
+    size_t offset = 0;
+    for (size_t i = 0; i < layers - 1; ++i)
+    {
+        size_t weightCount = layerSizes[i + 1] * layerSizes[i];
+        if (weights != NULL)
+        {
+            weights[i] = matView(slab + offset, layerSizes[i + 1], layerSizes[i], layerSizes[i]);
+        }
+        offset += (weightCount + 15) & ~(size_t)15;
+
+        if (biases != NULL)
+        {
+            biases[i] = matView(slab + offset, layerSizes[i + 1], 1, 1);
+        }
+        offset += (layerSizes[i + 1] + 15) & ~(size_t)15;
+    }
+
+    return offset;
+}
+
 /**
  * @brief Initializes a neural network by allocating memory for the weights and 
- *        biases.
+ *        biases. Every weight and bias matrix is a view of one zeroed, 64 byte 
+ *        aligned parameter slab, so the whole model can be updated, reduced or 
+ *        copied in a single pass.
  *
  * @param net An uninitialized neural network.
  * @param layers A number of layers, including the input and output layers.
  * @param layerSizes A number of neurons for each layer.
  * @param initWeights An initialization function for the weights.
  * @param initBiases An initialization function for the baises.
+ * @param options The seed and threads for the initialization functions, or 
+ *                NULL for the defaults. Each weight and bias matrix gets its 
+ *                own random stream of the seed, so the same seed always gives 
+ *                the same network.
  */
 void netInit(NeuralNet *net,
              size_t layers,
              size_t *layerSizes,
              NetInitFunc initWeights,
-             NetInitFunc initBiases)
+             NetInitFunc initBiases,
+             const InitOptions *options)
 {
+    InitOptions defaults;
+    if (options == NULL)
+    {
+        initOptionsInit(&defaults);
+        options = &defaults;
+    }
+
     net->layers = layers;
+    net->precision = NET_FLOAT32;
+    net->output = NET_OUTPUT_ACTIVATION;
+    net->halfWeights = NULL;
+    net->mapping = NULL;
+    net->mappingSize = 0;
+    net->trainThreads = 0;
+    net->testThreads = 0;
     net->layerSizes = (size_t *)malloc(layers * sizeof(size_t));
     for (size_t i = 0; i < layers; ++i)
     {
@@ -29,34 +114,44 @@ void netInit(NeuralNet *net,
 
     net->weights = (Matrix *)malloc((layers - 1) * sizeof(Matrix));
     net->biases = (Matrix *)malloc((layers - 1) * sizeof(Matrix));
+    net->parameterCount = netParameterLayout(layers, layerSizes, NULL, NULL, NULL);
+    net->parameters = (float *)aligned_alloc(64, net->parameterCount * sizeof(float));
+    memset(net->parameters, 0, net->parameterCount * sizeof(float));
+    profileAlloc(net->parameterCount * sizeof(float));
+    netParameterLayout(layers, layerSizes, net->parameters, net->weights, net->biases);
     for (size_t i = 0; i < layers - 1; ++i)
     {
-        matInit(&net->weights[i], layerSizes[i + 1], layerSizes[i]);
-        matInit(&net->biases[i], layerSizes[i + 1], 1);
-        
+        InitParams params = {options->seed, 2 * i, layerSizes[i], layerSizes[i + 1], options->threads};
         if (initWeights != NULL)
         {
-            initWeights(&net->weights[i]);
+            initWeights(&net->weights[i], &params);
         }
+        params.stream = 2 * i + 1;
         if (initBiases != NULL)
         {
-            initBiases(&net->biases[i]);
+            initBiases(&net->biases[i], &params);
         }
     }
 }
 
 /**
- * @brief Frees the memory of a neural network.
+ * @brief Frees the memory of a neural network, or unmaps its model file if it
+ *        was mapped.
  *
  * @param net An initialized neural network.
  */
 void netFree(NeuralNet *net)
 {
+    netSetPrecision(net, NET_FLOAT32);
     free(net->layerSizes);
-    for (size_t i = 0; i < net->layers - 1; ++i)
+    if (net->mapping != NULL)
+    {
+        munmap(net->mapping, net->mappingSize);
+    }
+    else
     {
-        matFree(&net->weights[i]);
-        matFree(&net->biases[i]);
+        profileFree(net->parameterCount * sizeof(float));
+        free(net->parameters);
     }
     free(net->weights);
     free(net->biases);
@@ -65,10 +160,378 @@ void netFree(NeuralNet *net)
     net->layerSizes = NULL;
     net->weights = NULL;
     net->biases = NULL;
+    net->parameters = NULL;
+    net->parameterCount = 0;
+    net->mapping = NULL;
+    net->mappingSize = 0;
+}
+
+/**
+ * @brief Stores the weights of a neural network in half precision for the 
+ *        forward and backward passes, halving the memory they stream. The 
+ *        float weights stay as the master copy: training updates them and 
+ *        then refreshes the half precision copy.
+ *
+ * @param net An initialized neural network.
+ * @param precision The storage for the weights used in matrix products.
+ */
+void netSetPrecision(NeuralNet *net, NetPrecision precision)
+{
+    if (net->halfWeights != NULL)
+    {
+        for (size_t i = 0; i < net->layers - 1; ++i)
+        {
+            halfMatFree(&net->halfWeights[i]);
+        }
+        free(net->halfWeights);
+        net->halfWeights = NULL;
+    }
+
+    net->precision = precision;
+    if (precision == NET_FLOAT32)
+    {
+        return;
+    }
+
+    HalfFormat format = precision == NET_FLOAT16 ? HALF_FLOAT16 : HALF_BFLOAT16;
+    net->halfWeights = (HalfMatrix *)malloc((net->layers - 1) * sizeof(HalfMatrix));
+    for (size_t i = 0; i < net->layers - 1; ++i)
+    {
+        Matrix *weights = &net->weights[i];
+        halfMatInit(&net->halfWeights[i], format, weights->rows, weights->columns);
+        halfFromFloats(format, weights->elements, net->halfWeights[i].elements, weights->rows * weights->columns);
+    }
+}
+
+/**
+ * @brief Refreshes the half precision copy of the weights in a range of the 
+ *        parameter slab from the master copy. Does nothing for float storage.
+ *
+ * @param net An initialized neural network.
+ * @param start The first element of the slab to refresh.
+ * @param end One past the last element to refresh.
+ */
+static void netSyncWeights(NeuralNet *net, size_t start, size_t end)
+{
+    if (net->halfWeights == NULL)
+    {
+        return;
+    }
+
+    for (size_t i = 0; i < net->layers - 1; ++i)
+    {
+        Matrix *weights = &net->weights[i];
+        size_t weightStart = (size_t)(weights->elements - net->parameters);
+        size_t weightEnd = weightStart + weights->rows * weights->columns;
+        size_t first = start > weightStart ? start : weightStart;
+        size_t last = end < weightEnd ? end : weightEnd;
+        if (first < last)
+        {
+            HalfMatrix *half = &net->halfWeights[i];
+            halfFromFloats(half->format,
+                           &net->parameters[first],
+                           &half->elements[first - weightStart],
+                           last - first);
+        }
+    }
+}
+
+/**
+ * @brief Copies every weight and bias of a neural network into another with 
+ *        the same layer sizes, with one copy of the parameter slab. The half 
+ *        precision copy of the result, if any, is refreshed.
+ *
+ * @param result An initialized neural network to overwrite. It must not be 
+ *               mapped from a model file.
+ * @param net An initialized neural network.
+ */
+void netCopyParameters(NeuralNet *result, NeuralNet *net)
+{
+    if (result->parameterCount != net->parameterCount)
+    {
+        fprintf(stderr,
+                "Error: Cannot copy %lu parameters into %lu\n",
+                net->parameterCount, result->parameterCount);
+
+        return;
+    }
+
+    memcpy(result->parameters, net->parameters, net->parameterCount * sizeof(float));
+    netSyncWeights(result, 0, result->parameterCount);
+}
+
+/**
+ * @brief Multiplies a layer's weights by a matrix, reading the weights in 
+ *        their current storage.
+ */
+static void netMulWeights(NeuralNet *net, size_t layer, Matrix *result, Matrix *mat)
+{
+    if (net->halfWeights != NULL)
+    {
+        matMulHalfInto(result, &net->halfWeights[layer], mat);
+    }
+    else
+    {
+        matMulInto(result, &net->weights[layer], mat);
+    }
+}
+
+/**
+ * @brief Multiplies a layer's transposed weights by a matrix, reading the 
+ *        weights in their current storage.
+ */
+static void netMulWeightsTransA(NeuralNet *net, size_t layer, Matrix *result, Matrix *mat)
+{
+    if (net->halfWeights != NULL)
+    {
+        matMulHalfTransAInto(result, &net->halfWeights[layer], mat);
+    }
+    else
+    {
+        matMulTransAInto(result, &net->weights[layer], mat);
+    }
+}
+
+/**
+ * @brief Makes a batch of features the input activations. Sparse features 
+ *        have no dense copy, so the input only records the batch shape.
+ *
+ * @param net An initialized neural network.
+ * @param activationOutputs The activation outputs of a workspace.
+ * @param features A feature matrix, or NULL for sparse features.
+ * @param batchSize The number of samples in the batch.
+ */
+static void netSetInput(NeuralNet *net, Matrix *activationOutputs, Matrix *features, size_t batchSize)
+{
+    if (features != NULL)
+    {
+        activationOutputs[0] = *features;
+    }
+    else
+    {
+        activationOutputs[0] = matView(NULL, net->layerSizes[0], batchSize, batchSize);
+    }
+}
+
+/**
+ * @brief Multiplies a layer's weights by its input. The first layer 
+ *        multiplies sparse features through their nonzeros, reading the float 
+ *        master weights.
+ *
+ * @param net An initialized neural network.
+ * @param layer The index of the weights.
+ * @param result The activation inputs of the layer.
+ * @param mat The activation outputs of the previous layer.
+ * @param sparseFeatures Sparse features, or NULL for dense ones.
+ */
+static void netMulLayer(NeuralNet *net,
+                        size_t layer,
+                        Matrix *result,
+                        Matrix *mat,
+                        SparseMatrix *sparseFeatures)
+{
+    if (layer == 0 && sparseFeatures != NULL)
+    {
+        matMulSparseInto(result, &net->weights[0], sparseFeatures);
+    }
+    else
+    {
+        netMulWeights(net, layer, result, mat);
+    }
+}
+
+/**
+ * @brief Applies the activation of one layer. The last layer of a network 
+ *        with a softmax output takes the softmax of each column instead. The 
+ *        result may be the input.
+ *
+ * @param net An initialized neural network.
+ * @param layer The index of the weight matrix feeding the layer.
+ * @param activation An activation function.
+ * @param result The activation outputs.
+ * @param mat The activation inputs.
+ */
+static void netActivate(NeuralNet *net,
+                        size_t layer,
+                        NetActivationFunc activation,
+                        Matrix *result,
+                        Matrix *mat)
+{
+    if (net->output == NET_OUTPUT_SOFTMAX && layer == net->layers - 2)
+    {
+        actSoftmaxInto(result, mat);
+        return;
+    }
+    activation(result, mat);
+}
+
+/**
+ * @brief Reserves a 64 byte aligned region of a workspace arena.
+ *
+ * @param arena The arena, or NULL to only measure the layout.
+ * @param offset The current end of the arena. Moved past the region.
+ * @param bytes The size of the region.
+ * @return The region, or NULL when only measuring.
+ */
+static void *netWorkspaceCarve(char *arena, size_t *offset, size_t bytes)
+{
+    size_t start = (*offset + 63) & ~(size_t)63;
+    *offset = start + bytes;
+
+    return arena == NULL ? NULL : arena + start;
+}
+
+/**
+ * @brief Reserves a matrix in a workspace arena.
+ *
+ * @param mat A matrix to point at the region.
+ * @param arena The arena, or NULL to only measure the layout.
+ * @param offset The current end of the arena. Moved past the region.
+ * @param rows A number of rows.
+ * @param columns A number of columns.
+ */
+static void netWorkspaceCarveMatrix(Matrix *mat,
+                                    char *arena,
+                                    size_t *offset,
+                                    size_t rows,
+                                    size_t columns)
+{
+    float *elements = (float *)netWorkspaceCarve(arena, offset, rows * columns * sizeof(float));
+    if (mat != NULL)
+    {
+        *mat = matView(elements, rows, columns, columns);
+    }
+}
+
+/**
+ * @brief Lays out every buffer of a workspace in one arena. The same layout 
+ *        is used to measure and to build the workspace.
+ *
+ * @param workspace A workspace to fill in, or NULL to only measure.
+ * @param net An initialized neural network.
+ * @param maxBatchSize The largest number of samples in a mini batch.
+ * @param arena The arena, or NULL to only measure.
+ * @return The number of bytes in the arena.
+ */
+static size_t netWorkspaceLayout(NetWorkspace *workspace,
+                                 NeuralNet *net,
+                                 size_t maxBatchSize,
+                                 char *arena)
+{
+    size_t offset = 0;
+    size_t layers = net->layers;
+    Matrix *activationInputs = (Matrix *)netWorkspaceCarve(arena, &offset, (layers - 1) * sizeof(Matrix));
+    Matrix *activationOutputs = (Matrix *)netWorkspaceCarve(arena, &offset, layers * sizeof(Matrix));
+    Matrix *deltas = (Matrix *)netWorkspaceCarve(arena, &offset, (layers - 1) * sizeof(Matrix));
+    Matrix *weightGrads = (Matrix *)netWorkspaceCarve(arena, &offset, (layers - 1) * sizeof(Matrix));
+    Matrix *biasGrads = (Matrix *)netWorkspaceCarve(arena, &offset, (layers - 1) * sizeof(Matrix));
+
+    // The gradients mirror the parameter slab, so they can be reduced and 
+    // applied in one pass. The padding stays zero.
+    size_t gradCount = netParameterLayout(layers, net->layerSizes, NULL, NULL, NULL);
+    float *grads = (float *)netWorkspaceCarve(arena, &offset, gradCount * sizeof(float));
+    if (workspace != NULL)
+    {
+        workspace->activationInputs = activationInputs;
+        workspace->activationOutputs = activationOutputs;
+        workspace->deltas = deltas;
+        workspace->gradients = (NetGradients){weightGrads, biasGrads, grads, gradCount};
+        netParameterLayout(layers, net->layerSizes, grads, weightGrads, biasGrads);
+        activationOutputs[0] = matView(NULL, 0, 0, 0);
+    }
+
+    netWorkspaceCarveMatrix(workspace ? &workspace->features : NULL,
+                            arena, &offset, net->layerSizes[0], maxBatchSize);
+    netWorkspaceCarveMatrix(workspace ? &workspace->labels : NULL,
+                            arena, &offset, net->layerSizes[layers - 1], maxBatchSize);
+
+    // The sparse features have room for every feature of every sample, since 
+    // a single batch can be denser than its dataset.
+    size_t capacity = net->layerSizes[0] * maxBatchSize;
+    size_t *columnStarts = (size_t *)netWorkspaceCarve(arena, &offset, (maxBatchSize + 1) * sizeof(size_t));
+    uint32_t *rowIndices = (uint32_t *)netWorkspaceCarve(arena, &offset, capacity * sizeof(uint32_t));
+    float *values = (float *)netWorkspaceCarve(arena, &offset, capacity * sizeof(float));
+    if (workspace != NULL)
+    {
+        workspace->sparseFeatures = (SparseMatrix){net->layerSizes[0],
+                                                   0,
+                                                   capacity,
+                                                   columnStarts,
+                                                   rowIndices,
+                                                   values};
+    }
+
+    for (size_t i = 0; i < layers - 1; ++i)
+    {
+        size_t rows = net->layerSizes[i + 1];
+        netWorkspaceCarveMatrix(workspace ? &activationInputs[i] : NULL,
+                                arena, &offset, rows, maxBatchSize);
+        netWorkspaceCarveMatrix(workspace ? &activationOutputs[i + 1] : NULL,
+                                arena, &offset, rows, maxBatchSize);
+        netWorkspaceCarveMatrix(workspace ? &deltas[i] : NULL,
+                                arena, &offset, rows, maxBatchSize);
+    }
+
+    return (offset + 63) & ~(size_t)63;
+}
+
+/**
+ * @brief Measures the memory a workspace needs, without allocating it.
+ *
+ * @param net An initialized neural network.
+ * @param maxBatchSize The largest number of samples in a mini batch.
+ * @return The number of bytes in the workspace arena.
+ */
+size_t netWorkspaceSize(NeuralNet *net, size_t maxBatchSize)
+{
+    return netWorkspaceLayout(NULL, net, maxBatchSize, NULL);
+}
+
+/**
+ * @brief Allocates every intermediate buffer for training on mini batches of 
+ *        up to a maximum size. The buffers live in one aligned arena and are 
+ *        reused by every call to netBackprop.
+ *
+ * @param workspace An uninitialized workspace.
+ * @param net An initialized neural network.
+ * @param maxBatchSize The largest number of samples in a mini batch.
+ */
+void netWorkspaceInit(NetWorkspace *workspace, NeuralNet *net, size_t maxBatchSize)
+{
+    workspace->layers = net->layers;
+    workspace->maxBatchSize = maxBatchSize;
+    workspace->bytes = netWorkspaceSize(net, maxBatchSize);
+    workspace->arena = aligned_alloc(64, workspace->bytes);
+    profileAlloc(workspace->bytes);
+    memset(workspace->arena, 0, workspace->bytes);
+    netWorkspaceLayout(workspace, net, maxBatchSize, (char *)workspace->arena);
+    workspace->loss = 0.0f;
 }
 
 /**
- * @brief Predicts the label for a feature.
+ * @brief Frees the memory of a workspace.
+ *
+ * @param workspace An initialized workspace.
+ */
+void netWorkspaceFree(NetWorkspace *workspace)
+{
+    profileFree(workspace->bytes);
+    free(workspace->arena);
+
+    workspace->layers = 0;
+    workspace->maxBatchSize = 0;
+    workspace->bytes = 0;
+    workspace->arena = NULL;
+    workspace->activationInputs = NULL;
+    workspace->activationOutputs = NULL;
+    workspace->deltas = NULL;
+    workspace->gradients = (NetGradients){NULL, NULL, NULL, 0};
+    workspace->sparseFeatures = (SparseMatrix){0, 0, 0, NULL, NULL, NULL};
+}
+
+/**
+ * @brief Predicts the label for a feature. Each column of the feature matrix 
+ *        is a separate sample.
  *
  * @param net An initialized neural network.
  * @param features A feature matrix.
@@ -79,290 +542,1147 @@ Matrix netPredict(NeuralNet *net,
                   Matrix *features, 
                   NetActivationFunc activation)
 {
-    Matrix prediction = matCopy(features);
+    size_t maxHiddenSize = 0;
+    for (size_t i = 1; i + 1 < net->layers; ++i)
+    {
+        if (net->layerSizes[i] > maxHiddenSize)
+        {
+            maxHiddenSize = net->layerSizes[i];
+        }
+    }
+
+    // Hidden layers alternate between two buffers large enough for any of
+    // them. The output layer gets a matrix of its own size, so the caller
+    // frees exactly what was allocated.
+    Matrix current, next, output;
+    matInit(&current, maxHiddenSize, features->columns);
+    matInit(&next, maxHiddenSize, features->columns);
+    matInit(&output, net->layerSizes[net->layers - 1], features->columns);
+
+    uint64_t profileStart = profileBegin();
+    Matrix *input = features;
     for (size_t i = 0; i < net->layers - 1; ++i)
     {
-        Matrix mul = matMul(&net->weights[i], &prediction);
-        Matrix add = matAdd(&net->biases[i], &mul);
-        matFree(&prediction);
-        prediction = activation(&add);
-        
-        matFree(&mul);
-        matFree(&add);
+        Matrix *result = i == net->layers - 2 ? &output : &next;
+        result->rows = net->layerSizes[i + 1];
+        netMulWeights(net, i, result, input);
+        matAddColumnInto(result, result, &net->biases[i]);
+        netActivate(net, i, activation, result, result);
+
+        Matrix temp = current;
+        current = next;
+        next = temp;
+        input = &current;
     }
+    profileEndSection(PROFILE_FORWARD, profileStart);
+    current.rows = maxHiddenSize;
+    next.rows = maxHiddenSize;
+    matFree(&current);
+    matFree(&next);
 
-    return prediction;
+    return output;
 }
 
 /**
- * @brief Shuffles the order of the training data. Modifies the original arrays.
+ * @brief Shuffles the order the training samples are visited in with an 
+ *        unbiased Fisher-Yates shuffle. Only the order is modified; the 
+ *        samples stay in place.
  *
- * @param trainingFeats A set of training features.
- * @param trainingLabels A set of labels for each training features.
+ * @param order The indices of the training samples.
  * @param trainingSize The number of training samples.
+ * @param rng A seeded random number generator.
+ */
+void netShuffle(uint32_t *order, size_t trainingSize, Rng *rng)
+{
+    for (size_t i = trainingSize; i > 1; --i)
+    {
+        size_t j = rngBounded(rng, (uint32_t)i);
+
+        uint32_t temp = order[i - 1];
+        order[i - 1] = order[j];
+        order[j] = temp;
+    }
+}
+
+/**
+ * @brief Sets the default training options: the network's own thread count, 
+ *        synchronous, with a fixed shuffle seed, gathering its own batches and updating with 
+ *        plain gradient descent, without statistics or an epoch callback.
+ *
+ * @param options Uninitialized training options.
+ */
+void netTrainOptionsInit(NetTrainOptions *options)
+{
+    options->threads = 0;
+    options->async = 0;
+    options->seed = 0;
+    options->threadStats = NULL;
+    options->epochCallback = NULL;
+    options->epochArg = NULL;
+    options->prefetch = 0;
+    options->augment = NULL;
+    options->augmentArg = NULL;
+    optimizerOptionsInit(&options->optimizer, OPTIMIZER_SGD);
+}
+
+/**
+ * @brief Initializes an optimizer for the weights and biases of a neural 
+ *        network. The whole parameter slab is its only slot.
+ *
+ * @param optimizer An uninitialized optimizer.
+ * @param net An initialized neural network.
+ * @param options The optimizer options, or NULL for plain gradient descent.
+ * @param learningRate A learning rate.
+ */
+void netOptimizerInit(Optimizer *optimizer,
+                      NeuralNet *net,
+                      const OptimizerOptions *options,
+                      float learningRate)
+{
+    optimizerInit(optimizer, options, learningRate, 1, &net->parameterCount);
+}
+
+/**
+ * @brief Reads a monotonic clock.
+ *
+ * @return A time in seconds.
+ */
+static double netSeconds(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return now.tv_sec + now.tv_nsec * 1e-9;
+}
+
+/**
+ * @brief Applies one optimizer step to every weight and bias of a neural 
+ *        network in a single pass over the parameter and gradient slabs.
+ *
+ * @param net An initialized neural network.
+ * @param gradients The weight and bias gradients, summed over the batch.
+ * @param optimizer An optimizer initialized for the network.
+ * @param step The scalars of the step.
+ */
+static void netApplyGradients(NeuralNet *net,
+                              NetGradients *gradients,
+                              Optimizer *optimizer,
+                              const OptimizerStep *step)
+{
+    optimizerUpdate(optimizer, step, 0, net->parameters, gradients->elements, 0, net->parameterCount);
+    netSyncWeights(net, 0, net->parameterCount);
+}
+
+/**
+ * @brief Starts an optimizer step and applies it to the whole network.
+ *
+ * @param net An initialized neural network.
+ * @param gradients The weight and bias gradients, summed over the batch.
+ * @param optimizer An optimizer initialized for the network.
+ * @param batchSize The number of samples the gradients are summed over.
+ */
+static void netUpdate(NeuralNet *net, NetGradients *gradients, Optimizer *optimizer, size_t batchSize)
+{
+    uint64_t profileStart = profileBegin();
+    OptimizerStep step;
+    optimizerBeginStep(optimizer, batchSize, &step);
+    netApplyGradients(net, gradients, optimizer, &step);
+    profileEndSection(PROFILE_UPDATE, profileStart);
+}
+
+/**
+ * @brief The state shared by the threads training on one mini batch.
+ */
+typedef struct
+{
+    NeuralNet *net;
+    Dataset *dataset;
+    const uint32_t *indices;
+    size_t miniBatchSize;
+    NetActivationFunc activation;
+    NetActivationDerivFunc activationDeriv;
+    NetCostFunc costDeriv;
+    Optimizer *optimizer;
+    OptimizerStep step;
+    int sparse;
+    NetWorkspace *workspaces;
+    PrefetchBatch *prefetched;
+}
+NetParallelBatch;
+
+/**
+ * @brief Gathers a batch of samples into dense or sparse features, recording 
+ *        the time spent.
+ *
+ * @param dataset A dataset, with a sparse index for sparse features.
+ * @param indices The indices of the samples.
+ * @param count The number of samples.
+ * @param features A feature matrix, or NULL to gather sparse features.
+ * @param sparseFeatures A sparse feature matrix, used when features is NULL.
+ * @param labels A label matrix, or NULL to skip the labels.
+ */
+static void netGatherBatch(Dataset *dataset,
+                           const uint32_t *indices,
+                           size_t count,
+                           Matrix *features,
+                           SparseMatrix *sparseFeatures,
+                           Matrix *labels)
+{
+    uint64_t profileStart = profileBegin();
+    if (labels != NULL)
+    {
+        labels->columns = count;
+        labels->stride = count;
+    }
+    if (features != NULL)
+    {
+        features->columns = count;
+        features->stride = count;
+        datasetGather(dataset, indices, count, features, labels);
+    }
+    else
+    {
+        datasetGatherSparse(dataset, indices, count, sparseFeatures, labels);
+    }
+    profileEndSection(PROFILE_GATHER, profileStart);
+}
+
+/**
+ * @brief Finds the part of a range that belongs to one thread. The parts are 
+ *        contiguous and differ in size by at most one.
+ *
+ * @param size The size of the whole range.
+ * @param thread The index of the thread.
+ * @param threads The number of threads.
+ * @param start Set to the start of the part.
+ * @param end Set to the end of the part.
  */
-void netShuffle(Matrix *trainingFeats,
-                Matrix *trainingLabels,
-                size_t trainingSize)
+static void netShardRange(size_t size, size_t thread, size_t threads, size_t *start, size_t *end)
 {
-    srand(time(NULL));
-    for (size_t i = trainingSize - 1; i > 0; --i)
+    *start = size * thread / threads;
+    *end = size * (thread + 1) / threads;
+}
+
+/**
+ * @brief Runs backpropagation on one thread's share of a mini batch, leaving 
+ *        the summed gradients in that thread's workspace. The share is 
+ *        gathered here unless the loader thread already prefetched it.
+ *
+ * @param arg The shared mini batch state.
+ * @param thread The index of the thread.
+ * @param threads The number of threads.
+ */
+static void netBackpropShard(void *arg, size_t thread, size_t threads)
+{
+    NetParallelBatch *batch = (NetParallelBatch *)arg;
+    NetWorkspace *workspace = &batch->workspaces[thread];
+
+    Matrix *features = batch->sparse ? NULL : &workspace->features;
+    SparseMatrix *sparseFeatures = batch->sparse ? &workspace->sparseFeatures : NULL;
+    Matrix *labels = &workspace->labels;
+    if (batch->prefetched != NULL)
+    {
+        features = batch->sparse ? NULL : &batch->prefetched->features[thread];
+        sparseFeatures = batch->sparse ? &batch->prefetched->sparseFeatures[thread] : NULL;
+        labels = &batch->prefetched->labels[thread];
+    }
+    else
+    {
+        size_t start, end;
+        netShardRange(batch->miniBatchSize, thread, threads, &start, &end);
+        netGatherBatch(batch->dataset, &batch->indices[start], end - start, features, sparseFeatures, labels);
+    }
+    netBackpropInput(batch->net,
+                     features,
+                     sparseFeatures,
+                     labels,
+                     batch->activation,
+                     batch->activationDeriv,
+                     batch->costDeriv,
+                     workspace);
+}
+
+/**
+ * @brief Sums the gradients of every thread over one range of elements with a 
+ *        fixed pairwise tree, then applies the update to the parameters. The 
+ *        order of additions only depends on the number of threads, so results 
+ *        are reproducible.
+ *
+ * @param grads The gradient elements of each thread. The sum is left in the 
+ *              first.
+ * @param threads The number of threads.
+ * @param batch The shared mini batch state, holding the optimizer.
+ * @param slot The optimizer slot of the parameters.
+ * @param params The parameter elements.
+ * @param start The first element of the range.
+ * @param end The end of the range.
+ */
+static void netReduceUpdate(float **grads,
+                            size_t threads,
+                            NetParallelBatch *batch,
+                            size_t slot,
+                            float *params,
+                            size_t start,
+                            size_t end)
+{
+    uint64_t profileStart = profileBegin();
+    for (size_t stride = 1; stride < threads; stride *= 2)
+    {
+        for (size_t t = 0; t + stride < threads; t += 2 * stride)
+        {
+            float *sum = grads[t];
+            float *other = grads[t + stride];
+            for (size_t i = start; i < end; ++i)
+            {
+                sum[i] += other[i];
+            }
+        }
+    }
+
+    profileStart = profileEndSection(PROFILE_ACCUMULATE, profileStart);
+
+    optimizerUpdate(batch->optimizer, &batch->step, slot, params, grads[0], start, end);
+    profileEndSection(PROFILE_UPDATE, profileStart);
+}
+
+/**
+ * @brief Reduces the gradients of every thread and updates one thread's share 
+ *        of the parameter slab. The shares are whole cache lines, so threads 
+ *        never write to the same line.
+ *
+ * @param arg The shared mini batch state.
+ * @param thread The index of the thread.
+ * @param threads The number of threads.
+ */
+static void netReduceShard(void *arg, size_t thread, size_t threads)
+{
+    NetParallelBatch *batch = (NetParallelBatch *)arg;
+    NeuralNet *net = batch->net;
+
+    float *grads[threads];
+    for (size_t t = 0; t < threads; ++t)
+    {
+        grads[t] = batch->workspaces[t].gradients.elements;
+    }
+
+    // The slab is a whole number of 16 float lines.
+    size_t start, end;
+    netShardRange(net->parameterCount / 16, thread, threads, &start, &end);
+    netReduceUpdate(grads, threads, batch, 0, net->parameters, 16 * start, 16 * end);
+    netSyncWeights(net, 16 * start, 16 * end);
+}
+
+/**
+ * @brief Starts an optimizer step and applies it to the parts of a network a 
+ *        sparse batch touched: the first layer weights of the features that 
+ *        are nonzero in some sample, and every parameter past them. The other 
+ *        first layer gradients are zero, which plain gradient descent would 
+ *        add for nothing.
+ *
+ * @param net An initialized neural network.
+ * @param gradients The weight and bias gradients, summed over the batch.
+ * @param optimizer An optimizer initialized for the network. It must keep no 
+ *                  state, or skipped parameters would miss their decay.
+ * @param features The sparse features of the batch.
+ * @param touched One zeroed flag per feature, left zeroed.
+ * @param runs Room for one more than the number of features.
+ * @param batchSize The number of samples the gradients are summed over.
+ */
+static void netUpdateSparseInput(NeuralNet *net,
+                                 NetGradients *gradients,
+                                 Optimizer *optimizer,
+                                 SparseMatrix *features,
+                                 uint8_t *touched,
+                                 size_t *runs,
+                                 size_t batchSize)
+{
+    uint64_t profileStart = profileBegin();
+    OptimizerStep step;
+    optimizerBeginStep(optimizer, batchSize, &step);
+
+    // Merge the nonzero features into runs of adjacent columns, so each row 
+    // is updated with a few long calls.
+    for (size_t p = 0; p < features->columnStarts[features->columns]; ++p)
+    {
+        touched[features->rowIndices[p]] = 1;
+    }
+    size_t runCount = 0;
+    for (size_t j = 0; j < features->rows;)
+    {
+        if (!touched[j])
+        {
+            ++j;
+            continue;
+        }
+        runs[runCount++] = j;
+        while (j < features->rows && touched[j])
+        {
+            touched[j++] = 0;
+        }
+        runs[runCount++] = j;
+    }
+
+    Matrix *weights = &net->weights[0];
+    size_t weightStart = (size_t)(weights->elements - net->parameters);
+    for (size_t i = 0; i < weights->rows; ++i)
+    {
+        size_t row = weightStart + i * weights->stride;
+        for (size_t r = 0; r < runCount; r += 2)
+        {
+            optimizerUpdate(optimizer, &step, 0, net->parameters, gradients->elements,
+                            row + runs[r], row + runs[r + 1]);
+            netSyncWeights(net, row + runs[r], row + runs[r + 1]);
+        }
+    }
+
+    // The first layer biases and every later layer are small and dense.
+    size_t rest = (size_t)(net->biases[0].elements - net->parameters);
+    optimizerUpdate(optimizer, &step, 0, net->parameters, gradients->elements, rest, net->parameterCount);
+    netSyncWeights(net, rest, net->parameterCount);
+    profileEndSection(PROFILE_UPDATE, profileStart);
+}
+
+/**
+ * @brief The state shared by the threads of one asynchronous epoch.
+ */
+typedef struct
+{
+    NeuralNet *net;
+    Dataset *dataset;
+    const uint32_t *order;
+    size_t miniBatchSize;
+    NetActivationFunc activation;
+    NetActivationDerivFunc activationDeriv;
+    NetCostFunc costDeriv;
+    Optimizer *optimizer;
+    int sparse;
+    NetWorkspace *workspaces;
+    NetThreadStats *threadStats;
+    double *losses;
+    _Atomic size_t next;
+}
+NetAsyncEpoch;
+
+/**
+ * @brief Trains on mini batches claimed from a shared index until the epoch 
+ *        runs out, updating the weights and biases directly. Threads do not 
+ *        wait for each other, so they may read parameters that another thread 
+ *        is updating. This trades determinism for scaling (Hogwild). Sparse 
+ *        batches only update the first layer weights of their nonzero 
+ *        features.
+ *
+ * @param arg The shared epoch state.
+ * @param thread The index of the thread.
+ * @param threads The number of threads.
+ */
+static void netAsyncWorker(void *arg, size_t thread, size_t threads)
+{
+    NetAsyncEpoch *epoch = (NetAsyncEpoch *)arg;
+    NeuralNet *net = epoch->net;
+    NetWorkspace *workspace = &epoch->workspaces[thread];
+    NetGradients *gradients = &workspace->gradients;
+    double start = netSeconds();
+    double loss = 0.0;
+    size_t updates = 0, samples = 0;
+    uint8_t *touched = NULL;
+    size_t *runs = NULL;
+    if (epoch->sparse)
+    {
+        touched = (uint8_t *)calloc(net->layerSizes[0], sizeof(uint8_t));
+        runs = (size_t *)malloc((net->layerSizes[0] + 1) * sizeof(size_t));
+    }
+
+    for (;;)
+    {
+        size_t j = atomic_fetch_add_explicit(&epoch->next, epoch->miniBatchSize, memory_order_relaxed);
+        if (j >= epoch->dataset->samples)
+        {
+            break;
+        }
+        size_t batchSize = epoch->miniBatchSize;
+        if (j + batchSize > epoch->dataset->samples)
+        {
+            batchSize = epoch->dataset->samples - j;
+        }
+
+        Matrix *features = epoch->sparse ? NULL : &workspace->features;
+        SparseMatrix *sparseFeatures = epoch->sparse ? &workspace->sparseFeatures : NULL;
+        netGatherBatch(epoch->dataset, &epoch->order[j], batchSize, features, sparseFeatures, &workspace->labels);
+        netBackpropInput(net,
+                         features,
+                         sparseFeatures,
+                         &workspace->labels,
+                         epoch->activation,
+                         epoch->activationDeriv,
+                         epoch->costDeriv,
+                         workspace);
+
+        if (epoch->sparse)
+        {
+            netUpdateSparseInput(net, gradients, epoch->optimizer, sparseFeatures, touched, runs, batchSize);
+        }
+        else
+        {
+            netUpdate(net, gradients, epoch->optimizer, batchSize);
+        }
+
+        loss += workspace->loss;
+        ++updates;
+        samples += batchSize;
+    }
+    epoch->losses[thread] = loss;
+    free(touched);
+    free(runs);
+
+    if (epoch->threadStats != NULL)
     {
-        size_t j = rand() % (i + 1);
+        epoch->threadStats[thread].updates += updates;
+        epoch->threadStats[thread].samples += samples;
+        epoch->threadStats[thread].seconds += netSeconds() - start;
+    }
+}
 
-        Matrix tempFeat = trainingFeats[i];
-        trainingFeats[i] = trainingFeats[j];
-        trainingFeats[j] = tempFeat;
-        
-        Matrix tempLabel = trainingLabels[i];
-        trainingLabels[i] = trainingLabels[j];
-        trainingLabels[j] = tempLabel;
+/**
+ * @brief Calls the epoch callback of the training options, if there is one, 
+ *        with the time of the epoch and the profiling counters accumulated 
+ *        during it.
+ *
+ * @param options The training options.
+ * @param report A report holding the mean loss of the epoch and a profiling 
+ *               snapshot from the start of it.
+ * @param epoch The number of the epoch, starting from one.
+ * @param epochs The number of epochs.
+ * @param start The time the epoch started.
+ */
+static void netReportEpoch(NetTrainOptions *options,
+                           NetEpochReport *report,
+                           size_t epoch,
+                           size_t epochs,
+                           double start)
+{
+    if (options->epochCallback == NULL)
+    {
+        return;
     }
+
+    ProfileStats end;
+    profileSnapshot(&end);
+    profileDiff(&report->profile, &end, &report->profile);
+    report->epoch = epoch;
+    report->epochs = epochs;
+    report->seconds = netSeconds() - start;
+    options->epochCallback(report, options->epochArg);
 }
 
 /**
  * @brief Performs mini batch gradient descent.
  *
  * @param net An initialized neural network.
- * @param trainingFeats A set of training features.
- * @param trainingLabels A set of labels for each training features.
- * @param trainingSize The number of training samples.
+ * @param training A training dataset. Batches are gathered from it in an 
+ *                 order shuffled with the seed in the options.
  * @param activation An activation function.
- * @param activationDeriv The derivative of the activation function.
+ * @param activationDeriv The derivative of the activation function, in terms 
+ *                        of the activation output.
  * @param costDeriv The derivative of a cost function.
  * @param epochs A number of epochs.
  * @param miniBatchSize A number of training samples for each mini batch.
- * @param learningRate A learning rate.
+ * @param learningRate A learning rate for the optimizer in the options.
+ * @param options Training options, or NULL for the defaults. Zero threads 
+ *                means the network's training thread count. With more than 
+ *                one thread, each mini batch is split across the threads and 
+ *                their gradients are reduced before a single update. In 
+ *                asynchronous mode, each thread instead trains on whole mini 
+ *                batches and updates the parameters without synchronizing. 
+ *                Threads would race on the state of the other optimizers, so 
+ *                asynchronous mode only accepts plain gradient descent. 
+ *                When threadStats is set, it must hold one entry per thread 
+ *                and receives the updates, samples and time of each thread.
+ *                When epochCallback is set, it is called after each epoch
+ *                with the time and mean loss of the epoch and the profiling
+ *                counters accumulated during it. With prefetch, a loader thread
+ *                gathers and augments the next mini batch while the current
+ *                one trains. Asynchronous mode always gathers its own. The 
+ *                optimizer in the options applies every update, keeping its 
+ *                state from one mini batch to the next.
  */
 void netTrain(NeuralNet *net,
-              Matrix *trainingFeats,
-              Matrix *trainingLabels,
-              size_t trainingSize,
+              Dataset *training,
               NetActivationFunc activation,
-              NetActivationFunc activationDeriv,
+              NetActivationDerivFunc activationDeriv,
               NetCostFunc costDeriv,
               size_t epochs,
               size_t miniBatchSize,
-              float learningRate)
+              float learningRate,
+              NetTrainOptions *options)
 {
+    NetTrainOptions defaults;
+    if (options == NULL)
+    {
+        netTrainOptionsInit(&defaults);
+        options = &defaults;
+    }
+    size_t threads = options->threads > 0 ? options->threads : net->trainThreads;
+    if (threads == 0)
+    {
+        threads = 1;
+    }
+    int async = options->async && threads > 1;
+    if (async && options->optimizer.type != OPTIMIZER_SGD)
+    {
+        fprintf(stderr, "Error: Asynchronous training only supports plain gradient descent\n");
+
+        return;
+    }
+    if (!async && threads > miniBatchSize)
+    {
+        threads = miniBatchSize;
+    }
+    if (options->threadStats != NULL)
+    {
+        for (size_t i = 0; i < threads; ++i)
+        {
+            options->threadStats[i] = (NetThreadStats){0, 0, 0.0};
+        }
+    }
+
+    // Allocate every intermediate buffer once and reuse it for each batch. 
+    // Each thread gets its own workspace for its share of a mini batch, or for 
+    // whole mini batches when training asynchronously.
+    size_t shardSize = async ? miniBatchSize : (miniBatchSize + threads - 1) / threads;
+    NetWorkspace *workspaces = (NetWorkspace *)malloc(threads * sizeof(NetWorkspace));
+    for (size_t i = 0; i < threads; ++i)
+    {
+        netWorkspaceInit(&workspaces[i], net, shardSize);
+    }
+    ThreadPool pool;
+    if (threads > 1)
+    {
+        poolInit(&pool, threads);
+    }
+
+    // Shuffle a permutation of the samples rather than the samples. The 
+    // generator is seeded once, so each epoch gets a new order.
+    size_t trainingSize = training->samples;
+    uint32_t *order = (uint32_t *)malloc(trainingSize * sizeof(uint32_t));
+    for (size_t i = 0; i < trainingSize; ++i)
+    {
+        order[i] = (uint32_t)i;
+    }
+    Rng rng;
+    rngSeed(&rng, options->seed);
+    double losses[threads];
+
+    // The optimizer state persists across every mini batch of the call.
+    Optimizer optimizer;
+    netOptimizerInit(&optimizer, net, &options->optimizer, learningRate);
+
+    // A loader thread can gather the next mini batch, split into the same 
+    // shards as the threads, while the current one is trained on.
+    int prefetch = options->prefetch && !async;
+    Prefetcher prefetcher;
+
+    // Sparse datasets are gathered and multiplied through their nonzeros, 
+    // unless the loader thread augments the dense features.
+    int sparse = datasetIsSparse(training) && !(prefetch && options->augment != NULL);
+    if (prefetch)
+    {
+        prefetchInit(&prefetcher, training, miniBatchSize, threads, options->augment, options->augmentArg);
+    }
+
     for (size_t i = 1; i <= epochs; ++i)
     {
+        NetEpochReport report;
+        double epochStart = netSeconds();
+        double loss = 0.0;
+        if (options->epochCallback != NULL)
+        {
+            profileSnapshot(&report.profile);
+        }
+
         // Update the weights and biases for each mini batch.
-        netShuffle(trainingFeats, trainingLabels, trainingSize);
+        uint64_t profileStart = profileBegin();
+        netShuffle(order, trainingSize, &rng);
+        profileEndSection(PROFILE_SHUFFLE, profileStart);
+        if (async)
+        {
+            NetAsyncEpoch epoch = {net,
+                                   training,
+                                   order,
+                                   miniBatchSize,
+                                   activation,
+                                   activationDeriv,
+                                   costDeriv,
+                                   &optimizer,
+                                   sparse,
+                                   workspaces,
+                                   options->threadStats,
+                                   losses,
+                                   0};
+            poolRun(&pool, netAsyncWorker, &epoch);
+            for (size_t t = 0; t < threads; ++t)
+            {
+                loss += losses[t];
+            }
+            report.loss = loss / trainingSize;
+            netReportEpoch(options, &report, i, epochs, epochStart);
+            continue;
+        }
+
+        if (prefetch)
+        {
+            prefetchStart(&prefetcher, order, trainingSize);
+        }
+
+        double start = netSeconds();
         for (size_t j = 0; j < trainingSize; j += miniBatchSize)
         {
             // The mini batch size may not align with the number of training 
             // samples.
-            if (j + miniBatchSize > trainingSize)
+            size_t batchSize = miniBatchSize;
+            if (j + batchSize > trainingSize)
+            {
+                batchSize = trainingSize - j;
+            }
+
+            if (options->threadStats != NULL)
+            {
+                for (size_t t = 0; t < threads; ++t)
+                {
+                    size_t shardStart, shardEnd;
+                    netShardRange(batchSize, t, threads, &shardStart, &shardEnd);
+                    options->threadStats[t].updates += 1;
+                    options->threadStats[t].samples += shardEnd - shardStart;
+                }
+            }
+
+            PrefetchBatch *prefetched = prefetch ? prefetchNext(&prefetcher) : NULL;
+            if (threads == 1)
             {
-                miniBatchSize = trainingSize - j;
+                NetWorkspace *workspace = &workspaces[0];
+                Matrix *features = sparse ? NULL : &workspace->features;
+                SparseMatrix *sparseFeatures = sparse ? &workspace->sparseFeatures : NULL;
+                Matrix *labels = &workspace->labels;
+                if (prefetched != NULL)
+                {
+                    features = sparse ? NULL : &prefetched->features[0];
+                    sparseFeatures = sparse ? &prefetched->sparseFeatures[0] : NULL;
+                    labels = &prefetched->labels[0];
+                }
+                else
+                {
+                    netGatherBatch(training, &order[j], batchSize, features, sparseFeatures, labels);
+                }
+                netBackpropInput(net,
+                                 features,
+                                 sparseFeatures,
+                                 labels,
+                                 activation,
+                                 activationDeriv,
+                                 costDeriv,
+                                 workspace);
+                netUpdate(net, &workspace->gradients, &optimizer, batchSize);
+                loss += workspace->loss;
+                continue;
             }
 
-            netUpdateMiniBatch(net,
-                               &trainingFeats[j],
-                               &trainingLabels[j],
-                               miniBatchSize,
-                               activation,
-                               activationDeriv,
-                               costDeriv,
-                               learningRate);
+            NetParallelBatch batch = {net,
+                                      training,
+                                      &order[j],
+                                      batchSize,
+                                      activation,
+                                      activationDeriv,
+                                      costDeriv,
+                                      &optimizer,
+                                      {0},
+                                      sparse,
+                                      workspaces,
+                                      prefetched};
+            optimizerBeginStep(&optimizer, batchSize, &batch.step);
+            poolRun(&pool, netBackpropShard, &batch);
+            poolRun(&pool, netReduceShard, &batch);
+            for (size_t t = 0; t < threads; ++t)
+            {
+                loss += workspaces[t].loss;
+            }
         }
+
+        // Synchronous threads all take part in every update.
+        if (options->threadStats != NULL)
+        {
+            double seconds = netSeconds() - start;
+            for (size_t j = 0; j < threads; ++j)
+            {
+                options->threadStats[j].seconds += seconds;
+            }
+        }
+        report.loss = loss / trainingSize;
+        netReportEpoch(options, &report, i, epochs, epochStart);
+    }
+
+    free(order);
+    optimizerFree(&optimizer);
+    if (prefetch)
+    {
+        prefetchFree(&prefetcher);
+    }
+    if (threads > 1)
+    {
+        poolFree(&pool);
+    }
+    for (size_t i = 0; i < threads; ++i)
+    {
+        netWorkspaceFree(&workspaces[i]);
     }
+    free(workspaces);
 }
 
 /**
- * @brief Updates the weight and biases of a neural network based on the 
- *        average of the gradients from backpropagation. Modifies the neural 
- *        network.
+ * @brief Updates the weight and biases of a neural network with one 
+ *        optimizer step on the average of the gradients from 
+ *        backpropagation. The whole mini batch goes through a single batched 
+ *        backpropagation pass. Modifies the neural network.
  *
  * @param net An initialized neural network.
- * @param miniBatchFeats A set of features in a mini batch.
- * @param miniBatchLabels A set of labels for the features.
- * @param miniBatchSize The number of samples in the mini batch.
+ * @param features A feature matrix with one column per sample.
+ * @param labels The labels for the features.
  * @param activation An activation function.
- * @param activationDeriv The derivative of the activation function.
+ * @param activationDeriv The derivative of the activation function, in terms 
+ *                        of the activation output.
  * @param costDeriv The derivative of a cost function.
- * @param learningRate A learning rate.
+ * @param optimizer An optimizer initialized for the network with 
+ *                  netOptimizerInit. Its state is updated.
+ * @param workspace A workspace for at least as many samples as the features.
  */
 void netUpdateMiniBatch(NeuralNet *net,
-                        Matrix *miniBatchFeats,
-                        Matrix *miniBatchLabels,
-                        size_t miniBatchSize,
+                        Matrix *features,
+                        Matrix *labels,
                         NetActivationFunc activation,
-                        NetActivationFunc activationDeriv,
+                        NetActivationDerivFunc activationDeriv,
                         NetCostFunc costDeriv,
-                        float learningRate)
+                        Optimizer *optimizer,
+                        NetWorkspace *workspace)
 {
-    Matrix *weightGradientSums = (Matrix *)malloc((net->layers - 1) * sizeof(Matrix));
-    Matrix *biasGradientSums = (Matrix *)malloc((net->layers - 1) * sizeof(Matrix));
-    
+    netBackprop(net,
+                features,
+                labels,
+                activation,
+                activationDeriv,
+                costDeriv,
+                workspace);
+    netUpdate(net, &workspace->gradients, optimizer, features->columns);
+}
+
+/**
+ * @brief Performs the backpropagation algorithm on a batch of samples. Each 
+ *        column of the feature and label matrices is a separate sample. With 
+ *        sparse features, the first layer only multiplies through their 
+ *        nonzeros, both forward and for the weight gradient.
+ *
+ * @param net An initialized neural network.
+ * @param features A feature matrix, or NULL for sparse features.
+ * @param sparseFeatures A sparse feature matrix, used when features is NULL.
+ * @param labels The labels for the feature matrix.
+ * @param activation An activation function.
+ * @param activationDeriv The derivative of the activation function, in terms 
+ *                        of the activation output.
+ * @param costDeriv The derivative of a cost function. With a softmax output, 
+ *                  the cross entropy gradient is fused instead and this is 
+ *                  not used.
+ * @param workspace A workspace for at least as many samples as the features. 
+ *                  Its gradients are overwritten with the weight and bias 
+ *                  gradients for each layer, summed over the batch, and its 
+ *                  loss with the summed cross entropy for a softmax output or 
+ *                  half the squared error otherwise.
+ */
+static void netBackpropInput(NeuralNet *net,
+                             Matrix *features,
+                             SparseMatrix *sparseFeatures,
+                             Matrix *labels,
+                             NetActivationFunc activation,
+                             NetActivationDerivFunc activationDeriv,
+                             NetCostFunc costDeriv,
+                             NetWorkspace *workspace)
+{
+    size_t batchSize = features != NULL ? features->columns : sparseFeatures->columns;
+    Matrix *activationInputs = workspace->activationInputs;
+    Matrix *activationOutputs = workspace->activationOutputs;
+    Matrix *deltas = workspace->deltas;
+    NetGradients *gradients = &workspace->gradients;
+    netSetInput(net, activationOutputs, features, batchSize);
+
+    // Perform a forward pass and save the intermediate results.
+    uint64_t profileStart = profileBegin();
     for (size_t i = 0; i < net->layers - 1; ++i)
     {
-        matInit(&weightGradientSums[i], net->layerSizes[i + 1], net->layerSizes[i]);
-        matInit(&biasGradientSums[i], net->layerSizes[i + 1], 1);
+        activationInputs[i].columns = batchSize;
+        activationInputs[i].stride = batchSize;
+        activationOutputs[i + 1].columns = batchSize;
+        activationOutputs[i + 1].stride = batchSize;
+        deltas[i].columns = batchSize;
+        deltas[i].stride = batchSize;
+
+        netMulLayer(net, i, &activationInputs[i], &activationOutputs[i], sparseFeatures);
+        matAddColumnInto(&activationInputs[i], &activationInputs[i], &net->biases[i]);
+        netActivate(net, i, activation, &activationOutputs[i + 1], &activationInputs[i]);
     }
+    profileStart = profileEndSection(PROFILE_FORWARD, profileStart);
 
-    // Sum the gradients for each sample in the mini batch.
-    for (size_t i = 0; i < miniBatchSize; ++i)
+    // The activation inputs are not needed after the forward pass, so they 
+    // hold the activation derivatives. The derivatives are taken from the 
+    // saved outputs, so the activation is never evaluated again. A softmax 
+    // output with cross entropy has the fused delta of the prediction minus 
+    // the label, which needs no derivative at all.
+    Matrix *delta = &deltas[net->layers - 2];
+    Matrix *prediction = &activationOutputs[net->layers - 1];
+    if (net->output == NET_OUTPUT_SOFTMAX)
     {
-        NetGradients gradients = netBackprop(net,
-                                             &miniBatchFeats[i],
-                                             &miniBatchLabels[i],
-                                             activation,
-                                             activationDeriv,
-                                             costDeriv);
-
-        for (size_t j = 0; j < net->layers - 1; ++j)
-        {
-            Matrix newWeightSum = matAdd(&weightGradientSums[j], &gradients.weightGrads[j]);
-            Matrix newBiasSum = matAdd(&biasGradientSums[j], &gradients.biasGrads[j]);
-
-            matFree(&weightGradientSums[j]);
-            matFree(&biasGradientSums[j]);
-            weightGradientSums[j] = newWeightSum;
-            biasGradientSums[j] = newBiasSum;
-            
-            matFree(&gradients.weightGrads[j]);
-            matFree(&gradients.biasGrads[j]);
-        }
-        
-        free(gradients.weightGrads);
-        free(gradients.biasGrads);
+        workspace->loss = costSoftmaxCrossEntropyDeltaInto(delta, prediction, labels);
     }
-
-    // Update the weights and biases of the neural network.
-    for (size_t i = 0; i < net->layers - 1; ++i)
+    else
     {
-        Matrix weightGradientAvgs = matScalarMul(&weightGradientSums[i], learningRate / miniBatchSize);
-        Matrix biasGradientAvgs = matScalarMul(&biasGradientSums[i], learningRate / miniBatchSize);
-        Matrix newWeights = matSub(&net->weights[i], &weightGradientAvgs);
-        Matrix newBiases = matSub(&net->biases[i], &biasGradientAvgs);
+        workspace->loss = costSquaredErrSum(prediction, labels);
+        costDeriv(delta, prediction, labels);
+        activationDeriv(&activationInputs[net->layers - 2], prediction);
+        matElementMulInto(delta, delta, &activationInputs[net->layers - 2]);
+    }
 
-        matFree(&net->weights[i]);
-        matFree(&net->biases[i]);
-        net->weights[i] = newWeights;
-        net->biases[i] = newBiases;
+    // Perform a backward pass using the intermediate results.
+    for (size_t i = net->layers - 2; i < net->layers; --i)
+    {
+        delta = &deltas[i];
+        if (i < net->layers - 2)
+        {
+            netMulWeightsTransA(net, i + 1, delta, &deltas[i + 1]);
+            activationDeriv(&activationInputs[i], &activationOutputs[i + 1]);
+            matElementMulInto(delta, delta, &activationInputs[i]);
+        }
+        profileStart = profileEndSection(PROFILE_BACKWARD, profileStart);
 
-        matFree(&weightGradientAvgs);
-        matFree(&biasGradientAvgs);
-        matFree(&weightGradientSums[i]);
-        matFree(&biasGradientSums[i]);
+        if (i == 0 && sparseFeatures != NULL)
+        {
+            matMulSparseTransBInto(&gradients->weightGrads[i], delta, sparseFeatures);
+        }
+        else
+        {
+            matMulTransBInto(&gradients->weightGrads[i], delta, &activationOutputs[i]);
+        }
+        matRowSumInto(&gradients->biasGrads[i], delta);
+        profileStart = profileEndSection(PROFILE_ACCUMULATE, profileStart);
     }
-
-    free(weightGradientSums);
-    free(biasGradientSums);
 }
 
 /**
- * @brief Performs the backpropagation algorithm.
+ * @brief Performs the backpropagation algorithm on a batch of samples. Each 
+ *        column of the feature and label matrices is a separate sample.
  *
  * @param net An initialized neural network.
  * @param features A feature matrix.
- * @param label The label for the feature matrix.
+ * @param labels The labels for the feature matrix.
  * @param activation An activation function.
- * @param activationDeriv The derivative of the activation function.
- * @param costDeriv The derivative of a cost function.
- * @return Gradients of the weights and biases for each layer.
+ * @param activationDeriv The derivative of the activation function, in terms 
+ *                        of the activation output.
+ * @param costDeriv The derivative of a cost function. With a softmax output, 
+ *                  the cross entropy gradient is fused instead and this is 
+ *                  not used.
+ * @param workspace A workspace for at least as many samples as the features. 
+ *                  Its gradients are overwritten with the weight and bias 
+ *                  gradients for each layer, summed over the batch, and its 
+ *                  loss with the summed cross entropy for a softmax output or 
+ *                  half the squared error otherwise.
  */
-NetGradients netBackprop(NeuralNet *net,
-                         Matrix *features,
-                         Matrix *label,
-                         NetActivationFunc activation,
-                         NetActivationFunc activationDeriv,
-                         NetCostFunc costDeriv)
+void netBackprop(NeuralNet *net,
+                 Matrix *features,
+                 Matrix *labels,
+                 NetActivationFunc activation,
+                 NetActivationDerivFunc activationDeriv,
+                 NetCostFunc costDeriv,
+                 NetWorkspace *workspace)
 {
-    Matrix *weightGradients = (Matrix *)malloc((net->layers - 1) * sizeof(Matrix));
-    Matrix *biasGradients = (Matrix *)malloc((net->layers - 1) * sizeof(Matrix));
-    
-    Matrix act = matCopy(features);
-    Matrix *activationOutputs = (Matrix *)malloc(net->layers * sizeof(Matrix));
-    activationOutputs[0] = act;
-    Matrix *activationInputs = (Matrix *)malloc((net->layers - 1) * sizeof(Matrix));
+    netBackpropInput(net,
+                     features,
+                     NULL,
+                     labels,
+                     activation,
+                     activationDeriv,
+                     costDeriv,
+                     workspace);
+}
 
-    // Perform a forward pass and save the intermediate results.
-    for (size_t i = 0; i < net->layers - 1; ++i)
+/**
+ * @brief Predicts the labels of a batch of dense or sparse features with one 
+ *        matrix multiplication per layer. Nothing is allocated: the 
+ *        predictions are written to the workspace.
+ *
+ * @param net An initialized neural network.
+ * @param features A matrix with one column per sample, and no more columns 
+ *                 than the maximum batch size of the workspace, or NULL for 
+ *                 sparse features.
+ * @param sparseFeatures A sparse matrix with one column per sample, used when 
+ *                       features is NULL.
+ * @param activation An activation function.
+ * @param workspace A workspace for the neural network.
+ * @return The predictions, one column per sample. Valid until the workspace 
+ *         is next used.
+ */
+static Matrix *netPredictInput(NeuralNet *net,
+                               Matrix *features,
+                               SparseMatrix *sparseFeatures,
+                               NetActivationFunc activation,
+                               NetWorkspace *workspace)
+{
+    size_t batchSize = features != NULL ? features->columns : sparseFeatures->columns;
+    if (batchSize > workspace->maxBatchSize)
     {
-        Matrix mul = matMul(&net->weights[i], &act);
-        Matrix add = matAdd(&mul, &net->biases[i]);
-        
-        activationInputs[i] = add;
-        act = activation(&add);
-        activationOutputs[i + 1] = act;
+        fprintf(stderr,
+                "Error: Cannot predict %lu samples with a workspace for %lu\n",
+                batchSize, workspace->maxBatchSize);
 
-        matFree(&mul);
+        return NULL;
     }
-    
-    Matrix costDerivOutput = costDeriv(&activationOutputs[net->layers - 1], label);
-    Matrix actDeriv = activationDeriv(&activationInputs[net->layers - 2]);
-    Matrix delta = matElementMul(&costDerivOutput, &actDeriv);
-    biasGradients[net->layers - 2] = delta;
-    Matrix transpose = matTranspose(&activationOutputs[net->layers - 2]);
-    weightGradients[net->layers - 2] = matMul(&delta, &transpose);
-
-    matFree(&costDerivOutput);
-    matFree(&actDeriv);
-    matFree(&transpose);
 
-    // Perform a backward pass using the intermediate results.
-    for (size_t i = net->layers - 3; i < net->layers; --i)
+    // Only the outputs are kept, so the activation is applied in place.
+    uint64_t profileStart = profileBegin();
+    Matrix *activationOutputs = workspace->activationOutputs;
+    netSetInput(net, activationOutputs, features, batchSize);
+    for (size_t i = 0; i < net->layers - 1; ++i)
     {
-        actDeriv = activationDeriv(&activationInputs[i]);
-        Matrix weightTranspose = matTranspose(&net->weights[i + 1]);
-        Matrix mul = matMul(&weightTranspose, &delta);
-        delta = matElementMul(&mul, &actDeriv);
+        Matrix *output = &activationOutputs[i + 1];
+        output->columns = batchSize;
+        output->stride = batchSize;
+        netMulLayer(net, i, output, &activationOutputs[i], sparseFeatures);
+        matAddColumnInto(output, output, &net->biases[i]);
+        netActivate(net, i, activation, output, output);
+    }
+    profileEndSection(PROFILE_FORWARD, profileStart);
 
-        biasGradients[i] = delta;
-        transpose = matTranspose(&activationOutputs[i]);
-        weightGradients[i] = matMul(&delta, &transpose);
+    return &activationOutputs[net->layers - 1];
+}
 
-        matFree(&actDeriv);
-        matFree(&weightTranspose);
-        matFree(&mul);
-        matFree(&transpose);
-    }
+/**
+ * @brief Predicts the labels of a batch of features with one matrix 
+ *        multiplication per layer. Nothing is allocated: the predictions are 
+ *        written to the workspace.
+ *
+ * @param net An initialized neural network.
+ * @param features A matrix with one column per sample, and no more columns 
+ *                 than the maximum batch size of the workspace.
+ * @param activation An activation function.
+ * @param workspace A workspace for the neural network.
+ * @return The predictions, one column per sample. Valid until the workspace 
+ *         is next used.
+ */
+Matrix *netPredictBatch(NeuralNet *net,
+                        Matrix *features,
+                        NetActivationFunc activation,
+                        NetWorkspace *workspace)
+{
+    return netPredictInput(net, features, NULL, activation, workspace);
+}
 
-    for (size_t i = 0; i < net->layers - 1; ++i)
+/**
+ * @brief The state shared by the threads testing a dataset.
+ */
+typedef struct
+{
+    NeuralNet *net;
+    Dataset *testing;
+    NetActivationFunc activation;
+    NetWorkspace *workspaces;
+    size_t *correct;
+}
+NetParallelTest;
+
+/**
+ * @brief Counts the correct predictions over a contiguous shard of a testing 
+ *        dataset, one batch at a time.
+ */
+static void netTestShard(void *arg, size_t thread, size_t threads)
+{
+    NetParallelTest *test = (NetParallelTest *)arg;
+    NetWorkspace *workspace = &test->workspaces[thread];
+    Dataset *testing = test->testing;
+
+    size_t start, end;
+    netShardRange(testing->samples, thread, threads, &start, &end);
+
+    int sparse = datasetIsSparse(testing);
+    uint32_t indices[NET_TEST_BATCH_SIZE];
+    size_t classes[NET_TEST_BATCH_SIZE];
+    size_t correct = 0;
+    for (size_t i = start; i < end; i += NET_TEST_BATCH_SIZE)
     {
-        matFree(&activationOutputs[i]);
-        matFree(&activationInputs[i]);
+        size_t batchSize = end - i < NET_TEST_BATCH_SIZE ? end - i : NET_TEST_BATCH_SIZE;
+        for (size_t j = 0; j < batchSize; ++j)
+        {
+            indices[j] = (uint32_t)(i + j);
+        }
+
+        Matrix *features = sparse ? NULL : &workspace->features;
+        SparseMatrix *sparseFeatures = sparse ? &workspace->sparseFeatures : NULL;
+        netGatherBatch(testing, indices, batchSize, features, sparseFeatures, NULL);
+        Matrix *predictions = netPredictInput(test->net, features, sparseFeatures, test->activation, workspace);
+        matMaxColumnElements(predictions, classes);
+        for (size_t j = 0; j < batchSize; ++j)
+        {
+            if (classes[j] == testing->labels[i + j])
+            {
+                ++correct;
+            }
+        }
     }
-    matFree(&activationOutputs[net->layers - 1]);
-    free(activationOutputs);
-    free(activationInputs);
-    
-    return (NetGradients){weightGradients, biasGradients};
+    test->correct[thread] = correct;
 }
 
 /**
- * @brief Tests the accuracy of a neural network. Assumes the labels have a one
- *        hot encoding.
+ * @brief Tests the accuracy of a neural network on a dataset of class labels.
+ *        The dataset is split into one contiguous shard per thread, and each 
+ *        shard is predicted in batches.
  *
  * @param net An initialized neural network.
- * @param testingFeats A set of testing features.
- * @param testingLabels A set of testing labels for the features.
- * @param testingSize The number of test samples.
+ * @param testing A testing dataset.
  * @param activation An activation function.
+ * @param threads The number of threads to test with, or zero for the 
+ *                network's testing thread count.
  * @return The number of correct predictions.
  */
 size_t netTest(NeuralNet *net,
-              Matrix *testingFeats,
-              Matrix *testingLabels,
-              size_t testingSize,
-              NetActivationFunc activation)
+               Dataset *testing,
+               NetActivationFunc activation,
+               size_t threads)
 {
-    size_t correct = 0;
-    for (size_t i = 0; i < testingSize; ++i)
+    if (threads == 0)
     {
-        Matrix prediction = netPredict(net, &testingFeats[i], activation);
-        size_t predictionMax = matMaxElement(&prediction);
-        size_t labelMax = matMaxElement(&testingLabels[i]);
-        if (predictionMax == labelMax)
-        {
-            ++correct;
-        }
+        threads = net->testThreads > 0 ? net->testThreads : 1;
+    }
 
-        matFree(&prediction);
+    NetWorkspace *workspaces = (NetWorkspace *)malloc(threads * sizeof(NetWorkspace));
+    size_t *correct = (size_t *)malloc(threads * sizeof(size_t));
+    for (size_t i = 0; i < threads; ++i)
+    {
+        netWorkspaceInit(&workspaces[i], net, NET_TEST_BATCH_SIZE);
+    }
+
+    NetParallelTest test = {net, testing, activation, workspaces, correct};
+    if (threads == 1)
+    {
+        netTestShard(&test, 0, 1);
+    }
+    else
+    {
+        ThreadPool pool;
+        poolInit(&pool, threads);
+        poolRun(&pool, netTestShard, &test);
+        poolFree(&pool);
+    }
+
+    size_t total = 0;
+    for (size_t i = 0; i < threads; ++i)
+    {
+        total += correct[i];
+        netWorkspaceFree(&workspaces[i]);
     }
+    free(correct);
+    free(workspaces);
 
-    return correct;
+    return total;
 }
@@ -1,69 +1,169 @@
 #ifndef NEURAL_NET_H
 #define NEURAL_NET_H
 
+#include <stdint.h>
 #include <stdlib.h>
 #include "matrix.h"
+#include "random.h"
+#include "initialization.h"
+#include "dataset.h"
+#include "profile.h"
+#include "prefetch.h"
+#include "optimizer.h"
 
-typedef void (*NetInitFunc)(Matrix *);
-typedef Matrix (*NetActivationFunc)(Matrix *);
-typedef Matrix (*NetCostFunc)(Matrix *, Matrix *);
+// The number of samples predicted together when testing.
+#define NET_TEST_BATCH_SIZE 256
+
+typedef void (*NetInitFunc)(Matrix *, const InitParams *);
+typedef void (*NetActivationFunc)(Matrix *, Matrix *);
+// Takes the output of the activation, not its input, such as
+// actSigmoidDerivOutputInto. The output is const so that an activation, or a
+// derivative in terms of the input, does not convert to this type.
+typedef void (*NetActivationDerivFunc)(Matrix *, const Matrix *);
+typedef void (*NetCostFunc)(Matrix *, Matrix *, Matrix *);
+
+typedef enum
+{
+    NET_FLOAT32,
+    NET_FLOAT16,
+    NET_BFLOAT16
+}
+NetPrecision;
+
+typedef enum
+{
+    NET_OUTPUT_ACTIVATION,
+    NET_OUTPUT_SOFTMAX
+}
+NetOutput;
 
 typedef struct
 {
     size_t layers;
     size_t *layerSizes;
     Matrix *weights, *biases;
+    float *parameters;
+    size_t parameterCount;
+    NetPrecision precision;
+    NetOutput output;
+    HalfMatrix *halfWeights;
+    void *mapping;
+    size_t mappingSize;
+    // Thread counts that training and testing use when asked for zero, such 
+    // as tuned ones. Zero means one thread.
+    size_t trainThreads, testThreads;
 }
 NeuralNet;
 
 typedef struct
 {
     Matrix *weightGrads, *biasGrads;
+    float *elements;
+    size_t count;
 }
 NetGradients;
 
-void netShuffle(Matrix *trainingFeats,
-                Matrix *trainingLabels,
-                size_t trainingSize);
+typedef struct
+{
+    size_t layers, maxBatchSize, bytes;
+    void *arena;
+    Matrix features, labels;
+    SparseMatrix sparseFeatures;
+    Matrix *activationInputs, *activationOutputs, *deltas;
+    NetGradients gradients;
+    float loss;
+}
+NetWorkspace;
+
+typedef struct
+{
+    size_t updates, samples;
+    double seconds;
+}
+NetThreadStats;
+
+typedef struct
+{
+    size_t epoch, epochs;
+    double seconds;
+    double loss;
+    ProfileStats profile;
+}
+NetEpochReport;
+
+typedef void (*NetEpochFunc)(const NetEpochReport *report, void *arg);
+
+typedef struct
+{
+    size_t threads;
+    int async;
+    uint64_t seed;
+    NetThreadStats *threadStats;
+    NetEpochFunc epochCallback;
+    void *epochArg;
+    int prefetch;
+    PrefetchAugmentFunc augment;
+    void *augmentArg;
+    OptimizerOptions optimizer;
+}
+NetTrainOptions;
+
+void netShuffle(uint32_t *order, size_t trainingSize, Rng *rng);
 
 void netInit(NeuralNet *net,
              size_t layers,
              size_t *layerSizes,
              NetInitFunc initWeights,
-             NetInitFunc initBiases);
+             NetInitFunc initBiases,
+             const InitOptions *options);
 void netFree(NeuralNet *net);
+void netSetPrecision(NeuralNet *net, NetPrecision precision);
+void netCopyParameters(NeuralNet *result, NeuralNet *net);
+
+size_t netWorkspaceSize(NeuralNet *net, size_t maxBatchSize);
+void netWorkspaceInit(NetWorkspace *workspace, NeuralNet *net, size_t maxBatchSize);
+void netWorkspaceFree(NetWorkspace *workspace);
+
+void netTrainOptionsInit(NetTrainOptions *options);
+void netOptimizerInit(Optimizer *optimizer,
+                      NeuralNet *net,
+                      const OptimizerOptions *options,
+                      float learningRate);
 
 Matrix netPredict(NeuralNet *net,
                   Matrix *features,
                   NetActivationFunc activation);
 void netTrain(NeuralNet *net,
-              Matrix *trainingFeats,
-              Matrix *trainingLabels,
-              size_t trainingSize,
+              Dataset *training,
               NetActivationFunc activation,
-              NetActivationFunc activationDeriv,
+              NetActivationDerivFunc activationDeriv,
               NetCostFunc costDeriv,
               size_t epochs,
               size_t miniBatchSize,
-              float learningRate);
+              float learningRate,
+              NetTrainOptions *options);
 void netUpdateMiniBatch(NeuralNet *net,
-                        Matrix *miniBatchFeats,
-                        Matrix *miniBatchLabels,
-                        size_t miniBatchSize,
+                        Matrix *features,
+                        Matrix *labels,
                         NetActivationFunc activation,
-                        NetActivationFunc activationDeriv,
+                        NetActivationDerivFunc activationDeriv,
                         NetCostFunc costDeriv,
-                        float learningRate);
-NetGradients netBackprop(NeuralNet *net,
-                         Matrix *features,
-                         Matrix *label,
-                         NetActivationFunc activation,
-                         NetActivationFunc activationDeriv,
-                         NetCostFunc costDeriv);
+                        Optimizer *optimizer,
+                        NetWorkspace *workspace);
+void netBackprop(NeuralNet *net,
+                 Matrix *features,
+                 Matrix *labels,
+                 NetActivationFunc activation,
+                 NetActivationDerivFunc activationDeriv,
+                 NetCostFunc costDeriv,
+                 NetWorkspace *workspace);
+Matrix *netPredictBatch(NeuralNet *net,
+                        Matrix *features,
+                        NetActivationFunc activation,
+                        NetWorkspace *workspace);
 size_t netTest(NeuralNet *net,
-              Matrix *testingFeats,
-              Matrix *testingLabels,
-              size_t testingSize,
-              NetActivationFunc activation);
+               Dataset *testing,
+               NetActivationFunc activation,
+               size_t threads);
 
 #endif
@@ -0,0 +1,442 @@
+#include "optimizer.h"
+#include "profile.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#define OPTIMIZER_VECTOR 1
+#define OPTIMIZER_WIDTH 8
+typedef __m256 OptimizerVector;
+#define OPTIMIZER_LOAD _mm256_loadu_ps
+#define OPTIMIZER_STORE _mm256_storeu_ps
+#define OPTIMIZER_SET1 _mm256_set1_ps
+#define OPTIMIZER_ADD _mm256_add_ps
+#define OPTIMIZER_SUB _mm256_sub_ps
+#define OPTIMIZER_MUL _mm256_mul_ps
+#define OPTIMIZER_DIV _mm256_div_ps
+#define OPTIMIZER_SQRT _mm256_sqrt_ps
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define OPTIMIZER_VECTOR 1
+#define OPTIMIZER_WIDTH 4
+typedef __m128 OptimizerVector;
+#define OPTIMIZER_LOAD _mm_loadu_ps
+#define OPTIMIZER_STORE _mm_storeu_ps
+#define OPTIMIZER_SET1 _mm_set1_ps
+#define OPTIMIZER_ADD _mm_add_ps
+#define OPTIMIZER_SUB _mm_sub_ps
+#define OPTIMIZER_MUL _mm_mul_ps
+#define OPTIMIZER_DIV _mm_div_ps
+#define OPTIMIZER_SQRT _mm_sqrt_ps
+#endif
+
+// The floating point operations each optimizer spends on one parameter.
+static const uint64_t optimizerFlops[] = {2, 5, 7, 9, 14};
+
+// The number of state values each optimizer keeps for one parameter.
+static const size_t optimizerStates[] = {0, 1, 1, 1, 2};
+
+// The update kernels below read each parameter, gradient and state value
+// once and write them back in the same pass. The vector loops multiply and
+// add separately rather than fusing, so they round exactly like the scalar
+// tails and a parameter gets the same value wherever a range is split.
+
+/**
+ * @brief Plain gradient descent: p += -lr * scale * g.
+ *
+ * @param params The parameters to update.
+ * @param grads The summed gradients of the parameters.
+ * @param first Unused.
+ * @param second Unused.
+ * @param count The number of parameters.
+ * @param step The scalars of the update.
+ */
+static void optimizerSgd(float *params,
+                         const float *grads,
+                         float *first,
+                         float *second,
+                         size_t count,
+                         const OptimizerStep *step)
+{
+    float scale = -step->learningRate * step->gradScale;
+    size_t i = 0;
+#ifdef OPTIMIZER_VECTOR
+    OptimizerVector scaleVector = OPTIMIZER_SET1(scale);
+    for (; i + OPTIMIZER_WIDTH <= count; i += OPTIMIZER_WIDTH)
+    {
+        OptimizerVector g = OPTIMIZER_LOAD(&grads[i]);
+        OptimizerVector p = OPTIMIZER_LOAD(&params[i]);
+        OPTIMIZER_STORE(&params[i], OPTIMIZER_ADD(p, OPTIMIZER_MUL(scaleVector, g)));
+    }
+#endif
+    for (; i < count; ++i)
+    {
+        params[i] += scale * grads[i];
+    }
+}
+
+/**
+ * @brief Gradient descent with momentum: v = mu * v + g, p -= lr * v.
+ *
+ * @param params The parameters to update.
+ * @param grads The summed gradients of the parameters.
+ * @param first The velocities.
+ * @param second Unused.
+ * @param count The number of parameters.
+ * @param step The scalars of the update.
+ */
+static void optimizerMomentum(float *params,
+                              const float *grads,
+                              float *first,
+                              float *second,
+                              size_t count,
+                              const OptimizerStep *step)
+{
+    size_t i = 0;
+#ifdef OPTIMIZER_VECTOR
+    OptimizerVector learningRate = OPTIMIZER_SET1(step->learningRate);
+    OptimizerVector gradScale = OPTIMIZER_SET1(step->gradScale);
+    OptimizerVector momentum = OPTIMIZER_SET1(step->momentum);
+    for (; i + OPTIMIZER_WIDTH <= count; i += OPTIMIZER_WIDTH)
+    {
+        OptimizerVector g = OPTIMIZER_MUL(gradScale, OPTIMIZER_LOAD(&grads[i]));
+        OptimizerVector v = OPTIMIZER_ADD(OPTIMIZER_MUL(momentum, OPTIMIZER_LOAD(&first[i])), g);
+        OptimizerVector p = OPTIMIZER_LOAD(&params[i]);
+        OPTIMIZER_STORE(&first[i], v);
+        OPTIMIZER_STORE(&params[i], OPTIMIZER_SUB(p, OPTIMIZER_MUL(learningRate, v)));
+    }
+#endif
+    for (; i < count; ++i)
+    {
+        float g = step->gradScale * grads[i];
+        float v = step->momentum * first[i] + g;
+        first[i] = v;
+        params[i] -= step->learningRate * v;
+    }
+}
+
+/**
+ * @brief Nesterov momentum, stepping from the look ahead point:
+ *        v = mu * v + g, p -= lr * (g + mu * v).
+ *
+ * @param params The parameters to update.
+ * @param grads The summed gradients of the parameters.
+ * @param first The velocities.
+ * @param second Unused.
+ * @param count The number of parameters.
+ * @param step The scalars of the update.
+ */
+static void optimizerNesterov(float *params,
+                              const float *grads,
+                              float *first,
+                              float *second,
+                              size_t count,
+                              const OptimizerStep *step)
+{
+    size_t i = 0;
+#ifdef OPTIMIZER_VECTOR
+    OptimizerVector learningRate = OPTIMIZER_SET1(step->learningRate);
+    OptimizerVector gradScale = OPTIMIZER_SET1(step->gradScale);
+    OptimizerVector momentum = OPTIMIZER_SET1(step->momentum);
+    for (; i + OPTIMIZER_WIDTH <= count; i += OPTIMIZER_WIDTH)
+    {
+        OptimizerVector g = OPTIMIZER_MUL(gradScale, OPTIMIZER_LOAD(&grads[i]));
+        OptimizerVector v = OPTIMIZER_ADD(OPTIMIZER_MUL(momentum, OPTIMIZER_LOAD(&first[i])), g);
+        OptimizerVector d = OPTIMIZER_ADD(g, OPTIMIZER_MUL(momentum, v));
+        OptimizerVector p = OPTIMIZER_LOAD(&params[i]);
+        OPTIMIZER_STORE(&first[i], v);
+        OPTIMIZER_STORE(&params[i], OPTIMIZER_SUB(p, OPTIMIZER_MUL(learningRate, d)));
+    }
+#endif
+    for (; i < count; ++i)
+    {
+        float g = step->gradScale * grads[i];
+        float v = step->momentum * first[i] + g;
+        first[i] = v;
+        params[i] -= step->learningRate * (g + step->momentum * v);
+    }
+}
+
+/**
+ * @brief RMSProp: s = b2 * s + (1 - b2) * g^2, p -= lr * g / (sqrt(s) + eps).
+ *
+ * @param params The parameters to update.
+ * @param grads The summed gradients of the parameters.
+ * @param first Unused.
+ * @param second The running averages of the squared gradients.
+ * @param count The number of parameters.
+ * @param step The scalars of the update.
+ */
+static void optimizerRmsProp(float *params,
+                             const float *grads,
+                             float *first,
+                             float *second,
+                             size_t count,
+                             const OptimizerStep *step)
+{
+    float decay = 1.0f - step->beta2;
+    size_t i = 0;
+#ifdef OPTIMIZER_VECTOR
+    OptimizerVector learningRate = OPTIMIZER_SET1(step->learningRate);
+    OptimizerVector gradScale = OPTIMIZER_SET1(step->gradScale);
+    OptimizerVector beta2 = OPTIMIZER_SET1(step->beta2);
+    OptimizerVector decayVector = OPTIMIZER_SET1(decay);
+    OptimizerVector epsilon = OPTIMIZER_SET1(step->epsilon);
+    for (; i + OPTIMIZER_WIDTH <= count; i += OPTIMIZER_WIDTH)
+    {
+        OptimizerVector g = OPTIMIZER_MUL(gradScale, OPTIMIZER_LOAD(&grads[i]));
+        OptimizerVector s = OPTIMIZER_ADD(OPTIMIZER_MUL(beta2, OPTIMIZER_LOAD(&second[i])),
+                                          OPTIMIZER_MUL(decayVector, OPTIMIZER_MUL(g, g)));
+        OptimizerVector d = OPTIMIZER_DIV(OPTIMIZER_MUL(learningRate, g),
+                                          OPTIMIZER_ADD(OPTIMIZER_SQRT(s), epsilon));
+        OptimizerVector p = OPTIMIZER_LOAD(&params[i]);
+        OPTIMIZER_STORE(&second[i], s);
+        OPTIMIZER_STORE(&params[i], OPTIMIZER_SUB(p, d));
+    }
+#endif
+    for (; i < count; ++i)
+    {
+        float g = step->gradScale * grads[i];
+        float s = step->beta2 * second[i] + decay * (g * g);
+        second[i] = s;
+        params[i] -= step->learningRate * g / (sqrtf(s) + step->epsilon);
+    }
+}
+
+/**
+ * @brief Adam: m = b1 * m + (1 - b1) * g, s = b2 * s + (1 - b2) * g^2,
+ *        p -= lr * m / (sqrt(s) + eps). The bias corrections are already
+ *        folded into the learning rate and epsilon of the step.
+ *
+ * @param params The parameters to update.
+ * @param grads The summed gradients of the parameters.
+ * @param first The running averages of the gradients.
+ * @param second The running averages of the squared gradients.
+ * @param count The number of parameters.
+ * @param step The scalars of the update.
+ */
+static void optimizerAdam(float *params,
+                          const float *grads,
+                          float *first,
+                          float *second,
+                          size_t count,
+                          const OptimizerStep *step)
+{
+    float decay1 = 1.0f - step->beta1;
+    float decay2 = 1.0f - step->beta2;
+    size_t i = 0;
+#ifdef OPTIMIZER_VECTOR
+    OptimizerVector learningRate = OPTIMIZER_SET1(step->learningRate);
+    OptimizerVector gradScale = OPTIMIZER_SET1(step->gradScale);
+    OptimizerVector beta1 = OPTIMIZER_SET1(step->beta1);
+    OptimizerVector beta2 = OPTIMIZER_SET1(step->beta2);
+    OptimizerVector decay1Vector = OPTIMIZER_SET1(decay1);
+    OptimizerVector decay2Vector = OPTIMIZER_SET1(decay2);
+    OptimizerVector epsilon = OPTIMIZER_SET1(step->epsilon);
+    for (; i + OPTIMIZER_WIDTH <= count; i += OPTIMIZER_WIDTH)
+    {
+        OptimizerVector g = OPTIMIZER_MUL(gradScale, OPTIMIZER_LOAD(&grads[i]));
+        OptimizerVector m = OPTIMIZER_ADD(OPTIMIZER_MUL(beta1, OPTIMIZER_LOAD(&first[i])),
+                                          OPTIMIZER_MUL(decay1Vector, g));
+        OptimizerVector s = OPTIMIZER_ADD(OPTIMIZER_MUL(beta2, OPTIMIZER_LOAD(&second[i])),
+                                          OPTIMIZER_MUL(decay2Vector, OPTIMIZER_MUL(g, g)));
+        OptimizerVector d = OPTIMIZER_DIV(OPTIMIZER_MUL(learningRate, m),
+                                          OPTIMIZER_ADD(OPTIMIZER_SQRT(s), epsilon));
+        OptimizerVector p = OPTIMIZER_LOAD(&params[i]);
+        OPTIMIZER_STORE(&first[i], m);
+        OPTIMIZER_STORE(&second[i], s);
+        OPTIMIZER_STORE(&params[i], OPTIMIZER_SUB(p, d));
+    }
+#endif
+    for (; i < count; ++i)
+    {
+        float g = step->gradScale * grads[i];
+        float m = step->beta1 * first[i] + decay1 * g;
+        float s = step->beta2 * second[i] + decay2 * (g * g);
+        first[i] = m;
+        second[i] = s;
+        params[i] -= step->learningRate * m / (sqrtf(s) + step->epsilon);
+    }
+}
+
+static const OptimizerUpdateFunc optimizerUpdates[] = {
+    optimizerSgd,
+    optimizerMomentum,
+    optimizerNesterov,
+    optimizerRmsProp,
+    optimizerAdam,
+};
+
+/**
+ * @brief Sets the usual hyperparameters for an optimizer: a momentum of 0.9,
+ *        Adam decays of 0.9 and 0.999, an RMSProp decay of 0.9 and an epsilon
+ *        of 1e-8.
+ *
+ * @param options Uninitialized optimizer options.
+ * @param type The optimizer.
+ */
+void optimizerOptionsInit(OptimizerOptions *options, OptimizerType type)
+{
+    options->type = type;
+    options->momentum = 0.9f;
+    options->beta1 = 0.9f;
+    options->beta2 = type == OPTIMIZER_RMSPROP ? 0.9f : 0.999f;
+    options->epsilon = 1e-8f;
+}
+
+/**
+ * @brief Allocates the state of an optimizer for a set of parameter arrays,
+ *        called slots. The state of every slot lives in one zeroed, 64 byte
+ *        aligned arena and persists from one update to the next.
+ *
+ * @param optimizer An uninitialized optimizer.
+ * @param options The optimizer options, or NULL for plain gradient descent.
+ * @param learningRate A learning rate.
+ * @param slots The number of parameter arrays.
+ * @param sizes The number of elements in each parameter array.
+ */
+void optimizerInit(Optimizer *optimizer,
+                   const OptimizerOptions *options,
+                   float learningRate,
+                   size_t slots,
+                   const size_t *sizes)
+{
+    if (options == NULL)
+    {
+        optimizerOptionsInit(&optimizer->options, OPTIMIZER_SGD);
+    }
+    else
+    {
+        optimizer->options = *options;
+    }
+    optimizer->update = optimizerUpdates[optimizer->options.type];
+    optimizer->learningRate = learningRate;
+    optimizer->slots = slots;
+    atomic_init(&optimizer->steps, 0);
+
+    // Round each slot up to whole cache lines.
+    size_t states = optimizerStates[optimizer->options.type];
+    optimizer->bytes = 0;
+    for (size_t i = 0; i < slots; ++i)
+    {
+        optimizer->bytes += states * ((sizes[i] * sizeof(float) + 63) & ~(size_t)63);
+    }
+    optimizer->arena = NULL;
+    if (optimizer->bytes > 0)
+    {
+        optimizer->arena = aligned_alloc(64, optimizer->bytes);
+        memset(optimizer->arena, 0, optimizer->bytes);
+        profileAlloc(optimizer->bytes);
+    }
+
+    optimizer->first = (float **)malloc(slots * sizeof(float *));
+    optimizer->second = (float **)malloc(slots * sizeof(float *));
+    char *next = (char *)optimizer->arena;
+    for (size_t i = 0; i < slots; ++i)
+    {
+        size_t bytes = (sizes[i] * sizeof(float) + 63) & ~(size_t)63;
+        optimizer->first[i] = NULL;
+        optimizer->second[i] = NULL;
+        if (states == 2)
+        {
+            optimizer->first[i] = (float *)next;
+            optimizer->second[i] = (float *)(next + bytes);
+        }
+        else if (optimizer->options.type == OPTIMIZER_RMSPROP)
+        {
+            optimizer->second[i] = (float *)next;
+        }
+        else if (states == 1)
+        {
+            optimizer->first[i] = (float *)next;
+        }
+        next += states * bytes;
+    }
+}
+
+/**
+ * @brief Frees the state of an optimizer.
+ *
+ * @param optimizer An initialized optimizer.
+ */
+void optimizerFree(Optimizer *optimizer)
+{
+    if (optimizer->arena != NULL)
+    {
+        profileFree(optimizer->bytes);
+        free(optimizer->arena);
+        optimizer->arena = NULL;
+    }
+    free(optimizer->first);
+    free(optimizer->second);
+    optimizer->first = NULL;
+    optimizer->second = NULL;
+}
+
+/**
+ * @brief Starts an update of every slot, counting it and working out the
+ *        scalars it uses. Adam folds its bias corrections into the learning
+ *        rate and epsilon here rather than in every element. The count is
+ *        atomic, so threads updating without synchronizing each get their
+ *        own step.
+ *
+ * @param optimizer An initialized optimizer.
+ * @param batchSize The number of samples the gradients are summed over.
+ * @param step Set to the scalars of the update.
+ */
+void optimizerBeginStep(Optimizer *optimizer, size_t batchSize, OptimizerStep *step)
+{
+    OptimizerOptions *options = &optimizer->options;
+    uint64_t t = atomic_fetch_add_explicit(&optimizer->steps, 1, memory_order_relaxed) + 1;
+
+    step->learningRate = optimizer->learningRate;
+    step->gradScale = 1.0f / batchSize;
+    step->momentum = options->momentum;
+    step->beta1 = options->beta1;
+    step->beta2 = options->beta2;
+    step->epsilon = options->epsilon;
+    if (options->type == OPTIMIZER_ADAM)
+    {
+        double correction1 = 1.0 - pow(options->beta1, (double)t);
+        double correction2 = sqrt(1.0 - pow(options->beta2, (double)t));
+        step->learningRate = (float)(optimizer->learningRate * correction2 / correction1);
+        step->epsilon = (float)(options->epsilon * correction2);
+    }
+}
+
+/**
+ * @brief Updates a range of the elements of one slot in place, in a single
+ *        pass over the parameters, gradients and state. Ranges of the same
+ *        slot can be updated by different threads at once.
+ *
+ * @param optimizer An initialized optimizer.
+ * @param step The scalars from optimizerBeginStep.
+ * @param slot The index of the parameter array.
+ * @param params The elements of the parameter array.
+ * @param grads The summed gradients of the parameter array.
+ * @param start The first element of the range.
+ * @param end The end of the range.
+ */
+void optimizerUpdate(Optimizer *optimizer,
+                     const OptimizerStep *step,
+                     size_t slot,
+                     float *params,
+                     const float *grads,
+                     size_t start,
+                     size_t end)
+{
+    if (end <= start)
+    {
+        return;
+    }
+
+    uint64_t profileStart = profileBegin();
+    float *first = optimizer->first[slot] != NULL ? optimizer->first[slot] + start : NULL;
+    float *second = optimizer->second[slot] != NULL ? optimizer->second[slot] + start : NULL;
+    optimizer->update(&params[start], &grads[start], first, second, end - start, step);
+    profileEndKernel(PROFILE_OPTIMIZER,
+                     profileStart,
+                     optimizerFlops[optimizer->options.type] * (end - start));
+}
@@ -0,0 +1,74 @@
+#ifndef OPTIMIZER_H
+#define OPTIMIZER_H
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef enum
+{
+    OPTIMIZER_SGD,
+    OPTIMIZER_MOMENTUM,
+    OPTIMIZER_NESTEROV,
+    OPTIMIZER_RMSPROP,
+    OPTIMIZER_ADAM
+}
+OptimizerType;
+
+typedef struct
+{
+    OptimizerType type;
+    float momentum;
+    float beta1, beta2;
+    float epsilon;
+}
+OptimizerOptions;
+
+// The scalars of one update, shared by every element it touches.
+typedef struct
+{
+    float learningRate, gradScale;
+    float momentum;
+    float beta1, beta2;
+    float epsilon;
+}
+OptimizerStep;
+
+typedef void (*OptimizerUpdateFunc)(float *params,
+                                    const float *grads,
+                                    float *first,
+                                    float *second,
+                                    size_t count,
+                                    const OptimizerStep *step);
+
+typedef struct
+{
+    OptimizerOptions options;
+    OptimizerUpdateFunc update;
+    float learningRate;
+    size_t slots, bytes;
+    float **first, **second;
+    void *arena;
+    _Atomic uint64_t steps;
+}
+Optimizer;
+
+void optimizerOptionsInit(OptimizerOptions *options, OptimizerType type);
+
+void optimizerInit(Optimizer *optimizer,
+                   const OptimizerOptions *options,
+                   float learningRate,
+                   size_t slots,
+                   const size_t *sizes);
+void optimizerFree(Optimizer *optimizer);
+
+void optimizerBeginStep(Optimizer *optimizer, size_t batchSize, OptimizerStep *step);
+void optimizerUpdate(Optimizer *optimizer,
+                     const OptimizerStep *step,
+                     size_t slot,
+                     float *params,
+                     const float *grads,
+                     size_t start,
+                     size_t end);
+
+#endif
@@ -0,0 +1,304 @@
+#include "prefetch.h"
+#include "matrix.h"
+#include "dataset.h"
+#include "profile.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+/**
+ * @brief Rounds a size up to a whole number of 64 byte cache lines.
+ */
+static size_t prefetchAlign(size_t bytes)
+{
+    return (bytes + 63) & ~(size_t)63;
+}
+
+/**
+ * @brief Gathers one mini batch into a buffer, split into contiguous shards
+ *        the same way netTrain splits a batch across threads, then augments
+ *        each shard. A sparse prefetcher gathers sparse shards instead, which
+ *        are never augmented.
+ *
+ * @param prefetcher The prefetcher.
+ * @param batch The buffer to fill.
+ * @param start The position of the batch in the order.
+ */
+static void prefetchLoad(Prefetcher *prefetcher, PrefetchBatch *batch, size_t start)
+{
+    size_t count = prefetcher->batchSize;
+    if (start + count > prefetcher->samples)
+    {
+        count = prefetcher->samples - start;
+    }
+
+    batch->samples = count;
+    for (size_t i = 0; i < prefetcher->shards; ++i)
+    {
+        size_t shardStart = count * i / prefetcher->shards;
+        size_t shardEnd = count * (i + 1) / prefetcher->shards;
+        Matrix *labels = &batch->labels[i];
+        labels->columns = shardEnd - shardStart;
+        labels->stride = shardEnd - shardStart;
+        if (prefetcher->sparse)
+        {
+            datasetGatherSparse(prefetcher->dataset,
+                                &prefetcher->order[start + shardStart],
+                                shardEnd - shardStart,
+                                &batch->sparseFeatures[i],
+                                labels);
+            continue;
+        }
+
+        Matrix *features = &batch->features[i];
+        features->columns = shardEnd - shardStart;
+        features->stride = shardEnd - shardStart;
+        datasetGather(prefetcher->dataset,
+                      &prefetcher->order[start + shardStart],
+                      shardEnd - shardStart,
+                      features,
+                      labels);
+
+        if (prefetcher->augment != NULL && shardEnd > shardStart)
+        {
+            prefetcher->augment(features, labels, prefetcher->augmentArg);
+        }
+    }
+}
+
+/**
+ * @brief Loads batches into free buffers, in order, until the epoch has been
+ *        loaded, then waits for the next epoch or for the prefetcher to stop.
+ *
+ * @param arg The prefetcher.
+ * @return NULL.
+ */
+static void *prefetchLoaderMain(void *arg)
+{
+    Prefetcher *prefetcher = (Prefetcher *)arg;
+
+    pthread_mutex_lock(&prefetcher->mutex);
+    for (;;)
+    {
+        while (!prefetcher->stop &&
+               (prefetcher->loaded == prefetcher->batches ||
+                prefetcher->full[prefetcher->loaded % PREFETCH_BUFFERS]))
+        {
+            pthread_cond_wait(&prefetcher->load, &prefetcher->mutex);
+        }
+        if (prefetcher->stop)
+        {
+            break;
+        }
+
+        size_t index = prefetcher->loaded;
+        PrefetchBatch *batch = &prefetcher->buffers[index % PREFETCH_BUFFERS];
+        pthread_mutex_unlock(&prefetcher->mutex);
+
+        uint64_t profileStart = profileBegin();
+        prefetchLoad(prefetcher, batch, index * prefetcher->batchSize);
+        profileEndSection(PROFILE_GATHER, profileStart);
+
+        pthread_mutex_lock(&prefetcher->mutex);
+        prefetcher->full[index % PREFETCH_BUFFERS] = 1;
+        prefetcher->loaded = index + 1;
+        pthread_cond_signal(&prefetcher->ready);
+    }
+    pthread_mutex_unlock(&prefetcher->mutex);
+
+    return NULL;
+}
+
+/**
+ * @brief Allocates the batch buffers and starts the loader thread. Every
+ *        buffer lives in one 64 byte aligned arena, which is locked into
+ *        memory when the system allows so batches are never paged out. A
+ *        dataset with a sparse index is gathered into sparse shards unless
+ *        the shards are augmented. Each sparse shard has room for every
+ *        feature of every sample, since a batch can be denser than its
+ *        dataset.
+ *
+ * @param prefetcher An uninitialized prefetcher.
+ * @param dataset The dataset to gather from.
+ * @param batchSize The number of samples in each mini batch.
+ * @param shards The number of contiguous shards each batch is split into.
+ * @param augment A function applied to each shard after it is gathered, or
+ *                NULL. It runs on the loader thread.
+ * @param augmentArg An argument for the augment function.
+ */
+void prefetchInit(Prefetcher *prefetcher,
+                  Dataset *dataset,
+                  size_t batchSize,
+                  size_t shards,
+                  PrefetchAugmentFunc augment,
+                  void *augmentArg)
+{
+    prefetcher->dataset = dataset;
+    prefetcher->batchSize = batchSize;
+    prefetcher->shards = shards > 0 ? shards : 1;
+    prefetcher->augment = augment;
+    prefetcher->augmentArg = augmentArg;
+    prefetcher->sparse = datasetIsSparse(dataset) && augment == NULL;
+
+    size_t shardSize = (batchSize + prefetcher->shards - 1) / prefetcher->shards;
+    size_t capacity = dataset->featureSize * shardSize;
+    size_t featureBytes = prefetchAlign(capacity * sizeof(float));
+    size_t startBytes = prefetchAlign((shardSize + 1) * sizeof(size_t));
+    size_t indexBytes = prefetchAlign(capacity * sizeof(uint32_t));
+    size_t labelBytes = prefetchAlign(dataset->classes * shardSize * sizeof(float));
+    if (prefetcher->sparse)
+    {
+        featureBytes += startBytes + indexBytes;
+    }
+    prefetcher->bytes = PREFETCH_BUFFERS * prefetcher->shards * (featureBytes + labelBytes);
+    prefetcher->arena = aligned_alloc(64, prefetcher->bytes);
+    memset(prefetcher->arena, 0, prefetcher->bytes);
+    mlock(prefetcher->arena, prefetcher->bytes);
+    profileAlloc(prefetcher->bytes);
+
+    unsigned char *next = (unsigned char *)prefetcher->arena;
+    for (size_t i = 0; i < PREFETCH_BUFFERS; ++i)
+    {
+        PrefetchBatch *batch = &prefetcher->buffers[i];
+        batch->samples = 0;
+        batch->shards = prefetcher->shards;
+        batch->features = NULL;
+        batch->sparseFeatures = NULL;
+        if (prefetcher->sparse)
+        {
+            batch->sparseFeatures = (SparseMatrix *)malloc(prefetcher->shards * sizeof(SparseMatrix));
+        }
+        else
+        {
+            batch->features = (Matrix *)malloc(prefetcher->shards * sizeof(Matrix));
+        }
+        batch->labels = (Matrix *)malloc(prefetcher->shards * sizeof(Matrix));
+        for (size_t j = 0; j < prefetcher->shards; ++j)
+        {
+            if (prefetcher->sparse)
+            {
+                size_t *columnStarts = (size_t *)next;
+                uint32_t *rowIndices = (uint32_t *)(next + startBytes);
+                float *values = (float *)(next + startBytes + indexBytes);
+                batch->sparseFeatures[j] = (SparseMatrix){dataset->featureSize,
+                                                          0,
+                                                          capacity,
+                                                          columnStarts,
+                                                          rowIndices,
+                                                          values};
+            }
+            else
+            {
+                batch->features[j] = matView((float *)next, dataset->featureSize, shardSize, shardSize);
+            }
+            next += featureBytes;
+            batch->labels[j] = matView((float *)next, dataset->classes, shardSize, shardSize);
+            next += labelBytes;
+        }
+        prefetcher->full[i] = 0;
+    }
+
+    prefetcher->order = NULL;
+    prefetcher->samples = 0;
+    prefetcher->batches = 0;
+    prefetcher->loaded = 0;
+    prefetcher->taken = 0;
+    prefetcher->stop = 0;
+    pthread_mutex_init(&prefetcher->mutex, NULL);
+    pthread_cond_init(&prefetcher->load, NULL);
+    pthread_cond_init(&prefetcher->ready, NULL);
+    pthread_create(&prefetcher->thread, NULL, prefetchLoaderMain, prefetcher);
+}
+
+/**
+ * @brief Stops the loader thread and frees the batch buffers.
+ *
+ * @param prefetcher An initialized prefetcher.
+ */
+void prefetchFree(Prefetcher *prefetcher)
+{
+    pthread_mutex_lock(&prefetcher->mutex);
+    prefetcher->stop = 1;
+    pthread_cond_signal(&prefetcher->load);
+    pthread_mutex_unlock(&prefetcher->mutex);
+    pthread_join(prefetcher->thread, NULL);
+
+    pthread_mutex_destroy(&prefetcher->mutex);
+    pthread_cond_destroy(&prefetcher->load);
+    pthread_cond_destroy(&prefetcher->ready);
+
+    for (size_t i = 0; i < PREFETCH_BUFFERS; ++i)
+    {
+        free(prefetcher->buffers[i].features);
+        free(prefetcher->buffers[i].sparseFeatures);
+        free(prefetcher->buffers[i].labels);
+    }
+    munlock(prefetcher->arena, prefetcher->bytes);
+    profileFree(prefetcher->bytes);
+    free(prefetcher->arena);
+    prefetcher->arena = NULL;
+}
+
+/**
+ * @brief Starts loading an epoch in the background. The previous epoch must
+ *        have been taken to its end, and the order must not change until
+ *        this epoch has been.
+ *
+ * @param prefetcher An initialized prefetcher.
+ * @param order The indices of the samples, in the order they are visited.
+ * @param samples The number of samples in the epoch.
+ */
+void prefetchStart(Prefetcher *prefetcher, const uint32_t *order, size_t samples)
+{
+    pthread_mutex_lock(&prefetcher->mutex);
+    prefetcher->order = order;
+    prefetcher->samples = samples;
+    prefetcher->batches = (samples + prefetcher->batchSize - 1) / prefetcher->batchSize;
+    prefetcher->loaded = 0;
+    prefetcher->taken = 0;
+    for (size_t i = 0; i < PREFETCH_BUFFERS; ++i)
+    {
+        prefetcher->full[i] = 0;
+    }
+    pthread_cond_signal(&prefetcher->load);
+    pthread_mutex_unlock(&prefetcher->mutex);
+}
+
+/**
+ * @brief Takes the next mini batch of the epoch, waiting for the loader if it
+ *        is not ready. The batch taken before is handed back to the loader, so
+ *        it must no longer be used.
+ *
+ * @param prefetcher An initialized prefetcher with a started epoch.
+ * @return The batch, valid until the next call, or NULL at the end of the
+ *         epoch.
+ */
+PrefetchBatch *prefetchNext(Prefetcher *prefetcher)
+{
+    pthread_mutex_lock(&prefetcher->mutex);
+    if (prefetcher->taken > 0)
+    {
+        prefetcher->full[(prefetcher->taken - 1) % PREFETCH_BUFFERS] = 0;
+        pthread_cond_signal(&prefetcher->load);
+    }
+    if (prefetcher->taken == prefetcher->batches)
+    {
+        pthread_mutex_unlock(&prefetcher->mutex);
+        return NULL;
+    }
+
+    uint64_t profileStart = profileBegin();
+    size_t index = prefetcher->taken % PREFETCH_BUFFERS;
+    while (!prefetcher->full[index])
+    {
+        pthread_cond_wait(&prefetcher->ready, &prefetcher->mutex);
+    }
+    profileEndSection(PROFILE_WAIT, profileStart);
+
+    PrefetchBatch *batch = &prefetcher->buffers[index];
+    ++prefetcher->taken;
+    pthread_mutex_unlock(&prefetcher->mutex);
+
+    return batch;
+}
@@ -0,0 +1,54 @@
+#ifndef PREFETCH_H
+#define PREFETCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "matrix.h"
+#include "dataset.h"
+
+// The number of batches the loader can have in flight: one being trained on
+// and one being loaded.
+#define PREFETCH_BUFFERS 2
+
+typedef void (*PrefetchAugmentFunc)(Matrix *features, Matrix *labels, void *arg);
+
+typedef struct
+{
+    size_t samples, shards;
+    Matrix *features, *labels;
+    SparseMatrix *sparseFeatures;
+}
+PrefetchBatch;
+
+typedef struct
+{
+    Dataset *dataset;
+    size_t batchSize, shards, bytes;
+    PrefetchAugmentFunc augment;
+    void *augmentArg;
+    int sparse;
+    void *arena;
+    PrefetchBatch buffers[PREFETCH_BUFFERS];
+    int full[PREFETCH_BUFFERS];
+
+    const uint32_t *order;
+    size_t samples, batches, loaded, taken;
+    int stop;
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t load, ready;
+}
+Prefetcher;
+
+void prefetchInit(Prefetcher *prefetcher,
+                  Dataset *dataset,
+                  size_t batchSize,
+                  size_t shards,
+                  PrefetchAugmentFunc augment,
+                  void *augmentArg);
+void prefetchFree(Prefetcher *prefetcher);
+void prefetchStart(Prefetcher *prefetcher, const uint32_t *order, size_t samples);
+PrefetchBatch *prefetchNext(Prefetcher *prefetcher);
+
+#endif
@@ -0,0 +1,305 @@
+#include "profile.h"
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+// Counters are shared by every thread and only ever added to, so relaxed
+// atomics are enough. Times are kept in nanoseconds.
+static atomic_int profileActive;
+static _Atomic uint64_t profileSectionNanoseconds[PROFILE_SECTIONS];
+static _Atomic uint64_t profileSectionCalls[PROFILE_SECTIONS];
+static _Atomic uint64_t profileKernelNanoseconds[PROFILE_KERNELS];
+static _Atomic uint64_t profileKernelCalls[PROFILE_KERNELS];
+static _Atomic uint64_t profileKernelFlops[PROFILE_KERNELS];
+static _Atomic uint64_t profileAllocations, profileFrees;
+static _Atomic uint64_t profileBytesAllocated, profileBytesFreed;
+
+static const char *const profileSectionNames[PROFILE_SECTIONS] = {
+    "shuffle",
+    "gather",
+    "wait",
+    "forward",
+    "backward",
+    "accumulate",
+    "update",
+};
+
+static const char *const profileKernelNames[PROFILE_KERNELS] = {
+    "matMul",
+    "matMulTransA",
+    "matMulTransB",
+    "matMulHalf",
+    "matMulSparse",
+    "matElementwise",
+    "activation",
+    "optimizer",
+};
+
+/**
+ * @brief Adds to a counter.
+ */
+static void profileAdd(_Atomic uint64_t *counter, uint64_t value)
+{
+    atomic_fetch_add_explicit(counter, value, memory_order_relaxed);
+}
+
+/**
+ * @brief Reads a counter.
+ */
+static uint64_t profileLoad(_Atomic uint64_t *counter)
+{
+    return atomic_load_explicit(counter, memory_order_relaxed);
+}
+
+/**
+ * @brief Switches profiling on or off. While it is off, the instrumented
+ *        code only pays for one flag check per call, and the counters keep
+ *        their values.
+ *
+ * @param enabled Nonzero to profile.
+ */
+void profileEnable(int enabled)
+{
+    atomic_store_explicit(&profileActive, enabled != 0, memory_order_relaxed);
+}
+
+/**
+ * @brief Checks whether profiling is on.
+ *
+ * @return Nonzero if profiling.
+ */
+int profileEnabled(void)
+{
+    return atomic_load_explicit(&profileActive, memory_order_relaxed);
+}
+
+/**
+ * @brief Zeroes every counter.
+ */
+void profileReset(void)
+{
+    for (size_t i = 0; i < PROFILE_SECTIONS; ++i)
+    {
+        atomic_store_explicit(&profileSectionNanoseconds[i], 0, memory_order_relaxed);
+        atomic_store_explicit(&profileSectionCalls[i], 0, memory_order_relaxed);
+    }
+    for (size_t i = 0; i < PROFILE_KERNELS; ++i)
+    {
+        atomic_store_explicit(&profileKernelNanoseconds[i], 0, memory_order_relaxed);
+        atomic_store_explicit(&profileKernelCalls[i], 0, memory_order_relaxed);
+        atomic_store_explicit(&profileKernelFlops[i], 0, memory_order_relaxed);
+    }
+    atomic_store_explicit(&profileAllocations, 0, memory_order_relaxed);
+    atomic_store_explicit(&profileFrees, 0, memory_order_relaxed);
+    atomic_store_explicit(&profileBytesAllocated, 0, memory_order_relaxed);
+    atomic_store_explicit(&profileBytesFreed, 0, memory_order_relaxed);
+}
+
+/**
+ * @brief Copies the counters accumulated since the last reset. Times are
+ *        summed over threads, and kernel times are also counted in the
+ *        section that called the kernel.
+ *
+ * @param stats The copy of the counters.
+ */
+void profileSnapshot(ProfileStats *stats)
+{
+    for (size_t i = 0; i < PROFILE_SECTIONS; ++i)
+    {
+        stats->sectionSeconds[i] = profileLoad(&profileSectionNanoseconds[i]) * 1e-9;
+        stats->sectionCalls[i] = profileLoad(&profileSectionCalls[i]);
+    }
+    for (size_t i = 0; i < PROFILE_KERNELS; ++i)
+    {
+        stats->kernelSeconds[i] = profileLoad(&profileKernelNanoseconds[i]) * 1e-9;
+        stats->kernelCalls[i] = profileLoad(&profileKernelCalls[i]);
+        stats->kernelFlops[i] = profileLoad(&profileKernelFlops[i]);
+    }
+    stats->allocations = profileLoad(&profileAllocations);
+    stats->frees = profileLoad(&profileFrees);
+    stats->bytesAllocated = profileLoad(&profileBytesAllocated);
+    stats->bytesFreed = profileLoad(&profileBytesFreed);
+}
+
+/**
+ * @brief Finds the counters accumulated between two snapshots.
+ *
+ * @param result The difference. May be one of the snapshots.
+ * @param end The later snapshot.
+ * @param start The earlier snapshot.
+ */
+void profileDiff(ProfileStats *result, const ProfileStats *end, const ProfileStats *start)
+{
+    for (size_t i = 0; i < PROFILE_SECTIONS; ++i)
+    {
+        result->sectionSeconds[i] = end->sectionSeconds[i] - start->sectionSeconds[i];
+        result->sectionCalls[i] = end->sectionCalls[i] - start->sectionCalls[i];
+    }
+    for (size_t i = 0; i < PROFILE_KERNELS; ++i)
+    {
+        result->kernelSeconds[i] = end->kernelSeconds[i] - start->kernelSeconds[i];
+        result->kernelCalls[i] = end->kernelCalls[i] - start->kernelCalls[i];
+        result->kernelFlops[i] = end->kernelFlops[i] - start->kernelFlops[i];
+    }
+    result->allocations = end->allocations - start->allocations;
+    result->frees = end->frees - start->frees;
+    result->bytesAllocated = end->bytesAllocated - start->bytesAllocated;
+    result->bytesFreed = end->bytesFreed - start->bytesFreed;
+}
+
+/**
+ * @brief Prints a table of profiling counters.
+ *
+ * @param stream The output stream.
+ * @param stats The counters.
+ */
+void profilePrint(FILE *stream, const ProfileStats *stats)
+{
+    for (size_t i = 0; i < PROFILE_SECTIONS; ++i)
+    {
+        fprintf(stream,
+                "  %-16s %10.4fs %10lu calls\n",
+                profileSectionNames[i],
+                stats->sectionSeconds[i],
+                stats->sectionCalls[i]);
+    }
+    for (size_t i = 0; i < PROFILE_KERNELS; ++i)
+    {
+        double seconds = stats->kernelSeconds[i];
+        fprintf(stream,
+                "  %-16s %10.4fs %10lu calls %8.2f GFLOP/s\n",
+                profileKernelNames[i],
+                seconds,
+                stats->kernelCalls[i],
+                seconds > 0.0 ? stats->kernelFlops[i] / seconds * 1e-9 : 0.0);
+    }
+    fprintf(stream,
+            "  %-16s %10lu allocations %lu bytes, %lu frees %lu bytes\n",
+            "memory",
+            stats->allocations,
+            stats->bytesAllocated,
+            stats->frees,
+            stats->bytesFreed);
+}
+
+/**
+ * @brief Names a section of training or inference.
+ */
+const char *profileSectionName(ProfileSection section)
+{
+    return section < PROFILE_SECTIONS ? profileSectionNames[section] : "unknown";
+}
+
+/**
+ * @brief Names an instrumented kernel.
+ */
+const char *profileKernelName(ProfileKernel kernel)
+{
+    return kernel < PROFILE_KERNELS ? profileKernelNames[kernel] : "unknown";
+}
+
+/**
+ * @brief Starts timing a section or kernel.
+ *
+ * @return A start time to pass to the matching end, or zero when profiling
+ *         is off.
+ */
+uint64_t profileBegin(void)
+{
+    if (!profileEnabled())
+    {
+        return 0;
+    }
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+/**
+ * @brief Reads the time elapsed since a start time.
+ */
+static uint64_t profileElapsed(uint64_t start)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec - start;
+}
+
+/**
+ * @brief Finishes timing a section.
+ *
+ * @param section The section.
+ * @param start The time returned by profileBegin. Nothing is recorded if it
+ *              is zero.
+ * @return The end time, which can start the next section, or zero when
+ *         nothing was recorded.
+ */
+uint64_t profileEndSection(ProfileSection section, uint64_t start)
+{
+    if (start == 0)
+    {
+        return 0;
+    }
+
+    uint64_t elapsed = profileElapsed(start);
+    profileAdd(&profileSectionNanoseconds[section], elapsed);
+    profileAdd(&profileSectionCalls[section], 1);
+
+    return start + elapsed;
+}
+
+/**
+ * @brief Finishes timing a call of a kernel.
+ *
+ * @param kernel The kernel.
+ * @param start The time returned by profileBegin. Nothing is recorded if it
+ *              is zero.
+ * @param flops The floating point operations of the call.
+ */
+void profileEndKernel(ProfileKernel kernel, uint64_t start, uint64_t flops)
+{
+    if (start == 0)
+    {
+        return;
+    }
+
+    profileAdd(&profileKernelNanoseconds[kernel], profileElapsed(start));
+    profileAdd(&profileKernelCalls[kernel], 1);
+    profileAdd(&profileKernelFlops[kernel], flops);
+}
+
+/**
+ * @brief Records an allocation while profiling.
+ *
+ * @param bytes The size of the allocation.
+ */
+void profileAlloc(size_t bytes)
+{
+    if (!profileEnabled())
+    {
+        return;
+    }
+
+    profileAdd(&profileAllocations, 1);
+    profileAdd(&profileBytesAllocated, bytes);
+}
+
+/**
+ * @brief Records a free while profiling.
+ *
+ * @param bytes The size of the freed memory.
+ */
+void profileFree(size_t bytes)
+{
+    if (!profileEnabled())
+    {
+        return;
+    }
+
+    profileAdd(&profileFrees, 1);
+    profileAdd(&profileBytesFreed, bytes);
+}
@@ -0,0 +1,63 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+typedef enum
+{
+    PROFILE_SHUFFLE,
+    PROFILE_GATHER,
+    PROFILE_WAIT,
+    PROFILE_FORWARD,
+    PROFILE_BACKWARD,
+    PROFILE_ACCUMULATE,
+    PROFILE_UPDATE,
+    PROFILE_SECTIONS
+}
+ProfileSection;
+
+typedef enum
+{
+    PROFILE_MAT_MUL,
+    PROFILE_MAT_MUL_TRANS_A,
+    PROFILE_MAT_MUL_TRANS_B,
+    PROFILE_MAT_MUL_HALF,
+    PROFILE_MAT_MUL_SPARSE,
+    PROFILE_MAT_ELEMENTWISE,
+    PROFILE_ACTIVATION,
+    PROFILE_OPTIMIZER,
+    PROFILE_KERNELS
+}
+ProfileKernel;
+
+typedef struct
+{
+    double sectionSeconds[PROFILE_SECTIONS];
+    uint64_t sectionCalls[PROFILE_SECTIONS];
+    double kernelSeconds[PROFILE_KERNELS];
+    uint64_t kernelCalls[PROFILE_KERNELS];
+    uint64_t kernelFlops[PROFILE_KERNELS];
+    uint64_t allocations, frees;
+    uint64_t bytesAllocated, bytesFreed;
+}
+ProfileStats;
+
+void profileEnable(int enabled);
+int profileEnabled(void);
+void profileReset(void);
+void profileSnapshot(ProfileStats *stats);
+void profileDiff(ProfileStats *result, const ProfileStats *end, const ProfileStats *start);
+void profilePrint(FILE *stream, const ProfileStats *stats);
+
+const char *profileSectionName(ProfileSection section);
+const char *profileKernelName(ProfileKernel kernel);
+
+uint64_t profileBegin(void);
+uint64_t profileEndSection(ProfileSection section, uint64_t start);
+void profileEndKernel(ProfileKernel kernel, uint64_t start, uint64_t flops);
+void profileAlloc(size_t bytes);
+void profileFree(size_t bytes);
+
+#endif
@@ -0,0 +1,824 @@
+#include "quantize.h"
+#include "matrix.h"
+#include "neural_net.h"
+#include "activation.h"
+#include "thread_pool.h"
+#include "cpu.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef CPU_X86
+#include <immintrin.h>
+#endif
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// Weights use the symmetric range [-127, 127] and activations the unsigned
+// range [0, 127]. A product pair then fits in 16 bits, so maddubs never
+// saturates and every kernel gives the same result.
+#define QUANT_WEIGHT_MAX 127
+#define QUANT_ACTIVATION_MAX 127
+
+// The zero point used when a batch has negative activations.
+#define QUANT_ZERO_POINT 64
+
+// Activations are interleaved in groups of four features, and the dot
+// product kernel works on blocks of sixteen samples.
+#define QUANT_GROUP 4
+#define QUANT_BLOCK 16
+
+/**
+ * @brief Rounds a row length up to the padded stride of a quantized matrix.
+ */
+static size_t quantStride(size_t columns)
+{
+    return (columns + QUANT_ALIGNMENT - 1) & ~(size_t)(QUANT_ALIGNMENT - 1);
+}
+
+/**
+ * @brief Rounds a batch size up to a whole number of sample blocks.
+ */
+static size_t quantBatchStride(size_t batchSize)
+{
+    return (batchSize + QUANT_BLOCK - 1) / QUANT_BLOCK * QUANT_BLOCK;
+}
+
+/**
+ * @brief Quantizes a matrix of weights to int8 with one scale per row.
+ *
+ * @param qmat An uninitialized quantized matrix.
+ * @param mat An initialized matrix.
+ */
+static void quantMatrixInit(QuantMatrix *qmat, Matrix *mat)
+{
+    qmat->rows = mat->rows;
+    qmat->columns = mat->columns;
+    qmat->stride = quantStride(mat->columns);
+    qmat->elements = (int8_t *)aligned_alloc(QUANT_ALIGNMENT, qmat->rows * qmat->stride);
+    qmat->scales = (float *)malloc(qmat->rows * sizeof(float));
+    qmat->rowSums = (int32_t *)malloc(qmat->rows * sizeof(int32_t));
+    memset(qmat->elements, 0, qmat->rows * qmat->stride);
+
+    for (size_t i = 0; i < mat->rows; ++i)
+    {
+        const float *row = &mat->elements[i * mat->stride];
+        float maxAbs = 0.0f;
+        for (size_t j = 0; j < mat->columns; ++j)
+        {
+            if (fabsf(row[j]) > maxAbs)
+            {
+                maxAbs = fabsf(row[j]);
+            }
+        }
+
+        float scale = maxAbs > 0.0f ? maxAbs / QUANT_WEIGHT_MAX : 1.0f;
+        int8_t *quantized = &qmat->elements[i * qmat->stride];
+        int32_t sum = 0;
+        for (size_t j = 0; j < mat->columns; ++j)
+        {
+            long value = lrintf(row[j] / scale);
+            if (value > QUANT_WEIGHT_MAX)
+            {
+                value = QUANT_WEIGHT_MAX;
+            }
+            if (value < -QUANT_WEIGHT_MAX)
+            {
+                value = -QUANT_WEIGHT_MAX;
+            }
+            quantized[j] = (int8_t)value;
+            sum += (int32_t)value;
+        }
+        qmat->scales[i] = scale;
+        qmat->rowSums[i] = sum;
+    }
+}
+
+/**
+ * @brief Frees the memory of a quantized matrix.
+ */
+static void quantMatrixFree(QuantMatrix *qmat)
+{
+    free(qmat->elements);
+    free(qmat->scales);
+    free(qmat->rowSums);
+
+    qmat->rows = 0;
+    qmat->columns = 0;
+    qmat->stride = 0;
+    qmat->elements = NULL;
+    qmat->scales = NULL;
+    qmat->rowSums = NULL;
+}
+
+/**
+ * @brief Quantizes a trained neural network for inference. Weights are stored
+ *        as int8 with a scale for each row, and biases stay in float.
+ *
+ * @param qnet An uninitialized quantized neural network.
+ * @param net An initialized neural network.
+ */
+void quantInit(QuantNet *qnet, NeuralNet *net)
+{
+    qnet->layers = net->layers;
+    qnet->output = net->output;
+    qnet->layerSizes = (size_t *)malloc(net->layers * sizeof(size_t));
+    memcpy(qnet->layerSizes, net->layerSizes, net->layers * sizeof(size_t));
+
+    qnet->weights = (QuantMatrix *)malloc((net->layers - 1) * sizeof(QuantMatrix));
+    qnet->biases = (Matrix *)malloc((net->layers - 1) * sizeof(Matrix));
+    for (size_t i = 0; i < net->layers - 1; ++i)
+    {
+        quantMatrixInit(&qnet->weights[i], &net->weights[i]);
+        qnet->biases[i] = matCopy(&net->biases[i]);
+    }
+}
+
+/**
+ * @brief Frees the memory of a quantized neural network.
+ *
+ * @param qnet An initialized quantized neural network.
+ */
+void quantFree(QuantNet *qnet)
+{
+    for (size_t i = 0; i < qnet->layers - 1; ++i)
+    {
+        quantMatrixFree(&qnet->weights[i]);
+        matFree(&qnet->biases[i]);
+    }
+    free(qnet->layerSizes);
+    free(qnet->weights);
+    free(qnet->biases);
+
+    qnet->layers = 0;
+    qnet->layerSizes = NULL;
+    qnet->weights = NULL;
+    qnet->biases = NULL;
+}
+
+/**
+ * @brief Measures the memory held by the parameters of a quantized neural
+ *        network, including padding, scales and row sums.
+ *
+ * @param qnet An initialized quantized neural network.
+ * @return The number of bytes.
+ */
+size_t quantSize(QuantNet *qnet)
+{
+    size_t bytes = 0;
+    for (size_t i = 0; i < qnet->layers - 1; ++i)
+    {
+        QuantMatrix *weights = &qnet->weights[i];
+        bytes += weights->rows * weights->stride;
+        bytes += weights->rows * (sizeof(float) + sizeof(int32_t));
+        bytes += qnet->biases[i].rows * sizeof(float);
+    }
+
+    return bytes;
+}
+
+/**
+ * @brief Allocates the buffers for predicting batches of up to a maximum size.
+ *
+ * @param workspace An uninitialized workspace.
+ * @param qnet An initialized quantized neural network.
+ * @param maxBatchSize The largest number of samples in a batch.
+ */
+void quantWorkspaceInit(QuantWorkspace *workspace, QuantNet *qnet, size_t maxBatchSize)
+{
+    size_t maxLayerSize = 0;
+    size_t maxStride = 0;
+    for (size_t i = 0; i < qnet->layers; ++i)
+    {
+        if (i > 0 && qnet->layerSizes[i] > maxLayerSize)
+        {
+            maxLayerSize = qnet->layerSizes[i];
+        }
+        if (quantStride(qnet->layerSizes[i]) > maxStride)
+        {
+            maxStride = quantStride(qnet->layerSizes[i]);
+        }
+    }
+
+    workspace->maxBatchSize = maxBatchSize;
+    workspace->maxStride = maxStride;
+    matInit(&workspace->features, qnet->layerSizes[0], maxBatchSize);
+    matInit(&workspace->current, maxLayerSize, maxBatchSize);
+    matInit(&workspace->next, maxLayerSize, maxBatchSize);
+    size_t bytes = quantBatchStride(maxBatchSize) * maxStride;
+    workspace->quantized = (uint8_t *)aligned_alloc(QUANT_ALIGNMENT, bytes);
+    memset(workspace->quantized, 0, bytes);
+}
+
+/**
+ * @brief Frees the memory of a workspace.
+ *
+ * @param workspace An initialized workspace.
+ */
+void quantWorkspaceFree(QuantWorkspace *workspace)
+{
+    matFree(&workspace->features);
+    matFree(&workspace->current);
+    matFree(&workspace->next);
+    free(workspace->quantized);
+
+    workspace->maxBatchSize = 0;
+    workspace->maxStride = 0;
+    workspace->quantized = NULL;
+}
+
+/**
+ * @brief Quantizes a batch of activations to unsigned bytes with one scale
+ *        for the batch. Features are interleaved in groups of four: each
+ *        group holds four bytes per sample, the operand layout of the int8
+ *        dot product instructions.
+ *
+ * @param mat Activations with one column per sample.
+ * @param quantized The quantized groups of features.
+ * @param zeroPoint The quantized value of zero.
+ * @return The scale of the quantized values.
+ */
+static float quantActivations(Matrix *mat, uint8_t *quantized, int32_t *zeroPoint)
+{
+    // A contiguous batch is scanned as one long row.
+    int contiguous = matIsContiguous(mat);
+    size_t rowCount = contiguous ? 1 : mat->rows;
+    size_t count = contiguous ? mat->rows * mat->columns : mat->columns;
+    float min = 0.0f, max = 0.0f;
+    for (size_t r = 0; r < rowCount; ++r)
+    {
+        const float *values = &mat->elements[r * mat->stride];
+        size_t i = 0;
+#if defined(__SSE2__)
+        __m128 mins = _mm_setzero_ps(), maxs = _mm_setzero_ps();
+        for (; i + 4 <= count; i += 4)
+        {
+            __m128 value = _mm_loadu_ps(&values[i]);
+            mins = _mm_min_ps(mins, value);
+            maxs = _mm_max_ps(maxs, value);
+        }
+        float lanes[2][4];
+        _mm_storeu_ps(lanes[0], mins);
+        _mm_storeu_ps(lanes[1], maxs);
+        for (size_t q = 0; q < 4; ++q)
+        {
+            min = lanes[0][q] < min ? lanes[0][q] : min;
+            max = lanes[1][q] > max ? lanes[1][q] : max;
+        }
+#endif
+        for (; i < count; ++i)
+        {
+            min = values[i] < min ? values[i] : min;
+            max = values[i] > max ? values[i] : max;
+        }
+    }
+
+    // Non-negative batches, such as the sigmoid outputs, use the full range.
+    float maxAbs = -min > max ? -min : max;
+    float scale;
+    if (min >= 0.0f)
+    {
+        *zeroPoint = 0;
+        scale = max > 0.0f ? max / QUANT_ACTIVATION_MAX : 1.0f;
+    }
+    else
+    {
+        *zeroPoint = QUANT_ZERO_POINT;
+        scale = maxAbs / (QUANT_ACTIVATION_MAX - QUANT_ZERO_POINT);
+    }
+
+    float inverse = 1.0f / scale;
+    float offset = *zeroPoint + 0.5f;
+    size_t columns = mat->columns;
+    size_t groupSize = quantBatchStride(columns) * QUANT_GROUP;
+    for (size_t g = 0; g * QUANT_GROUP < mat->rows; ++g)
+    {
+        const float *rows[QUANT_GROUP];
+        int whole = 1;
+        for (size_t q = 0; q < QUANT_GROUP; ++q)
+        {
+            size_t row = g * QUANT_GROUP + q;
+            rows[q] = row < mat->rows ? &mat->elements[row * mat->stride] : NULL;
+            whole = whole && rows[q] != NULL;
+        }
+
+        uint8_t *group = &quantized[g * groupSize];
+        size_t j = 0;
+#if defined(__SSE2__)
+        // The quantized values fit in seven bits, so the four features of a
+        // sample are packed into one 32 bit word with shifts.
+        if (whole)
+        {
+            __m128 inverses = _mm_set1_ps(inverse);
+            __m128 offsets = _mm_set1_ps(offset);
+            for (; j + 4 <= columns; j += 4)
+            {
+                __m128i word = _mm_setzero_si128();
+                for (size_t q = 0; q < QUANT_GROUP; ++q)
+                {
+                    __m128 value = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(&rows[q][j]), inverses), offsets);
+                    value = _mm_min_ps(_mm_max_ps(value, _mm_setzero_ps()), _mm_set1_ps(QUANT_ACTIVATION_MAX));
+                    word = _mm_or_si128(word, _mm_sll_epi32(_mm_cvttps_epi32(value), _mm_cvtsi32_si128(8 * q)));
+                }
+                _mm_storeu_si128((__m128i *)&group[j * QUANT_GROUP], word);
+            }
+        }
+#endif
+        for (; j < columns; ++j)
+        {
+            for (size_t q = 0; q < QUANT_GROUP; ++q)
+            {
+                float value = rows[q] != NULL ? rows[q][j] * inverse + offset : 0.0f;
+                value = value < 0.0f ? 0.0f : value;
+                value = value > QUANT_ACTIVATION_MAX ? QUANT_ACTIVATION_MAX : value;
+                group[j * QUANT_GROUP + q] = (uint8_t)value;
+            }
+        }
+    }
+
+    return scale;
+}
+
+// Computes the dot products of up to four rows of weights with a block of
+// QUANT_BLOCK samples, accumulating in 32 bits. Each group of four weights is
+// broadcast against the same group of every sample, so each lane of an
+// accumulator belongs to one sample and no horizontal sums are needed.
+// input: the quantized groups of the first sample of the block.
+// groupSize: the distance between consecutive groups of features.
+// rows: four rows of weights. Unused rows may repeat a valid row.
+// groups: the number of groups of features.
+// dots: the dot products, by row and then by sample.
+typedef void (*QuantDotBlockFunc)(const uint8_t *input,
+                                  size_t groupSize,
+                                  const int8_t *rows[4],
+                                  size_t groups,
+                                  int32_t dots[4][QUANT_BLOCK]);
+
+/**
+ * @brief The dot product kernel in plain C, the reference the others match.
+ */
+static void quantDotBlockScalar(const uint8_t *input,
+                                size_t groupSize,
+                                const int8_t *rows[4],
+                                size_t groups,
+                                int32_t dots[4][QUANT_BLOCK])
+{
+    for (size_t r = 0; r < 4; ++r)
+    {
+        for (size_t j = 0; j < QUANT_BLOCK; ++j)
+        {
+            dots[r][j] = 0;
+        }
+        for (size_t g = 0; g < groups; ++g)
+        {
+            const uint8_t *group = &input[g * groupSize];
+            const int8_t *w = &rows[r][g * QUANT_GROUP];
+            for (size_t j = 0; j < QUANT_BLOCK; ++j)
+            {
+                for (size_t q = 0; q < QUANT_GROUP; ++q)
+                {
+                    dots[r][j] += (int32_t)group[j * QUANT_GROUP + q] * (int32_t)w[q];
+                }
+            }
+        }
+    }
+}
+
+#ifdef CPU_X86
+/**
+ * @brief The dot product kernel on SSE registers. Without maddubs, the bytes 
+ *        are widened to 16 bits first. Each madd then leaves two partial sums 
+ *        per sample, which are combined at the end.
+ */
+static CPU_TARGET_SSE42 void quantDotBlockSse(const uint8_t *input,
+                                              size_t groupSize,
+                                              const int8_t *rows[4],
+                                              size_t groups,
+                                              int32_t dots[4][QUANT_BLOCK])
+{
+    __m128i zero = _mm_setzero_si128();
+    for (size_t r = 0; r < 4; ++r)
+    {
+        __m128i acc0 = _mm_setzero_si128(), acc1 = _mm_setzero_si128();
+        __m128i acc2 = _mm_setzero_si128(), acc3 = _mm_setzero_si128();
+        __m128i acc4 = _mm_setzero_si128(), acc5 = _mm_setzero_si128();
+        __m128i acc6 = _mm_setzero_si128(), acc7 = _mm_setzero_si128();
+        for (size_t g = 0; g < groups; ++g)
+        {
+            const uint8_t *group = &input[g * groupSize];
+            int32_t word;
+            memcpy(&word, &rows[r][g * QUANT_GROUP], sizeof(int32_t));
+            __m128i w = _mm_cvtsi32_si128(word);
+            w = _mm_srai_epi16(_mm_unpacklo_epi8(w, w), 8);
+            w = _mm_unpacklo_epi64(w, w);
+
+            __m128i x = _mm_load_si128((const __m128i *)group);
+            acc0 = _mm_add_epi32(acc0, _mm_madd_epi16(_mm_unpacklo_epi8(x, zero), w));
+            acc1 = _mm_add_epi32(acc1, _mm_madd_epi16(_mm_unpackhi_epi8(x, zero), w));
+            x = _mm_load_si128((const __m128i *)(group + 16));
+            acc2 = _mm_add_epi32(acc2, _mm_madd_epi16(_mm_unpacklo_epi8(x, zero), w));
+            acc3 = _mm_add_epi32(acc3, _mm_madd_epi16(_mm_unpackhi_epi8(x, zero), w));
+            x = _mm_load_si128((const __m128i *)(group + 32));
+            acc4 = _mm_add_epi32(acc4, _mm_madd_epi16(_mm_unpacklo_epi8(x, zero), w));
+            acc5 = _mm_add_epi32(acc5, _mm_madd_epi16(_mm_unpackhi_epi8(x, zero), w));
+            x = _mm_load_si128((const __m128i *)(group + 48));
+            acc6 = _mm_add_epi32(acc6, _mm_madd_epi16(_mm_unpacklo_epi8(x, zero), w));
+            acc7 = _mm_add_epi32(acc7, _mm_madd_epi16(_mm_unpackhi_epi8(x, zero), w));
+        }
+
+        __m128i acc[QUANT_BLOCK / 2] = {acc0, acc1, acc2, acc3, acc4, acc5, acc6, acc7};
+        for (size_t k = 0; k < QUANT_BLOCK / 4; ++k)
+        {
+            __m128 low = _mm_castsi128_ps(acc[2 * k]);
+            __m128 high = _mm_castsi128_ps(acc[2 * k + 1]);
+            __m128i even = _mm_castps_si128(_mm_shuffle_ps(low, high, _MM_SHUFFLE(2, 0, 2, 0)));
+            __m128i odd = _mm_castps_si128(_mm_shuffle_ps(low, high, _MM_SHUFFLE(3, 1, 3, 1)));
+            _mm_storeu_si128((__m128i *)&dots[r][4 * k], _mm_add_epi32(even, odd));
+        }
+    }
+}
+
+// Defines a dot product kernel on AVX2 registers around one multiply-add of
+// unsigned by signed bytes into 32 bit lanes.
+#define QUANT_DOT_BLOCK_256(name, target, mac)                                          \
+    static target void quantDotBlock##name(const uint8_t *input,                        \
+                                           size_t groupSize,                            \
+                                           const int8_t *rows[4],                       \
+                                           size_t groups,                               \
+                                           int32_t dots[4][QUANT_BLOCK])                \
+    {                                                                                   \
+        __m256i acc00 = _mm256_setzero_si256(), acc01 = _mm256_setzero_si256();         \
+        __m256i acc10 = _mm256_setzero_si256(), acc11 = _mm256_setzero_si256();         \
+        __m256i acc20 = _mm256_setzero_si256(), acc21 = _mm256_setzero_si256();         \
+        __m256i acc30 = _mm256_setzero_si256(), acc31 = _mm256_setzero_si256();         \
+        for (size_t g = 0; g < groups; ++g)                                             \
+        {                                                                               \
+            const uint8_t *group = &input[g * groupSize];                               \
+            __m256i x0 = _mm256_load_si256((const __m256i *)group);                     \
+            __m256i x1 = _mm256_load_si256((const __m256i *)(group + 32));              \
+            int32_t word;                                                               \
+            memcpy(&word, &rows[0][g * QUANT_GROUP], sizeof(int32_t));                  \
+            __m256i w = _mm256_set1_epi32(word);                                        \
+            acc00 = mac(acc00, x0, w);                                                  \
+            acc01 = mac(acc01, x1, w);                                                  \
+            memcpy(&word, &rows[1][g * QUANT_GROUP], sizeof(int32_t));                  \
+            w = _mm256_set1_epi32(word);                                                \
+            acc10 = mac(acc10, x0, w);                                                  \
+            acc11 = mac(acc11, x1, w);                                                  \
+            memcpy(&word, &rows[2][g * QUANT_GROUP], sizeof(int32_t));                  \
+            w = _mm256_set1_epi32(word);                                                \
+            acc20 = mac(acc20, x0, w);                                                  \
+            acc21 = mac(acc21, x1, w);                                                  \
+            memcpy(&word, &rows[3][g * QUANT_GROUP], sizeof(int32_t));                  \
+            w = _mm256_set1_epi32(word);                                                \
+            acc30 = mac(acc30, x0, w);                                                  \
+            acc31 = mac(acc31, x1, w);                                                  \
+        }                                                                               \
+                                                                                        \
+        _mm256_storeu_si256((__m256i *)&dots[0][0], acc00);                             \
+        _mm256_storeu_si256((__m256i *)&dots[0][8], acc01);                             \
+        _mm256_storeu_si256((__m256i *)&dots[1][0], acc10);                             \
+        _mm256_storeu_si256((__m256i *)&dots[1][8], acc11);                             \
+        _mm256_storeu_si256((__m256i *)&dots[2][0], acc20);                             \
+        _mm256_storeu_si256((__m256i *)&dots[2][8], acc21);                             \
+        _mm256_storeu_si256((__m256i *)&dots[3][0], acc30);                             \
+        _mm256_storeu_si256((__m256i *)&dots[3][8], acc31);                             \
+    }
+
+// maddubs multiplies bytes into pairs of 16 bit sums, and madd with ones
+// widens them to 32 bits. The VNNI instructions (vpdpbusd) do both at once.
+#define QUANT_MADDUBS(acc, x, w) \
+    _mm256_add_epi32(acc, _mm256_madd_epi16(_mm256_maddubs_epi16(x, w), _mm256_set1_epi16(1)))
+
+QUANT_DOT_BLOCK_256(Avx2, CPU_TARGET_AVX2, QUANT_MADDUBS)
+QUANT_DOT_BLOCK_256(AvxVnni, CPU_TARGET_AVXVNNI, _mm256_dpbusd_avx_epi32)
+QUANT_DOT_BLOCK_256(Avx512Vnni, CPU_TARGET_AVX512VNNI, _mm256_dpbusd_epi32)
+
+static const QuantDotBlockFunc quantDotBlocks[CPU_ISAS] = {
+    quantDotBlockScalar,
+    quantDotBlockSse,
+    quantDotBlockAvx2,
+    quantDotBlockAvx2,
+};
+#else
+static const QuantDotBlockFunc quantDotBlocks[CPU_ISAS] = {quantDotBlockScalar};
+#endif
+
+/**
+ * @brief Picks the dot product kernel for the selected tier, using VNNI
+ *        where the processor has it.
+ */
+static QuantDotBlockFunc quantDotBlockKernel(void)
+{
+#ifdef CPU_X86
+    if (cpuHasFeature(CPU_AVX512VNNI))
+    {
+        return quantDotBlockAvx512Vnni;
+    }
+    if (cpuHasFeature(CPU_AVXVNNI))
+    {
+        return quantDotBlockAvxVnni;
+    }
+#endif
+
+    return quantDotBlocks[cpuIsa()];
+}
+
+/**
+ * @brief Computes one layer from quantized activations. The zero point is
+ *        removed with the precomputed row sums of the weights, and the
+ *        result is dequantized and biased in float.
+ *
+ * @param weights The quantized weights of the layer.
+ * @param biases The biases of the layer.
+ * @param input The quantized groups of activations.
+ * @param inputScale The scale of the activations.
+ * @param zeroPoint The zero point of the activations.
+ * @param output A matrix with one row per neuron and one column per sample.
+ */
+static void quantLayer(QuantMatrix *weights,
+                       Matrix *biases,
+                       const uint8_t *input,
+                       float inputScale,
+                       int32_t zeroPoint,
+                       Matrix *output)
+{
+    size_t batchSize = output->columns;
+    size_t groupSize = quantBatchStride(batchSize) * QUANT_GROUP;
+    size_t groups = weights->stride / QUANT_GROUP;
+    QuantDotBlockFunc dotBlock = quantDotBlockKernel();
+    for (size_t i = 0; i < weights->rows; i += 4)
+    {
+        // A partial block of rows repeats its last row rather than branching.
+        size_t rows = weights->rows - i < 4 ? weights->rows - i : 4;
+        const int8_t *rowPointers[4];
+        for (size_t r = 0; r < 4; ++r)
+        {
+            size_t row = r < rows ? i + r : i + rows - 1;
+            rowPointers[r] = &weights->elements[row * weights->stride];
+        }
+
+        for (size_t j = 0; j < batchSize; j += QUANT_BLOCK)
+        {
+            int32_t dots[4][QUANT_BLOCK];
+            dotBlock(&input[j * QUANT_GROUP], groupSize, rowPointers, groups, dots);
+
+            size_t columns = batchSize - j < QUANT_BLOCK ? batchSize - j : QUANT_BLOCK;
+            for (size_t r = 0; r < rows; ++r)
+            {
+                float scale = weights->scales[i + r] * inputScale;
+                int32_t offset = zeroPoint * weights->rowSums[i + r];
+                float bias = biases->elements[(i + r) * biases->stride];
+                float *result = &output->elements[(i + r) * output->stride + j];
+                for (size_t c = 0; c < columns; ++c)
+                {
+                    result[c] = (float)(dots[r][c] - offset) * scale + bias;
+                }
+            }
+        }
+    }
+}
+
+/**
+ * @brief Predicts the labels of a batch of features with the quantized
+ *        network. The activations of each layer are quantized per batch.
+ *
+ * @param qnet An initialized quantized neural network.
+ * @param features A matrix with one column per sample, and no more columns
+ *                 than the maximum batch size of the workspace.
+ * @param activation An activation function.
+ * @param workspace A workspace for the quantized neural network.
+ * @return The predictions, one column per sample. Valid until the workspace
+ *         is next used.
+ */
+Matrix *quantPredictBatch(QuantNet *qnet,
+                          Matrix *features,
+                          NetActivationFunc activation,
+                          QuantWorkspace *workspace)
+{
+    size_t batchSize = features->columns;
+    if (batchSize > workspace->maxBatchSize)
+    {
+        fprintf(stderr,
+                "Error: Cannot predict %lu samples with a workspace for %lu\n",
+                batchSize, workspace->maxBatchSize);
+
+        return NULL;
+    }
+
+    Matrix *input = features;
+    for (size_t i = 0; i < qnet->layers - 1; ++i)
+    {
+        QuantMatrix *weights = &qnet->weights[i];
+        int32_t zeroPoint;
+        float scale = quantActivations(input, workspace->quantized, &zeroPoint);
+
+        Matrix *output = input == &workspace->current ? &workspace->next : &workspace->current;
+        output->rows = weights->rows;
+        output->columns = batchSize;
+        output->stride = batchSize;
+        quantLayer(weights, &qnet->biases[i], workspace->quantized, scale, zeroPoint, output);
+        if (qnet->output == NET_OUTPUT_SOFTMAX && i == qnet->layers - 2)
+        {
+            actSoftmaxInto(output, output);
+        }
+        else
+        {
+            activation(output, output);
+        }
+        input = output;
+    }
+
+    return input;
+}
+
+/**
+ * @brief The state shared by the threads testing a quantized network.
+ */
+typedef struct
+{
+    QuantNet *qnet;
+    NeuralNet *net;
+    Dataset *testing;
+    NetActivationFunc activation;
+    QuantWorkspace *workspaces;
+    NetWorkspace *netWorkspaces;
+    QuantComparison *comparisons;
+}
+QuantParallelTest;
+
+/**
+ * @brief Tests a contiguous shard of a testing dataset in batches, comparing
+ *        against the float network when there is one.
+ */
+static void quantTestShard(void *arg, size_t thread, size_t threads)
+{
+    QuantParallelTest *test = (QuantParallelTest *)arg;
+    QuantWorkspace *workspace = &test->workspaces[thread];
+    QuantComparison *comparison = &test->comparisons[thread];
+    Dataset *testing = test->testing;
+    memset(comparison, 0, sizeof(QuantComparison));
+
+    size_t start = testing->samples * thread / threads;
+    size_t end = testing->samples * (thread + 1) / threads;
+
+    uint32_t indices[NET_TEST_BATCH_SIZE];
+    size_t quantClasses[NET_TEST_BATCH_SIZE];
+    size_t floatClasses[NET_TEST_BATCH_SIZE];
+    for (size_t i = start; i < end; i += NET_TEST_BATCH_SIZE)
+    {
+        size_t batchSize = end - i < NET_TEST_BATCH_SIZE ? end - i : NET_TEST_BATCH_SIZE;
+        for (size_t j = 0; j < batchSize; ++j)
+        {
+            indices[j] = (uint32_t)(i + j);
+        }
+
+        workspace->features.columns = batchSize;
+        workspace->features.stride = batchSize;
+        datasetGather(testing, indices, batchSize, &workspace->features, NULL);
+        Matrix *quantPredictions = quantPredictBatch(test->qnet, &workspace->features, test->activation, workspace);
+        matMaxColumnElements(quantPredictions, quantClasses);
+
+        Matrix *floatPredictions = NULL;
+        if (test->net != NULL)
+        {
+            floatPredictions = netPredictBatch(test->net,
+                                               &workspace->features,
+                                               test->activation,
+                                               &test->netWorkspaces[thread]);
+            matMaxColumnElements(floatPredictions, floatClasses);
+
+            for (size_t j = 0; j < quantPredictions->rows * batchSize; ++j)
+            {
+                float error = fabsf(quantPredictions->elements[j] - floatPredictions->elements[j]);
+                if (error > comparison->maxError)
+                {
+                    comparison->maxError = error;
+                }
+            }
+        }
+
+        for (size_t j = 0; j < batchSize; ++j)
+        {
+            unsigned char label = testing->labels[i + j];
+            comparison->quantCorrect += quantClasses[j] == label;
+            if (floatPredictions != NULL)
+            {
+                comparison->floatCorrect += floatClasses[j] == label;
+                comparison->agreements += floatClasses[j] == quantClasses[j];
+            }
+        }
+        comparison->samples += batchSize;
+    }
+}
+
+/**
+ * @brief Runs the quantized network, and optionally the float network, over
+ *        a testing dataset split into one shard per thread.
+ */
+static void quantRun(QuantNet *qnet,
+                     NeuralNet *net,
+                     Dataset *testing,
+                     NetActivationFunc activation,
+                     size_t threads,
+                     QuantComparison *comparison)
+{
+    if (threads == 0)
+    {
+        threads = 1;
+    }
+
+    QuantWorkspace *workspaces = (QuantWorkspace *)malloc(threads * sizeof(QuantWorkspace));
+    NetWorkspace *netWorkspaces = (NetWorkspace *)malloc(threads * sizeof(NetWorkspace));
+    QuantComparison *comparisons = (QuantComparison *)malloc(threads * sizeof(QuantComparison));
+    for (size_t i = 0; i < threads; ++i)
+    {
+        quantWorkspaceInit(&workspaces[i], qnet, NET_TEST_BATCH_SIZE);
+        if (net != NULL)
+        {
+            netWorkspaceInit(&netWorkspaces[i], net, NET_TEST_BATCH_SIZE);
+        }
+    }
+
+    QuantParallelTest test = {qnet, net, testing, activation, workspaces, netWorkspaces, comparisons};
+    if (threads == 1)
+    {
+        quantTestShard(&test, 0, 1);
+    }
+    else
+    {
+        ThreadPool pool;
+        poolInit(&pool, threads);
+        poolRun(&pool, quantTestShard, &test);
+        poolFree(&pool);
+    }
+
+    memset(comparison, 0, sizeof(QuantComparison));
+    for (size_t i = 0; i < threads; ++i)
+    {
+        comparison->samples += comparisons[i].samples;
+        comparison->floatCorrect += comparisons[i].floatCorrect;
+        comparison->quantCorrect += comparisons[i].quantCorrect;
+        comparison->agreements += comparisons[i].agreements;
+        if (comparisons[i].maxError > comparison->maxError)
+        {
+            comparison->maxError = comparisons[i].maxError;
+        }
+
+        quantWorkspaceFree(&workspaces[i]);
+        if (net != NULL)
+        {
+            netWorkspaceFree(&netWorkspaces[i]);
+        }
+    }
+    free(comparisons);
+    free(netWorkspaces);
+    free(workspaces);
+}
+
+/**
+ * @brief Tests the accuracy of a quantized neural network on a dataset of
+ *        class labels.
+ *
+ * @param qnet An initialized quantized neural network.
+ * @param testing A testing dataset.
+ * @param activation An activation function.
+ * @param threads The number of threads to test with.
+ * @return The number of correct predictions.
+ */
+size_t quantTest(QuantNet *qnet,
+                 Dataset *testing,
+                 NetActivationFunc activation,
+                 size_t threads)
+{
+    QuantComparison comparison;
+    quantRun(qnet, NULL, testing, activation, threads, &comparison);
+
+    return comparison.quantCorrect;
+}
+
+/**
+ * @brief Compares a quantized neural network against the float network it
+ *        was made from on the same testing dataset, to decide whether the
+ *        quantized network is accurate enough to serve.
+ *
+ * @param qnet An initialized quantized neural network.
+ * @param net The neural network the quantized network was made from.
+ * @param testing A testing dataset.
+ * @param activation An activation function.
+ * @param threads The number of threads to test with.
+ * @param comparison The correct predictions of both networks, how often
+ *                   their predictions agree, and the largest difference
+ *                   between their outputs.
+ */
+void quantCompare(QuantNet *qnet,
+                  NeuralNet *net,
+                  Dataset *testing,
+                  NetActivationFunc activation,
+                  size_t threads,
+                  QuantComparison *comparison)
+{
+    quantRun(qnet, net, testing, activation, threads, comparison);
+}
@@ -0,0 +1,72 @@
+#ifndef QUANTIZE_H
+#define QUANTIZE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "matrix.h"
+#include "neural_net.h"
+#include "dataset.h"
+
+// Rows of quantized values are padded with zeros to a multiple of this, so
+// the dot product kernels never need a tail.
+#define QUANT_ALIGNMENT 64
+
+typedef struct
+{
+    size_t rows, columns, stride;
+    int8_t *elements;
+    float *scales;
+    int32_t *rowSums;
+}
+QuantMatrix;
+
+typedef struct
+{
+    size_t layers;
+    size_t *layerSizes;
+    QuantMatrix *weights;
+    Matrix *biases;
+    NetOutput output;
+}
+QuantNet;
+
+typedef struct
+{
+    size_t maxBatchSize, maxStride;
+    Matrix features, current, next;
+    uint8_t *quantized;
+}
+QuantWorkspace;
+
+typedef struct
+{
+    size_t samples;
+    size_t floatCorrect, quantCorrect;
+    size_t agreements;
+    float maxError;
+}
+QuantComparison;
+
+void quantInit(QuantNet *qnet, NeuralNet *net);
+void quantFree(QuantNet *qnet);
+size_t quantSize(QuantNet *qnet);
+
+void quantWorkspaceInit(QuantWorkspace *workspace, QuantNet *qnet, size_t maxBatchSize);
+void quantWorkspaceFree(QuantWorkspace *workspace);
+
+Matrix *quantPredictBatch(QuantNet *qnet,
+                          Matrix *features,
+                          NetActivationFunc activation,
+                          QuantWorkspace *workspace);
+size_t quantTest(QuantNet *qnet,
+                 Dataset *testing,
+                 NetActivationFunc activation,
+                 size_t threads);
+void quantCompare(QuantNet *qnet,
+                  NeuralNet *net,
+                  Dataset *testing,
+                  NetActivationFunc activation,
+                  size_t threads,
+                  QuantComparison *comparison);
+
+#endif
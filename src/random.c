@@ -0,0 +1,114 @@
+#include "random.h"
+#include <stdint.h>
+
+/**
+ * @brief Rotates the bits of a 64 bit value left.
+ */
+static inline uint64_t rngRotate(uint64_t value, int bits)
+{
+    return (value << bits) | (value >> (64 - bits));
+}
+
+/**
+ * @brief Advances a SplitMix64 state. Used to expand a seed into a full 
+ *        generator state.
+ *
+ * @param state A SplitMix64 state.
+ * @return The next output.
+ */
+static uint64_t rngSplitMix(uint64_t *state)
+{
+    uint64_t z = (*state += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+
+    return z ^ (z >> 31);
+}
+
+/**
+ * @brief Seeds a random number generator. The same seed always produces the 
+ *        same sequence.
+ *
+ * @param rng An uninitialized generator.
+ * @param seed A seed.
+ */
+void rngSeed(Rng *rng, uint64_t seed)
+{
+    for (int i = 0; i < 4; ++i)
+    {
+        rng->state[i] = rngSplitMix(&seed);
+    }
+}
+
+/**
+ * @brief Seeds a generator for one of the independent streams of a seed. 
+ *        The stream is hashed into the seed rather than reached by stepping, 
+ *        so any stream can be started directly, in any order, on any thread.
+ *
+ * @param rng An uninitialized generator.
+ * @param seed A seed.
+ * @param stream The index of the stream.
+ */
+void rngSeedStream(Rng *rng, uint64_t seed, uint64_t stream)
+{
+    uint64_t key = rngSplitMix(&seed) ^ stream;
+    rngSeed(rng, rngSplitMix(&key));
+}
+
+/**
+ * @brief Generates 64 random bits with xoshiro256**.
+ *
+ * @param rng A seeded generator.
+ * @return A random value.
+ */
+uint64_t rngNext(Rng *rng)
+{
+    uint64_t *s = rng->state;
+    uint64_t result = rngRotate(s[1] * 5, 7) * 9;
+    uint64_t t = s[1] << 17;
+
+    s[2] ^= s[0];
+    s[3] ^= s[1];
+    s[1] ^= s[2];
+    s[0] ^= s[3];
+    s[2] ^= t;
+    s[3] = rngRotate(s[3], 45);
+
+    return result;
+}
+
+/**
+ * @brief Generates an unbiased random integer below a bound, using Lemire's 
+ *        multiply and reject method. It rarely needs a division.
+ *
+ * @param rng A seeded generator.
+ * @param bound An exclusive upper bound greater than zero.
+ * @return A random value in [0, bound).
+ */
+uint32_t rngBounded(Rng *rng, uint32_t bound)
+{
+    uint64_t product = (rngNext(rng) >> 32) * bound;
+    uint32_t low = (uint32_t)product;
+    if (low < bound)
+    {
+        uint32_t threshold = -bound % bound;
+        while (low < threshold)
+        {
+            product = (rngNext(rng) >> 32) * bound;
+            low = (uint32_t)product;
+        }
+    }
+
+    return (uint32_t)(product >> 32);
+}
+
+/**
+ * @brief Generates a random float.
+ *
+ * @param rng A seeded generator.
+ * @return A random value in [0, 1).
+ */
+float rngUniform(Rng *rng)
+{
+    return (rngNext(rng) >> 40) * (1.0f / 16777216.0f);
+}
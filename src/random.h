@@ -0,0 +1,18 @@
+#ifndef RANDOM_H
+#define RANDOM_H
+
+#include <stdint.h>
+
+typedef struct
+{
+    uint64_t state[4];
+}
+Rng;
+
+void rngSeed(Rng *rng, uint64_t seed);
+void rngSeedStream(Rng *rng, uint64_t seed, uint64_t stream);
+uint64_t rngNext(Rng *rng);
+uint32_t rngBounded(Rng *rng, uint32_t bound);
+float rngUniform(Rng *rng);
+
+#endif
@@ -0,0 +1,133 @@
+#include "thread_pool.h"
+#include <pthread.h>
+#include <stdlib.h>
+
+/**
+ * @brief Waits for work from the pool and runs it until the pool stops.
+ *
+ * @param arg The worker.
+ * @return NULL.
+ */
+static void *poolWorkerMain(void *arg)
+{
+    PoolWorker *worker = (PoolWorker *)arg;
+    ThreadPool *pool = worker->pool;
+
+    pthread_mutex_lock(&pool->mutex);
+    size_t seen = 0;
+    for (;;)
+    {
+        while (pool->generation == seen && !pool->stop)
+        {
+            pthread_cond_wait(&pool->start, &pool->mutex);
+        }
+        if (pool->stop)
+        {
+            break;
+        }
+
+        seen = pool->generation;
+        PoolFunc func = pool->func;
+        void *funcArg = pool->arg;
+        pthread_mutex_unlock(&pool->mutex);
+
+        func(funcArg, worker->index, pool->threads);
+
+        pthread_mutex_lock(&pool->mutex);
+        if (--pool->remaining == 0)
+        {
+            pthread_cond_signal(&pool->done);
+        }
+    }
+    pthread_mutex_unlock(&pool->mutex);
+
+    return NULL;
+}
+
+/**
+ * @brief Starts a pool of threads. The calling thread counts as one of the 
+ *        threads, so one fewer worker is started.
+ *
+ * @param pool An uninitialized thread pool.
+ * @param threads The number of threads, including the caller.
+ */
+void poolInit(ThreadPool *pool, size_t threads)
+{
+    pool->threads = threads > 0 ? threads : 1;
+    pool->generation = 0;
+    pool->remaining = 0;
+    pool->stop = 0;
+    pool->func = NULL;
+    pool->arg = NULL;
+    pthread_mutex_init(&pool->mutex, NULL);
+    pthread_cond_init(&pool->start, NULL);
+    pthread_cond_init(&pool->done, NULL);
+
+    pool->workers = (PoolWorker *)malloc(pool->threads * sizeof(PoolWorker));
+    for (size_t i = 1; i < pool->threads; ++i)
+    {
+        pool->workers[i].pool = pool;
+        pool->workers[i].index = i;
+        pthread_create(&pool->workers[i].thread, NULL, poolWorkerMain, &pool->workers[i]);
+    }
+}
+
+/**
+ * @brief Stops and joins the threads of a pool.
+ *
+ * @param pool An initialized thread pool.
+ */
+void poolFree(ThreadPool *pool)
+{
+    pthread_mutex_lock(&pool->mutex);
+    pool->stop = 1;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->mutex);
+
+    for (size_t i = 1; i < pool->threads; ++i)
+    {
+        pthread_join(pool->workers[i].thread, NULL);
+    }
+    free(pool->workers);
+    pthread_mutex_destroy(&pool->mutex);
+    pthread_cond_destroy(&pool->start);
+    pthread_cond_destroy(&pool->done);
+
+    pool->threads = 0;
+    pool->workers = NULL;
+}
+
+/**
+ * @brief Runs a function on every thread of a pool and waits for all of them 
+ *        to finish. The function receives its argument, the index of the 
+ *        thread and the number of threads. The calling thread runs index 0.
+ *
+ * @param pool An initialized thread pool.
+ * @param func A function to run.
+ * @param arg An argument for the function.
+ */
+void poolRun(ThreadPool *pool, PoolFunc func, void *arg)
+{
+    if (pool->threads > 1)
+    {
+        pthread_mutex_lock(&pool->mutex);
+        pool->func = func;
+        pool->arg = arg;
+        pool->remaining = pool->threads - 1;
+        ++pool->generation;
+        pthread_cond_broadcast(&pool->start);
+        pthread_mutex_unlock(&pool->mutex);
+    }
+
+    func(arg, 0, pool->threads);
+
+    if (pool->threads > 1)
+    {
+        pthread_mutex_lock(&pool->mutex);
+        while (pool->remaining > 0)
+        {
+            pthread_cond_wait(&pool->done, &pool->mutex);
+        }
+        pthread_mutex_unlock(&pool->mutex);
+    }
+}
@@ -0,0 +1,36 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <stddef.h>
+#include <pthread.h>
+
+typedef void (*PoolFunc)(void *, size_t, size_t);
+
+struct ThreadPool;
+
+typedef struct
+{
+    struct ThreadPool *pool;
+    size_t index;
+    pthread_t thread;
+}
+PoolWorker;
+
+typedef struct ThreadPool
+{
+    size_t threads;
+    PoolWorker *workers;
+    pthread_mutex_t mutex;
+    pthread_cond_t start, done;
+    size_t generation, remaining;
+    int stop;
+    PoolFunc func;
+    void *arg;
+}
+ThreadPool;
+
+void poolInit(ThreadPool *pool, size_t threads);
+void poolFree(ThreadPool *pool);
+void poolRun(ThreadPool *pool, PoolFunc func, void *arg);
+
+#endif
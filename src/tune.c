@@ -0,0 +1,698 @@
+#include "tune.h"
+#include "gemm.h"
+#include "cpu.h"
+#include "matrix.h"
+#include "random.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// The first line of a tuning cache. A file starting with anything else is
+// ignored and rewritten.
+#define TUNE_HEADER "# net tuning cache 1"
+
+#define TUNE_KEY_SIZE 256
+#define TUNE_VALUE_SIZE 64
+
+// Each measurement is the best of this many runs, which filters out
+// interference from the rest of the machine.
+#define TUNE_REPETITIONS 3
+
+// Smaller products are dominated by call overhead rather than by the cache,
+// so their blocks are left alone.
+#define TUNE_MIN_GEMM_FLOPS 1e6
+
+// Candidate cache blocks, the defaults first. Each fits the packing buffers:
+// they trade a taller or shorter panel of A against a deeper or shallower
+// sliver of B.
+static const GemmBlocking tuneBlockings[] = {
+    {GEMM_MC, GEMM_KC, GEMM_NC},
+    {48, 256, 1024},
+    {192, 128, 2048},
+    {96, 128, 2048},
+    {48, 512, 512},
+    {24, 512, 512},
+    {192, 128, 1024},
+    {96, 256, 512},
+};
+
+#define TUNE_BLOCKINGS (sizeof(tuneBlockings) / sizeof(tuneBlockings[0]))
+
+typedef void (*TuneFunc)(void *);
+
+// One line of a tuning cache.
+typedef struct
+{
+    char key[TUNE_KEY_SIZE];
+    char value[TUNE_VALUE_SIZE];
+}
+TuneEntry;
+
+typedef struct
+{
+    TuneEntry *entries;
+    size_t count, capacity;
+    int changed;
+}
+TuneCache;
+
+// A product shape as gemm sees it.
+typedef struct
+{
+    GemmTranspose transA, transB;
+    size_t m, n, k;
+}
+TuneShape;
+
+typedef struct
+{
+    NeuralNet *net;
+    Dataset *dataset;
+    NetActivationFunc activation;
+    NetActivationDerivFunc activationDeriv;
+    NetCostFunc costDeriv;
+    size_t miniBatchSize, threads;
+}
+TuneNetRun;
+
+typedef struct
+{
+    TuneShape shape;
+    GemmBlocking blocking;
+    Matrix a, b, c;
+}
+TuneGemmRun;
+
+/**
+ * @brief Gets the time from a monotonic clock in seconds.
+ */
+static double tuneSeconds(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return now.tv_sec + now.tv_nsec * 1e-9;
+}
+
+/**
+ * @brief Times a function: each run repeats it until at least the minimum
+ *        time has passed, and the best time per call of several runs is
+ *        kept.
+ *
+ * @param func The function to time.
+ * @param arg The argument of the function.
+ * @param minSeconds The minimum time of each run.
+ * @return The best seconds per call.
+ */
+static double tuneMeasure(TuneFunc func, void *arg, double minSeconds)
+{
+    double best = 0.0;
+    for (size_t repetition = 0; repetition < TUNE_REPETITIONS; ++repetition)
+    {
+        size_t calls = 0;
+        double start = tuneSeconds();
+        double seconds;
+        do
+        {
+            func(arg);
+            ++calls;
+            seconds = tuneSeconds() - start;
+        }
+        while (seconds < minSeconds);
+
+        if (repetition == 0 || seconds / calls < best)
+        {
+            best = seconds / calls;
+        }
+    }
+
+    return best;
+}
+
+/**
+ * @brief Finds the value of a key in a tuning cache.
+ *
+ * @return The value, or NULL if the key is not cached.
+ */
+static const char *tuneCacheGet(TuneCache *cache, const char *key)
+{
+    for (size_t i = 0; i < cache->count; ++i)
+    {
+        if (strcmp(cache->entries[i].key, key) == 0)
+        {
+            return cache->entries[i].value;
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief Sets the value of a key in a tuning cache, replacing any earlier
+ *        value.
+ */
+static void tuneCacheSet(TuneCache *cache, const char *key, const char *value)
+{
+    TuneEntry *entry = NULL;
+    for (size_t i = 0; i < cache->count && entry == NULL; ++i)
+    {
+        if (strcmp(cache->entries[i].key, key) == 0)
+        {
+            entry = &cache->entries[i];
+        }
+    }
+
+    if (entry == NULL)
+    {
+        if (cache->count == cache->capacity)
+        {
+            cache->capacity = cache->capacity > 0 ? 2 * cache->capacity : 16;
+            cache->entries = (TuneEntry *)realloc(cache->entries, cache->capacity * sizeof(TuneEntry));
+        }
+        entry = &cache->entries[cache->count++];
+        snprintf(entry->key, sizeof(entry->key), "%s", key);
+    }
+    snprintf(entry->value, sizeof(entry->value), "%s", value);
+    cache->changed = 1;
+}
+
+/**
+ * @brief Reads a tuning cache. A missing file or one without the header
+ *        gives an empty cache, so it is measured and written again.
+ *
+ * @param cache An uninitialized cache.
+ * @param path The path of the file.
+ */
+static void tuneCacheLoad(TuneCache *cache, const char *path)
+{
+    *cache = (TuneCache){NULL, 0, 0, 0};
+
+    FILE *stream = fopen(path, "r");
+    if (stream == NULL)
+    {
+        return;
+    }
+
+    char line[TUNE_KEY_SIZE + TUNE_VALUE_SIZE];
+    if (fgets(line, sizeof(line), stream) == NULL ||
+        strncmp(line, TUNE_HEADER, strlen(TUNE_HEADER)) != 0)
+    {
+        fclose(stream);
+        return;
+    }
+
+    while (fgets(line, sizeof(line), stream) != NULL)
+    {
+        line[strcspn(line, "\r\n")] = '\0';
+        char *tab = strchr(line, '\t');
+        if (line[0] == '#' || tab == NULL)
+        {
+            continue;
+        }
+
+        *tab = '\0';
+        tuneCacheSet(cache, line, tab + 1);
+    }
+    fclose(stream);
+    cache->changed = 0;
+}
+
+/**
+ * @brief Writes a tuning cache. The file is written beside the old one and
+ *        renamed over it, so a reader never sees half a cache.
+ *
+ * @param cache A cache.
+ * @param path The path of the file.
+ * @return Zero on success, or nonzero if the file could not be written.
+ */
+static int tuneCacheSave(TuneCache *cache, const char *path)
+{
+    char temporary[TUNE_KEY_SIZE];
+    snprintf(temporary, sizeof(temporary), "%s.tmp", path);
+
+    FILE *stream = fopen(temporary, "w");
+    if (stream == NULL)
+    {
+        fprintf(stderr, "Error: Cannot open %s for writing\n", temporary);
+        return -1;
+    }
+
+    int failed = fprintf(stream, "%s\n", TUNE_HEADER) < 0;
+    for (size_t i = 0; i < cache->count && !failed; ++i)
+    {
+        failed = fprintf(stream, "%s\t%s\n", cache->entries[i].key, cache->entries[i].value) < 0;
+    }
+    failed |= fclose(stream) != 0;
+
+    if (failed || rename(temporary, path) != 0)
+    {
+        fprintf(stderr, "Error: Cannot write %s\n", path);
+        remove(temporary);
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Frees a tuning cache.
+ */
+static void tuneCacheFree(TuneCache *cache)
+{
+    free(cache->entries);
+    *cache = (TuneCache){NULL, 0, 0, 0};
+}
+
+/**
+ * @brief Trains one epoch without changing the parameters.
+ */
+static void tuneTrainEpoch(void *arg)
+{
+    TuneNetRun *run = (TuneNetRun *)arg;
+
+    NetTrainOptions options;
+    netTrainOptionsInit(&options);
+    options.threads = run->threads;
+    netTrain(run->net,
+             run->dataset,
+             run->activation,
+             run->activationDeriv,
+             run->costDeriv,
+             1,
+             run->miniBatchSize,
+             0.0f,
+             &options);
+}
+
+/**
+ * @brief Tests the whole dataset.
+ */
+static void tuneTestDataset(void *arg)
+{
+    TuneNetRun *run = (TuneNetRun *)arg;
+
+    netTest(run->net, run->dataset, run->activation, run->threads);
+}
+
+/**
+ * @brief Finds the fastest thread count, trying one thread, each power of
+ *        two and then the maximum. The fewest threads win a tie.
+ *
+ * @param func Trains or tests with the thread count in the run.
+ * @param run The network and data to run on.
+ * @param maxThreads The most threads to try.
+ * @param minSeconds The minimum time of each measurement.
+ * @return The fastest thread count.
+ */
+static size_t tuneThreads(TuneFunc func, TuneNetRun *run, size_t maxThreads, double minSeconds)
+{
+    size_t best = 1;
+    double bestSeconds = 0.0;
+    for (size_t threads = 1;; threads *= 2)
+    {
+        if (threads > maxThreads)
+        {
+            threads = maxThreads;
+        }
+
+        run->threads = threads;
+        double seconds = tuneMeasure(func, run, minSeconds);
+        if (threads == 1 || seconds < bestSeconds)
+        {
+            best = threads;
+            bestSeconds = seconds;
+        }
+
+        if (threads == maxThreads)
+        {
+            break;
+        }
+    }
+
+    return best;
+}
+
+/**
+ * @brief Measures the fastest training and testing thread counts on a copy
+ *        of a neural network, over the first samples of the training data.
+ */
+static void tuneNetThreads(NeuralNet *net,
+                           Dataset *training,
+                           NetActivationFunc activation,
+                           NetActivationDerivFunc activationDeriv,
+                           NetCostFunc costDeriv,
+                           size_t miniBatchSize,
+                           const TuneOptions *options,
+                           size_t *trainThreads,
+                           size_t *testThreads)
+{
+    Dataset sample;
+    size_t samples = training->samples < options->samples ? training->samples : options->samples;
+    datasetInit(&sample,
+                training->features,
+                training->format,
+                training->labels,
+                samples,
+                training->featureSize,
+                training->classes,
+                training->featureScale);
+    if (datasetIsSparse(training))
+    {
+        datasetIndexSparse(&sample);
+    }
+
+    NeuralNet scratch;
+    netInit(&scratch, net->layers, net->layerSizes, NULL, NULL, NULL);
+    netCopyParameters(&scratch, net);
+    netSetPrecision(&scratch, net->precision);
+    scratch.output = net->output;
+
+    TuneNetRun run = {&scratch, &sample, activation, activationDeriv, costDeriv, miniBatchSize, 1};
+    size_t maxTrainThreads = options->maxThreads < miniBatchSize ? options->maxThreads : miniBatchSize;
+    *trainThreads = tuneThreads(tuneTrainEpoch, &run, maxTrainThreads, options->minSeconds);
+    *testThreads = tuneThreads(tuneTestDataset, &run, options->maxThreads, options->minSeconds);
+
+    netFree(&scratch);
+    datasetFree(&sample);
+}
+
+/**
+ * @brief Adds a product shape to a list unless it is already there or too
+ *        small to tune. Products of one column take the matrix-vector path,
+ *        which has no blocks.
+ *
+ * @return The new length of the list.
+ */
+static size_t tuneAddShape(TuneShape *shapes,
+                           size_t count,
+                           GemmTranspose transA,
+                           GemmTranspose transB,
+                           size_t m,
+                           size_t n,
+                           size_t k)
+{
+    if (n <= 1 || 2.0 * m * n * k < TUNE_MIN_GEMM_FLOPS)
+    {
+        return count;
+    }
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        if (shapes[i].transA == transA && shapes[i].transB == transB &&
+            shapes[i].m == m && shapes[i].n == n && shapes[i].k == k)
+        {
+            return count;
+        }
+    }
+
+    shapes[count] = (TuneShape){transA, transB, m, n, k};
+    return count + 1;
+}
+
+/**
+ * @brief Lists the dense products training and testing run: the forward,
+ *        backward and weight gradient products of each layer for each shard
+ *        size, and the forward products of each test batch. Sparse input
+ *        skips the dense products of the first layer.
+ *
+ * @param shapes Room for eight shapes per layer.
+ * @return The number of shapes.
+ */
+static size_t tuneNetShapes(NeuralNet *net,
+                            int sparse,
+                            size_t miniBatchSize,
+                            size_t trainThreads,
+                            TuneShape *shapes)
+{
+    size_t shardSizes[] = {miniBatchSize / trainThreads,
+                           (miniBatchSize + trainThreads - 1) / trainThreads};
+
+    size_t count = 0;
+    for (size_t i = 0; i < net->layers - 1; ++i)
+    {
+        size_t in = net->layerSizes[i], out = net->layerSizes[i + 1];
+        for (size_t j = 0; j < 2; ++j)
+        {
+            size_t shard = shardSizes[j];
+            if (i > 0 || !sparse)
+            {
+                count = tuneAddShape(shapes, count, GEMM_NO_TRANS, GEMM_NO_TRANS, out, shard, in);
+                count = tuneAddShape(shapes, count, GEMM_NO_TRANS, GEMM_TRANS, out, in, shard);
+            }
+            if (i > 0)
+            {
+                count = tuneAddShape(shapes, count, GEMM_TRANS, GEMM_NO_TRANS, in, shard, out);
+            }
+        }
+        if (i > 0 || !sparse)
+        {
+            count = tuneAddShape(shapes, count, GEMM_NO_TRANS, GEMM_NO_TRANS, out, NET_TEST_BATCH_SIZE, in);
+        }
+    }
+
+    return count;
+}
+
+/**
+ * @brief Runs one product of the shape being tuned with the candidate blocks.
+ */
+static void tuneGemm(void *arg)
+{
+    TuneGemmRun *run = (TuneGemmRun *)arg;
+    TuneShape *shape = &run->shape;
+
+    gemmWithBlocking(&run->blocking,
+                     shape->transA,
+                     shape->transB,
+                     shape->m,
+                     shape->n,
+                     shape->k,
+                     1.0f,
+                     run->a.elements,
+                     run->a.stride,
+                     run->b.elements,
+                     run->b.stride,
+                     0.0f,
+                     run->c.elements,
+                     run->c.stride);
+}
+
+/**
+ * @brief Fills a matrix with uniform random values.
+ */
+static void tuneRandomize(Matrix *mat, Rng *rng)
+{
+    for (size_t i = 0; i < mat->rows; ++i)
+    {
+        for (size_t j = 0; j < mat->columns; ++j)
+        {
+            mat->elements[i * mat->stride + j] = rngUniform(rng);
+        }
+    }
+}
+
+/**
+ * @brief Finds the fastest candidate blocks of a product shape on random
+ *        operands. The defaults win a tie, and a candidate that does not fit
+ *        the packing buffers is skipped. Candidates are passed to each
+ *        product rather than set, so the blocks of the shape are unchanged.
+ *
+ * @param shape The shape.
+ * @param minSeconds The minimum time of each measurement.
+ * @param blocking Set to the fastest blocks.
+ */
+static void tuneGemmBlocking(const TuneShape *shape, double minSeconds, GemmBlocking *blocking)
+{
+    TuneGemmRun run;
+    run.shape = *shape;
+    if (shape->transA == GEMM_TRANS)
+    {
+        matInit(&run.a, shape->k, shape->m);
+    }
+    else
+    {
+        matInit(&run.a, shape->m, shape->k);
+    }
+    if (shape->transB == GEMM_TRANS)
+    {
+        matInit(&run.b, shape->n, shape->k);
+    }
+    else
+    {
+        matInit(&run.b, shape->k, shape->n);
+    }
+    matInit(&run.c, shape->m, shape->n);
+
+    Rng rng;
+    rngSeed(&rng, 0);
+    tuneRandomize(&run.a, &rng);
+    tuneRandomize(&run.b, &rng);
+
+    gemmDefaultBlocking(blocking);
+    double bestSeconds = 0.0;
+    int measured = 0;
+    for (size_t i = 0; i < TUNE_BLOCKINGS; ++i)
+    {
+        if (!gemmBlockingFits(&tuneBlockings[i]))
+        {
+            continue;
+        }
+        run.blocking = tuneBlockings[i];
+
+        double seconds = tuneMeasure(tuneGemm, &run, minSeconds);
+        if (!measured || seconds < bestSeconds)
+        {
+            *blocking = tuneBlockings[i];
+            bestSeconds = seconds;
+            measured = 1;
+        }
+    }
+
+    matFree(&run.a);
+    matFree(&run.b);
+    matFree(&run.c);
+}
+
+/**
+ * @brief Sets the default tuning options: the default cache, every online
+ *        processor, and short measurements over the first 2000 samples.
+ *
+ * @param options Uninitialized tuning options.
+ */
+void tuneOptionsInit(TuneOptions *options)
+{
+    long processors = sysconf(_SC_NPROCESSORS_ONLN);
+
+    options->path = TUNE_DEFAULT_PATH;
+    options->maxThreads = processors > 1 ? (size_t)processors : 1;
+    options->samples = 2000;
+    options->minSeconds = 0.02;
+}
+
+/**
+ * @brief Tunes a neural network for this machine: the training and testing
+ *        thread counts, and the cache blocks of every product shape training
+ *        and testing run. Results are read from the tuning cache when it has
+ *        them, keyed by processor model, instruction set tier and shape, and
+ *        anything missing is measured and written back, so only the first
+ *        run on a machine pays for the measurements. The thread counts are
+ *        stored in the network and used whenever training or testing is
+ *        asked for zero threads. The blocks replace any set before for the
+ *        same shapes and apply to every later product of their shape; other
+ *        shapes keep their blocks.
+ *
+ * @param net An initialized neural network. Its parameters are not changed.
+ * @param training The training dataset, whose first samples are timed.
+ * @param activation An activation function.
+ * @param activationDeriv The derivative of the activation function, in terms
+ *                        of the activation output.
+ * @param costDeriv The derivative of a cost function.
+ * @param miniBatchSize The number of training samples for each mini batch.
+ * @param options Tuning options, or NULL for the defaults.
+ * @return Zero on success, or nonzero if the cache could not be written or
+ *         some blocks could not be set. The rest of the tuning is applied
+ *         either way.
+ */
+int tuneNet(NeuralNet *net,
+            Dataset *training,
+            NetActivationFunc activation,
+            NetActivationDerivFunc activationDeriv,
+            NetCostFunc costDeriv,
+            size_t miniBatchSize,
+            const TuneOptions *options)
+{
+    TuneOptions defaults;
+    if (options == NULL)
+    {
+        tuneOptionsInit(&defaults);
+        options = &defaults;
+    }
+
+    char model[128];
+    cpuModel(model, sizeof(model));
+    const char *isa = cpuIsaName(cpuIsa());
+
+    char topology[128] = "";
+    for (size_t i = 0, length = 0; i < net->layers && length < sizeof(topology); ++i)
+    {
+        length += snprintf(topology + length,
+                           sizeof(topology) - length,
+                           i > 0 ? "-%lu" : "%lu",
+                           net->layerSizes[i]);
+    }
+    int sparse = datasetIsSparse(training);
+
+    TuneCache cache;
+    tuneCacheLoad(&cache, options->path);
+
+    // Thread counts depend on the whole topology and on the processors.
+    char key[TUNE_KEY_SIZE], value[TUNE_VALUE_SIZE];
+    snprintf(key, sizeof(key), "threads %s %s p%lu %s b%lu %s",
+             model, isa, options->maxThreads, topology, miniBatchSize, sparse ? "sparse" : "dense");
+    size_t trainThreads = 0, testThreads = 0;
+    const char *cached = tuneCacheGet(&cache, key);
+    if (cached == NULL ||
+        sscanf(cached, "%lu %lu", &trainThreads, &testThreads) != 2 ||
+        trainThreads == 0 || testThreads == 0)
+    {
+        tuneNetThreads(net, training, activation, activationDeriv, costDeriv,
+                       miniBatchSize, options, &trainThreads, &testThreads);
+        snprintf(value, sizeof(value), "%lu %lu", trainThreads, testThreads);
+        tuneCacheSet(&cache, key, value);
+    }
+    net->trainThreads = trainThreads;
+    net->testThreads = testThreads;
+
+    // Blocks only depend on the product shape, so nets of other topologies
+    // share them.
+    static const char *const transNames[2][2] = {{"NN", "NT"}, {"TN", "TT"}};
+    TuneShape *shapes = (TuneShape *)malloc(8 * (net->layers - 1) * sizeof(TuneShape));
+    GemmBlocking *blockings = (GemmBlocking *)malloc(8 * (net->layers - 1) * sizeof(GemmBlocking));
+    size_t shapeCount = tuneNetShapes(net, sparse, miniBatchSize, trainThreads, shapes);
+    for (size_t i = 0; i < shapeCount; ++i)
+    {
+        TuneShape *shape = &shapes[i];
+        snprintf(key, sizeof(key), "gemm %s %s %s %lux%lux%lu",
+                 model, isa, transNames[shape->transA][shape->transB], shape->m, shape->n, shape->k);
+
+        GemmBlocking *blocking = &blockings[i];
+        cached = tuneCacheGet(&cache, key);
+        if (cached == NULL ||
+            sscanf(cached, "%lu %lu %lu", &blocking->mc, &blocking->kc, &blocking->nc) != 3 ||
+            !gemmBlockingFits(blocking))
+        {
+            tuneGemmBlocking(shape, options->minSeconds, blocking);
+            snprintf(value, sizeof(value), "%lu %lu %lu", blocking->mc, blocking->kc, blocking->nc);
+            tuneCacheSet(&cache, key, value);
+        }
+    }
+
+    // Only shapes whose blocks change are set, so shapes that keep the
+    // defaults take no room in the table; measuring never sets any. Shapes of
+    // other networks are left alone.
+    int result = 0;
+    for (size_t i = 0; i < shapeCount; ++i)
+    {
+        TuneShape *shape = &shapes[i];
+        GemmBlocking *blocking = &blockings[i];
+        GemmBlocking current;
+        gemmGetBlocking(shape->transA, shape->transB, shape->m, shape->n, shape->k, &current);
+        if ((blocking->mc != current.mc || blocking->kc != current.kc || blocking->nc != current.nc) &&
+            gemmSetBlocking(shape->transA, shape->transB, shape->m, shape->n, shape->k, blocking) != 0)
+        {
+            result = -1;
+        }
+    }
+    free(shapes);
+    free(blockings);
+
+    if (cache.changed && tuneCacheSave(&cache, options->path) != 0)
+    {
+        result = -1;
+    }
+    tuneCacheFree(&cache);
+
+    return result;
+}
@@ -0,0 +1,29 @@
+#ifndef TUNE_H
+#define TUNE_H
+
+#include <stddef.h>
+#include "neural_net.h"
+#include "dataset.h"
+
+// The tuning cache that is read and written unless another path is given.
+#define TUNE_DEFAULT_PATH "./net.tune"
+
+typedef struct
+{
+    const char *path;
+    size_t maxThreads;
+    size_t samples;
+    double minSeconds;
+}
+TuneOptions;
+
+void tuneOptionsInit(TuneOptions *options);
+int tuneNet(NeuralNet *net,
+            Dataset *training,
+            NetActivationFunc activation,
+            NetActivationDerivFunc activationDeriv,
+            NetCostFunc costDeriv,
+            size_t miniBatchSize,
+            const TuneOptions *options);
+
+#endif
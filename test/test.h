@@ -0,0 +1,82 @@
+#ifndef TEST_H
+#define TEST_H
+
+#include "../src/matrix.h"
+#include "../src/random.h"
+#include <stddef.h>
+#include <stdio.h>
+
+// Operands hold small integers, so products and sums of them are exact in
+// single precision and results can be compared for equality whatever order
+// the kernels add in.
+#define TEST_MAX_VALUE 4
+
+// Each test program counts its own failed checks.
+static size_t testFailures;
+
+/**
+ * @brief Records a failed check with its location.
+ */
+#define TEST_CHECK(condition, ...)                                   \
+    do                                                               \
+    {                                                                \
+        if (!(condition))                                            \
+        {                                                            \
+            fprintf(stderr, "FAIL %s:%d: ", __FILE__, __LINE__);     \
+            fprintf(stderr, __VA_ARGS__);                            \
+            fprintf(stderr, "\n");                                   \
+            ++testFailures;                                          \
+        }                                                            \
+    }                                                                \
+    while (0)
+
+/**
+ * @brief Fills strided storage with small random integers.
+ */
+static inline void testRandomize(float *elements, size_t rows, size_t columns, size_t stride, Rng *rng)
+{
+    for (size_t i = 0; i < rows; ++i)
+    {
+        for (size_t j = 0; j < columns; ++j)
+        {
+            elements[i * stride + j] = (float)rngBounded(rng, 2 * TEST_MAX_VALUE + 1) - TEST_MAX_VALUE;
+        }
+    }
+}
+
+/**
+ * @brief Counts the elements of two matrices of the same size that differ.
+ */
+static inline size_t testDifferences(Matrix *a, Matrix *b)
+{
+    size_t differences = 0;
+    for (size_t i = 0; i < a->rows; ++i)
+    {
+        for (size_t j = 0; j < a->columns; ++j)
+        {
+            differences += a->elements[i * a->stride + j] != b->elements[i * b->stride + j];
+        }
+    }
+
+    return differences;
+}
+
+/**
+ * @brief Prints the outcome of a test program.
+ *
+ * @param name The name of the program.
+ * @return The exit status: zero if every check passed.
+ */
+static inline int testReport(const char *name)
+{
+    if (testFailures > 0)
+    {
+        fprintf(stderr, "%s: %lu checks failed\n", name, testFailures);
+        return 1;
+    }
+    printf("%s: all tests passed\n", name);
+
+    return 0;
+}
+
+#endif
@@ -0,0 +1,132 @@
+#include "test.h"
+#include "../src/neural_net.h"
+#include "../src/matrix.h"
+#include "../src/dataset.h"
+#include "../src/random.h"
+#include <stdint.h>
+#include <stdlib.h>
+
+#define TEST_SAMPLES 50
+#define TEST_FEATURES 120
+#define TEST_CLASSES 10
+#define TEST_BATCH_SIZE 37
+
+/**
+ * @brief Makes byte features with about one in ten nonzero, and labels.
+ */
+static void testSparseData(unsigned char *features, unsigned char *labels, Rng *rng)
+{
+    for (size_t i = 0; i < TEST_SAMPLES; ++i)
+    {
+        labels[i] = (unsigned char)rngBounded(rng, TEST_CLASSES);
+        for (size_t j = 0; j < TEST_FEATURES; ++j)
+        {
+            features[i * TEST_FEATURES + j] = rngBounded(rng, 10) == 0 ?
+                                              (unsigned char)(1 + rngBounded(rng, TEST_MAX_VALUE)) : 0;
+        }
+    }
+}
+
+/**
+ * @brief Checks that the sparse index is opt-in, that dense data gets none,
+ *        and that labels past the last class are rejected.
+ */
+static void testIndex(Rng *rng)
+{
+    unsigned char features[TEST_SAMPLES * TEST_FEATURES], labels[TEST_SAMPLES];
+    testSparseData(features, labels, rng);
+
+    Dataset dataset;
+    TEST_CHECK(datasetInit(&dataset, features, DATASET_UINT8, labels, TEST_SAMPLES,
+                           TEST_FEATURES, TEST_CLASSES, 1.0f) == 0,
+               "a valid dataset was rejected");
+    TEST_CHECK(!datasetIsSparse(&dataset), "datasetInit built a sparse index unasked");
+    TEST_CHECK(datasetIndexSparse(&dataset) && datasetIsSparse(&dataset),
+               "a dataset with 10%% nonzeros got no sparse index");
+    datasetFree(&dataset);
+
+    unsigned char dense[TEST_SAMPLES * TEST_FEATURES];
+    for (size_t i = 0; i < TEST_SAMPLES * TEST_FEATURES; ++i)
+    {
+        dense[i] = (unsigned char)(1 + rngBounded(rng, 255));
+    }
+    datasetInit(&dataset, dense, DATASET_UINT8, labels, TEST_SAMPLES, TEST_FEATURES, TEST_CLASSES, 1.0f);
+    TEST_CHECK(!datasetIndexSparse(&dataset), "a dense dataset got a sparse index");
+    datasetFree(&dataset);
+
+    labels[TEST_SAMPLES - 1] = TEST_CLASSES;
+    TEST_CHECK(datasetInit(&dataset, features, DATASET_UINT8, labels, TEST_SAMPLES,
+                           TEST_FEATURES, TEST_CLASSES, 1.0f) != 0,
+               "a label past the last class was accepted");
+}
+
+/**
+ * @brief Checks that the first layer gives the same forward products and
+ *        weight gradients through the nonzeros of a sparse batch as through
+ *        the dense batch.
+ */
+static void testSparseLayer(Rng *rng)
+{
+    unsigned char features[TEST_SAMPLES * TEST_FEATURES], labels[TEST_SAMPLES];
+    testSparseData(features, labels, rng);
+
+    Dataset dataset;
+    datasetInit(&dataset, features, DATASET_UINT8, labels, TEST_SAMPLES,
+                TEST_FEATURES, TEST_CLASSES, 0.5f);
+    datasetIndexSparse(&dataset);
+
+    size_t sizes[] = {TEST_FEATURES, 30, TEST_CLASSES};
+    NeuralNet net;
+    netInit(&net, 3, sizes, NULL, NULL, NULL);
+    testRandomize(net.weights[0].elements, net.weights[0].rows, net.weights[0].columns,
+                  net.weights[0].stride, rng);
+    NetWorkspace workspace;
+    netWorkspaceInit(&workspace, &net, TEST_BATCH_SIZE);
+
+    uint32_t indices[TEST_BATCH_SIZE];
+    for (size_t i = 0; i < TEST_BATCH_SIZE; ++i)
+    {
+        indices[i] = (uint32_t)rngBounded(rng, TEST_SAMPLES);
+    }
+    Matrix dense;
+    matInit(&dense, TEST_FEATURES, TEST_BATCH_SIZE);
+    datasetGather(&dataset, indices, TEST_BATCH_SIZE, &dense, NULL);
+    datasetGatherSparse(&dataset, indices, TEST_BATCH_SIZE, &workspace.sparseFeatures, NULL);
+
+    Matrix sparseResult, denseResult;
+    matInit(&sparseResult, 30, TEST_BATCH_SIZE);
+    matInit(&denseResult, 30, TEST_BATCH_SIZE);
+    matMulSparseInto(&sparseResult, &net.weights[0], &workspace.sparseFeatures);
+    matMulInto(&denseResult, &net.weights[0], &dense);
+    TEST_CHECK(testDifferences(&sparseResult, &denseResult) == 0, "sparse first layer differs from dense");
+
+    Matrix sparseGrad, denseGrad;
+    matInit(&sparseGrad, 30, TEST_FEATURES);
+    matInit(&denseGrad, 30, TEST_FEATURES);
+    matMulSparseTransBInto(&sparseGrad, &denseResult, &workspace.sparseFeatures);
+    matMulTransBInto(&denseGrad, &denseResult, &dense);
+    TEST_CHECK(testDifferences(&sparseGrad, &denseGrad) == 0, "sparse weight gradient differs from dense");
+
+    matFree(&sparseResult);
+    matFree(&denseResult);
+    matFree(&sparseGrad);
+    matFree(&denseGrad);
+    matFree(&dense);
+    netWorkspaceFree(&workspace);
+    netFree(&net);
+    datasetFree(&dataset);
+}
+
+/**
+ * @brief Checks datasets and sparse batches.
+ */
+int main(void)
+{
+    Rng rng;
+    rngSeed(&rng, 1);
+
+    testIndex(&rng);
+    testSparseLayer(&rng);
+
+    return testReport("test_dataset");
+}
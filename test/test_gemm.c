@@ -0,0 +1,236 @@
+#include "test.h"
+#include "../src/matrix.h"
+#include "../src/gemm.h"
+#include "../src/random.h"
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * @brief Checks one gemm call against the textbook triple loop. Each operand
+ *        is stored with extra columns past its stride, so the product must
+ *        only read and write its own rows.
+ *
+ * @return The number of mismatched elements.
+ */
+static size_t testGemmCase(GemmTranspose transA,
+                           GemmTranspose transB,
+                           size_t m,
+                           size_t n,
+                           size_t k,
+                           float alpha,
+                           float beta,
+                           Rng *rng)
+{
+    size_t aRows = transA == GEMM_TRANS ? k : m, aColumns = transA == GEMM_TRANS ? m : k;
+    size_t bRows = transB == GEMM_TRANS ? n : k, bColumns = transB == GEMM_TRANS ? k : n;
+    size_t lda = aColumns + 3, ldb = bColumns + 5, ldc = n + 7;
+
+    float *a = (float *)malloc(aRows * lda * sizeof(float));
+    float *b = (float *)malloc(bRows * ldb * sizeof(float));
+    float *c = (float *)malloc(m * ldc * sizeof(float));
+    float *expected = (float *)malloc(m * ldc * sizeof(float));
+    testRandomize(a, aRows, aColumns, lda, rng);
+    testRandomize(b, bRows, bColumns, ldb, rng);
+    testRandomize(c, m, ldc, ldc, rng);
+    memcpy(expected, c, m * ldc * sizeof(float));
+
+    for (size_t i = 0; i < m; ++i)
+    {
+        for (size_t j = 0; j < n; ++j)
+        {
+            float sum = 0.0f;
+            for (size_t p = 0; p < k; ++p)
+            {
+                float x = transA == GEMM_TRANS ? a[p * lda + i] : a[i * lda + p];
+                float y = transB == GEMM_TRANS ? b[j * ldb + p] : b[p * ldb + j];
+                sum += x * y;
+            }
+            expected[i * ldc + j] = alpha * sum + (beta == 0.0f ? 0.0f : beta * expected[i * ldc + j]);
+        }
+    }
+
+    gemm(transA, transB, m, n, k, alpha, a, lda, b, ldb, beta, c, ldc);
+
+    size_t mismatches = 0;
+    for (size_t i = 0; i < m * ldc; ++i)
+    {
+        mismatches += c[i] != expected[i];
+    }
+    TEST_CHECK(mismatches == 0,
+               "gemm %c%c %lux%lux%lu alpha %g beta %g has %lu wrong elements",
+               transA == GEMM_TRANS ? 'T' : 'N', transB == GEMM_TRANS ? 'T' : 'N',
+               m, n, k, alpha, beta, mismatches);
+
+    free(a);
+    free(b);
+    free(c);
+    free(expected);
+
+    return mismatches;
+}
+
+/**
+ * @brief Checks gemm in every transpose combination, on sizes that are and
+ *        are not multiples of the register and cache blocks, on the
+ *        matrix-vector paths of one column, and with tuned blocks.
+ */
+static void testGemm(Rng *rng)
+{
+    static const size_t shapes[][3] = {
+        {1, 1, 1},
+        {6, 16, 8},
+        {7, 17, 9},
+        {13, 1, 300},
+        {300, 1, 13},
+        {97, 33, 257},
+        {100, 1040, 40},
+        {200, 70, 600},
+    };
+    static const float scalars[][2] = {{1.0f, 0.0f}, {2.0f, 1.0f}, {-1.0f, -3.0f}};
+
+    for (size_t s = 0; s < sizeof(shapes) / sizeof(shapes[0]); ++s)
+    {
+        for (int transA = 0; transA < 2; ++transA)
+        {
+            for (int transB = 0; transB < 2; ++transB)
+            {
+                for (size_t x = 0; x < sizeof(scalars) / sizeof(scalars[0]); ++x)
+                {
+                    testGemmCase((GemmTranspose)transA, (GemmTranspose)transB,
+                                 shapes[s][0], shapes[s][1], shapes[s][2],
+                                 scalars[x][0], scalars[x][1], rng);
+                }
+            }
+        }
+    }
+
+    // Blocks that pass the check only once panels are padded to whole
+    // register blocks must be rejected.
+    GemmBlocking unpadded = {97, 253, 97};
+    TEST_CHECK(!gemmBlockingFits(&unpadded), "blocks (97, 253, 97) overflow the packed A panel");
+
+    // Tuned blocks smaller than the product, including ones that are not
+    // multiples of the register block, split it into many cache blocks.
+    static const GemmBlocking blockings[] = {{24, 64, 48}, {90, 250, 100}, {6, 1, 16}};
+    for (size_t i = 0; i < sizeof(blockings) / sizeof(blockings[0]); ++i)
+    {
+        for (int transA = 0; transA < 2; ++transA)
+        {
+            for (int transB = 0; transB < 2; ++transB)
+            {
+                TEST_CHECK(gemmSetBlocking((GemmTranspose)transA, (GemmTranspose)transB,
+                                           97, 250, 257, &blockings[i]) == 0,
+                           "blocks (%lu, %lu, %lu) were rejected",
+                           blockings[i].mc, blockings[i].kc, blockings[i].nc);
+                testGemmCase((GemmTranspose)transA, (GemmTranspose)transB, 97, 250, 257, 1.0f, 1.0f, rng);
+            }
+        }
+    }
+
+    // Tuning a shape again replaces its blocks instead of filling the table.
+    for (size_t i = 0; i < 2 * GEMM_TUNINGS; ++i)
+    {
+        TEST_CHECK(gemmSetBlocking(GEMM_NO_TRANS, GEMM_NO_TRANS, 97, 250, 257, &blockings[i % 2]) == 0,
+                   "retuning a shape failed after %lu calls", i);
+    }
+    gemmClearBlockings();
+}
+
+/**
+ * @brief Checks that explicit blocks give the product the default blocks
+ *        give, that blocks which do not fit are refused, and that neither
+ *        registers blocks for the shape.
+ */
+static void testExplicitBlocking(Rng *rng)
+{
+    Matrix a, b, expected, c;
+    matInit(&a, 97, 257);
+    matInit(&b, 257, 250);
+    matInit(&expected, 97, 250);
+    matInit(&c, 97, 250);
+    testRandomize(a.elements, a.rows, a.columns, a.stride, rng);
+    testRandomize(b.elements, b.rows, b.columns, b.stride, rng);
+    gemm(GEMM_NO_TRANS, GEMM_NO_TRANS, 97, 250, 257, 1.0f, a.elements, a.stride,
+         b.elements, b.stride, 0.0f, expected.elements, expected.stride);
+
+    GemmBlocking blocking = {24, 64, 48};
+    TEST_CHECK(gemmWithBlocking(&blocking, GEMM_NO_TRANS, GEMM_NO_TRANS, 97, 250, 257, 1.0f,
+                                a.elements, a.stride, b.elements, b.stride,
+                                0.0f, c.elements, c.stride) == 0,
+               "gemmWithBlocking refused blocks (24, 64, 48)");
+    TEST_CHECK(testDifferences(&c, &expected) == 0, "gemmWithBlocking differs from gemm");
+
+    GemmBlocking unpadded = {97, 253, 97};
+    TEST_CHECK(gemmWithBlocking(&unpadded, GEMM_NO_TRANS, GEMM_NO_TRANS, 97, 250, 257, 1.0f,
+                                a.elements, a.stride, b.elements, b.stride,
+                                0.0f, c.elements, c.stride) != 0,
+               "gemmWithBlocking accepted blocks (97, 253, 97)");
+
+    GemmBlocking defaults, current;
+    gemmDefaultBlocking(&defaults);
+    gemmGetBlocking(GEMM_NO_TRANS, GEMM_NO_TRANS, 97, 250, 257, &current);
+    TEST_CHECK(current.mc == defaults.mc && current.kc == defaults.kc && current.nc == defaults.nc,
+               "gemmWithBlocking registered blocks for its shape");
+
+    matFree(&a);
+    matFree(&b);
+    matFree(&expected);
+    matFree(&c);
+}
+
+/**
+ * @brief Checks products through matrix views against the same products on
+ *        contiguous copies.
+ */
+static void testViews(Rng *rng)
+{
+    Matrix a, b;
+    matInit(&a, 40, 50);
+    matInit(&b, 60, 30);
+    testRandomize(a.elements, a.rows, a.columns, a.stride, rng);
+    testRandomize(b.elements, b.rows, b.columns, b.stride, rng);
+
+    Matrix aView = matSubView(&a, 3, 5, 20, 33);
+    Matrix bView = matSubView(&b, 7, 2, 33, 25);
+    Matrix aCopy = matCopy(&aView), bCopy = matCopy(&bView);
+    TEST_CHECK(!matIsContiguous(&aView) && matIsContiguous(&aCopy), "views keep the stride of their parent");
+
+    Matrix viewResult, copyResult;
+    matInit(&viewResult, 20, 25);
+    matInit(&copyResult, 20, 25);
+    matMulInto(&viewResult, &aView, &bView);
+    matMulInto(&copyResult, &aCopy, &bCopy);
+
+    size_t mismatches = 0;
+    for (size_t i = 0; i < 20; ++i)
+    {
+        for (size_t j = 0; j < 25; ++j)
+        {
+            mismatches += viewResult.elements[i * viewResult.stride + j] !=
+                          copyResult.elements[i * copyResult.stride + j];
+        }
+    }
+    TEST_CHECK(mismatches == 0, "product of views has %lu wrong elements", mismatches);
+
+    matFree(&viewResult);
+    matFree(&copyResult);
+    matFree(&aCopy);
+    matFree(&bCopy);
+    matFree(&a);
+    matFree(&b);
+}
+
+/**
+ * @brief Checks the GEMM kernels and the products built on them.
+ */
+int main(void)
+{
+    Rng rng;
+    rngSeed(&rng, 1);
+
+    testGemm(&rng);
+    testExplicitBlocking(&rng);
+    testViews(&rng);
+
+    return testReport("test_gemm");
+}
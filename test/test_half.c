@@ -0,0 +1,220 @@
+#include "test.h"
+#include "../src/neural_net.h"
+#include "../src/activation.h"
+#include "../src/cost.h"
+#include "../src/dataset.h"
+#include "../src/half.h"
+#include "../src/initialization.h"
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define TEST_VALUES 1000
+#define TEST_SAMPLES 100
+#define TEST_FEATURES 40
+#define TEST_CLASSES 10
+
+static const char *const testFormatNames[] = {"fp16", "bf16"};
+
+/**
+ * @brief Checks whether stored bits hold a NaN.
+ */
+static int testIsNan(HalfFormat format, uint16_t value)
+{
+    return isnan(halfToFloat(format, value));
+}
+
+/**
+ * @brief Checks that every stored value converts to a float and back to
+ *        the same bits, and that NaNs stay NaNs.
+ */
+static void testRoundTrip(HalfFormat format)
+{
+    size_t mismatches = 0;
+    for (uint32_t bits = 0; bits <= UINT16_MAX; ++bits)
+    {
+        uint16_t value = (uint16_t)bits;
+        uint16_t back = halfFromFloat(format, halfToFloat(format, value));
+        mismatches += testIsNan(format, value) ? !testIsNan(format, back) : back != value;
+    }
+    TEST_CHECK(mismatches == 0, "%lu %s values do not round trip", mismatches, testFormatNames[format]);
+}
+
+/**
+ * @brief Checks that a finite float converts to the nearest stored value, and
+ *        on a tie to the one with an even last bit. Values past the largest
+ *        stored value must become infinity.
+ */
+static int testNearest(HalfFormat format, float x)
+{
+    uint16_t value = halfFromFloat(format, x);
+    float result = halfToFloat(format, value);
+    if (isinf(result))
+    {
+        float largest = halfToFloat(format, (uint16_t)((value & 0x8000) | (format == HALF_FLOAT16 ? 0x7bff : 0x7f7f)));
+        return fabsf(x) >= fabsf(largest);
+    }
+
+    double error = fabs((double)x - result);
+    for (int direction = -1; direction <= 1; direction += 2)
+    {
+        uint16_t neighbor = (uint16_t)(value + direction);
+        if ((neighbor & 0x7fff) == 0x7fff || ((value & 0x7fff) == 0 && direction < 0))
+        {
+            continue;
+        }
+        float other = halfToFloat(format, neighbor);
+        if (isnan(other) || isinf(other))
+        {
+            continue;
+        }
+        double otherError = fabs((double)x - other);
+        if (otherError < error || (otherError == error && (value & 1)))
+        {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+/**
+ * @brief Makes floats that stress rounding: ties and near ties between
+ *        stored values, subnormals, values near overflow and special values.
+ */
+static void testValues(HalfFormat format, float *values, Rng *rng)
+{
+    static const float specials[] = {0.0f, -0.0f, 1.0f, -1.0f, 65504.0f, 65520.0f, 1e-8f, 3e-5f, 1e30f};
+    size_t count = sizeof(specials) / sizeof(specials[0]);
+    memcpy(values, specials, sizeof(specials));
+    values[count++] = INFINITY;
+    values[count++] = -INFINITY;
+    values[count++] = NAN;
+    for (size_t i = count; i < TEST_VALUES; ++i)
+    {
+        // A stored value plus a fraction of its last place: exactly half
+        // of the time a tie.
+        uint16_t value = (uint16_t)rngBounded(rng, format == HALF_FLOAT16 ? 0x7c00 : 0x7f80);
+        float low = halfToFloat(format, value), high = halfToFloat(format, (uint16_t)(value + 1));
+        float fraction = rngBounded(rng, 2) ? 0.5f : rngUniform(rng);
+        float x = low + (high - low) * fraction;
+        values[i] = rngBounded(rng, 2) ? -x : x;
+    }
+}
+
+/**
+ * @brief Checks rounding, and that the bulk conversions, vectorized when the
+ *        processor allows, give the same bits as one value at a time.
+ */
+static void testConversions(HalfFormat format, Rng *rng)
+{
+    float values[TEST_VALUES], widened[TEST_VALUES];
+    uint16_t stored[TEST_VALUES];
+    testValues(format, values, rng);
+    halfFromFloats(format, values, stored, TEST_VALUES);
+    halfToFloats(format, stored, widened, TEST_VALUES);
+
+    size_t notNearest = 0, bulkMismatches = 0;
+    for (size_t i = 0; i < TEST_VALUES; ++i)
+    {
+        if (isnan(values[i]))
+        {
+            bulkMismatches += !testIsNan(format, stored[i]) || !isnan(widened[i]);
+            continue;
+        }
+        notNearest += !testNearest(format, values[i]);
+        bulkMismatches += stored[i] != halfFromFloat(format, values[i]) ||
+                          memcmp(&widened[i], &(float){halfToFloat(format, stored[i])}, sizeof(float)) != 0;
+    }
+    TEST_CHECK(notNearest == 0, "%lu floats do not round to the nearest %s", notNearest, testFormatNames[format]);
+    TEST_CHECK(bulkMismatches == 0, "%lu bulk %s conversions differ from the scalar ones",
+               bulkMismatches, testFormatNames[format]);
+}
+
+/**
+ * @brief Checks a network stored in half precision: it predicts close to the
+ *        float network, and after training its stored weights are the float
+ *        master weights rounded.
+ */
+static void testNetwork(NetPrecision precision, HalfFormat format, Rng *rng)
+{
+    unsigned char features[TEST_SAMPLES * TEST_FEATURES], labels[TEST_SAMPLES];
+    for (size_t i = 0; i < TEST_SAMPLES; ++i)
+    {
+        labels[i] = (unsigned char)rngBounded(rng, TEST_CLASSES);
+        for (size_t j = 0; j < TEST_FEATURES; ++j)
+        {
+            features[i * TEST_FEATURES + j] = (unsigned char)rngBounded(rng, 256);
+        }
+    }
+    Dataset dataset;
+    datasetInit(&dataset, features, DATASET_UINT8, labels, TEST_SAMPLES, TEST_FEATURES, TEST_CLASSES, 1.0f / 255.0f);
+
+    size_t sizes[] = {TEST_FEATURES, 30, TEST_CLASSES};
+    InitOptions options;
+    initOptionsInit(&options);
+    options.seed = 17;
+    NeuralNet net;
+    netInit(&net, 3, sizes, initNormalDist, initNormalDist, &options);
+
+    Matrix batch;
+    matInit(&batch, TEST_FEATURES, TEST_SAMPLES);
+    uint32_t indices[TEST_SAMPLES];
+    for (size_t i = 0; i < TEST_SAMPLES; ++i)
+    {
+        indices[i] = (uint32_t)i;
+    }
+    datasetGather(&dataset, indices, TEST_SAMPLES, &batch, NULL);
+    Matrix expected = netPredict(&net, &batch, actSigmoidInto);
+    netSetPrecision(&net, precision);
+    Matrix actual = netPredict(&net, &batch, actSigmoidInto);
+    float maxError = 0.0f;
+    for (size_t i = 0; i < expected.rows * expected.columns; ++i)
+    {
+        maxError = fmaxf(maxError, fabsf(actual.elements[i] - expected.elements[i]));
+    }
+    TEST_CHECK(maxError < (format == HALF_FLOAT16 ? 1e-2f : 5e-2f),
+               "%s predictions are off the float ones by %g", testFormatNames[format], maxError);
+
+    NetTrainOptions trainOptions;
+    netTrainOptionsInit(&trainOptions);
+    trainOptions.threads = 2;
+    netTrain(&net, &dataset, actSigmoidFastInto, actSigmoidDerivOutputInto, costSquaredErrDerivInto,
+             2, 10, 0.5f, &trainOptions);
+    size_t stale = 0;
+    for (size_t i = 0; i + 1 < net.layers; ++i)
+    {
+        Matrix *weights = &net.weights[i];
+        for (size_t j = 0; j < weights->rows * weights->columns; ++j)
+        {
+            stale += net.halfWeights[i].elements[j] != halfFromFloat(format, weights->elements[j]);
+        }
+    }
+    TEST_CHECK(stale == 0, "%lu %s weights are not the rounded master weights after training",
+               stale, testFormatNames[format]);
+
+    matFree(&expected);
+    matFree(&actual);
+    matFree(&batch);
+    netFree(&net);
+    datasetFree(&dataset);
+}
+
+/**
+ * @brief Checks half precision storage.
+ */
+int main(void)
+{
+    Rng rng;
+    rngSeed(&rng, 1);
+
+    testRoundTrip(HALF_FLOAT16);
+    testRoundTrip(HALF_BFLOAT16);
+    testConversions(HALF_FLOAT16, &rng);
+    testConversions(HALF_BFLOAT16, &rng);
+    testNetwork(NET_FLOAT16, HALF_FLOAT16, &rng);
+    testNetwork(NET_BFLOAT16, HALF_BFLOAT16, &rng);
+
+    return testReport("test_half");
+}
@@ -0,0 +1,120 @@
+#include "test.h"
+#include "../src/neural_net.h"
+#include "../src/initialization.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Large enough for many chunks, with a partial chunk at the end.
+#define TEST_ROWS 300
+#define TEST_COLUMNS 171
+
+/**
+ * @brief Checks that a matrix is filled with the same values on any number
+ *        of threads, and that other seeds and streams give other values.
+ */
+static void testThreads(void)
+{
+    Matrix reference, other;
+    matInit(&reference, TEST_ROWS, TEST_COLUMNS);
+    matInit(&other, TEST_ROWS, TEST_COLUMNS);
+    InitParams params = {7, 3, TEST_COLUMNS, TEST_ROWS, 1};
+    initNormalDist(&reference, &params);
+
+    for (size_t threads = 2; threads <= 8; threads += 3)
+    {
+        params.threads = threads;
+        initNormalDist(&other, &params);
+        TEST_CHECK(testDifferences(&reference, &other) == 0, "filling on %lu threads changed the values", threads);
+    }
+
+    params.threads = 4;
+    params.seed = 8;
+    initNormalDist(&other, &params);
+    TEST_CHECK(testDifferences(&reference, &other) > TEST_ROWS * TEST_COLUMNS * 99 / 100,
+               "another seed gave the same values");
+    params.seed = 7;
+    params.stream = 4;
+    initNormalDist(&other, &params);
+    TEST_CHECK(testDifferences(&reference, &other) > TEST_ROWS * TEST_COLUMNS * 99 / 100,
+               "another stream gave the same values");
+
+    matFree(&reference);
+    matFree(&other);
+}
+
+/**
+ * @brief Checks the mean and standard deviation of a fill against those
+ *        asked for, within a few standard errors.
+ */
+static void testMoments(Matrix *mat, double stddev, const char *name)
+{
+    size_t count = mat->rows * mat->columns;
+    double sum = 0.0, squares = 0.0;
+    for (size_t i = 0; i < count; ++i)
+    {
+        sum += mat->elements[i];
+        squares += (double)mat->elements[i] * mat->elements[i];
+    }
+    double mean = sum / count;
+    double deviation = sqrt(squares / count - mean * mean);
+    TEST_CHECK(fabs(mean) < 5.0 * stddev / sqrt((double)count), "%s has a mean of %g", name, mean);
+    TEST_CHECK(fabs(deviation / stddev - 1.0) < 0.02, "%s has a standard deviation of %g, not %g",
+               name, deviation, stddev);
+}
+
+/**
+ * @brief Checks that the normal, Xavier and He fills have the spread their
+ *        fan in and fan out call for.
+ */
+static void testScales(void)
+{
+    Matrix mat;
+    matInit(&mat, TEST_ROWS, TEST_COLUMNS);
+    InitParams params = {11, 0, TEST_COLUMNS, TEST_ROWS, 2};
+
+    initNormalDist(&mat, &params);
+    testMoments(&mat, 1.0, "initNormalDist");
+    initXavier(&mat, &params);
+    testMoments(&mat, sqrt(2.0 / (TEST_COLUMNS + TEST_ROWS)), "initXavier");
+    initHe(&mat, &params);
+    testMoments(&mat, sqrt(2.0 / TEST_COLUMNS), "initHe");
+
+    matFree(&mat);
+}
+
+/**
+ * @brief Checks that netInit gives the same network for a seed whatever the
+ *        thread count, and different weights to layers of the same shape.
+ */
+static void testNetwork(void)
+{
+    size_t sizes[] = {120, 120, 120};
+    InitOptions options;
+    initOptionsInit(&options);
+    options.seed = 5;
+    NeuralNet single, parallel;
+    netInit(&single, 3, sizes, initXavier, initNormalDist, &options);
+    options.threads = 4;
+    netInit(&parallel, 3, sizes, initXavier, initNormalDist, &options);
+
+    TEST_CHECK(memcmp(single.parameters, parallel.parameters, single.parameterCount * sizeof(float)) == 0,
+               "netInit on four threads differs from one thread");
+    TEST_CHECK(testDifferences(&single.weights[0], &single.weights[1]) > 120 * 120 * 99 / 100,
+               "two layers of the same shape got the same weights");
+
+    netFree(&single);
+    netFree(&parallel);
+}
+
+/**
+ * @brief Checks parameter initialization.
+ */
+int main(void)
+{
+    testThreads();
+    testScales();
+    testNetwork();
+
+    return testReport("test_init");
+}
@@ -0,0 +1,178 @@
+#include "test.h"
+#include "../src/neural_net.h"
+#include "../src/net_io.h"
+#include "../src/initialization.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/**
+ * @brief Checks that two networks have the same layers, output and
+ *        parameters.
+ */
+static void testSameNet(NeuralNet *a, NeuralNet *b, const char *what)
+{
+    int same = a->layers == b->layers && a->output == b->output;
+    for (size_t i = 0; same && i < a->layers; ++i)
+    {
+        same = a->layerSizes[i] == b->layerSizes[i];
+    }
+    for (size_t i = 0; same && i + 1 < a->layers; ++i)
+    {
+        same = testDifferences(&a->weights[i], &b->weights[i]) == 0 &&
+               testDifferences(&a->biases[i], &b->biases[i]) == 0;
+    }
+    TEST_CHECK(same, "%s does not match the saved network", what);
+}
+
+/**
+ * @brief Reads a whole file.
+ *
+ * @param size Set to the size of the file.
+ * @return The contents, to be freed, or NULL if the file cannot be read.
+ */
+static unsigned char *testReadFile(const char *fileName, size_t *size)
+{
+    FILE *stream = fopen(fileName, "rb");
+    if (stream == NULL)
+    {
+        return NULL;
+    }
+    fseek(stream, 0, SEEK_END);
+    *size = (size_t)ftell(stream);
+    fseek(stream, 0, SEEK_SET);
+    unsigned char *data = (unsigned char *)malloc(*size);
+    if (fread(data, 1, *size, stream) != *size)
+    {
+        free(data);
+        data = NULL;
+    }
+    fclose(stream);
+
+    return data;
+}
+
+/**
+ * @brief Replaces a file with the given bytes.
+ */
+static void testWriteFile(const char *fileName, const unsigned char *data, size_t size)
+{
+    FILE *stream = fopen(fileName, "wb");
+    if (stream != NULL)
+    {
+        fwrite(data, 1, size, stream);
+        fclose(stream);
+    }
+}
+
+/**
+ * @brief Checks that a model file is rejected by netLoad and by netMap with
+ *        the checksum verified, and, unless only the checksum can tell,
+ *        without it.
+ */
+static void testRejected(const char *fileName, int checksumOnly, const char *what)
+{
+    NeuralNet net;
+    TEST_CHECK(netLoad(&net, fileName) != 0, "netLoad accepted %s", what);
+    TEST_CHECK(netMap(&net, fileName, 1) != 0, "netMap accepted %s", what);
+    if (!checksumOnly)
+    {
+        TEST_CHECK(netMap(&net, fileName, 0) != 0, "netMap without the checksum accepted %s", what);
+    }
+}
+
+/**
+ * @brief Checks that a saved model loads and maps back to the same network,
+ *        and that damaged or crafted files are rejected.
+ */
+static void testModelFile(void)
+{
+    char fileName[] = "/tmp/net_test_XXXXXX";
+    int descriptor = mkstemp(fileName);
+    if (descriptor < 0)
+    {
+        TEST_CHECK(0, "cannot create a temporary model file");
+        return;
+    }
+    close(descriptor);
+
+    size_t sizes[] = {50, 17, 3};
+    InitOptions options;
+    initOptionsInit(&options);
+    options.seed = 7;
+    NeuralNet net;
+    netInit(&net, 3, sizes, initNormalDist, initNormalDist, &options);
+    net.output = NET_OUTPUT_SOFTMAX;
+    TEST_CHECK(netSave(&net, fileName) == 0, "netSave failed");
+
+    NeuralNet loaded;
+    if (netLoad(&loaded, fileName) == 0)
+    {
+        testSameNet(&net, &loaded, "netLoad");
+        netFree(&loaded);
+    }
+    else
+    {
+        TEST_CHECK(0, "netLoad failed");
+    }
+
+    for (int verify = 0; verify < 2; ++verify)
+    {
+        NeuralNet mapped;
+        if (netMap(&mapped, fileName, verify) == 0)
+        {
+            testSameNet(&net, &mapped, "netMap");
+            netFree(&mapped);
+        }
+        else
+        {
+            TEST_CHECK(0, "netMap failed");
+        }
+    }
+
+    size_t size;
+    unsigned char *saved = testReadFile(fileName, &size);
+    TEST_CHECK(saved != NULL, "cannot read the saved model file");
+    if (saved != NULL)
+    {
+        // Cutting off the last section leaves the layer table promising more.
+        testWriteFile(fileName, saved, size - NET_FILE_ALIGNMENT);
+        testRejected(fileName, 0, "a truncated file");
+
+        // One flipped bit in the weights only changes the checksum.
+        unsigned char *flipped = (unsigned char *)malloc(size);
+        memcpy(flipped, saved, size);
+        flipped[size / 2] ^= 0x10;
+        testWriteFile(fileName, flipped, size);
+        testRejected(fileName, 1, "a file with a flipped bit");
+
+        // Layer sizes whose weights need more than 2^64 bytes must not wrap
+        // into a size the file appears to hold.
+        NetFileHeader header;
+        memcpy(&header, saved, sizeof(NetFileHeader));
+        header.layers = 2;
+        uint64_t hugeSizes[2] = {UINT64_C(1) << 31, UINT64_C(1) << 31};
+        memcpy(flipped, &header, sizeof(NetFileHeader));
+        memcpy(&flipped[sizeof(NetFileHeader)], hugeSizes, sizeof(hugeSizes));
+        testWriteFile(fileName, flipped, size);
+        testRejected(fileName, 0, "layer sizes that overflow");
+
+        free(flipped);
+        free(saved);
+    }
+
+    netFree(&net);
+    remove(fileName);
+}
+
+/**
+ * @brief Checks model files.
+ */
+int main(void)
+{
+    testModelFile();
+
+    return testReport("test_net_io");
+}
@@ -0,0 +1,159 @@
+#include "test.h"
+#include "../src/optimizer.h"
+#include "../src/random.h"
+#include <math.h>
+#include <stdlib.h>
+
+// Not a multiple of any vector width, so every kernel also runs its tail.
+#define TEST_COUNT 37
+#define TEST_STEPS 5
+#define TEST_BATCH_SIZE 4
+
+static const char *const testOptimizerNames[] = {"sgd", "momentum", "nesterov", "rmsprop", "adam"};
+
+/**
+ * @brief Applies the textbook update of an optimizer in double precision,
+ *        with the bias corrections of Adam applied to its averages.
+ *
+ * @param t The number of the step, starting from one.
+ */
+static void testReferenceStep(const OptimizerOptions *options,
+                              double learningRate,
+                              double *params,
+                              const float *grads,
+                              double *first,
+                              double *second,
+                              uint64_t t)
+{
+    for (size_t i = 0; i < TEST_COUNT; ++i)
+    {
+        double g = (double)grads[i] / TEST_BATCH_SIZE;
+        switch (options->type)
+        {
+        case OPTIMIZER_SGD:
+            params[i] -= learningRate * g;
+            break;
+        case OPTIMIZER_MOMENTUM:
+            first[i] = options->momentum * first[i] + g;
+            params[i] -= learningRate * first[i];
+            break;
+        case OPTIMIZER_NESTEROV:
+            first[i] = options->momentum * first[i] + g;
+            params[i] -= learningRate * (g + options->momentum * first[i]);
+            break;
+        case OPTIMIZER_RMSPROP:
+            second[i] = options->beta2 * second[i] + (1.0 - options->beta2) * g * g;
+            params[i] -= learningRate * g / (sqrt(second[i]) + options->epsilon);
+            break;
+        case OPTIMIZER_ADAM:
+        {
+            first[i] = options->beta1 * first[i] + (1.0 - options->beta1) * g;
+            second[i] = options->beta2 * second[i] + (1.0 - options->beta2) * g * g;
+            double mean = first[i] / (1.0 - pow(options->beta1, (double)t));
+            double variance = second[i] / (1.0 - pow(options->beta2, (double)t));
+            params[i] -= learningRate * mean / (sqrt(variance) + options->epsilon);
+            break;
+        }
+        }
+    }
+}
+
+/**
+ * @brief Checks a few fused updates of every optimizer against the textbook
+ *        formulas, within a few units in the last place.
+ */
+static void testUpdates(Rng *rng)
+{
+    for (OptimizerType type = OPTIMIZER_SGD; type <= OPTIMIZER_ADAM; ++type)
+    {
+        OptimizerOptions options;
+        optimizerOptionsInit(&options, type);
+        Optimizer optimizer;
+        size_t size = TEST_COUNT;
+        optimizerInit(&optimizer, &options, 0.1f, 1, &size);
+
+        float params[TEST_COUNT], grads[TEST_COUNT];
+        double expected[TEST_COUNT], first[TEST_COUNT] = {0.0}, second[TEST_COUNT] = {0.0};
+        testRandomize(params, 1, TEST_COUNT, TEST_COUNT, rng);
+        for (size_t i = 0; i < TEST_COUNT; ++i)
+        {
+            expected[i] = params[i];
+        }
+
+        double maxError = 0.0;
+        for (uint64_t t = 1; t <= TEST_STEPS; ++t)
+        {
+            testRandomize(grads, 1, TEST_COUNT, TEST_COUNT, rng);
+            OptimizerStep step;
+            optimizerBeginStep(&optimizer, TEST_BATCH_SIZE, &step);
+            optimizerUpdate(&optimizer, &step, 0, params, grads, 0, TEST_COUNT);
+            testReferenceStep(&options, 0.1, expected, grads, first, second, t);
+            for (size_t i = 0; i < TEST_COUNT; ++i)
+            {
+                double error = fabs(params[i] - expected[i]) / (fabs(expected[i]) + 1.0);
+                maxError = error > maxError ? error : maxError;
+            }
+        }
+        TEST_CHECK(maxError < 1e-5, "%s is off the textbook update by %g", testOptimizerNames[type], maxError);
+
+        optimizerFree(&optimizer);
+    }
+}
+
+/**
+ * @brief Checks that every optimizer walks down a quadratic bowl from a
+ *        random start, updating the parameters in two ranges as threads do.
+ */
+static void testDescent(Rng *rng)
+{
+    for (OptimizerType type = OPTIMIZER_SGD; type <= OPTIMIZER_ADAM; ++type)
+    {
+        OptimizerOptions options;
+        optimizerOptionsInit(&options, type);
+        Optimizer optimizer;
+        size_t size = TEST_COUNT;
+        float learningRate = type == OPTIMIZER_SGD || type == OPTIMIZER_MOMENTUM ||
+                             type == OPTIMIZER_NESTEROV ? 0.1f : 0.02f;
+        optimizerInit(&optimizer, &options, learningRate, 1, &size);
+
+        float params[TEST_COUNT], grads[TEST_COUNT];
+        testRandomize(params, 1, TEST_COUNT, TEST_COUNT, rng);
+        double start = 0.0, end = 0.0;
+        for (size_t i = 0; i < TEST_COUNT; ++i)
+        {
+            start += params[i] * params[i];
+        }
+        for (size_t t = 0; t < 500; ++t)
+        {
+            for (size_t i = 0; i < TEST_COUNT; ++i)
+            {
+                grads[i] = params[i];
+            }
+            OptimizerStep step;
+            optimizerBeginStep(&optimizer, 1, &step);
+            optimizerUpdate(&optimizer, &step, 0, params, grads, 0, 20);
+            optimizerUpdate(&optimizer, &step, 0, params, grads, 20, TEST_COUNT);
+        }
+        for (size_t i = 0; i < TEST_COUNT; ++i)
+        {
+            end += params[i] * params[i];
+        }
+        TEST_CHECK(end < start * 1e-3, "%s only went from %g to %g", testOptimizerNames[type], start, end);
+
+        optimizerFree(&optimizer);
+    }
+}
+
+/**
+ * @brief Checks the optimizers.
+ */
+int main(void)
+{
+    Rng rng;
+    rngSeed(&rng, 1);
+
+    testUpdates(&rng);
+    testDescent(&rng);
+
+    return testReport("test_optimizer");
+}
@@ -0,0 +1,101 @@
+#include "test.h"
+#include "../src/neural_net.h"
+#include "../src/activation.h"
+#include "../src/cost.h"
+#include "../src/dataset.h"
+#include "../src/initialization.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define TEST_SAMPLES 300
+#define TEST_FEATURES 50
+#define TEST_CLASSES 10
+#define TEST_BATCH_SIZE 16
+#define TEST_EPOCHS 3
+
+/**
+ * @brief Initializes a network the same way every time and trains it on a
+ *        number of threads.
+ */
+static void testTrain(NeuralNet *net, Dataset *dataset, size_t threads)
+{
+    size_t sizes[] = {TEST_FEATURES, 40, TEST_CLASSES};
+    InitOptions initOptions;
+    initOptionsInit(&initOptions);
+    initOptions.seed = 29;
+    netInit(net, 3, sizes, initNormalDist, initNormalDist, &initOptions);
+
+    NetTrainOptions options;
+    netTrainOptionsInit(&options);
+    options.threads = threads;
+    options.seed = 31;
+    netTrain(net, dataset, actSigmoidFastInto, actSigmoidDerivOutputInto, costSquaredErrDerivInto,
+             TEST_EPOCHS, TEST_BATCH_SIZE, 0.5f, &options);
+}
+
+/**
+ * @brief Checks that data-parallel training is bit-reproducible for a given
+ *        thread count, including counts that split the mini batches
+ *        unevenly, that other counts only differ by rounding, and that
+ *        testing counts the same on any number of threads.
+ */
+static void testReproducible(Rng *rng)
+{
+    unsigned char features[TEST_SAMPLES * TEST_FEATURES], labels[TEST_SAMPLES];
+    for (size_t i = 0; i < TEST_SAMPLES; ++i)
+    {
+        labels[i] = (unsigned char)rngBounded(rng, TEST_CLASSES);
+        for (size_t j = 0; j < TEST_FEATURES; ++j)
+        {
+            features[i * TEST_FEATURES + j] = (unsigned char)rngBounded(rng, 256);
+        }
+    }
+    Dataset dataset;
+    datasetInit(&dataset, features, DATASET_UINT8, labels, TEST_SAMPLES, TEST_FEATURES, TEST_CLASSES, 1.0f / 255.0f);
+
+    NeuralNet reference;
+    testTrain(&reference, &dataset, 1);
+    static const size_t threadCounts[] = {2, 3, 5};
+    for (size_t t = 0; t < sizeof(threadCounts) / sizeof(threadCounts[0]); ++t)
+    {
+        NeuralNet first, second;
+        testTrain(&first, &dataset, threadCounts[t]);
+        testTrain(&second, &dataset, threadCounts[t]);
+        TEST_CHECK(memcmp(first.parameters, second.parameters, first.parameterCount * sizeof(float)) == 0,
+                   "two trainings on %lu threads differ", threadCounts[t]);
+
+        float maxError = 0.0f;
+        for (size_t i = 0; i < first.parameterCount; ++i)
+        {
+            maxError = fmaxf(maxError, fabsf(first.parameters[i] - reference.parameters[i]));
+        }
+        TEST_CHECK(maxError < 1e-3f, "training on %lu threads is off one thread by %g", threadCounts[t], maxError);
+
+        netFree(&first);
+        netFree(&second);
+    }
+
+    size_t correct = netTest(&reference, &dataset, actSigmoidFastInto, 1);
+    for (size_t threads = 2; threads <= 4; ++threads)
+    {
+        TEST_CHECK(netTest(&reference, &dataset, actSigmoidFastInto, threads) == correct,
+                   "testing on %lu threads counts differently", threads);
+    }
+
+    netFree(&reference);
+    datasetFree(&dataset);
+}
+
+/**
+ * @brief Checks data-parallel training.
+ */
+int main(void)
+{
+    Rng rng;
+    rngSeed(&rng, 1);
+
+    testReproducible(&rng);
+
+    return testReport("test_parallel");
+}
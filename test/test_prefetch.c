@@ -0,0 +1,138 @@
+#include "test.h"
+#include "../src/neural_net.h"
+#include "../src/activation.h"
+#include "../src/cost.h"
+#include "../src/dataset.h"
+#include "../src/initialization.h"
+#include <stdlib.h>
+#include <string.h>
+
+// The batch size does not divide the samples, so every epoch ends on a short
+// batch.
+#define TEST_SAMPLES 230
+#define TEST_FEATURES 60
+#define TEST_CLASSES 10
+#define TEST_BATCH_SIZE 16
+#define TEST_EPOCHS 3
+
+/**
+ * @brief Makes byte features, about one in ten nonzero, and labels.
+ */
+static void testData(unsigned char *features, unsigned char *labels, Rng *rng)
+{
+    for (size_t i = 0; i < TEST_SAMPLES; ++i)
+    {
+        labels[i] = (unsigned char)rngBounded(rng, TEST_CLASSES);
+        for (size_t j = 0; j < TEST_FEATURES; ++j)
+        {
+            features[i * TEST_FEATURES + j] = rngBounded(rng, 10) == 0 ? (unsigned char)(1 + rngBounded(rng, 255)) : 0;
+        }
+    }
+}
+
+/**
+ * @brief Initializes a network the same way every time and trains it.
+ */
+static void testTrain(NeuralNet *net, Dataset *dataset, NetTrainOptions *options)
+{
+    size_t sizes[] = {TEST_FEATURES, 24, TEST_CLASSES};
+    InitOptions initOptions;
+    initOptionsInit(&initOptions);
+    initOptions.seed = 19;
+    netInit(net, 3, sizes, initNormalDist, initNormalDist, &initOptions);
+    netTrain(net, dataset, actSigmoidFastInto, actSigmoidDerivOutputInto, costSquaredErrDerivInto,
+             TEST_EPOCHS, TEST_BATCH_SIZE, 0.5f, options);
+}
+
+/**
+ * @brief Checks that training with a loader thread gives bit for bit the
+ *        parameters of training without one, at several thread counts, on
+ *        dense and on sparse batches.
+ */
+static void testEquivalence(Rng *rng)
+{
+    unsigned char features[TEST_SAMPLES * TEST_FEATURES], labels[TEST_SAMPLES];
+    testData(features, labels, rng);
+    static const size_t threadCounts[] = {1, 3};
+
+    for (int sparse = 0; sparse < 2; ++sparse)
+    {
+        Dataset dataset;
+        datasetInit(&dataset, features, DATASET_UINT8, labels, TEST_SAMPLES, TEST_FEATURES, TEST_CLASSES,
+                    1.0f / 255.0f);
+        if (sparse)
+        {
+            TEST_CHECK(datasetIndexSparse(&dataset), "the test data got no sparse index");
+        }
+
+        for (size_t t = 0; t < sizeof(threadCounts) / sizeof(threadCounts[0]); ++t)
+        {
+            NetTrainOptions options;
+            netTrainOptionsInit(&options);
+            options.threads = threadCounts[t];
+            options.seed = 23;
+            NeuralNet direct, prefetched;
+            testTrain(&direct, &dataset, &options);
+            options.prefetch = 1;
+            testTrain(&prefetched, &dataset, &options);
+
+            TEST_CHECK(memcmp(direct.parameters, prefetched.parameters, direct.parameterCount * sizeof(float)) == 0,
+                       "prefetching changed the %s training on %lu threads",
+                       sparse ? "sparse" : "dense", threadCounts[t]);
+
+            netFree(&direct);
+            netFree(&prefetched);
+        }
+        datasetFree(&dataset);
+    }
+}
+
+/**
+ * @brief Counts the samples the loader thread augments.
+ */
+static void testCountSamples(Matrix *features, Matrix *labels, void *arg)
+{
+    (void)labels;
+    *(size_t *)arg += features->columns;
+}
+
+/**
+ * @brief Checks that the loader augments every sample of every epoch once.
+ */
+static void testAugment(Rng *rng)
+{
+    unsigned char features[TEST_SAMPLES * TEST_FEATURES], labels[TEST_SAMPLES];
+    testData(features, labels, rng);
+    Dataset dataset;
+    datasetInit(&dataset, features, DATASET_UINT8, labels, TEST_SAMPLES, TEST_FEATURES, TEST_CLASSES,
+                1.0f / 255.0f);
+
+    size_t augmented = 0;
+    NetTrainOptions options;
+    netTrainOptionsInit(&options);
+    options.threads = 3;
+    options.prefetch = 1;
+    options.augment = testCountSamples;
+    options.augmentArg = &augmented;
+    NeuralNet net;
+    testTrain(&net, &dataset, &options);
+    TEST_CHECK(augmented == TEST_SAMPLES * TEST_EPOCHS, "the loader augmented %lu samples, not %d",
+               augmented, TEST_SAMPLES * TEST_EPOCHS);
+
+    netFree(&net);
+    datasetFree(&dataset);
+}
+
+/**
+ * @brief Checks the background batch loader.
+ */
+int main(void)
+{
+    Rng rng;
+    rngSeed(&rng, 1);
+
+    testEquivalence(&rng);
+    testAugment(&rng);
+
+    return testReport("test_prefetch");
+}
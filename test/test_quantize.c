@@ -0,0 +1,184 @@
+#include "test.h"
+#include "../src/neural_net.h"
+#include "../src/activation.h"
+#include "../src/dataset.h"
+#include "../src/quantize.h"
+#include "../src/initialization.h"
+#include "../src/cpu.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define TEST_SAMPLES 200
+#define TEST_FEATURES 70
+#define TEST_CLASSES 10
+#define TEST_BATCH_SIZE 37
+
+/**
+ * @brief Makes a small network and a dataset of random pixels, the same on
+ *        every run.
+ */
+static void testQuantSetup(NeuralNet *net, Dataset *dataset, unsigned char *features, unsigned char *labels)
+{
+    Rng rng;
+    rngSeed(&rng, 3);
+    for (size_t i = 0; i < TEST_SAMPLES; ++i)
+    {
+        labels[i] = (unsigned char)rngBounded(&rng, TEST_CLASSES);
+        for (size_t j = 0; j < TEST_FEATURES; ++j)
+        {
+            features[i * TEST_FEATURES + j] = (unsigned char)rngBounded(&rng, 256);
+        }
+    }
+    datasetInit(dataset, features, DATASET_UINT8, labels, TEST_SAMPLES, TEST_FEATURES, TEST_CLASSES, 1.0f / 255.0f);
+
+    size_t sizes[] = {TEST_FEATURES, 33, TEST_CLASSES};
+    InitOptions options;
+    initOptionsInit(&options);
+    options.seed = 5;
+    netInit(net, 3, sizes, initNormalDist, initNormalDist, &options);
+}
+
+/**
+ * @brief Prints the quantized outputs for the first batch in hexadecimal,
+ *        for the parent process to compare across tiers. The activation is
+ *        the plain C sigmoid, so only the int8 kernels depend on the tier.
+ */
+static int testDump(void)
+{
+    unsigned char features[TEST_SAMPLES * TEST_FEATURES], labels[TEST_SAMPLES];
+    NeuralNet net;
+    Dataset dataset;
+    testQuantSetup(&net, &dataset, features, labels);
+
+    QuantNet qnet;
+    quantInit(&qnet, &net);
+    QuantWorkspace workspace;
+    quantWorkspaceInit(&workspace, &qnet, TEST_BATCH_SIZE);
+    uint32_t indices[TEST_BATCH_SIZE];
+    for (size_t i = 0; i < TEST_BATCH_SIZE; ++i)
+    {
+        indices[i] = (uint32_t)i;
+    }
+    datasetGather(&dataset, indices, TEST_BATCH_SIZE, &workspace.features, NULL);
+    Matrix *outputs = quantPredictBatch(&qnet, &workspace.features, actSigmoidInto, &workspace);
+    for (size_t i = 0; i < outputs->rows; ++i)
+    {
+        for (size_t j = 0; j < outputs->columns; ++j)
+        {
+            printf("%a\n", outputs->elements[i * outputs->stride + j]);
+        }
+    }
+
+    quantWorkspaceFree(&workspace);
+    quantFree(&qnet);
+    netFree(&net);
+    datasetFree(&dataset);
+
+    return 0;
+}
+
+/**
+ * @brief Runs this program under a tier and reads what it dumps.
+ *
+ * @return The output, to be freed, or NULL if the program failed.
+ */
+static char *testRunTier(const char *program, const char *tier)
+{
+    char command[1024];
+    snprintf(command, sizeof(command), "%s=%s '%s' dump", CPU_ISA_ENV, tier, program);
+    FILE *stream = popen(command, "r");
+    if (stream == NULL)
+    {
+        return NULL;
+    }
+    size_t size = 0, capacity = 4096;
+    char *output = (char *)malloc(capacity);
+    size_t count;
+    while ((count = fread(&output[size], 1, capacity - size - 1, stream)) > 0)
+    {
+        size += count;
+        if (capacity - size == 1)
+        {
+            capacity *= 2;
+            output = (char *)realloc(output, capacity);
+        }
+    }
+    output[size] = '\0';
+    if (pclose(stream) != 0 || size == 0)
+    {
+        free(output);
+        return NULL;
+    }
+
+    return output;
+}
+
+/**
+ * @brief Checks that every tier the processor has gives the same quantized
+ *        outputs as plain C, bit for bit.
+ */
+static void testTiers(const char *program)
+{
+    char *reference = testRunTier(program, cpuIsaName(CPU_SCALAR));
+    TEST_CHECK(reference != NULL, "the scalar dump failed");
+    if (reference == NULL)
+    {
+        return;
+    }
+    for (CpuIsa isa = CPU_SCALAR + 1; isa <= cpuDetect(); ++isa)
+    {
+        char *output = testRunTier(program, cpuIsaName(isa));
+        TEST_CHECK(output != NULL && strcmp(output, reference) == 0,
+                   "the %s kernels differ from plain C", cpuIsaName(isa));
+        free(output);
+    }
+    free(reference);
+}
+
+/**
+ * @brief Checks that quantCompare reports the accuracies netTest and
+ *        quantTest find, and that the two networks mostly agree.
+ */
+static void testCompare(void)
+{
+    unsigned char features[TEST_SAMPLES * TEST_FEATURES], labels[TEST_SAMPLES];
+    NeuralNet net;
+    Dataset dataset;
+    testQuantSetup(&net, &dataset, features, labels);
+    QuantNet qnet;
+    quantInit(&qnet, &net);
+
+    QuantComparison comparison;
+    quantCompare(&qnet, &net, &dataset, actSigmoidFastInto, 3, &comparison);
+    TEST_CHECK(comparison.samples == TEST_SAMPLES, "quantCompare covered %lu samples", comparison.samples);
+    TEST_CHECK(comparison.floatCorrect == netTest(&net, &dataset, actSigmoidFastInto, 2),
+               "quantCompare and netTest disagree on the float accuracy");
+    TEST_CHECK(comparison.quantCorrect == quantTest(&qnet, &dataset, actSigmoidFastInto, 2),
+               "quantCompare and quantTest disagree on the quantized accuracy");
+    TEST_CHECK(comparison.agreements >= TEST_SAMPLES * 9 / 10,
+               "the quantized network agrees on only %lu of %d samples",
+               comparison.agreements, TEST_SAMPLES);
+    TEST_CHECK(comparison.maxError < 0.1f, "the quantized outputs are off by %g", comparison.maxError);
+
+    quantFree(&qnet);
+    netFree(&net);
+    datasetFree(&dataset);
+}
+
+/**
+ * @brief Checks the int8 inference model. With the argument "dump", prints
+ *        its outputs instead.
+ */
+int main(int argc, char **argv)
+{
+    if (argc > 1 && strcmp(argv[1], "dump") == 0)
+    {
+        return testDump();
+    }
+
+    testTiers(argv[0]);
+    testCompare();
+
+    return testReport("test_quantize");
+}
@@ -0,0 +1,255 @@
+#include "test.h"
+#include "../src/neural_net.h"
+#include "../src/activation.h"
+#include "../src/cost.h"
+#include "../src/dataset.h"
+#include "../src/initialization.h"
+#include <math.h>
+#include <stdlib.h>
+
+#define TEST_CLASSES 10
+#define TEST_BATCH_SIZE 5
+#define TEST_FEATURES 12
+#define TEST_HIDDEN 8
+#define TEST_SAMPLES 200
+
+/**
+ * @brief Checks the softmax of each column against a double precision
+ *        reference, including columns large enough to overflow a naive
+ *        exponential.
+ */
+static void testSoftmax(Rng *rng)
+{
+    // Wide enough that each tier runs its vector loop as well as its tail.
+    Matrix mat, result;
+    matInit(&mat, TEST_CLASSES, 37);
+    matInit(&result, TEST_CLASSES, 37);
+    for (size_t i = 0; i < mat.rows * mat.columns; ++i)
+    {
+        mat.elements[i] = 8.0f * rngUniform(rng) - 4.0f;
+    }
+    for (size_t r = 0; r < mat.rows; ++r)
+    {
+        mat.elements[r * mat.stride] += 1000.0f;
+    }
+    actSoftmaxInto(&result, &mat);
+
+    double maxError = 0.0, maxSumError = 0.0;
+    for (size_t j = 0; j < mat.columns; ++j)
+    {
+        double maximum = mat.elements[j], sum = 0.0, resultSum = 0.0;
+        for (size_t r = 1; r < mat.rows; ++r)
+        {
+            maximum = fmax(maximum, mat.elements[r * mat.stride + j]);
+        }
+        for (size_t r = 0; r < mat.rows; ++r)
+        {
+            sum += exp(mat.elements[r * mat.stride + j] - maximum);
+        }
+        for (size_t r = 0; r < mat.rows; ++r)
+        {
+            double expected = exp(mat.elements[r * mat.stride + j] - maximum) / sum;
+            double actual = result.elements[r * result.stride + j];
+            maxError = fmax(maxError, fabs(actual - expected));
+            resultSum += actual;
+        }
+        maxSumError = fmax(maxSumError, fabs(resultSum - 1.0));
+    }
+    TEST_CHECK(maxError < 1e-6, "softmax is off by %g", maxError);
+    TEST_CHECK(maxSumError < 1e-5, "softmax columns sum to 1 within only %g", maxSumError);
+
+    matFree(&mat);
+    matFree(&result);
+}
+
+/**
+ * @brief Fills a one-hot label matrix.
+ */
+static void testLabels(Matrix *labels, Rng *rng)
+{
+    matSet(labels, 0.0f);
+    for (size_t j = 0; j < labels->columns; ++j)
+    {
+        labels->elements[rngBounded(rng, TEST_CLASSES) * labels->stride + j] = 1.0f;
+    }
+}
+
+/**
+ * @brief Checks that the fused delta is the prediction minus the label and
+ *        that the loss it returns is the summed cross entropy.
+ */
+static void testFusedDelta(Rng *rng)
+{
+    Matrix logits, prediction, labels, delta;
+    matInit(&logits, TEST_CLASSES, TEST_BATCH_SIZE);
+    matInit(&prediction, TEST_CLASSES, TEST_BATCH_SIZE);
+    matInit(&labels, TEST_CLASSES, TEST_BATCH_SIZE);
+    matInit(&delta, TEST_CLASSES, TEST_BATCH_SIZE);
+    for (size_t i = 0; i < logits.rows * logits.columns; ++i)
+    {
+        logits.elements[i] = 4.0f * rngUniform(rng) - 2.0f;
+    }
+    actSoftmaxInto(&prediction, &logits);
+    testLabels(&labels, rng);
+
+    float loss = costSoftmaxCrossEntropyDeltaInto(&delta, &prediction, &labels);
+    TEST_CHECK(loss == costCrossEntropySum(&prediction, &labels),
+               "the fused loss %g is not the cross entropy %g", loss, costCrossEntropySum(&prediction, &labels));
+    size_t mismatches = 0;
+    for (size_t i = 0; i < delta.rows * delta.columns; ++i)
+    {
+        mismatches += delta.elements[i] != prediction.elements[i] - labels.elements[i];
+    }
+    TEST_CHECK(mismatches == 0, "%lu elements of the fused delta are not prediction minus label", mismatches);
+
+    matFree(&logits);
+    matFree(&prediction);
+    matFree(&labels);
+    matFree(&delta);
+}
+
+/**
+ * @brief Finds the summed cross entropy of a softmax network over a batch.
+ */
+static double testLoss(NeuralNet *net, Matrix *features, Matrix *labels)
+{
+    Matrix prediction = netPredict(net, features, actSigmoidInto);
+    double loss = costCrossEntropySum(&prediction, labels);
+    matFree(&prediction);
+
+    return loss;
+}
+
+/**
+ * @brief Checks the gradients backpropagated from the fused delta against
+ *        central differences of the loss, for parameters of both layers.
+ */
+static void testGradients(Rng *rng)
+{
+    size_t sizes[] = {TEST_FEATURES, TEST_HIDDEN, TEST_CLASSES};
+    InitOptions options;
+    initOptionsInit(&options);
+    options.seed = 11;
+    NeuralNet net;
+    netInit(&net, 3, sizes, initNormalDist, initNormalDist, &options);
+    net.output = NET_OUTPUT_SOFTMAX;
+
+    Matrix features, labels;
+    matInit(&features, TEST_FEATURES, TEST_BATCH_SIZE);
+    matInit(&labels, TEST_CLASSES, TEST_BATCH_SIZE);
+    for (size_t i = 0; i < features.rows * features.columns; ++i)
+    {
+        features.elements[i] = rngUniform(rng);
+    }
+    testLabels(&labels, rng);
+
+    NetWorkspace workspace;
+    netWorkspaceInit(&workspace, &net, TEST_BATCH_SIZE);
+    netBackprop(&net, &features, &labels, actSigmoidInto, actSigmoidDerivOutputInto, NULL, &workspace);
+    TEST_CHECK(fabs(workspace.loss - testLoss(&net, &features, &labels)) < 1e-4 * workspace.loss,
+               "netBackprop reports a loss of %g, not %g", workspace.loss, testLoss(&net, &features, &labels));
+
+    // Every parameter of the slab, weights and biases of both layers.
+    size_t worst = 0;
+    double maxError = 0.0;
+    const double step = 1e-2;
+    for (size_t i = 0; i < net.parameterCount; ++i)
+    {
+        float saved = net.parameters[i];
+        net.parameters[i] = saved + (float)step;
+        double above = testLoss(&net, &features, &labels);
+        net.parameters[i] = saved - (float)step;
+        double below = testLoss(&net, &features, &labels);
+        net.parameters[i] = saved;
+
+        double expected = (above - below) / (2.0 * step);
+        double error = fabs(workspace.gradients.elements[i] - expected) / (fabs(expected) + 0.1);
+        if (error > maxError)
+        {
+            maxError = error;
+            worst = i;
+        }
+    }
+    TEST_CHECK(maxError < 1e-2, "the gradient of parameter %lu is off by %g", worst, maxError);
+
+    netWorkspaceFree(&workspace);
+    matFree(&features);
+    matFree(&labels);
+    netFree(&net);
+}
+
+/**
+ * @brief Records the loss of each epoch.
+ */
+static void testRecordLoss(const NetEpochReport *report, void *arg)
+{
+    double *losses = (double *)arg;
+    losses[report->epoch - 1] = report->loss;
+}
+
+/**
+ * @brief Checks that training a softmax network reports a falling mean cross
+ *        entropy per epoch, starting near that of a uniform guess.
+ */
+static void testEpochLoss(Rng *rng)
+{
+    // Each class lights up its own feature, so the problem is easy.
+    unsigned char features[TEST_SAMPLES * TEST_FEATURES], labels[TEST_SAMPLES];
+    for (size_t i = 0; i < TEST_SAMPLES; ++i)
+    {
+        labels[i] = (unsigned char)rngBounded(rng, TEST_CLASSES);
+        for (size_t j = 0; j < TEST_FEATURES; ++j)
+        {
+            features[i * TEST_FEATURES + j] = (unsigned char)rngBounded(rng, 64);
+        }
+        features[i * TEST_FEATURES + labels[i]] = 255;
+    }
+    Dataset dataset;
+    datasetInit(&dataset, features, DATASET_UINT8, labels, TEST_SAMPLES, TEST_FEATURES, TEST_CLASSES, 1.0f / 255.0f);
+
+    size_t sizes[] = {TEST_FEATURES, TEST_HIDDEN * 4, TEST_CLASSES};
+    InitOptions options;
+    initOptionsInit(&options);
+    options.seed = 13;
+    NeuralNet net;
+    netInit(&net, 3, sizes, initNormalDist, initNormalDist, &options);
+    net.output = NET_OUTPUT_SOFTMAX;
+
+    double losses[5];
+    NetTrainOptions trainOptions;
+    netTrainOptionsInit(&trainOptions);
+    trainOptions.threads = 1;
+    trainOptions.epochCallback = testRecordLoss;
+    trainOptions.epochArg = losses;
+    optimizerOptionsInit(&trainOptions.optimizer, OPTIMIZER_ADAM);
+    netTrain(&net, &dataset, actSigmoidFastInto, actSigmoidDerivOutputInto, NULL, 5, 10, 0.01f, &trainOptions);
+
+    TEST_CHECK(losses[0] < 2.0 * log(TEST_CLASSES), "the first epoch lost %g per sample", losses[0]);
+    for (size_t i = 1; i < 5; ++i)
+    {
+        TEST_CHECK(losses[i] < losses[i - 1], "the loss rose from %g to %g in epoch %lu",
+                   losses[i - 1], losses[i], i + 1);
+    }
+    size_t correct = netTest(&net, &dataset, actSigmoidFastInto, 1);
+    TEST_CHECK(correct > TEST_SAMPLES * 9 / 10, "only %lu of %d samples are right after training",
+               correct, TEST_SAMPLES);
+
+    netFree(&net);
+    datasetFree(&dataset);
+}
+
+/**
+ * @brief Checks the softmax output layer and its cross entropy loss.
+ */
+int main(void)
+{
+    Rng rng;
+    rngSeed(&rng, 1);
+
+    testSoftmax(&rng);
+    testFusedDelta(&rng);
+    testGradients(&rng);
+    testEpochLoss(&rng);
+
+    return testReport("test_softmax");
+}